@@ -4,175 +4,473 @@
 #include <string.h>
 #include <unistd.h>
 #include <pthread.h>
-#include <semaphore.h>
 #include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <time.h>
+#include "Q1_ReadWrite/ring_queue.h"
+#include "Q1_ReadWrite/steal_sched.h"
+#include "Q1_ReadWrite/node_pool.h"
+#include "Q1_ReadWrite/async_log.h"
+#include "Q1_ReadWrite/device_source.h"
+#include "Q1_ReadWrite/event_loop.h"
+#include "Q1_ReadWrite/pipeline.h"
+#include "Q1_ReadWrite/stage_stats.h"
+
+/*
+build: gcc -O2 -pthread Q1_ReadWrite._windows_v01.c Q1_ReadWrite/ring_queue.c Q1_ReadWrite/steal_sched.c Q1_ReadWrite/node_pool.c Q1_ReadWrite/async_log.c Q1_ReadWrite/device_source.c Q1_ReadWrite/event_loop.c Q1_ReadWrite/pipeline.c Q1_ReadWrite/stage_stats.c
+(add -DNDEBUG or -DSTAGE_STATS=0 to compile the stage timers out)
+run: ./a.out [file|fifo ...]  sources given on the command line are read by
+IO_THREADS epoll threads instead of M writer threads polling the stub;
+it runs until SIGINT/SIGTERM, RUN_SECONDS or the end of every source, then
+drains the readers and prints the totals; SIGUSR1/SIGUSR2 print the
+per-stage timings as text/JSON while it runs
+(add -DUSE_DEVICE=1 -DDEVICE_PATH=\"file\" to read a file or FIFO instead of the stub data)
+(add -DASYNC_LOG_MIN_LEVEL=ALOG_TRACE for the per-byte trace in process_data)
+*/
 
 #define M 10
 #define N 20
 #define BUFFER_SIZE 20
+/* each reader owns a ring of this size, see steal_sched.h */
+#define READER_QUEUE_CAPACITY 64
+#define QUEUE_CAPACITY (N*READER_QUEUE_CAPACITY)
+/* max nodes moved per device read/queue round trip */
+#define BATCH_SIZE 16
+/* log every n-th byte of the process_data trace */
+#define PROCESS_TRACE_SAMPLE 1
+#ifndef USE_DEVICE
+#define USE_DEVICE 0
+#endif
+#ifndef DEVICE_PATH
+#define DEVICE_PATH "/dev/xyz"
+#endif
+/* event loop threads that replace the M writers when reading real sources */
+#define IO_THREADS 2
+/* queued-but-unprocessed messages: throttle at HIGH, resume at LOW */
+#define PIPELINE_HIGH_WATERMARK (QUEUE_CAPACITY*3/4)
+#define PIPELINE_LOW_WATERMARK (QUEUE_CAPACITY/4)
+/* 1: discard batches while throttled instead of blocking the producers */
+#define PIPELINE_DROP_WHEN_FULL 0
+/* 0: no time limit */
+#ifndef RUN_SECONDS
+#define RUN_SECONDS 0
+#endif
 typedef struct node {
 	struct node *next;
 	char *data;
 	int length;
 } node_t;
-node_t *head=NULL;
-node_t *tail=NULL;
-sem_t data_count;
-
-pthread_mutex_t lock_1=PTHREAD_MUTEX_INITIALIZER;
-pthread_mutex_t lock_2=PTHREAD_MUTEX_INITIALIZER;
-pthread_mutex_t lock_3=PTHREAD_MUTEX_INITIALIZER;
+/* one pool block holds the node followed by its BUFFER_SIZE payload */
+#define NODE_BLOCK_SIZE (sizeof(node_t)+BUFFER_SIZE)
+/* queue full plus what every thread cache can hold */
+#define NODE_POOL_BLOCKS (QUEUE_CAPACITY+(M+N+1)*2*NODE_POOL_BATCH)
+/* writer->reader transport, replaces the head/tail list, lock_1 and data_count */
+steal_sched_t sched;
+node_pool_t pool;
+/* opened once in main, serializes stream reads itself in place of lock_3 */
+device_source_t device;
+event_loop_t io_loop;
+/* sources go through io_loop rather than writer_thread; set before any thread starts */
+int event_mode;
+/* watermarks, shutdown and throughput totals */
+pipeline_t flow;
 
 
 int get_external_data(char *buffer, int bufferSizeInBytes);
 void process_data(char *buffer, int bufferSizeInBytes);
+void process_data_batch(char **buffers, const int *lengths, int count);
+int get_external_data_batch(char **buffers, int *lengths, int count, int bufferSizeInBytes);
 
 void process_data(char *buffer, int bufferSizeInBytes)
 {
 	int i=0;
 	if(buffer!=NULL)
 	{
-		printf("@process_data with thread %li - \n",pthread_self());
+		ALOG(ALOG_DEBUG,"@process_data with thread %ld - \n",pthread_self());
 		
 		while(i<bufferSizeInBytes)
 		{
-			printf("i is %d and buffer[i] is %c \n",i,buffer[i]);
+			ALOG_STR_SAMPLED(ALOG_TRACE,PROCESS_TRACE_SAMPLE,"i is %ld and buffer[i] is %.*s \n",&buffer[i],1,i);
 			i++;  		
 		}
 		memset(buffer,0,bufferSizeInBytes);
 	}else{
-		printf("@process_data, error occurs for buffer==NULL \n");
+		ALOG(ALOG_ERROR,"@process_data, error occurs for buffer==NULL \n");
 	}
 	return;
 }
+/* process a whole dequeued batch */
+void process_data_batch(char **buffers, const int *lengths, int count)
+{
+	int i;
+
+	for(i=0;i<count;i++)
+	{
+		process_data(buffers[i],lengths[i]);
+	}
+}
 int get_external_data(char *buffer, int bufferSizeInBytes)
 {
 	
 	int value=-1;
-	int fd;
-	#if 1
+	#if !USE_DEVICE
 	   char temp_char[]="abcdefghijlmnopqrstu";
 	   value=strlen(temp_char)+1;
+	   if(value>bufferSizeInBytes)
+	       value=bufferSizeInBytes;
 	   memcpy(buffer,temp_char,value);
 	
-	   printf("@get_external_data, buffer is %s \n",buffer);
+	   ALOG_STR(ALOG_DEBUG,"@get_external_data, buffer is %.*s \n",buffer,value);
 	
 	   return value;
 	#else
-		/*char temp_char[4];*/
-        char temp_char[20];
-		fd=open("/dev/xyz",O_RDWR);
-		if(fd<0){
-			printf("can't open \n");
-			return -1;
-		}
-		printf("Open ok \n");
-
-		if(read(fd,temp_char,20)<0){
-		    printf("reading error \n");
-			return -1;
-		}
-		printf("Read ok \n");
-	   value=strlen(temp_char)+1;
-
-       memcpy(buffer,temp_char,value);
+	   value=device_source_read(&device,buffer,bufferSizeInBytes);
+	   if(value<0){
+		   ALOG(ALOG_ERROR,"reading error \n");
+		   return -1;
+	   }
 	
-	   printf("@get_external_data, buffer is %s \n",buffer);
-	   close(fd);
+	   ALOG_STR(ALOG_DEBUG,"@get_external_data, buffer is %.*s \n",buffer,value);
 	   return value;
 	
 	#endif
 	
 }
+/*
+fill up to count buffers in one go; with the device source this is a single
+readv/preadv, or no copy at all when the file is mapped (buffers[i] then
+points into the mapping). Returns the number filled, 0 when there is no
+data, -1 on error.
+*/
+int get_external_data_batch(char **buffers, int *lengths, int count, int bufferSizeInBytes)
+{
+	int i;
+	#if !USE_DEVICE
+	   for(i=0;i<count;i++)
+	   {
+		   lengths[i]=get_external_data(buffers[i],bufferSizeInBytes);
+		   if(lengths[i]<0)
+			   return i>0 ? i : -1;
+	   }
+	   return count;
+	#else
+	   int filled=device_source_read_batch(&device,buffers,lengths,count,bufferSizeInBytes);
+
+	   if(filled<0){
+		   ALOG(ALOG_ERROR,"reading error \n");
+		   return -1;
+	   }
+	   for(i=0;i<filled;i++)
+	   {
+		   ALOG_STR(ALOG_DEBUG,"@get_external_data, buffer is %.*s \n",buffers[i],lengths[i]);
+	   }
+	   return filled;
+	#endif
+}
 
 void *reader_thread(void *arg)
 {
+  int id=(int)(long)arg;
+  node_t *batch[BATCH_SIZE];
+  char *buffers[BATCH_SIZE];
+  int lengths[BATCH_SIZE];
+  int count;
+  int bytes;
+  int i;
+
+  /* own ring first, then steal from the other readers; 0 once closed and drained */
   while(1)
   {
-	  node_t *node_remove;
-   
-      int length=0;
-	  if(sem_wait(&data_count)==1)
-		   return NULL;
-	   pthread_mutex_lock(&lock_1);
-	   if(head!=NULL)
+	   STAGE_TIMER(wait_start);
+	   count=(int)steal_sched_pop_batch(&sched,id,(void **)batch,BATCH_SIZE);
+	   if(count<=0)
+		   break;
+	   STAGE_RECORD(STAGE_DEQUEUE_WAIT,wait_start,count);
+	   bytes=0;
+	   for(i=0;i<count;i++)
 	   {
-		   node_remove=head;
-		   head=head->next;
+		   buffers[i]=batch[i]->data;
+		   lengths[i]=batch[i]->length;
+		   bytes+=lengths[i];
 	   }
-       pthread_mutex_unlock(&lock_1);
 	   
-	   pthread_mutex_lock(&lock_2);
-	   process_data(node_remove->data,node_remove->length);
-       pthread_mutex_unlock(&lock_2);
-
-       free(node_remove->data);
-	   free(node_remove);
+	   STAGE_TIMER(process_start);
+	   process_data_batch(buffers,lengths,count);
+	   STAGE_RECORD(STAGE_PROCESS,process_start,count);
+	   pipeline_processed(&flow,count,bytes);
 
+	   for(i=0;i<count;i++)
+	   {
+		   node_pool_free(&pool,batch[i]);
+	   }
+	   /* blocks are free again: a stream parked for the lack of them can go on */
+	   if(event_mode&&atomic_load_explicit(&io_loop.parked,memory_order_relaxed)>0&&!pipeline_throttled(&flow))
+		   event_loop_resume(&io_loop);
   }
   return NULL;
 }
-void *writer_thread(void *arg)
+/*
+take up to BATCH_SIZE blocks, fill them with one read from src (NULL: the
+get_external_data stub/device) and publish them; returns the number
+published (or dropped while throttled), 0 when there was no data or the
+pipeline is stopping, -1 on error. An event loop source is never put to
+sleep: INGEST_NO_ROOM when there is no free block or the pipeline is
+throttled, and it is parked until reader_thread makes room
+*/
+#define INGEST_NO_ROOM EVENT_READY_PARK
+int ingest_batch(device_source_t *src)
 {
-	int length;
-	char *buffer;
+	int admit;
+	int count;
+	int filled;
+	int bytes;
+	int i;
 	node_t *new_node;
-	
-	
-   while(1)
-   {
-	   buffer=(char *)malloc(sizeof(buffer)*BUFFER_SIZE);
-	   new_node=(node_t*)malloc(sizeof(node_t));
-	   pthread_mutex_lock(&lock_3);
+	node_t *batch[BATCH_SIZE];
+	char *buffers[BATCH_SIZE];
+	int lengths[BATCH_SIZE];
 
-	   length=get_external_data(buffer,BUFFER_SIZE);
-	   if(length<0)
-	   {
-	       continue;
-	   }
-	   pthread_mutex_unlock(&lock_3);
+	/* the stub writers may sleep here while readers work the queue back down to the low watermark */
+	admit=src==NULL ? pipeline_admit(&flow) : pipeline_try_admit(&flow);
+	if(admit==PIPELINE_STOP)
+		return 0;
+	if(admit==PIPELINE_THROTTLED)
+		return INGEST_NO_ROOM;
 
-	   new_node->next=NULL;
-	   new_node->length=length;
-	   new_node->data=buffer;
-	   
-	   pthread_mutex_lock(&lock_1);
-	   
-	   if(head==NULL)
+	count=0;
+	while(count<BATCH_SIZE)
+	{
+		new_node=(node_t *)node_pool_alloc(&pool);
+		if(new_node==NULL)
+		{
+			break;
+		}
+		batch[count]=new_node;
+		buffers[count]=(char *)(new_node+1);
+		count++;
+	}
+	STAGE_TIMER(read_start);
+	if(count==0)
+		filled=0;
+	else if(src==NULL)
+		filled=get_external_data_batch(buffers,lengths,count,BUFFER_SIZE);
+	else
+		filled=device_source_read_batch(src,buffers,lengths,count,BUFFER_SIZE);
+	if(filled>0)
+		STAGE_RECORD(STAGE_SOURCE_READ,read_start,filled);
+	for(i=filled>0 ? filled : 0;i<count;i++)
+	{
+		node_pool_free(&pool,batch[i]);
+	}
+	if(count==0&&src!=NULL)
+		return INGEST_NO_ROOM;
+	if(filled<=0)
+		return filled;
+	if(admit==PIPELINE_DROP)
+	{
+		for(i=0;i<filled;i++)
+		{
+			node_pool_free(&pool,batch[i]);
+		}
+		pipeline_dropped(&flow,filled);
+		return filled;
+	}
+
+	bytes=0;
+	for(i=0;i<filled;i++)
+	{
+		bytes+=lengths[i];
+		batch[i]->next=NULL;
+		batch[i]->length=lengths[i];
+		batch[i]->data=buffers[i];
+		/* log before publishing, a reader may recycle the node right after */
+		ALOG_STR(ALOG_DEBUG,"@writer_thread, thread %ld write with buffer %.*s \n",buffers[i],lengths[i],pthread_self());
+	}
+	
+	pipeline_enqueued(&flow,filled,bytes);
+	STAGE_TIMER(enqueue_start);
+	steal_sched_push_batch(&sched,-1,(void **)batch,filled);
+	STAGE_RECORD(STAGE_ENQUEUE,enqueue_start,filled);
+	return filled;
+}
+
+void *writer_thread(void *arg)
+{
+   (void)arg;
+   while(pipeline_running(&flow))
+   {
+	   if(ingest_batch(NULL)<=0)
 	   {
-		   head=new_node;
-		   tail=new_node;
-	   }else{
-		
-		tail->next=new_node;
-	        tail=tail->next;
+	       /* no data or every block is queued or cached, let readers run */
+	       sched_yield();
 	   }
-	   
-	   pthread_mutex_unlock(&lock_1);
-	   
-           pthread_mutex_lock(&lock_2);
-	   
-	   printf("@writer_thread, thread %ld write with buffer %s \n", pthread_self(), buffer);
-	    pthread_mutex_unlock(&lock_2);
-   
    }
   return NULL;
 }
 
+/* event_loop callback for a ready source */
+int ingest_ready(void *ctx, device_source_t *src)
+{
+	int filled=ingest_batch(src);
+
+	(void)ctx;
+	if(filled==INGEST_NO_ROOM)
+		return EVENT_READY_PARK;
+	if(filled<0)
+	{
+		ALOG(ALOG_ERROR,"reading error \n");
+		return -1;
+	}
+	if(filled==0&&(device_source_at_eof(src)||!pipeline_running(&flow)))
+		return -1;
+	return filled;
+}
 
+/* register DEVICE_PATH and/or the command line sources with io_loop */
+int add_sources(int argc, char **argv)
+{
+  int i;
+  device_source_t *src;
+
+  if(event_loop_init(&io_loop)<0)
+     return -1;
+#if USE_DEVICE
+  if(device_source_open(&device,DEVICE_PATH,DEVSRC_MMAP|DEVSRC_NONBLOCK)<0)
+     return -1;
+  if(event_loop_add(&io_loop,&device,ingest_ready,NULL)<0)
+     return -1;
+#endif
+  for(i=1;i<argc;i++)
+  {
+     src=(device_source_t *)malloc(sizeof(device_source_t));
+     if(src==NULL||device_source_open(src,argv[i],DEVSRC_MMAP|DEVSRC_NONBLOCK)<0)
+     {
+        free(src);
+        return -1;
+     }
+     if(event_loop_add(&io_loop,src,ingest_ready,NULL)<0)
+        return -1;
+  }
+  return 0;
+}
+
+
+
+/*
+sleep until a stop signal, RUN_SECONDS, or every event loop source is done;
+SIGUSR1/SIGUSR2 dump the stage timings as text/JSON and keep running
+*/
+void wait_for_stop(const sigset_t *stop_signals)
+{
+  struct timespec tick={0,100000000};
+  /* CLOCK_MONOTONIC, like every other timer here; time() would cut the run up to a second short */
+  uint64_t deadline=stage_now_ns()+(uint64_t)RUN_SECONDS*1000000000u;
+  int sig;
+
+  while(1)
+  {
+     sig=sigtimedwait(stop_signals,NULL,&tick);
+     if(sig==SIGUSR1||sig==SIGUSR2)
+        stage_stats_dump(stderr,sig==SIGUSR2);
+     else if(sig>0)
+        break;
+     if(RUN_SECONDS>0&&stage_now_ns()>=deadline)
+        break;
+     if(event_mode&&atomic_load(&io_loop.live)==0)
+        break;
+  }
+}
 
 int main(int argc, char **argv)
 {
   int i,j;
-  int sem_count_initial=sem_init(&data_count,0,0);
-  pthread_t temp_t;
+  pthread_t readers[N];
+  pthread_t writers[M];
+  sigset_t stop_signals;
+  pipeline_config_t flow_config={PIPELINE_HIGH_WATERMARK,PIPELINE_LOW_WATERMARK,PIPELINE_DROP_WHEN_FULL};
+  node_pool_stats_t pool_stats;
+  steal_stats_t steal_stats;
+
+  /* every thread inherits the mask, only wait_for_stop picks these up */
+  sigemptyset(&stop_signals);
+  sigaddset(&stop_signals,SIGINT);
+  sigaddset(&stop_signals,SIGTERM);
+  sigaddset(&stop_signals,SIGUSR1);
+  sigaddset(&stop_signals,SIGUSR2);
+  pthread_sigmask(SIG_BLOCK,&stop_signals,NULL);
+
+  if(steal_sched_init(&sched,N,READER_QUEUE_CAPACITY)<0)
+     return 1;
+  if(node_pool_init(&pool,NODE_BLOCK_SIZE,NODE_POOL_BLOCKS)<0)
+     return 1;
+  if(pipeline_init(&flow,&flow_config)<0)
+     return 1;
+  if(async_log_start()<0)
+     return 1;
+  event_mode=USE_DEVICE||argc>1;
   for(i=0;i<N;i++)
   {
-     pthread_create(&temp_t,NULL,reader_thread,NULL);
+     pthread_create(&readers[i],NULL,reader_thread,(void *)(long)i);
   }
   
-  for(j=0;j<M;j++)
+  if(event_mode)
   {
-     pthread_create(&temp_t,NULL,writer_thread,NULL);
+     if(add_sources(argc,argv)<0||event_loop_start(&io_loop,IO_THREADS)<0)
+        return 1;
+  }else{
+     for(j=0;j<M;j++)
+     {
+        pthread_create(&writers[j],NULL,writer_thread,NULL);
+     }
   }
+
+  wait_for_stop(&stop_signals);
+
+  /* stop producers first, then let the readers drain what is queued */
+  pipeline_stop(&flow);
+  if(event_mode)
+  {
+     event_loop_stop(&io_loop);
+     event_loop_join(&io_loop);
+  }else{
+     for(j=0;j<M;j++)
+     {
+        pthread_join(writers[j],NULL);
+     }
+  }
+  steal_sched_close(&sched);
+  for(i=0;i<N;i++)
+  {
+     pthread_join(readers[i],NULL);
+  }
+  /* only now: queued nodes of a mapped source point into its mapping */
+  if(event_mode)
+  {
+     for(i=0;i<atomic_load(&io_loop.nsources);i++)
+     {
+        device_source_t *src=io_loop.sources[i].src;
+        device_source_close(src);
+        if(src!=&device)
+           free(src);
+     }
+  }
+  async_log_stop();
+
+  pipeline_report(&flow,stdout);
+  node_pool_get_stats(&pool,&pool_stats);
+  printf("@main, pool hits %lu refills %lu misses %lu high water %zu of %zu blocks \n",
+     (unsigned long)pool_stats.hits,(unsigned long)pool_stats.refills,(unsigned long)pool_stats.misses,
+     pool_stats.high_water,pool_stats.block_count);
+  steal_sched_get_stats(&sched,&steal_stats);
+  printf("@main, readers local %lu steals %lu (%lu nodes) idle %lu times %.3f ms \n",
+     (unsigned long)steal_stats.local_hits,(unsigned long)steal_stats.steals,
+     (unsigned long)steal_stats.stolen_items,(unsigned long)steal_stats.idle_waits,
+     (double)steal_stats.idle_ns/1e6);
+  stage_stats_dump(stdout,0);
+
+  pipeline_destroy(&flow);
+  node_pool_destroy(&pool);
+  steal_sched_destroy(&sched);
+  return 0;
 }
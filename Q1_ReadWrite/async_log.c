@@ -0,0 +1,232 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include "async_log.h"
+
+#define ALOG_IDLE_NS 1000000
+
+typedef struct log_record {
+	const char *fmt;
+	long args[3];
+	uint8_t level;
+	uint8_t nargs;
+	int8_t str_len;   /* -1: no string argument */
+	char str[ALOG_STR_MAX];
+} log_record_t;
+
+typedef struct log_ring {
+	_Alignas(64) atomic_size_t head;    /* written by the owning thread */
+	_Alignas(64) atomic_size_t tail;    /* written by the log thread */
+	_Alignas(64) atomic_ulong dropped;
+	atomic_int closed;                  /* owning thread has exited */
+	unsigned long thread;
+	unsigned long dropped_seen;
+	struct log_ring *next;
+	log_record_t records[ALOG_RING_RECORDS];
+} log_ring_t;
+
+atomic_int async_log_level=ALOG_TRACE;
+
+static pthread_mutex_t registry_lock=PTHREAD_MUTEX_INITIALIZER;
+static log_ring_t *registry=NULL;
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once=PTHREAD_ONCE_INIT;
+static pthread_t log_thread;
+static atomic_int log_running=0;
+
+static void ring_release(void *arg)
+{
+	log_ring_t *ring=(log_ring_t *)arg;
+
+	/* the log thread frees it once drained */
+	atomic_store_explicit(&ring->closed,1,memory_order_release);
+}
+
+static void ring_key_create(void)
+{
+	pthread_key_create(&ring_key,ring_release);
+}
+
+static log_ring_t *ring_get(void)
+{
+	log_ring_t *ring;
+
+	pthread_once(&ring_key_once,ring_key_create);
+	ring=(log_ring_t *)pthread_getspecific(ring_key);
+	if(ring!=NULL)
+		return ring;
+	ring=(log_ring_t *)aligned_alloc(64,sizeof(log_ring_t));
+	if(ring==NULL)
+		return NULL;
+	atomic_init(&ring->head,0);
+	atomic_init(&ring->tail,0);
+	atomic_init(&ring->dropped,0);
+	atomic_init(&ring->closed,0);
+	ring->thread=(unsigned long)pthread_self();
+	ring->dropped_seen=0;
+	pthread_setspecific(ring_key,ring);
+
+	pthread_mutex_lock(&registry_lock);
+	ring->next=registry;
+	registry=ring;
+	pthread_mutex_unlock(&registry_lock);
+	return ring;
+}
+
+void async_log_write(int level, const char *fmt, const char *str, int len,
+	int nargs, long a0, long a1, long a2)
+{
+	log_ring_t *ring=ring_get();
+	log_record_t *rec;
+	size_t head;
+
+	if(ring==NULL)
+		return;
+	head=atomic_load_explicit(&ring->head,memory_order_relaxed);
+	if(head-atomic_load_explicit(&ring->tail,memory_order_acquire)>=ALOG_RING_RECORDS)
+	{
+		atomic_fetch_add_explicit(&ring->dropped,1,memory_order_relaxed);
+		return;
+	}
+	rec=&ring->records[head%ALOG_RING_RECORDS];
+	rec->fmt=fmt;
+	rec->level=(uint8_t)level;
+	rec->nargs=(uint8_t)nargs;
+	rec->args[0]=a0;
+	rec->args[1]=a1;
+	rec->args[2]=a2;
+	if(str!=NULL)
+	{
+		if(len>ALOG_STR_MAX)
+			len=ALOG_STR_MAX;
+		if(len<0)
+			len=0;
+		memcpy(rec->str,str,len);
+		rec->str_len=(int8_t)len;
+	}else{
+		rec->str_len=-1;
+	}
+	atomic_store_explicit(&ring->head,head+1,memory_order_release);
+}
+
+static void record_format(FILE *out, const log_record_t *rec)
+{
+	const long *a=rec->args;
+	int len=rec->str_len;
+	const char *s=rec->str;
+
+	if(len<0)
+	{
+		switch(rec->nargs)
+		{
+		case 0: fputs(rec->fmt,out); break;
+		case 1: fprintf(out,rec->fmt,a[0]); break;
+		case 2: fprintf(out,rec->fmt,a[0],a[1]); break;
+		default: fprintf(out,rec->fmt,a[0],a[1],a[2]); break;
+		}
+	}else{
+		switch(rec->nargs)
+		{
+		case 0: fprintf(out,rec->fmt,len,s); break;
+		case 1: fprintf(out,rec->fmt,a[0],len,s); break;
+		case 2: fprintf(out,rec->fmt,a[0],a[1],len,s); break;
+		default: fprintf(out,rec->fmt,a[0],a[1],a[2],len,s); break;
+		}
+	}
+}
+
+static size_t ring_drain(FILE *out, log_ring_t *ring)
+{
+	size_t tail=atomic_load_explicit(&ring->tail,memory_order_relaxed);
+	size_t head=atomic_load_explicit(&ring->head,memory_order_acquire);
+	size_t count=head-tail;
+	unsigned long dropped;
+
+	while(tail!=head)
+	{
+		record_format(out,&ring->records[tail%ALOG_RING_RECORDS]);
+		tail++;
+	}
+	atomic_store_explicit(&ring->tail,tail,memory_order_release);
+
+	dropped=atomic_load_explicit(&ring->dropped,memory_order_relaxed);
+	if(dropped!=ring->dropped_seen)
+	{
+		fprintf(out,"@async_log, thread %lu dropped %lu records \n",
+			ring->thread,dropped-ring->dropped_seen);
+		ring->dropped_seen=dropped;
+	}
+	return count;
+}
+
+/* one pass over every ring; frees rings whose thread exited and are empty */
+static size_t drain_all(FILE *out)
+{
+	log_ring_t **link;
+	log_ring_t *ring;
+	size_t count=0;
+
+	pthread_mutex_lock(&registry_lock);
+	link=&registry;
+	while((ring=*link)!=NULL)
+	{
+		int closed=atomic_load_explicit(&ring->closed,memory_order_acquire);
+
+		count+=ring_drain(out,ring);
+		if(closed)
+		{
+			*link=ring->next;
+			free(ring);
+		}else{
+			link=&ring->next;
+		}
+	}
+	pthread_mutex_unlock(&registry_lock);
+	return count;
+}
+
+static void *log_thread_main(void *arg)
+{
+	struct timespec idle={0,ALOG_IDLE_NS};
+
+	(void)arg;
+	while(atomic_load_explicit(&log_running,memory_order_acquire))
+	{
+		if(drain_all(stdout)==0)
+		{
+			fflush(stdout);
+			nanosleep(&idle,NULL);
+		}
+	}
+	drain_all(stdout);
+	fflush(stdout);
+	return NULL;
+}
+
+int async_log_start(void)
+{
+	atomic_store(&log_running,1);
+	if(pthread_create(&log_thread,NULL,log_thread_main,NULL)!=0)
+	{
+		atomic_store(&log_running,0);
+		printf("@async_log_start, error occurs for pthread_create \n");
+		return -1;
+	}
+	return 0;
+}
+
+void async_log_stop(void)
+{
+	if(atomic_exchange(&log_running,0))
+	{
+		pthread_join(log_thread,NULL);
+	}
+}
+
+void async_log_set_level(int level)
+{
+	atomic_store_explicit(&async_log_level,level,memory_order_relaxed);
+}
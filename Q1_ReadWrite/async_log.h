@@ -0,0 +1,75 @@
+#ifndef Q1_ASYNC_LOG_H
+#define Q1_ASYNC_LOG_H
+
+/*
+Asynchronous logger replacing the printf calls serialized under lock_2.
+
+Each thread appends fixed-size binary records (format pointer, up to three
+integer arguments and an optional short byte string) to its own
+single-producer/single-consumer ring. One background thread drains every
+ring, formats the records and writes them to stdout. A full ring drops the
+record and counts it instead of blocking the caller.
+
+Formats must be string literals. Integer arguments are passed as long, so
+use %ld/%lu/%lx; the byte string, if any, is passed last as %.*s.
+
+Levels below ASYNC_LOG_MIN_LEVEL are compiled out entirely; the rest are
+filtered at run time by async_log_set_level.
+*/
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+#define ALOG_ERROR 0
+#define ALOG_INFO  1
+#define ALOG_DEBUG 2
+#define ALOG_TRACE 3
+
+#ifndef ASYNC_LOG_MIN_LEVEL
+#define ASYNC_LOG_MIN_LEVEL ALOG_DEBUG
+#endif
+
+#define ALOG_RING_RECORDS 1024
+#define ALOG_STR_MAX 32
+
+extern atomic_int async_log_level;
+
+int async_log_start(void);
+/* drains every ring, flushes stdout and joins the background thread */
+void async_log_stop(void);
+void async_log_set_level(int level);
+
+void async_log_write(int level, const char *fmt, const char *str, int len,
+	int nargs, long a0, long a1, long a2);
+
+#define ALOG_ENABLED(level) \
+	((level)<=ASYNC_LOG_MIN_LEVEL && \
+	 (level)<=atomic_load_explicit(&async_log_level,memory_order_relaxed))
+
+#define ALOG_PICK_(_0,_1,_2,_3,n,...) n
+#define ALOG_NARGS_(...) ALOG_PICK_(_0,##__VA_ARGS__,3,2,1,0)
+#define ALOG_LONGS_(z,a,b,c,...) (long)(a),(long)(b),(long)(c)
+
+/* ALOG(level, fmt, up to 3 integer args) */
+#define ALOG(level,fmt,...) do{ \
+	if(ALOG_ENABLED(level)) \
+		async_log_write((level),(fmt),NULL,0,ALOG_NARGS_(__VA_ARGS__), \
+			ALOG_LONGS_(0,##__VA_ARGS__,0,0,0)); \
+}while(0)
+
+/* ALOG_STR(level, fmt, bytes, length, up to 3 integer args) */
+#define ALOG_STR(level,fmt,str,len,...) do{ \
+	if(ALOG_ENABLED(level)) \
+		async_log_write((level),(fmt),(str),(len),ALOG_NARGS_(__VA_ARGS__), \
+			ALOG_LONGS_(0,##__VA_ARGS__,0,0,0)); \
+}while(0)
+
+/* only every n-th call per thread reaches the ring */
+#define ALOG_STR_SAMPLED(level,every,fmt,str,len,...) do{ \
+	static _Thread_local unsigned alog_tick_; \
+	if(ALOG_ENABLED(level)&&(alog_tick_++%(every))==0) \
+		async_log_write((level),(fmt),(str),(len),ALOG_NARGS_(__VA_ARGS__), \
+			ALOG_LONGS_(0,##__VA_ARGS__,0,0,0)); \
+}while(0)
+
+#endif
@@ -0,0 +1,432 @@
+/*
+Throughput/latency benchmark for the Q1_ReadWrite writer/reader queue.
+
+build: gcc -O2 -pthread Q1_ReadWrite/bench_q1.c Q1_ReadWrite/ring_queue.c Q1_ReadWrite/steal_sched.c Q1_ReadWrite/node_pool.c -o bench_q1
+run:   ./bench_q1 -q list|ring|steal -m writers -n readers -s payload -b batch -c messages [-Q capacity] [-f csv|json] [-H]
+
+M writers stamp each message with CLOCK_MONOTONIC and publish it in
+batches through the chosen transport:
+  list   the original head/tail list under one mutex plus the data_count semaphore
+  ring   one shared ring_queue
+  steal  steal_sched, one ring per reader with work stealing
+N readers touch every payload byte (what process_data does, minus the
+printing) and record enqueue-to-process latency. One result line is
+printed as CSV (-H adds the header) or JSON.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sched.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include "ring_queue.h"
+#include "steal_sched.h"
+#include "node_pool.h"
+
+#define BENCH_MAX_BATCH 256
+#define BENCH_MAX_SAMPLES (1<<20)   /* per reader, reservoir sampled beyond */
+
+typedef struct msg {
+	struct msg *next;
+	uint64_t enqueue_ns;
+	int length;
+	char data[];
+} msg_t;
+
+enum { Q_LIST, Q_RING, Q_STEAL };
+
+typedef struct bench_config {
+	int impl;
+	int writers;
+	int readers;
+	int payload;
+	int batch;
+	long messages;
+	size_t capacity;
+	int json;
+	int header;
+} bench_config_t;
+
+typedef struct reader_result {
+	int id;
+	uint64_t *samples;
+	long nsamples;
+	long seen;
+	uint64_t max;
+	uint64_t checksum;
+	unsigned int seed;
+} reader_result_t;
+
+/* a reservoir sample standing for seen/kept messages of its reader */
+typedef struct weighted_sample {
+	uint64_t latency;
+	double weight;
+} weighted_sample_t;
+
+static bench_config_t cfg={Q_RING,4,4,20,16,1000000,1024,0,0};
+static node_pool_t pool;
+
+/* list: the baseline from Q1_ReadWrite._windows_v01.c */
+static msg_t *list_head=NULL;
+static msg_t *list_tail=NULL;
+static pthread_mutex_t list_lock=PTHREAD_MUTEX_INITIALIZER;
+static sem_t list_count;
+
+static ring_queue_t ring;
+static steal_sched_t sched;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint64_t)ts.tv_sec*1000000000u+(uint64_t)ts.tv_nsec;
+}
+
+static void publish(msg_t **batch, int count)
+{
+	int i;
+
+	switch(cfg.impl)
+	{
+	case Q_LIST:
+		pthread_mutex_lock(&list_lock);
+		for(i=0;i<count;i++)
+		{
+			batch[i]->next=NULL;
+			if(list_head==NULL)
+				list_head=batch[i];
+			else
+				list_tail->next=batch[i];
+			list_tail=batch[i];
+		}
+		pthread_mutex_unlock(&list_lock);
+		for(i=0;i<count;i++)
+		{
+			sem_post(&list_count);
+		}
+		break;
+	case Q_RING:
+		ring_queue_enqueue_batch(&ring,(void **)batch,count);
+		break;
+	default:
+		steal_sched_push_batch(&sched,-1,(void **)batch,count);
+		break;
+	}
+}
+
+/* blocks for at least one message; 0 only for a closed steal_sched */
+static int take(int id, msg_t **batch, int max)
+{
+	int count=1;
+	int i;
+
+	switch(cfg.impl)
+	{
+	case Q_LIST:
+		sem_wait(&list_count);
+		while(count<max&&sem_trywait(&list_count)==0)
+		{
+			count++;
+		}
+		pthread_mutex_lock(&list_lock);
+		for(i=0;i<count;i++)
+		{
+			batch[i]=list_head;
+			list_head=list_head->next;
+		}
+		pthread_mutex_unlock(&list_lock);
+		return count;
+	case Q_RING:
+		return (int)ring_queue_dequeue_batch(&ring,(void **)batch,max);
+	default:
+		return (int)steal_sched_pop_batch(&sched,id,(void **)batch,max);
+	}
+}
+
+static void *bench_writer(void *arg)
+{
+	long quota=(long)arg;
+	msg_t *batch[BENCH_MAX_BATCH];
+	int count;
+
+	while(quota>0)
+	{
+		uint64_t stamp;
+		int i;
+
+		for(count=0;count<cfg.batch&&count<quota;count++)
+		{
+			while((batch[count]=(msg_t *)node_pool_alloc(&pool))==NULL)
+			{
+				sched_yield();
+			}
+			batch[count]->length=cfg.payload;
+			memset(batch[count]->data,(int)(quota-count),cfg.payload);
+		}
+		stamp=now_ns();
+		for(i=0;i<count;i++)
+		{
+			batch[i]->enqueue_ns=stamp;
+		}
+		publish(batch,count);
+		quota-=count;
+	}
+	return NULL;
+}
+
+static void record_latency(reader_result_t *r, uint64_t latency)
+{
+	if(r->nsamples<BENCH_MAX_SAMPLES)
+	{
+		r->samples[r->nsamples++]=latency;
+	}else{
+		/* reservoir: keep a uniform sample of everything seen */
+		long slot=(long)(rand_r(&r->seed)%(unsigned)(r->seen+1));
+		if(slot<BENCH_MAX_SAMPLES)
+			r->samples[slot]=latency;
+	}
+	r->seen++;
+	if(latency>r->max)
+		r->max=latency;
+}
+
+static void *bench_reader(void *arg)
+{
+	reader_result_t *r=(reader_result_t *)arg;
+	int id=r->id;
+	msg_t *batch[BENCH_MAX_BATCH];
+	int count;
+	int i;
+	int j;
+
+	while((count=take(id,batch,cfg.batch))>0)
+	{
+		int stop=0;
+
+		for(i=0;i<count;i++)
+		{
+			msg_t *m=batch[i];
+
+			if(m->length<0)
+			{
+				/* end marker; hand any extra ones back to the other readers */
+				if(stop++)
+					publish(&batch[i],1);
+				continue;
+			}
+			for(j=0;j<m->length;j++)
+			{
+				r->checksum+=(unsigned char)m->data[j];
+			}
+			/* each message completes when its own bytes are done, not the batch's first */
+			record_latency(r,now_ns()-m->enqueue_ns);
+			node_pool_free(&pool,m);
+		}
+		if(stop)
+			break;
+	}
+	return NULL;
+}
+
+static int cmp_sample(const void *a, const void *b)
+{
+	uint64_t x=((const weighted_sample_t *)a)->latency;
+	uint64_t y=((const weighted_sample_t *)b)->latency;
+
+	return x<y ? -1 : (x>y);
+}
+
+/* the smallest latency with at least p of the total weight at or below it */
+static uint64_t percentile(const weighted_sample_t *sorted, long n, double total_weight, double p)
+{
+	double target=p*total_weight;
+	double sum=0;
+	long i;
+
+	for(i=0;i<n;i++)
+	{
+		sum+=sorted[i].weight;
+		if(sum>=target)
+			return sorted[i].latency;
+	}
+	return n>0 ? sorted[n-1].latency : 0;
+}
+
+static const char *impl_name(int impl)
+{
+	return impl==Q_LIST ? "list" : (impl==Q_RING ? "ring" : "steal");
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,"usage: %s [-q list|ring|steal] [-m writers] [-n readers] [-s payload] [-b batch] "
+		"[-c messages] [-Q capacity] [-f csv|json] [-H]\n",prog);
+	exit(2);
+}
+
+static void parse_args(int argc, char **argv)
+{
+	int opt;
+
+	while((opt=getopt(argc,argv,"q:m:n:s:b:c:Q:f:H"))!=-1)
+	{
+		switch(opt)
+		{
+		case 'q':
+			if(strcmp(optarg,"list")==0) cfg.impl=Q_LIST;
+			else if(strcmp(optarg,"ring")==0) cfg.impl=Q_RING;
+			else if(strcmp(optarg,"steal")==0) cfg.impl=Q_STEAL;
+			else usage(argv[0]);
+			break;
+		case 'm': cfg.writers=atoi(optarg); break;
+		case 'n': cfg.readers=atoi(optarg); break;
+		case 's': cfg.payload=atoi(optarg); break;
+		case 'b': cfg.batch=atoi(optarg); break;
+		case 'c': cfg.messages=atol(optarg); break;
+		case 'Q': cfg.capacity=(size_t)atol(optarg); break;
+		case 'f': cfg.json=strcmp(optarg,"json")==0; break;
+		case 'H': cfg.header=1; break;
+		default: usage(argv[0]);
+		}
+	}
+	if(cfg.writers<1||cfg.readers<1||cfg.payload<1||cfg.batch<1||cfg.batch>BENCH_MAX_BATCH||cfg.messages<1)
+		usage(argv[0]);
+}
+
+int main(int argc, char **argv)
+{
+	pthread_t *writers;
+	pthread_t *readers;
+	reader_result_t *results;
+	weighted_sample_t *all;
+	double total_weight=0;
+	uint64_t max=0;
+	msg_t *end_markers;
+	long total=0;
+	long offset=0;
+	uint64_t checksum=0;
+	uint64_t start;
+	double seconds;
+	size_t blocks;
+	int i;
+
+	parse_args(argc,argv);
+	writers=(pthread_t *)calloc(cfg.writers,sizeof(pthread_t));
+	readers=(pthread_t *)calloc(cfg.readers,sizeof(pthread_t));
+	results=(reader_result_t *)calloc(cfg.readers,sizeof(reader_result_t));
+	/* one distinct end marker per reader, a list node can only be linked once */
+	end_markers=(msg_t *)calloc(cfg.readers,sizeof(msg_t));
+	blocks=cfg.capacity+(size_t)(cfg.writers+cfg.readers+1)*(2*NODE_POOL_BATCH+cfg.batch);
+	if(writers==NULL||readers==NULL||results==NULL||end_markers==NULL||
+		node_pool_init(&pool,sizeof(msg_t)+cfg.payload,blocks)<0)
+		return 1;
+	sem_init(&list_count,0,0);
+	if(cfg.impl==Q_RING&&ring_queue_init(&ring,cfg.capacity)<0)
+		return 1;
+	if(cfg.impl==Q_STEAL&&steal_sched_init(&sched,cfg.readers,(cfg.capacity+cfg.readers-1)/cfg.readers)<0)
+		return 1;
+
+	for(i=0;i<cfg.readers;i++)
+	{
+		results[i].samples=(uint64_t *)malloc(sizeof(uint64_t)*BENCH_MAX_SAMPLES);
+		if(results[i].samples==NULL)
+			return 1;
+		results[i].id=i;
+		results[i].seed=(unsigned int)i;
+		pthread_create(&readers[i],NULL,bench_reader,&results[i]);
+	}
+	start=now_ns();
+	for(i=0;i<cfg.writers;i++)
+	{
+		long quota=cfg.messages/cfg.writers+(i<cfg.messages%cfg.writers);
+		pthread_create(&writers[i],NULL,bench_writer,(void *)quota);
+	}
+	for(i=0;i<cfg.writers;i++)
+	{
+		pthread_join(writers[i],NULL);
+	}
+	if(cfg.impl==Q_STEAL)
+	{
+		steal_sched_close(&sched);
+	}else{
+		for(i=0;i<cfg.readers;i++)
+		{
+			msg_t *end=&end_markers[i];
+			end->length=-1;
+			publish(&end,1);
+		}
+	}
+	for(i=0;i<cfg.readers;i++)
+	{
+		pthread_join(readers[i],NULL);
+	}
+	seconds=(double)(now_ns()-start)/1e9;
+
+	for(i=0;i<cfg.readers;i++)
+	{
+		total+=results[i].nsamples;
+		checksum+=results[i].checksum;
+	}
+	all=(weighted_sample_t *)malloc(sizeof(weighted_sample_t)*(total>0 ? total : 1));
+	if(all==NULL)
+		return 1;
+	/* readers see different counts: each kept sample stands for seen/kept of its reader's messages */
+	for(i=0;i<cfg.readers;i++)
+	{
+		double weight=results[i].nsamples>0 ? (double)results[i].seen/results[i].nsamples : 0;
+		long k;
+
+		for(k=0;k<results[i].nsamples;k++)
+		{
+			all[offset+k].latency=results[i].samples[k];
+			all[offset+k].weight=weight;
+		}
+		offset+=results[i].nsamples;
+		total_weight+=weight*results[i].nsamples;
+		if(results[i].max>max)
+			max=results[i].max;
+	}
+	qsort(all,total,sizeof(weighted_sample_t),cmp_sample);
+
+	if(cfg.json)
+	{
+		printf("{\"impl\":\"%s\",\"writers\":%d,\"readers\":%d,\"payload\":%d,\"batch\":%d,"
+			"\"messages\":%ld,\"seconds\":%.6f,\"msgs_per_sec\":%.0f,\"bytes_per_sec\":%.0f,"
+			"\"p50_ns\":%lu,\"p99_ns\":%lu,\"p999_ns\":%lu,\"max_ns\":%lu,\"checksum\":%lu}\n",
+			impl_name(cfg.impl),cfg.writers,cfg.readers,cfg.payload,cfg.batch,cfg.messages,seconds,
+			(double)cfg.messages/seconds,(double)cfg.messages*cfg.payload/seconds,
+			(unsigned long)percentile(all,total,total_weight,0.50),(unsigned long)percentile(all,total,total_weight,0.99),
+			(unsigned long)percentile(all,total,total_weight,0.999),(unsigned long)max,
+			(unsigned long)checksum);
+	}else{
+		if(cfg.header)
+			printf("impl,writers,readers,payload,batch,messages,seconds,msgs_per_sec,bytes_per_sec,p50_ns,p99_ns,p999_ns,max_ns,checksum\n");
+		printf("%s,%d,%d,%d,%d,%ld,%.6f,%.0f,%.0f,%lu,%lu,%lu,%lu,%lu\n",
+			impl_name(cfg.impl),cfg.writers,cfg.readers,cfg.payload,cfg.batch,cfg.messages,seconds,
+			(double)cfg.messages/seconds,(double)cfg.messages*cfg.payload/seconds,
+			(unsigned long)percentile(all,total,total_weight,0.50),(unsigned long)percentile(all,total,total_weight,0.99),
+			(unsigned long)percentile(all,total,total_weight,0.999),(unsigned long)max,
+			(unsigned long)checksum);
+	}
+
+	for(i=0;i<cfg.readers;i++)
+	{
+		free(results[i].samples);
+	}
+	free(all);
+	free(results);
+	free(end_markers);
+	free(readers);
+	free(writers);
+	if(cfg.impl==Q_RING)
+		ring_queue_destroy(&ring);
+	if(cfg.impl==Q_STEAL)
+		steal_sched_destroy(&sched);
+	sem_destroy(&list_count);
+	node_pool_destroy(&pool);
+	return 0;
+}
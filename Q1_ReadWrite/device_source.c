@@ -0,0 +1,191 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "device_source.h"
+#include "stage_stats.h"
+
+int device_source_open(device_source_t *src, const char *path, int flags)
+{
+	int open_flags=O_RDONLY|O_CLOEXEC;
+	int fd;
+
+	if(flags&DEVSRC_NONBLOCK)
+		open_flags|=O_NONBLOCK;
+	fd=open(path,open_flags);
+	if(fd<0)
+	{
+		printf("@device_source_open, can't open %s: %s \n",path,strerror(errno));
+		return -1;
+	}
+	return device_source_attach(src,fd,flags);
+}
+
+int device_source_attach(device_source_t *src, int fd, int flags)
+{
+	struct stat st;
+
+	src->fd=fd;
+	if(flags&DEVSRC_NONBLOCK)
+		fcntl(fd,F_SETFL,fcntl(fd,F_GETFL)|O_NONBLOCK);
+	if(fstat(src->fd,&st)<0)
+	{
+		close(src->fd);
+		src->fd=-1;
+		return -1;
+	}
+	src->flags=flags;
+	src->seekable=S_ISREG(st.st_mode)||S_ISBLK(st.st_mode);
+	src->map=NULL;
+	src->map_size=0;
+	atomic_init(&src->offset,0);
+	atomic_init(&src->eof,0);
+	pthread_mutex_init(&src->lock,NULL);
+
+	if((flags&DEVSRC_MMAP)&&S_ISREG(st.st_mode)&&st.st_size>0)
+	{
+		/* private + writable so consumers may scribble on (memset) their view */
+		void *map=mmap(NULL,(size_t)st.st_size,PROT_READ|PROT_WRITE,MAP_PRIVATE,src->fd,0);
+		if(map!=MAP_FAILED)
+		{
+			madvise(map,(size_t)st.st_size,MADV_SEQUENTIAL);
+			src->map=(char *)map;
+			src->map_size=(size_t)st.st_size;
+		}
+	}
+	return 0;
+}
+
+void device_source_close(device_source_t *src)
+{
+	if(src->map!=NULL)
+	{
+		munmap(src->map,src->map_size);
+		src->map=NULL;
+	}
+	if(src->fd>=0)
+	{
+		close(src->fd);
+		src->fd=-1;
+	}
+	pthread_mutex_destroy(&src->lock);
+}
+
+int device_source_at_eof(device_source_t *src)
+{
+	return atomic_load_explicit(&src->eof,memory_order_relaxed);
+}
+
+/* spread total bytes across the buffers in order */
+static int split_lengths(ssize_t total, int *lengths, int count, int size)
+{
+	int filled=0;
+
+	while(total>0&&filled<count)
+	{
+		lengths[filled]=total>size ? size : (int)total;
+		total-=lengths[filled];
+		filled++;
+	}
+	return filled;
+}
+
+static int map_batch(device_source_t *src, char **buffers, int *lengths, int count, int size)
+{
+	long long want=(long long)count*size;
+	long long start=atomic_fetch_add_explicit(&src->offset,want,memory_order_relaxed);
+	long long avail;
+	int filled;
+	int i;
+
+	if(start>=(long long)src->map_size)
+	{
+		atomic_store_explicit(&src->eof,1,memory_order_relaxed);
+		return 0;
+	}
+	avail=(long long)src->map_size-start;
+	filled=split_lengths(avail<want ? avail : want,lengths,count,size);
+	for(i=0;i<filled;i++)
+	{
+		buffers[i]=src->map+start+(long long)i*size;
+	}
+	return filled;
+}
+
+int device_source_read_batch(device_source_t *src, char **buffers, int *lengths, int count, int size)
+{
+	struct iovec iov[DEVSRC_MAX_IOV];
+	ssize_t got;
+	int i;
+
+	if(count>DEVSRC_MAX_IOV)
+		count=DEVSRC_MAX_IOV;
+	if(count<=0||size<=0)
+		return 0;
+	if(src->map!=NULL)
+		return map_batch(src,buffers,lengths,count,size);
+
+	for(i=0;i<count;i++)
+	{
+		iov[i].iov_base=buffers[i];
+		iov[i].iov_len=(size_t)size;
+	}
+	if(src->seekable)
+	{
+		long long start=atomic_load_explicit(&src->offset,memory_order_relaxed);
+
+		/* claim only the bytes read, so a short read at the end of a file
+		that is still growing leaves the rest for the next call; if another
+		thread claimed from start first, read again where it stopped */
+		while(1)
+		{
+			do{
+				got=preadv(src->fd,iov,count,(off_t)start);
+			}while(got<0&&errno==EINTR);
+			if(got<=0||atomic_compare_exchange_strong_explicit(&src->offset,&start,start+got,
+				memory_order_relaxed,memory_order_relaxed))
+				break;
+		}
+	}else{
+		STAGE_TIMER(lock_start);
+		pthread_mutex_lock(&src->lock);
+		STAGE_RECORD(STAGE_SOURCE_LOCK_WAIT,lock_start,1);
+		STAGE_TIMER(hold_start);
+		do{
+			got=readv(src->fd,iov,count);
+		}while(got<0&&errno==EINTR);
+		pthread_mutex_unlock(&src->lock);
+		STAGE_RECORD(STAGE_SOURCE_LOCK_HOLD,hold_start,1);
+	}
+	if(got<0)
+	{
+		if(errno==EAGAIN||errno==EWOULDBLOCK)
+			return 0;
+		return -1;
+	}
+	if(got==0)
+	{
+		atomic_store_explicit(&src->eof,1,memory_order_relaxed);
+		return 0;
+	}
+	return split_lengths(got,lengths,count,size);
+}
+
+int device_source_read(device_source_t *src, char *buffer, int size)
+{
+	char *view=buffer;
+	int length=0;
+	int filled=device_source_read_batch(src,&view,&length,1,size);
+
+	if(filled<=0)
+		return filled;
+	if(view!=buffer)
+		memcpy(buffer,view,length);
+	return length;
+}
@@ -0,0 +1,63 @@
+#ifndef Q1_DEVICE_SOURCE_H
+#define Q1_DEVICE_SOURCE_H
+
+/*
+Persistent input source for get_external_data.
+
+The fd is opened once instead of per message. Data is read straight into
+the caller's (pool owned) buffers with one readv/preadv per batch, or, for
+a regular file opened with DEVSRC_MMAP, handed out as views into a private
+mapping without any copy. Lengths come from the byte counts the kernel
+returns, so binary data and partial reads are handled; nothing is strlen'd.
+
+Seekable files need no lock. preadv reads at the shared offset and then
+claims the bytes it got with a compare-and-swap, reading again if another
+thread claimed them first; a short read (the end of a file that is still
+being written) claims only what was there. A DEVSRC_MMAP file is a
+snapshot of its size at open, so its ranges are claimed with a plain
+atomic add. Streams (character devices, FIFOs, sockets) take src->lock
+around readv so one batch is never interleaved with another thread's.
+*/
+
+#include <stddef.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#define DEVSRC_MMAP     0x1   /* map regular files instead of reading */
+#define DEVSRC_NONBLOCK 0x2   /* O_NONBLOCK, empty streams return 0 */
+
+#define DEVSRC_MAX_IOV 64
+
+typedef struct device_source {
+	int fd;
+	int flags;
+	int seekable;
+	atomic_llong offset;      /* next byte for preadv/mmap */
+	char *map;
+	size_t map_size;
+	atomic_int eof;
+	pthread_mutex_t lock;     /* streams only */
+} device_source_t;
+
+/* returns 0 or -1 */
+int device_source_open(device_source_t *src, const char *path, int flags);
+/* wrap an fd that is already open (socket, pipe end); the source owns it */
+int device_source_attach(device_source_t *src, int fd, int flags);
+void device_source_close(device_source_t *src);
+
+/*
+Fill up to count buffers of size bytes each, in order, with one system
+call. lengths[i] gets the bytes placed in buffers[i]; only the last one
+can be short. In mmap mode buffers[i] is replaced by a pointer into the
+mapping. Returns the number of buffers filled, 0 when no data is
+available (end of file, or an empty non-blocking stream) and -1 on error.
+*/
+int device_source_read_batch(device_source_t *src, char **buffers, int *lengths, int count, int size);
+
+/* single buffer form, returns the byte count, 0 or -1 */
+int device_source_read(device_source_t *src, char *buffer, int size);
+
+int device_source_at_eof(device_source_t *src);
+
+#endif
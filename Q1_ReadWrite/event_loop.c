@@ -0,0 +1,261 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "event_loop.h"
+
+#define EVENT_LOOP_BATCH_EVENTS 32
+#define EVENT_LOOP_IDLE_MS 100
+/* regular files that are not at EOF yet but had no room in the pool */
+#define EVENT_LOOP_FILE_RETRY_MS 1
+
+int event_loop_init(event_loop_t *loop)
+{
+	struct epoll_event ev;
+
+	loop->epfd=epoll_create1(EPOLL_CLOEXEC);
+	if(loop->epfd<0)
+	{
+		printf("@event_loop_init, error occurs for epoll_create1: %s \n",strerror(errno));
+		return -1;
+	}
+	loop->wake_fd=eventfd(0,EFD_CLOEXEC|EFD_NONBLOCK);
+	if(loop->wake_fd<0)
+	{
+		close(loop->epfd);
+		return -1;
+	}
+	/* level triggered and never read: once signalled it wakes everybody */
+	memset(&ev,0,sizeof(ev));
+	ev.events=EPOLLIN;
+	ev.data.ptr=NULL;
+	epoll_ctl(loop->epfd,EPOLL_CTL_ADD,loop->wake_fd,&ev);
+
+	atomic_init(&loop->nsources,0);
+	atomic_init(&loop->live,0);
+	atomic_init(&loop->running,0);
+	atomic_init(&loop->parked,0);
+	atomic_init(&loop->resumes,0);
+	loop->nthreads=0;
+	return 0;
+}
+
+int event_loop_add(event_loop_t *loop, device_source_t *src, event_ready_fn ready, void *ctx)
+{
+	int index=atomic_load(&loop->nsources);
+	event_source_t *es;
+
+	if(index>=EVENT_LOOP_MAX_SOURCES)
+	{
+		printf("@event_loop_add, error occurs for too many sources \n");
+		return -1;
+	}
+	es=&loop->sources[index];
+	es->src=src;
+	es->ready=ready;
+	es->ctx=ctx;
+	es->polled=!src->seekable&&src->map==NULL;
+	atomic_init(&es->done,0);
+	atomic_init(&es->parked,0);
+	if(es->polled)
+	{
+		struct epoll_event ev;
+
+		memset(&ev,0,sizeof(ev));
+		ev.events=EPOLLIN|EPOLLONESHOT;
+		ev.data.ptr=es;
+		if(epoll_ctl(loop->epfd,EPOLL_CTL_ADD,src->fd,&ev)<0)
+		{
+			printf("@event_loop_add, error occurs for epoll_ctl: %s \n",strerror(errno));
+			return -1;
+		}
+	}
+	atomic_fetch_add(&loop->live,1);
+	atomic_store(&loop->nsources,index+1);
+	return 0;
+}
+
+static void event_loop_wake(event_loop_t *loop)
+{
+	uint64_t one=1;
+
+	if(write(loop->wake_fd,&one,sizeof(one))<0)
+	{
+		/* counter saturated: already signalled */
+	}
+}
+
+static void source_arm(event_loop_t *loop, event_source_t *es)
+{
+	struct epoll_event ev;
+
+	memset(&ev,0,sizeof(ev));
+	ev.events=EPOLLIN|EPOLLONESHOT;
+	ev.data.ptr=es;
+	epoll_ctl(loop->epfd,EPOLL_CTL_MOD,es->src->fd,&ev);
+}
+
+/* take es out of the parked set; 1 if this call did */
+static int source_unpark(event_loop_t *loop, event_source_t *es)
+{
+	if(!atomic_exchange(&es->parked,0))
+		return 0;
+	atomic_fetch_sub(&loop->parked,1);
+	return 1;
+}
+
+static void source_finish(event_loop_t *loop, event_source_t *es)
+{
+	if(atomic_exchange(&es->done,1))
+		return;
+	if(es->polled)
+		epoll_ctl(loop->epfd,EPOLL_CTL_DEL,es->src->fd,NULL);
+	if(atomic_fetch_sub(&loop->live,1)==1)
+		event_loop_wake(loop);
+}
+
+/*
+one pass over the regular files: returns 1 if any produced data, 0 if some
+are still open but produced nothing, -1 if none are left
+*/
+static int service_files(event_loop_t *loop)
+{
+	int count=atomic_load(&loop->nsources);
+	int busy=-1;
+	int i;
+
+	for(i=0;i<count;i++)
+	{
+		event_source_t *es=&loop->sources[i];
+		int r;
+
+		if(es->polled||atomic_load_explicit(&es->done,memory_order_relaxed))
+			continue;
+		r=es->ready(es->ctx,es->src);
+		if(r==EVENT_READY_PARK)
+			r=0;                  /* retried every pass anyway */
+		if(r<0)
+			source_finish(loop,es);
+		else if(r>0)
+			busy=1;
+		else if(busy<0)
+			busy=0;
+	}
+	return busy;
+}
+
+static void *event_loop_thread(void *arg)
+{
+	event_loop_t *loop=(event_loop_t *)arg;
+	struct epoll_event events[EVENT_LOOP_BATCH_EVENTS];
+	int n;
+	int i;
+
+	while(atomic_load(&loop->running)&&atomic_load(&loop->live)>0)
+	{
+		int busy=service_files(loop);
+		int timeout=busy>0 ? 0 : (busy==0 ? EVENT_LOOP_FILE_RETRY_MS : EVENT_LOOP_IDLE_MS);
+
+		n=epoll_wait(loop->epfd,events,EVENT_LOOP_BATCH_EVENTS,timeout);
+		if(n<0)
+		{
+			if(errno==EINTR)
+				continue;
+			printf("@event_loop_thread, error occurs for epoll_wait: %s \n",strerror(errno));
+			break;
+		}
+		/* quiet for a whole wait: try the parked streams again in case a
+		resume missed them; one that still has no room just parks again */
+		if(n==0)
+			event_loop_resume(loop);
+		for(i=0;i<n;i++)
+		{
+			event_source_t *es=(event_source_t *)events[i].data.ptr;
+			unsigned int resumes;
+			int r;
+
+			if(es==NULL)
+				continue;
+			resumes=atomic_load(&loop->resumes);
+			r=es->ready(es->ctx,es->src);
+			if(r==EVENT_READY_PARK)
+			{
+				/* left disarmed; unless a resume came in since the callback looked */
+				atomic_store(&es->parked,1);
+				atomic_fetch_add(&loop->parked,1);
+				if(atomic_load(&loop->resumes)!=resumes&&source_unpark(loop,es))
+					source_arm(loop,es);
+				continue;
+			}
+			if(r<0||(r==0&&(events[i].events&(EPOLLHUP|EPOLLERR))))
+			{
+				source_finish(loop,es);
+				continue;
+			}
+			source_arm(loop,es);
+		}
+	}
+	return NULL;
+}
+
+int event_loop_start(event_loop_t *loop, int nthreads)
+{
+	int i;
+
+	if(nthreads>EVENT_LOOP_MAX_THREADS)
+		nthreads=EVENT_LOOP_MAX_THREADS;
+	atomic_store(&loop->running,1);
+	for(i=0;i<nthreads;i++)
+	{
+		if(pthread_create(&loop->threads[i],NULL,event_loop_thread,loop)!=0)
+		{
+			printf("@event_loop_start, error occurs for pthread_create \n");
+			break;
+		}
+		loop->nthreads++;
+	}
+	return loop->nthreads>0 ? 0 : -1;
+}
+
+void event_loop_resume(event_loop_t *loop)
+{
+	int count;
+	int i;
+
+	/* one load when nothing is parked. A stream parking just after this
+	load is not seen here; the idle timeout in event_loop_thread picks it up */
+	if(atomic_load(&loop->parked)==0)
+		return;
+	/* a thread parking from here on sees the count move and re-arms itself */
+	atomic_fetch_add(&loop->resumes,1);
+	count=atomic_load(&loop->nsources);
+	for(i=0;i<count;i++)
+	{
+		event_source_t *es=&loop->sources[i];
+
+		if(source_unpark(loop,es)&&!atomic_load(&es->done))
+			source_arm(loop,es);
+	}
+}
+
+void event_loop_stop(event_loop_t *loop)
+{
+	atomic_store(&loop->running,0);
+	event_loop_wake(loop);
+}
+
+void event_loop_join(event_loop_t *loop)
+{
+	int i;
+
+	for(i=0;i<loop->nthreads;i++)
+	{
+		pthread_join(loop->threads[i],NULL);
+	}
+	loop->nthreads=0;
+	close(loop->wake_fd);
+	close(loop->epfd);
+}
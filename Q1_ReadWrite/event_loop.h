@@ -0,0 +1,75 @@
+#ifndef Q1_EVENT_LOOP_H
+#define Q1_EVENT_LOOP_H
+
+/*
+epoll driven ingestion for the writer side.
+
+Instead of one blocked writer_thread per source, a couple of I/O threads
+wait on a shared epoll set and call the source's ready callback, which
+reads a batch and publishes it to the queue. Streams (pipes, FIFOs,
+sockets, character devices) are registered EPOLLONESHOT and re-armed
+after each callback, so a source is only ever serviced by one thread at
+a time. A stream whose callback had nowhere to put its data (no free
+block, pipeline throttled) is parked instead: re-arming it would only
+spin in epoll_wait on an fd that stays readable. event_loop_resume
+re-arms the parked streams once the consumers have made room.
+
+Regular files never block and are not pollable; every I/O thread
+services them between epoll waits (device_source claims their ranges
+atomically, so that is safe).
+
+There is no io_uring backend: liburing is not part of this tree, and
+all reads go through device_source, so epoll covers every kind of source.
+*/
+
+#include <stdatomic.h>
+#include <pthread.h>
+#include "device_source.h"
+
+#define EVENT_LOOP_MAX_SOURCES 64
+#define EVENT_LOOP_MAX_THREADS 8
+
+/*
+returns messages taken (>0), 0 when the source had nothing ready, -1
+once it is finished (end of file, error), or EVENT_READY_PARK when it
+could not take what is ready; finished sources are dropped
+*/
+#define EVENT_READY_PARK (-2)
+typedef int (*event_ready_fn)(void *ctx, device_source_t *src);
+
+typedef struct event_source {
+	device_source_t *src;
+	event_ready_fn ready;
+	void *ctx;
+	int polled;           /* in the epoll set, else serviced every pass */
+	atomic_int done;
+	atomic_int parked;    /* disarmed until event_loop_resume */
+} event_source_t;
+
+typedef struct event_loop {
+	int epfd;
+	int wake_fd;          /* eventfd, wakes every thread on stop */
+	event_source_t sources[EVENT_LOOP_MAX_SOURCES];
+	atomic_int nsources;
+	atomic_int live;
+	atomic_int running;
+	atomic_int parked;
+	atomic_uint resumes;  /* event_loop_resume calls, to catch one racing a park */
+	pthread_t threads[EVENT_LOOP_MAX_THREADS];
+	int nthreads;
+} event_loop_t;
+
+int event_loop_init(event_loop_t *loop);
+/* register every source before event_loop_start; returns 0 or -1 */
+int event_loop_add(event_loop_t *loop, device_source_t *src, event_ready_fn ready, void *ctx);
+/* spawn nthreads I/O threads; they exit once every source is finished */
+int event_loop_start(event_loop_t *loop, int nthreads);
+/* re-arm the parked streams; a single load when none are. One parked
+just as this is called waits for the next call or an idle I/O thread */
+void event_loop_resume(event_loop_t *loop);
+/* ask the I/O threads to exit early */
+void event_loop_stop(event_loop_t *loop);
+/* join the I/O threads and release the epoll set (not the sources) */
+void event_loop_join(event_loop_t *loop);
+
+#endif
@@ -0,0 +1,259 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "node_pool.h"
+
+/* layout of a block while it sits in a free chain */
+typedef struct free_block {
+	uint32_t next;        /* next block of the same chain */
+	uint32_t next_chain;  /* next chain on the global stack (chain head only) */
+	uint32_t count;       /* blocks in this chain (chain head only) */
+} free_block_t;
+
+typedef struct chain {
+	uint32_t head;
+	uint32_t count;
+} chain_t;
+
+typedef struct pool_cache {
+	node_pool_t *pool;
+	chain_t cur;
+	chain_t spare;
+	uint64_t hits;
+} pool_cache_t;
+
+static free_block_t *pool_block(node_pool_t *pool, uint32_t index)
+{
+	return (free_block_t *)(pool->arena+(size_t)index*pool->block_size);
+}
+
+static void pool_note_outstanding(node_pool_t *pool, size_t now)
+{
+	size_t high=atomic_load_explicit(&pool->high_water,memory_order_relaxed);
+
+	while(now>high)
+	{
+		if(atomic_compare_exchange_weak_explicit(&pool->high_water,&high,now,
+			memory_order_relaxed,memory_order_relaxed))
+			break;
+	}
+}
+
+static void pool_push_chain(node_pool_t *pool, chain_t chain)
+{
+	uint64_t old_head=atomic_load_explicit(&pool->free_head,memory_order_relaxed);
+	uint64_t new_head;
+	free_block_t *first=pool_block(pool,chain.head);
+
+	first->count=chain.count;
+	do{
+		first->next_chain=(uint32_t)old_head;
+		new_head=((old_head>>32)+1)<<32|chain.head;
+	}while(!atomic_compare_exchange_weak_explicit(&pool->free_head,&old_head,new_head,
+		memory_order_release,memory_order_relaxed));
+
+	atomic_fetch_sub_explicit(&pool->outstanding,chain.count,memory_order_relaxed);
+}
+
+/*
+next_chain of a head may be rewritten by a thread that popped it first;
+the tag in free_head makes our CAS fail in that case, and the arena is
+never released while the pool is alive, so the stale read is harmless.
+*/
+static int pool_pop_chain(node_pool_t *pool, chain_t *chain)
+{
+	uint64_t old_head=atomic_load_explicit(&pool->free_head,memory_order_acquire);
+	uint64_t new_head;
+	uint32_t index;
+	size_t now;
+
+	do{
+		index=(uint32_t)old_head;
+		if(index==NODE_POOL_NONE)
+			return -1;
+		new_head=((old_head>>32)+1)<<32|pool_block(pool,index)->next_chain;
+	}while(!atomic_compare_exchange_weak_explicit(&pool->free_head,&old_head,new_head,
+		memory_order_acquire,memory_order_acquire));
+
+	chain->head=index;
+	chain->count=pool_block(pool,index)->count;
+	now=atomic_fetch_add_explicit(&pool->outstanding,chain->count,memory_order_relaxed)+chain->count;
+	pool_note_outstanding(pool,now);
+	return 0;
+}
+
+static void pool_fold_hits(pool_cache_t *cache)
+{
+	if(cache->hits!=0)
+	{
+		atomic_fetch_add_explicit(&cache->pool->hits,cache->hits,memory_order_relaxed);
+		cache->hits=0;
+	}
+}
+
+/* thread exit: hand the cached chains back */
+static void pool_cache_release(void *arg)
+{
+	pool_cache_t *cache=(pool_cache_t *)arg;
+
+	if(cache->cur.count!=0)
+		pool_push_chain(cache->pool,cache->cur);
+	if(cache->spare.count!=0)
+		pool_push_chain(cache->pool,cache->spare);
+	pool_fold_hits(cache);
+	free(cache);
+}
+
+static pool_cache_t *pool_get_cache(node_pool_t *pool)
+{
+	pool_cache_t *cache=(pool_cache_t *)pthread_getspecific(pool->cache_key);
+
+	if(cache==NULL)
+	{
+		cache=(pool_cache_t *)calloc(1,sizeof(pool_cache_t));
+		if(cache==NULL)
+			return NULL;
+		cache->pool=pool;
+		cache->cur.head=NODE_POOL_NONE;
+		cache->spare.head=NODE_POOL_NONE;
+		pthread_setspecific(pool->cache_key,cache);
+	}
+	return cache;
+}
+
+int node_pool_init(node_pool_t *pool, size_t block_size, size_t block_count)
+{
+	chain_t chain;
+	size_t i;
+
+	if(block_size<sizeof(free_block_t))
+		block_size=sizeof(free_block_t);
+	block_size=(block_size+63)&~(size_t)63;
+	if(block_count==0||block_count>=NODE_POOL_NONE)
+	{
+		printf("@node_pool_init, error occurs for block_count %zu \n",block_count);
+		return -1;
+	}
+	pool->arena=(char *)aligned_alloc(64,block_size*block_count);
+	if(pool->arena==NULL)
+	{
+		printf("@node_pool_init, error occurs for arena==NULL \n");
+		return -1;
+	}
+	if(pthread_key_create(&pool->cache_key,pool_cache_release)!=0)
+	{
+		free(pool->arena);
+		return -1;
+	}
+	pool->block_size=block_size;
+	pool->block_count=block_count;
+	atomic_init(&pool->free_head,NODE_POOL_NONE);
+	atomic_init(&pool->outstanding,block_count);
+	atomic_init(&pool->high_water,0);
+	atomic_init(&pool->hits,0);
+	atomic_init(&pool->refills,0);
+	atomic_init(&pool->flushes,0);
+	atomic_init(&pool->misses,0);
+
+	/* seed the global stack with chains of NODE_POOL_BATCH blocks */
+	for(i=0;i<block_count;i+=chain.count)
+	{
+		uint32_t j;
+
+		chain.head=(uint32_t)i;
+		chain.count=(uint32_t)(block_count-i<NODE_POOL_BATCH ? block_count-i : NODE_POOL_BATCH);
+		for(j=0;j<chain.count;j++)
+		{
+			pool_block(pool,(uint32_t)i+j)->next=(j+1<chain.count) ? (uint32_t)i+j+1 : NODE_POOL_NONE;
+		}
+		pool_push_chain(pool,chain);
+	}
+	return 0;
+}
+
+void node_pool_destroy(node_pool_t *pool)
+{
+	pool_cache_t *cache=(pool_cache_t *)pthread_getspecific(pool->cache_key);
+
+	if(cache!=NULL)
+	{
+		pthread_setspecific(pool->cache_key,NULL);
+		pool_cache_release(cache);
+	}
+	pthread_key_delete(pool->cache_key);
+	free(pool->arena);
+	pool->arena=NULL;
+}
+
+void *node_pool_alloc(node_pool_t *pool)
+{
+	pool_cache_t *cache=pool_get_cache(pool);
+	free_block_t *block;
+
+	if(cache==NULL)
+		return NULL;
+	if(cache->cur.count==0&&cache->spare.count!=0)
+	{
+		cache->cur=cache->spare;
+		cache->spare.head=NODE_POOL_NONE;
+		cache->spare.count=0;
+	}
+	if(cache->cur.count!=0)
+	{
+		cache->hits++;
+	}else if(pool_pop_chain(pool,&cache->cur)==0){
+		atomic_fetch_add_explicit(&pool->refills,1,memory_order_relaxed);
+		pool_fold_hits(cache);
+	}else{
+		atomic_fetch_add_explicit(&pool->misses,1,memory_order_relaxed);
+		return NULL;
+	}
+	block=pool_block(pool,cache->cur.head);
+	cache->cur.head=block->next;
+	cache->cur.count--;
+	return block;
+}
+
+void node_pool_free(node_pool_t *pool, void *ptr)
+{
+	pool_cache_t *cache=pool_get_cache(pool);
+	free_block_t *block=(free_block_t *)ptr;
+	uint32_t index;
+
+	if(ptr==NULL)
+		return;
+	index=(uint32_t)(((char *)ptr-pool->arena)/pool->block_size);
+	if(cache==NULL)
+	{
+		/* no cache for this thread: give the block back on its own */
+		chain_t single={index,1};
+		block->next=NODE_POOL_NONE;
+		pool_push_chain(pool,single);
+		return;
+	}
+	block->next=cache->cur.head;
+	cache->cur.head=index;
+	cache->cur.count++;
+	if(cache->cur.count==NODE_POOL_BATCH)
+	{
+		if(cache->spare.count!=0)
+		{
+			pool_push_chain(pool,cache->spare);
+			atomic_fetch_add_explicit(&pool->flushes,1,memory_order_relaxed);
+			pool_fold_hits(cache);
+		}
+		cache->spare=cache->cur;
+		cache->cur.head=NODE_POOL_NONE;
+		cache->cur.count=0;
+	}
+}
+
+void node_pool_get_stats(node_pool_t *pool, node_pool_stats_t *stats)
+{
+	stats->hits=atomic_load_explicit(&pool->hits,memory_order_relaxed);
+	stats->refills=atomic_load_explicit(&pool->refills,memory_order_relaxed);
+	stats->flushes=atomic_load_explicit(&pool->flushes,memory_order_relaxed);
+	stats->misses=atomic_load_explicit(&pool->misses,memory_order_relaxed);
+	stats->high_water=atomic_load_explicit(&pool->high_water,memory_order_relaxed);
+	stats->block_count=pool->block_count;
+	stats->block_size=pool->block_size;
+}
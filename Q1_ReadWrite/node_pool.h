@@ -0,0 +1,62 @@
+#ifndef Q1_NODE_POOL_H
+#define Q1_NODE_POOL_H
+
+/*
+Fixed-size block pool for node_t + payload.
+
+All blocks come from one arena allocated up front. Each thread keeps a
+small cache of free blocks (two chains of up to NODE_POOL_BATCH blocks,
+"cur" and "spare") so alloc/free normally touch no shared memory. Whole
+chains move between the thread caches and a global lock-free stack; the
+stack head packs a block index with an ABA tag into one 64-bit word.
+
+Writers only allocate and readers only free, so a reader's cache spills
+full chains back to the global stack for the writers to pick up.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#define NODE_POOL_BATCH 32
+#define NODE_POOL_NONE 0xffffffffu
+
+typedef struct node_pool_stats {
+	uint64_t hits;          /* alloc served from the thread cache */
+	uint64_t refills;       /* chains taken from the global stack */
+	uint64_t flushes;       /* chains given back to the global stack */
+	uint64_t misses;        /* alloc failed, pool exhausted */
+	size_t high_water;      /* max blocks held outside the global stack */
+	size_t block_count;
+	size_t block_size;
+} node_pool_stats_t;
+
+typedef struct node_pool {
+	char *arena;
+	size_t block_size;
+	size_t block_count;
+	pthread_key_t cache_key;
+
+	_Alignas(64) atomic_uint_fast64_t free_head;  /* tag<<32 | index */
+	_Alignas(64) atomic_size_t outstanding;       /* blocks not in free_head */
+	atomic_size_t high_water;
+	atomic_uint_fast64_t hits;
+	atomic_uint_fast64_t refills;
+	atomic_uint_fast64_t flushes;
+	atomic_uint_fast64_t misses;
+} node_pool_t;
+
+/* block_size is rounded up to a cache line; returns 0 or -1 */
+int node_pool_init(node_pool_t *pool, size_t block_size, size_t block_count);
+/* call once every thread using the pool has exited */
+void node_pool_destroy(node_pool_t *pool);
+
+/* returns NULL when every block is in use */
+void *node_pool_alloc(node_pool_t *pool);
+void node_pool_free(node_pool_t *pool, void *block);
+
+/* hits are folded in from the thread caches at each refill/flush */
+void node_pool_get_stats(node_pool_t *pool, node_pool_stats_t *stats);
+
+#endif
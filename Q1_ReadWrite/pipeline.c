@@ -0,0 +1,163 @@
+#include <stdlib.h>
+#include <time.h>
+#include "pipeline.h"
+#include "stage_stats.h"
+
+static uint64_t pipeline_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint64_t)ts.tv_sec*1000000000u+(uint64_t)ts.tv_nsec;
+}
+
+int pipeline_init(pipeline_t *p, const pipeline_config_t *config)
+{
+	if(config->high_watermark==0||config->low_watermark>config->high_watermark)
+	{
+		printf("@pipeline_init, error occurs for watermarks %zu/%zu \n",
+			config->low_watermark,config->high_watermark);
+		return -1;
+	}
+	p->config=*config;
+	atomic_init(&p->depth,0);
+	atomic_init(&p->throttled,0);
+	atomic_init(&p->running,1);
+	atomic_init(&p->produced,0);
+	atomic_init(&p->produced_bytes,0);
+	atomic_init(&p->dropped,0);
+	atomic_init(&p->throttle_waits,0);
+	atomic_init(&p->processed,0);
+	atomic_init(&p->processed_bytes,0);
+	pthread_mutex_init(&p->wait_lock,NULL);
+	pthread_cond_init(&p->resume,NULL);
+	atomic_init(&p->waiting,0);
+	p->start_ns=pipeline_now_ns();
+	p->stop_ns=0;
+	return 0;
+}
+
+void pipeline_destroy(pipeline_t *p)
+{
+	pthread_cond_destroy(&p->resume);
+	pthread_mutex_destroy(&p->wait_lock);
+}
+
+int pipeline_running(pipeline_t *p)
+{
+	return atomic_load_explicit(&p->running,memory_order_relaxed);
+}
+
+int pipeline_throttled(pipeline_t *p)
+{
+	return atomic_load_explicit(&p->throttled,memory_order_relaxed);
+}
+
+int pipeline_try_admit(pipeline_t *p)
+{
+	if(!pipeline_running(p))
+		return PIPELINE_STOP;
+	if(!atomic_load_explicit(&p->throttled,memory_order_relaxed))
+		return PIPELINE_ADMIT;
+	if(p->config.drop_when_full)
+		return PIPELINE_DROP;
+	atomic_fetch_add_explicit(&p->throttle_waits,1,memory_order_relaxed);
+	return PIPELINE_THROTTLED;
+}
+
+int pipeline_admit(pipeline_t *p)
+{
+	if(!pipeline_running(p))
+		return PIPELINE_STOP;
+	if(!atomic_load_explicit(&p->throttled,memory_order_relaxed))
+		return PIPELINE_ADMIT;
+	if(p->config.drop_when_full)
+		return PIPELINE_DROP;
+
+	atomic_fetch_add_explicit(&p->throttle_waits,1,memory_order_relaxed);
+	STAGE_TIMER(wait_start);
+	pthread_mutex_lock(&p->wait_lock);
+	atomic_fetch_add(&p->waiting,1);
+	while(atomic_load(&p->throttled)&&pipeline_running(p))
+	{
+		pthread_cond_wait(&p->resume,&p->wait_lock);
+	}
+	atomic_fetch_sub(&p->waiting,1);
+	pthread_mutex_unlock(&p->wait_lock);
+	STAGE_RECORD(STAGE_THROTTLE_WAIT,wait_start,1);
+	return pipeline_running(p) ? PIPELINE_ADMIT : PIPELINE_STOP;
+}
+
+static void pipeline_wake(pipeline_t *p)
+{
+	atomic_thread_fence(memory_order_seq_cst);
+	if(atomic_load_explicit(&p->waiting,memory_order_relaxed)>0)
+	{
+		pthread_mutex_lock(&p->wait_lock);
+		pthread_cond_broadcast(&p->resume);
+		pthread_mutex_unlock(&p->wait_lock);
+	}
+}
+
+void pipeline_enqueued(pipeline_t *p, size_t count, size_t bytes)
+{
+	size_t depth=atomic_fetch_add_explicit(&p->depth,count,memory_order_relaxed)+count;
+
+	atomic_fetch_add_explicit(&p->produced,count,memory_order_relaxed);
+	atomic_fetch_add_explicit(&p->produced_bytes,bytes,memory_order_relaxed);
+	if(depth>=p->config.high_watermark&&!atomic_load_explicit(&p->throttled,memory_order_relaxed))
+	{
+		atomic_store(&p->throttled,1);
+		/* readers may have drained everything before the flag was visible */
+		if(atomic_load(&p->depth)<=p->config.low_watermark&&atomic_exchange(&p->throttled,0))
+			pipeline_wake(p);
+	}
+}
+
+void pipeline_dropped(pipeline_t *p, size_t count)
+{
+	atomic_fetch_add_explicit(&p->dropped,count,memory_order_relaxed);
+}
+
+void pipeline_processed(pipeline_t *p, size_t count, size_t bytes)
+{
+	size_t depth=atomic_fetch_sub_explicit(&p->depth,count,memory_order_relaxed)-count;
+
+	atomic_fetch_add_explicit(&p->processed,count,memory_order_relaxed);
+	atomic_fetch_add_explicit(&p->processed_bytes,bytes,memory_order_relaxed);
+	/* hysteresis: only resume producers once back at the low watermark */
+	if(depth<=p->config.low_watermark&&atomic_load_explicit(&p->throttled,memory_order_relaxed))
+	{
+		if(atomic_exchange(&p->throttled,0))
+			pipeline_wake(p);
+	}
+}
+
+void pipeline_stop(pipeline_t *p)
+{
+	if(!atomic_exchange(&p->running,0))
+		return;
+	p->stop_ns=pipeline_now_ns();
+	pthread_mutex_lock(&p->wait_lock);
+	pthread_cond_broadcast(&p->resume);
+	pthread_mutex_unlock(&p->wait_lock);
+}
+
+void pipeline_report(pipeline_t *p, FILE *out)
+{
+	uint64_t end_ns=pipeline_now_ns();
+	double seconds=(double)(end_ns-p->start_ns)/1e9;
+	uint64_t processed=atomic_load(&p->processed);
+	uint64_t bytes=atomic_load(&p->processed_bytes);
+
+	if(seconds<=0)
+		seconds=1e-9;
+	fprintf(out,"@pipeline_report, produced %lu (%lu bytes) processed %lu (%lu bytes) dropped %lu throttled %lu times \n",
+		(unsigned long)atomic_load(&p->produced),(unsigned long)atomic_load(&p->produced_bytes),
+		(unsigned long)processed,(unsigned long)bytes,
+		(unsigned long)atomic_load(&p->dropped),(unsigned long)atomic_load(&p->throttle_waits));
+	fprintf(out,"@pipeline_report, %.3f s, %.0f msgs/s, %.3f MB/s \n",
+		seconds,(double)processed/seconds,(double)bytes/seconds/1e6);
+	if(p->stop_ns!=0)
+		fprintf(out,"@pipeline_report, drained in %.3f ms after stop \n",(double)(end_ns-p->stop_ns)/1e6);
+}
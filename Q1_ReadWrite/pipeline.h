@@ -0,0 +1,74 @@
+#ifndef Q1_PIPELINE_H
+#define Q1_PIPELINE_H
+
+/*
+Flow control and shutdown for the writer/reader pipeline.
+
+Producers ask pipeline_admit before reading a batch. Once the number of
+queued-but-unprocessed messages reaches high_watermark the pipeline is
+throttled until readers bring it back down to low_watermark; meanwhile
+producers either sleep or, with drop_when_full, read and discard their
+batch so the source keeps moving. pipeline_stop releases every blocked
+producer and makes pipeline_admit refuse further work, so the caller can
+join the producers, drain the readers and call pipeline_report.
+*/
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#define PIPELINE_ADMIT 0
+#define PIPELINE_DROP  1
+#define PIPELINE_STOP  2
+#define PIPELINE_THROTTLED 3
+
+typedef struct pipeline_config {
+	size_t high_watermark;
+	size_t low_watermark;
+	int drop_when_full;
+} pipeline_config_t;
+
+typedef struct pipeline {
+	pipeline_config_t config;
+	_Alignas(64) atomic_size_t depth;
+	atomic_int throttled;
+	atomic_int running;
+
+	_Alignas(64) atomic_uint_fast64_t produced;
+	atomic_uint_fast64_t produced_bytes;
+	atomic_uint_fast64_t dropped;
+	atomic_uint_fast64_t throttle_waits;
+	_Alignas(64) atomic_uint_fast64_t processed;
+	atomic_uint_fast64_t processed_bytes;
+
+	pthread_mutex_t wait_lock;
+	pthread_cond_t resume;
+	atomic_int waiting;
+	uint64_t start_ns;
+	uint64_t stop_ns;
+} pipeline_t;
+
+int pipeline_init(pipeline_t *p, const pipeline_config_t *config);
+void pipeline_destroy(pipeline_t *p);
+
+/* PIPELINE_ADMIT, PIPELINE_DROP (read and discard) or PIPELINE_STOP */
+int pipeline_admit(pipeline_t *p);
+/* the same without sleeping: PIPELINE_THROTTLED where pipeline_admit would wait */
+int pipeline_try_admit(pipeline_t *p);
+int pipeline_throttled(pipeline_t *p);
+/* producers: count messages / bytes are about to be queued (call before
+publishing so readers never see depth go below zero), or were discarded */
+void pipeline_enqueued(pipeline_t *p, size_t count, size_t bytes);
+void pipeline_dropped(pipeline_t *p, size_t count);
+/* readers: count messages / bytes were processed */
+void pipeline_processed(pipeline_t *p, size_t count, size_t bytes);
+
+int pipeline_running(pipeline_t *p);
+void pipeline_stop(pipeline_t *p);
+
+/* totals and throughput since pipeline_init, call after the drain */
+void pipeline_report(pipeline_t *p, FILE *out);
+
+#endif
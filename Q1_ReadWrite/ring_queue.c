@@ -0,0 +1,344 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+#include "ring_queue.h"
+
+#define RQ_SPIN_TRIES 64
+
+int ring_queue_init(ring_queue_t *q, size_t capacity)
+{
+	size_t size=2;
+	size_t i;
+
+	while(size<capacity)
+	{
+		size<<=1;
+	}
+	q->slots=(rq_slot_t *)aligned_alloc(RQ_CACHE_LINE,sizeof(rq_slot_t)*size);
+	if(q->slots==NULL)
+	{
+		printf("@ring_queue_init, error occurs for slots==NULL \n");
+		return -1;
+	}
+	for(i=0;i<size;i++)
+	{
+		atomic_init(&q->slots[i].seq,i);
+		q->slots[i].data=NULL;
+	}
+	q->mask=size-1;
+	atomic_init(&q->enqueue_pos,0);
+	atomic_init(&q->dequeue_pos,0);
+
+	pthread_mutex_init(&q->wait_lock,NULL);
+	pthread_cond_init(&q->not_empty,NULL);
+	pthread_cond_init(&q->not_full,NULL);
+	atomic_init(&q->waiting_readers,0);
+	atomic_init(&q->waiting_writers,0);
+	return 0;
+}
+
+void ring_queue_destroy(ring_queue_t *q)
+{
+	pthread_cond_destroy(&q->not_full);
+	pthread_cond_destroy(&q->not_empty);
+	pthread_mutex_destroy(&q->wait_lock);
+	free(q->slots);
+	q->slots=NULL;
+}
+
+/* wake blocked peers for count new items/slots, only paying for the mutex when someone waits */
+static void ring_queue_wake(ring_queue_t *q, atomic_int *waiting, pthread_cond_t *cond, size_t count)
+{
+	atomic_thread_fence(memory_order_seq_cst);
+	if(atomic_load_explicit(waiting,memory_order_relaxed)>0)
+	{
+		pthread_mutex_lock(&q->wait_lock);
+		if(count>1)
+			pthread_cond_broadcast(cond);
+		else
+			pthread_cond_signal(cond);
+		pthread_mutex_unlock(&q->wait_lock);
+	}
+}
+
+static int rq_claim_push(ring_queue_t *q, void *data)
+{
+	rq_slot_t *slot;
+	size_t pos=atomic_load_explicit(&q->enqueue_pos,memory_order_relaxed);
+	size_t seq;
+	long diff;
+
+	while(1)
+	{
+		slot=&q->slots[pos&q->mask];
+		seq=atomic_load_explicit(&slot->seq,memory_order_acquire);
+		diff=(long)seq-(long)pos;
+		if(diff==0)
+		{
+			if(atomic_compare_exchange_weak_explicit(&q->enqueue_pos,&pos,pos+1,
+				memory_order_relaxed,memory_order_relaxed))
+			{
+				break;
+			}
+		}else if(diff<0){
+			/* slot still owned by a consumer one lap behind: full */
+			return -1;
+		}else{
+			pos=atomic_load_explicit(&q->enqueue_pos,memory_order_relaxed);
+		}
+	}
+	slot->data=data;
+	atomic_store_explicit(&slot->seq,pos+1,memory_order_release);
+	return 0;
+}
+
+static int rq_claim_pop(ring_queue_t *q, void **data)
+{
+	rq_slot_t *slot;
+	size_t pos=atomic_load_explicit(&q->dequeue_pos,memory_order_relaxed);
+	size_t seq;
+	long diff;
+
+	while(1)
+	{
+		slot=&q->slots[pos&q->mask];
+		seq=atomic_load_explicit(&slot->seq,memory_order_acquire);
+		diff=(long)seq-(long)(pos+1);
+		if(diff==0)
+		{
+			if(atomic_compare_exchange_weak_explicit(&q->dequeue_pos,&pos,pos+1,
+				memory_order_relaxed,memory_order_relaxed))
+			{
+				break;
+			}
+		}else if(diff<0){
+			/* producer has not filled this slot yet: empty */
+			return -1;
+		}else{
+			pos=atomic_load_explicit(&q->dequeue_pos,memory_order_relaxed);
+		}
+	}
+	*data=slot->data;
+	atomic_store_explicit(&slot->seq,pos+q->mask+1,memory_order_release);
+	return 0;
+}
+
+/*
+Batch claims scan forward from the current position for up to max slots in
+the wanted state and take them all with one CAS. A slot found ready can
+only be taken by a peer that also moves the position, which makes our CAS
+fail and rescan.
+*/
+static size_t rq_claim_push_batch(ring_queue_t *q, void **items, size_t count)
+{
+	size_t pos=atomic_load_explicit(&q->enqueue_pos,memory_order_relaxed);
+	size_t n;
+	size_t i;
+
+	while(1)
+	{
+		for(n=0;n<count&&n<=q->mask;n++)
+		{
+			rq_slot_t *slot=&q->slots[(pos+n)&q->mask];
+			if(atomic_load_explicit(&slot->seq,memory_order_acquire)!=pos+n)
+				break;
+		}
+		if(n==0)
+		{
+			size_t now=atomic_load_explicit(&q->enqueue_pos,memory_order_relaxed);
+			if(now==pos)
+				return 0;
+			pos=now;
+			continue;
+		}
+		if(atomic_compare_exchange_weak_explicit(&q->enqueue_pos,&pos,pos+n,
+			memory_order_relaxed,memory_order_relaxed))
+			break;
+	}
+	for(i=0;i<n;i++)
+	{
+		rq_slot_t *slot=&q->slots[(pos+i)&q->mask];
+		slot->data=items[i];
+		atomic_store_explicit(&slot->seq,pos+i+1,memory_order_release);
+	}
+	return n;
+}
+
+static size_t rq_claim_pop_batch(ring_queue_t *q, void **items, size_t max)
+{
+	size_t pos=atomic_load_explicit(&q->dequeue_pos,memory_order_relaxed);
+	size_t n;
+	size_t i;
+
+	while(1)
+	{
+		for(n=0;n<max&&n<=q->mask;n++)
+		{
+			rq_slot_t *slot=&q->slots[(pos+n)&q->mask];
+			if(atomic_load_explicit(&slot->seq,memory_order_acquire)!=pos+n+1)
+				break;
+		}
+		if(n==0)
+		{
+			size_t now=atomic_load_explicit(&q->dequeue_pos,memory_order_relaxed);
+			if(now==pos)
+				return 0;
+			pos=now;
+			continue;
+		}
+		if(atomic_compare_exchange_weak_explicit(&q->dequeue_pos,&pos,pos+n,
+			memory_order_relaxed,memory_order_relaxed))
+			break;
+	}
+	for(i=0;i<n;i++)
+	{
+		rq_slot_t *slot=&q->slots[(pos+i)&q->mask];
+		items[i]=slot->data;
+		atomic_store_explicit(&slot->seq,pos+i+q->mask+1,memory_order_release);
+	}
+	return n;
+}
+
+int ring_queue_try_push(ring_queue_t *q, void *data)
+{
+	if(rq_claim_push(q,data)!=0)
+		return -1;
+	ring_queue_wake(q,&q->waiting_readers,&q->not_empty,1);
+	return 0;
+}
+
+int ring_queue_try_pop(ring_queue_t *q, void **data)
+{
+	if(rq_claim_pop(q,data)!=0)
+		return -1;
+	ring_queue_wake(q,&q->waiting_writers,&q->not_full,1);
+	return 0;
+}
+
+/*
+A waiter registers itself in waiting_* before its last try, and the other
+side fences before reading waiting_*, so either the retry sees the new
+item/slot or the other side sees the waiter and signals under wait_lock.
+The retries use the rq_claim_* helpers since wait_lock is already held;
+the peer is woken after it is dropped.
+*/
+void ring_queue_push(ring_queue_t *q, void *data)
+{
+	int i;
+
+	for(i=0;i<RQ_SPIN_TRIES;i++)
+	{
+		if(ring_queue_try_push(q,data)==0)
+			return;
+		sched_yield();
+	}
+	pthread_mutex_lock(&q->wait_lock);
+	atomic_fetch_add(&q->waiting_writers,1);
+	while(rq_claim_push(q,data)!=0)
+	{
+		pthread_cond_wait(&q->not_full,&q->wait_lock);
+	}
+	atomic_fetch_sub(&q->waiting_writers,1);
+	pthread_mutex_unlock(&q->wait_lock);
+	ring_queue_wake(q,&q->waiting_readers,&q->not_empty,1);
+}
+
+void *ring_queue_pop(ring_queue_t *q)
+{
+	void *data=NULL;
+	int i;
+
+	for(i=0;i<RQ_SPIN_TRIES;i++)
+	{
+		if(ring_queue_try_pop(q,&data)==0)
+			return data;
+		sched_yield();
+	}
+	pthread_mutex_lock(&q->wait_lock);
+	atomic_fetch_add(&q->waiting_readers,1);
+	while(rq_claim_pop(q,&data)!=0)
+	{
+		pthread_cond_wait(&q->not_empty,&q->wait_lock);
+	}
+	atomic_fetch_sub(&q->waiting_readers,1);
+	pthread_mutex_unlock(&q->wait_lock);
+	ring_queue_wake(q,&q->waiting_writers,&q->not_full,1);
+	return data;
+}
+
+size_t ring_queue_size(ring_queue_t *q)
+{
+	size_t tail=atomic_load_explicit(&q->enqueue_pos,memory_order_relaxed);
+	size_t head=atomic_load_explicit(&q->dequeue_pos,memory_order_relaxed);
+
+	return tail>head ? tail-head : 0;
+}
+
+size_t ring_queue_try_enqueue_batch(ring_queue_t *q, void **items, size_t count)
+{
+	size_t n=rq_claim_push_batch(q,items,count);
+
+	if(n!=0)
+		ring_queue_wake(q,&q->waiting_readers,&q->not_empty,n);
+	return n;
+}
+
+size_t ring_queue_try_dequeue_batch(ring_queue_t *q, void **items, size_t max)
+{
+	size_t n=rq_claim_pop_batch(q,items,max);
+
+	if(n!=0)
+		ring_queue_wake(q,&q->waiting_writers,&q->not_full,n);
+	return n;
+}
+
+void ring_queue_enqueue_batch(ring_queue_t *q, void **items, size_t count)
+{
+	size_t done=0;
+	size_t n;
+	int i;
+
+	for(i=0;i<RQ_SPIN_TRIES&&done<count;i++)
+	{
+		done+=ring_queue_try_enqueue_batch(q,items+done,count-done);
+		if(done<count)
+			sched_yield();
+	}
+	while(done<count)
+	{
+		pthread_mutex_lock(&q->wait_lock);
+		atomic_fetch_add(&q->waiting_writers,1);
+		while((n=rq_claim_push_batch(q,items+done,count-done))==0)
+		{
+			pthread_cond_wait(&q->not_full,&q->wait_lock);
+		}
+		atomic_fetch_sub(&q->waiting_writers,1);
+		pthread_mutex_unlock(&q->wait_lock);
+		ring_queue_wake(q,&q->waiting_readers,&q->not_empty,n);
+		done+=n;
+	}
+}
+
+size_t ring_queue_dequeue_batch(ring_queue_t *q, void **items, size_t max)
+{
+	size_t n;
+	int i;
+
+	for(i=0;i<RQ_SPIN_TRIES;i++)
+	{
+		n=ring_queue_try_dequeue_batch(q,items,max);
+		if(n!=0)
+			return n;
+		sched_yield();
+	}
+	pthread_mutex_lock(&q->wait_lock);
+	atomic_fetch_add(&q->waiting_readers,1);
+	while((n=rq_claim_pop_batch(q,items,max))==0)
+	{
+		pthread_cond_wait(&q->not_empty,&q->wait_lock);
+	}
+	atomic_fetch_sub(&q->waiting_readers,1);
+	pthread_mutex_unlock(&q->wait_lock);
+	ring_queue_wake(q,&q->waiting_writers,&q->not_full,n);
+	return n;
+}
@@ -0,0 +1,70 @@
+#ifndef Q1_RING_QUEUE_H
+#define Q1_RING_QUEUE_H
+
+/*
+Bounded multi-producer/multi-consumer ring used to hand node_t pointers
+from writer_thread to reader_thread.
+
+Each slot carries a sequence number (Vyukov style):
+  seq==pos      slot is free for the producer that claims pos
+  seq==pos+1    slot holds data for the consumer that claims pos
+so producers and consumers only contend on their own position counter,
+never on a shared lock.
+
+The blocking calls spin/try first and only fall back to a mutex+cond when
+the ring is really empty (readers) or really full (writers). That slow
+path replaces the old data_count semaphore.
+*/
+
+#include <stddef.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#define RQ_CACHE_LINE 64
+
+typedef struct rq_slot {
+	_Alignas(RQ_CACHE_LINE) atomic_size_t seq;
+	void *data;
+} rq_slot_t;
+
+typedef struct ring_queue {
+	_Alignas(RQ_CACHE_LINE) atomic_size_t enqueue_pos;
+	_Alignas(RQ_CACHE_LINE) atomic_size_t dequeue_pos;
+	_Alignas(RQ_CACHE_LINE) rq_slot_t *slots;
+	size_t mask;
+
+	/* slow path for the blocking calls only */
+	pthread_mutex_t wait_lock;
+	pthread_cond_t not_empty;
+	pthread_cond_t not_full;
+	atomic_int waiting_readers;
+	atomic_int waiting_writers;
+} ring_queue_t;
+
+/* capacity is rounded up to a power of two; returns 0 or -1 */
+int ring_queue_init(ring_queue_t *q, size_t capacity);
+void ring_queue_destroy(ring_queue_t *q);
+
+/* non-blocking: return 0 on success, -1 when full/empty */
+int ring_queue_try_push(ring_queue_t *q, void *data);
+int ring_queue_try_pop(ring_queue_t *q, void **data);
+
+/* blocking: wait while the ring is full/empty */
+void ring_queue_push(ring_queue_t *q, void *data);
+void *ring_queue_pop(ring_queue_t *q);
+
+/*
+batch variants move up to count/max items with a single position CAS
+try_*: return how many were moved, possibly 0
+enqueue_batch: waits until all count items are queued
+dequeue_batch: waits for at least one item, returns how many were taken
+*/
+size_t ring_queue_try_enqueue_batch(ring_queue_t *q, void **items, size_t count);
+size_t ring_queue_try_dequeue_batch(ring_queue_t *q, void **items, size_t max);
+void ring_queue_enqueue_batch(ring_queue_t *q, void **items, size_t count);
+size_t ring_queue_dequeue_batch(ring_queue_t *q, void **items, size_t max);
+
+/* approximate number of queued items */
+size_t ring_queue_size(ring_queue_t *q);
+
+#endif
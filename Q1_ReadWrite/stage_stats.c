@@ -0,0 +1,201 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "stage_stats.h"
+
+typedef struct stage_block {
+	atomic_uint_fast64_t count;
+	atomic_uint_fast64_t items;
+	atomic_uint_fast64_t sum_ns;
+	atomic_uint_fast64_t max_ns;
+	atomic_uint_fast64_t buckets[STATS_BUCKETS];
+} stage_block_t;
+
+/* one per thread that ever recorded; kept after the thread exits */
+typedef struct thread_stats {
+	stage_block_t stages[STAGE_COUNT];
+	struct thread_stats *next;
+} thread_stats_t;
+
+typedef struct merged_stage {
+	uint64_t count;
+	uint64_t items;
+	uint64_t sum_ns;
+	uint64_t max_ns;
+	uint64_t buckets[STATS_BUCKETS];
+} merged_stage_t;
+
+static const char *stage_names[STAGE_COUNT]={
+	"source_read",
+	"source_lock_wait",
+	"source_lock_hold",
+	"throttle_wait",
+	"enqueue",
+	"dequeue_wait",
+	"process",
+};
+
+static pthread_mutex_t registry_lock=PTHREAD_MUTEX_INITIALIZER;
+static thread_stats_t *registry=NULL;
+static _Thread_local thread_stats_t *mine=NULL;
+
+uint64_t stage_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint64_t)ts.tv_sec*1000000000u+(uint64_t)ts.tv_nsec;
+}
+
+static int bucket_of(uint64_t ns)
+{
+	int msb;
+
+	if(ns<(1u<<STATS_SUB_BITS))
+		return (int)ns;
+	msb=63-__builtin_clzll(ns);
+	if(msb>=STATS_MAX_BITS)
+		return STATS_BUCKETS-1;
+	return ((msb-STATS_SUB_BITS+1)<<STATS_SUB_BITS)+
+		(int)((ns>>(msb-STATS_SUB_BITS))&((1u<<STATS_SUB_BITS)-1));
+}
+
+/* lowest value that falls in bucket b */
+static uint64_t bucket_floor(int b)
+{
+	int major=b>>STATS_SUB_BITS;
+	int minor=b&((1<<STATS_SUB_BITS)-1);
+
+	if(major==0)
+		return (uint64_t)minor;
+	return (uint64_t)((1<<STATS_SUB_BITS)+minor)<<(major-1);
+}
+
+static thread_stats_t *stats_get(void)
+{
+	if(mine==NULL)
+	{
+		mine=(thread_stats_t *)calloc(1,sizeof(thread_stats_t));
+		if(mine==NULL)
+			return NULL;
+		pthread_mutex_lock(&registry_lock);
+		mine->next=registry;
+		registry=mine;
+		pthread_mutex_unlock(&registry_lock);
+	}
+	return mine;
+}
+
+/* only the owning thread writes, so load+store is enough */
+static void stat_add(atomic_uint_fast64_t *a, uint64_t v)
+{
+	atomic_store_explicit(a,atomic_load_explicit(a,memory_order_relaxed)+v,memory_order_relaxed);
+}
+
+void stage_stats_record(int stage, uint64_t ns, uint64_t items)
+{
+	thread_stats_t *ts=stats_get();
+	stage_block_t *b;
+
+	if(ts==NULL||stage<0||stage>=STAGE_COUNT)
+		return;
+	b=&ts->stages[stage];
+	stat_add(&b->count,1);
+	stat_add(&b->items,items);
+	stat_add(&b->sum_ns,ns);
+	if(ns>atomic_load_explicit(&b->max_ns,memory_order_relaxed))
+		atomic_store_explicit(&b->max_ns,ns,memory_order_relaxed);
+	stat_add(&b->buckets[bucket_of(ns)],1);
+}
+
+static void stats_merge(merged_stage_t *out)
+{
+	thread_stats_t *ts;
+	int s;
+	int i;
+
+	memset(out,0,sizeof(merged_stage_t)*STAGE_COUNT);
+	pthread_mutex_lock(&registry_lock);
+	for(ts=registry;ts!=NULL;ts=ts->next)
+	{
+		for(s=0;s<STAGE_COUNT;s++)
+		{
+			stage_block_t *b=&ts->stages[s];
+			uint64_t max=atomic_load_explicit(&b->max_ns,memory_order_relaxed);
+
+			out[s].count+=atomic_load_explicit(&b->count,memory_order_relaxed);
+			out[s].items+=atomic_load_explicit(&b->items,memory_order_relaxed);
+			out[s].sum_ns+=atomic_load_explicit(&b->sum_ns,memory_order_relaxed);
+			if(max>out[s].max_ns)
+				out[s].max_ns=max;
+			for(i=0;i<STATS_BUCKETS;i++)
+			{
+				out[s].buckets[i]+=atomic_load_explicit(&b->buckets[i],memory_order_relaxed);
+			}
+		}
+	}
+	pthread_mutex_unlock(&registry_lock);
+}
+
+static uint64_t stats_percentile(const merged_stage_t *m, double p)
+{
+	uint64_t total=0;
+	uint64_t want;
+	int i;
+
+	for(i=0;i<STATS_BUCKETS;i++)
+	{
+		total+=m->buckets[i];
+	}
+	if(total==0)
+		return 0;
+	want=(uint64_t)(p*(double)total);
+	if(want>=total)
+		want=total-1;
+	total=0;
+	for(i=0;i<STATS_BUCKETS;i++)
+	{
+		total+=m->buckets[i];
+		if(total>want)
+			return bucket_floor(i);
+	}
+	return m->max_ns;
+}
+
+void stage_stats_dump(FILE *out, int json)
+{
+	merged_stage_t *merged=(merged_stage_t *)malloc(sizeof(merged_stage_t)*STAGE_COUNT);
+	int s;
+
+	if(merged==NULL)
+		return;
+	stats_merge(merged);
+	if(json)
+		fprintf(out,"{\"stage_stats_enabled\":%d",STAGE_STATS);
+	else if(!STAGE_STATS)
+		fprintf(out,"@stage_stats, compiled out (STAGE_STATS=0) \n");
+	for(s=0;s<STAGE_COUNT;s++)
+	{
+		merged_stage_t *m=&merged[s];
+		double mean=m->count ? (double)m->sum_ns/(double)m->count : 0;
+
+		if(json)
+		{
+			fprintf(out,",\"%s\":{\"count\":%lu,\"items\":%lu,\"mean_ns\":%.0f,\"p50_ns\":%lu,"
+				"\"p99_ns\":%lu,\"p999_ns\":%lu,\"max_ns\":%lu}",
+				stage_names[s],(unsigned long)m->count,(unsigned long)m->items,mean,
+				(unsigned long)stats_percentile(m,0.50),(unsigned long)stats_percentile(m,0.99),
+				(unsigned long)stats_percentile(m,0.999),(unsigned long)m->max_ns);
+		}else if(m->count!=0){
+			fprintf(out,"@stage_stats, %-16s count %lu items %lu mean %.0f ns p50 %lu p99 %lu p999 %lu max %lu ns \n",
+				stage_names[s],(unsigned long)m->count,(unsigned long)m->items,mean,
+				(unsigned long)stats_percentile(m,0.50),(unsigned long)stats_percentile(m,0.99),
+				(unsigned long)stats_percentile(m,0.999),(unsigned long)m->max_ns);
+		}
+	}
+	if(json)
+		fprintf(out,"}\n");
+	fflush(out);
+	free(merged);
+}
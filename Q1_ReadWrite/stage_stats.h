@@ -0,0 +1,65 @@
+#ifndef Q1_STAGE_STATS_H
+#define Q1_STAGE_STATS_H
+
+/*
+Per-stage counters and latency histograms for the writer/reader pipeline.
+
+Every thread records into its own block (registered once, never shared
+for writing), so the hot path is a clock read and a few relaxed stores.
+stage_stats_dump merges all blocks on demand and prints count, items,
+mean, p50/p99/p999 and max per stage as text or JSON.
+
+Histograms are log-linear in the HDR style: values below 2^STATS_SUB_BITS
+ns are exact, above that each power of two is split into 2^STATS_SUB_BITS
+buckets (about 6% resolution), up to 2^STATS_MAX_BITS ns.
+
+Built with STAGE_STATS=0 (the default when NDEBUG is defined) the
+STAGE_* macros expand to nothing and no clock is read.
+
+lock_1 and lock_2 no longer exist (ring_queue/steal_sched and async_log
+replaced them); their waits show up as dequeue_wait and enqueue. The
+lock_3 role is device_source's stream lock, timed as source_lock_wait
+and source_lock_hold.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#ifndef STAGE_STATS
+#ifdef NDEBUG
+#define STAGE_STATS 0
+#else
+#define STAGE_STATS 1
+#endif
+#endif
+
+#define STATS_SUB_BITS 4
+#define STATS_MAX_BITS 40
+#define STATS_BUCKETS ((STATS_MAX_BITS-STATS_SUB_BITS+1)<<STATS_SUB_BITS)
+
+enum stage {
+	STAGE_SOURCE_READ,
+	STAGE_SOURCE_LOCK_WAIT,
+	STAGE_SOURCE_LOCK_HOLD,
+	STAGE_THROTTLE_WAIT,
+	STAGE_ENQUEUE,
+	STAGE_DEQUEUE_WAIT,
+	STAGE_PROCESS,
+	STAGE_COUNT
+};
+
+uint64_t stage_now_ns(void);
+void stage_stats_record(int stage, uint64_t ns, uint64_t items);
+/* merge every thread's block and print it; json!=0 for one JSON object */
+void stage_stats_dump(FILE *out, int json);
+
+#if STAGE_STATS
+#define STAGE_TIMER(name) uint64_t name=stage_now_ns()
+#define STAGE_RECORD(stage,start,items) stage_stats_record((stage),stage_now_ns()-(start),(items))
+#else
+#define STAGE_TIMER(name) do{}while(0)
+#define STAGE_RECORD(stage,start,items) do{}while(0)
+#endif
+
+#endif
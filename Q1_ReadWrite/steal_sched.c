@@ -0,0 +1,268 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "steal_sched.h"
+
+/* how long an empty ring waits for its producers before its owner steals */
+#define STEAL_DELAY_NS 1000000u
+/* a sleeping consumer rescans this often, in case a nudge was missed */
+#define STEAL_IDLE_NS 10000000u
+
+int steal_sched_init(steal_sched_t *s, int nconsumers, size_t capacity)
+{
+	pthread_condattr_t attr;
+	int i;
+
+	if(nconsumers<=0)
+		return -1;
+	s->consumers=(steal_consumer_t *)aligned_alloc(64,sizeof(steal_consumer_t)*nconsumers);
+	if(s->consumers==NULL)
+	{
+		printf("@steal_sched_init, error occurs for consumers==NULL \n");
+		return -1;
+	}
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr,CLOCK_MONOTONIC);
+	for(i=0;i<nconsumers;i++)
+	{
+		steal_consumer_t *c=&s->consumers[i];
+
+		if(ring_queue_init(&c->queue,capacity)<0)
+		{
+			while(--i>=0)
+			{
+				ring_queue_destroy(&s->consumers[i].queue);
+				pthread_cond_destroy(&s->consumers[i].cond);
+				pthread_mutex_destroy(&s->consumers[i].lock);
+			}
+			free(s->consumers);
+			pthread_condattr_destroy(&attr);
+			return -1;
+		}
+		atomic_init(&c->sleeping,0);
+		c->nudged=0;
+		pthread_mutex_init(&c->lock,NULL);
+		pthread_cond_init(&c->cond,&attr);
+		c->stats=(steal_stats_t){0};
+	}
+	pthread_condattr_destroy(&attr);
+	s->nconsumers=nconsumers;
+	atomic_init(&s->closed,0);
+	s->steal_delay_ns=STEAL_DELAY_NS;
+	s->steal_backlog=capacity/2>0 ? capacity/2 : 1;
+	return 0;
+}
+
+void steal_sched_destroy(steal_sched_t *s)
+{
+	int i;
+
+	for(i=0;i<s->nconsumers;i++)
+	{
+		ring_queue_destroy(&s->consumers[i].queue);
+		pthread_cond_destroy(&s->consumers[i].cond);
+		pthread_mutex_destroy(&s->consumers[i].lock);
+	}
+	free(s->consumers);
+	s->consumers=NULL;
+}
+
+/* wake c if it sleeps; the caller has published its items before */
+static int consumer_wake(steal_consumer_t *c, int nudge)
+{
+	atomic_thread_fence(memory_order_seq_cst);
+	if(!atomic_load_explicit(&c->sleeping,memory_order_relaxed))
+		return 0;
+	pthread_mutex_lock(&c->lock);
+	if(nudge)
+		c->nudged=1;
+	pthread_cond_signal(&c->cond);
+	pthread_mutex_unlock(&c->lock);
+	return 1;
+}
+
+/* the owner of ring is busy and behind: call in one sleeping peer */
+static void sched_nudge_thief(steal_sched_t *s, int ring)
+{
+	int k;
+
+	for(k=1;k<s->nconsumers;k++)
+	{
+		if(consumer_wake(&s->consumers[(ring+k)%s->nconsumers],1))
+			return;
+	}
+}
+
+void steal_sched_push_batch(steal_sched_t *s, int hint, void **items, size_t count)
+{
+	static _Thread_local unsigned cursor;
+	static _Thread_local int cursor_set;
+	size_t done=0;
+	int target;
+	int k;
+
+	if(hint>=0)
+	{
+		target=hint%s->nconsumers;
+	}else{
+		if(!cursor_set)
+		{
+			/* spread producers over different starting rings */
+			cursor=(unsigned)((uintptr_t)&cursor>>6);
+			cursor_set=1;
+		}
+		target=(int)(cursor++%(unsigned)s->nconsumers);
+	}
+	for(k=0;k<s->nconsumers&&done<count;k++)
+	{
+		int ring=(target+k)%s->nconsumers;
+		steal_consumer_t *c=&s->consumers[ring];
+		size_t n=ring_queue_try_enqueue_batch(&c->queue,items+done,count-done);
+
+		if(n==0)
+			continue;
+		done+=n;
+		if(!consumer_wake(c,0)&&ring_queue_size(&c->queue)>=s->steal_backlog)
+			sched_nudge_thief(s,ring);
+	}
+	if(done<count)
+	{
+		/* every ring is full: wait for the target's owner or a thief */
+		ring_queue_enqueue_batch(&s->consumers[target].queue,items+done,count-done);
+		consumer_wake(&s->consumers[target],0);
+	}
+}
+
+/* about half of a peer's backlog, starting with the neighbour; no locks */
+static size_t sched_steal(steal_sched_t *s, int id, void **items, size_t max)
+{
+	steal_consumer_t *self=&s->consumers[id];
+	size_t n;
+	int k;
+
+	for(k=1;k<s->nconsumers;k++)
+	{
+		ring_queue_t *peer=&s->consumers[(id+k)%s->nconsumers].queue;
+		size_t want=ring_queue_size(peer)/2;
+
+		if(want==0)
+			want=1;
+		if(want>max)
+			want=max;
+		n=ring_queue_try_dequeue_batch(peer,items,want);
+		if(n!=0)
+		{
+			self->stats.steals++;
+			self->stats.stolen_items+=n;
+			return n;
+		}
+	}
+	return 0;
+}
+
+static uint64_t sched_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint64_t)ts.tv_sec*1000000000u+(uint64_t)ts.tv_nsec;
+}
+
+/* sleep on the own wait object until the ring has items, a nudge, close or ns; 1 if nudged */
+static int consumer_wait(steal_sched_t *s, steal_consumer_t *self, uint64_t ns)
+{
+	uint64_t start=sched_now_ns();
+	uint64_t deadline=start+ns;
+	struct timespec ts;
+	int nudged;
+
+	ts.tv_sec=(time_t)(deadline/1000000000u);
+	ts.tv_nsec=(long)(deadline%1000000000u);
+	pthread_mutex_lock(&self->lock);
+	atomic_store(&self->sleeping,1);
+	/* a push after this sees the flag; one before it shows in the size */
+	atomic_thread_fence(memory_order_seq_cst);
+	if(ring_queue_size(&self->queue)==0&&!self->nudged&&!atomic_load(&s->closed))
+	{
+		pthread_cond_timedwait(&self->cond,&self->lock,&ts);
+		self->stats.idle_waits++;
+		self->stats.idle_ns+=sched_now_ns()-start;
+	}
+	nudged=self->nudged;
+	self->nudged=0;
+	atomic_store(&self->sleeping,0);
+	pthread_mutex_unlock(&self->lock);
+	return nudged;
+}
+
+size_t steal_sched_pop_batch(steal_sched_t *s, int id, void **items, size_t max)
+{
+	steal_consumer_t *self=&s->consumers[id];
+	int nudged=0;
+	size_t n;
+
+	while(1)
+	{
+		n=ring_queue_try_dequeue_batch(&self->queue,items,max);
+		if(n!=0)
+		{
+			self->stats.local_hits++;
+			return n;
+		}
+		/* give the own producers a moment before taking a peer's work, unless called in to steal */
+		if(!nudged&&!atomic_load(&s->closed))
+		{
+			nudged=consumer_wait(s,self,s->steal_delay_ns);
+			n=ring_queue_try_dequeue_batch(&self->queue,items,max);
+			if(n!=0)
+			{
+				self->stats.local_hits++;
+				return n;
+			}
+		}
+		n=sched_steal(s,id,items,max);
+		if(n!=0)
+			return n;
+		/* every ring looked empty: done once closed, else sleep until pushed to or nudged */
+		if(atomic_load(&s->closed))
+		{
+			n=ring_queue_try_dequeue_batch(&self->queue,items,max);
+			if(n==0)
+				n=sched_steal(s,id,items,max);
+			return n;
+		}
+		nudged=consumer_wait(s,self,STEAL_IDLE_NS);
+	}
+}
+
+void steal_sched_close(steal_sched_t *s)
+{
+	int i;
+
+	atomic_store(&s->closed,1);
+	for(i=0;i<s->nconsumers;i++)
+	{
+		steal_consumer_t *c=&s->consumers[i];
+
+		pthread_mutex_lock(&c->lock);
+		pthread_cond_signal(&c->cond);
+		pthread_mutex_unlock(&c->lock);
+	}
+}
+
+void steal_sched_get_stats(steal_sched_t *s, steal_stats_t *total)
+{
+	int i;
+
+	*total=(steal_stats_t){0};
+	for(i=0;i<s->nconsumers;i++)
+	{
+		steal_stats_t *st=&s->consumers[i].stats;
+
+		total->local_hits+=st->local_hits;
+		total->steals+=st->steals;
+		total->stolen_items+=st->stolen_items;
+		total->idle_waits+=st->idle_waits;
+		total->idle_ns+=st->idle_ns;
+	}
+}
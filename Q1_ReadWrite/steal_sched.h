@@ -0,0 +1,75 @@
+#ifndef Q1_STEAL_SCHED_H
+#define Q1_STEAL_SCHED_H
+
+/*
+Work-stealing distribution of nodes over the reader threads.
+
+Every consumer owns one ring_queue. Producers push whole batches to a
+consumer's ring (round robin per producer thread, or a given one), so the
+N readers no longer share one head/tail pair.
+
+Each consumer also has its own wait object, and a push wakes only the
+owner of the ring it went to (sleeping flag + fence, mutex only when the
+owner sleeps, as ring_queue does for its waiters). A consumer whose ring
+runs empty first waits up to steal_delay_ns for its producers to refill
+it; only if the ring stays empty does it steal about half of a peer's
+backlog, starting with its neighbour, scanning without any lock. With
+nothing to steal it sleeps until its own ring is pushed to. A push that
+leaves a busy owner with steal_backlog items or more also nudges one
+sleeping peer, so a backlog does not wait for the owner alone.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "ring_queue.h"
+
+typedef struct steal_stats {
+	uint64_t local_hits;    /* batches taken from the own ring */
+	uint64_t steals;        /* batches taken from a peer */
+	uint64_t stolen_items;
+	uint64_t idle_waits;    /* times a consumer went to sleep */
+	uint64_t idle_ns;       /* time spent asleep */
+} steal_stats_t;
+
+typedef struct steal_consumer {
+	_Alignas(64) ring_queue_t queue;
+	_Alignas(64) atomic_int sleeping;
+	int nudged;                          /* under lock: a peer has a backlog to steal */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	_Alignas(64) steal_stats_t stats;    /* written by the owner only */
+} steal_consumer_t;
+
+typedef struct steal_sched {
+	steal_consumer_t *consumers;
+	int nconsumers;
+	atomic_int closed;
+	uint64_t steal_delay_ns;             /* own ring empty this long before stealing */
+	size_t steal_backlog;                /* items on a busy owner's ring that call in a thief */
+} steal_sched_t;
+
+/* capacity is per consumer ring; returns 0 or -1 */
+int steal_sched_init(steal_sched_t *s, int nconsumers, size_t capacity);
+void steal_sched_destroy(steal_sched_t *s);
+
+/*
+queue count items on consumer hint's ring (hint<0: round robin), spilling
+to the next rings when it is full and waiting only if all of them are
+*/
+void steal_sched_push_batch(steal_sched_t *s, int hint, void **items, size_t count);
+
+/*
+take up to max items for consumer id, stealing when its own ring is empty;
+waits for work and returns 0 only once the scheduler is closed and empty
+*/
+size_t steal_sched_pop_batch(steal_sched_t *s, int id, void **items, size_t max);
+
+/* wake every consumer; pop_batch returns 0 once all rings are drained */
+void steal_sched_close(steal_sched_t *s);
+
+/* sum of every consumer's counters (read racily, for reporting) */
+void steal_sched_get_stats(steal_sched_t *s, steal_stats_t *total);
+
+#endif
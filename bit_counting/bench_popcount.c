@@ -0,0 +1,340 @@
+/*
+Throughput check for the popcount kernels.
+
+build: gcc -O2 bit_counting/bench_popcount.c bit_counting/popcount.c bit_counting/bitmap.c bit_counting/bitmap_sparse.c -o bench_popcount
+run:   ./bench_popcount [-s bytes] [-r repeats]
+
+Every kernel this CPU supports is first checked against the scalar one on
+odd lengths and misaligned starts, then timed over a random buffer; the
+per-byte counting() loop is timed too for comparison.
+
+The bitmaps are then checked bit by bit on a small bitmap that has a
+sparse, a run-heavy, a random, an empty and a full region: bitmap_rank
+and bitmap_select against a running count, the four fused set-op counts
+against counting each bit, and the compressed form against the dense one
+(test, cardinality, and_count and expanding it back). Finally two bitmaps
+of half the buffer each are intersected: fused (bitmap_op with no
+destination) against writing the result and counting it afterwards, and
+the same count on the first one compressed.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include "popcount.h"
+#include "bitmap.h"
+
+static const char *kernel_names[]={"avx512","avx2","popcnt","table","scalar"};
+
+#define NAME_COUNT (sizeof(kernel_names)/sizeof(kernel_names[0]))
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint64_t)ts.tv_sec*1000000000u+(uint64_t)ts.tv_nsec;
+}
+
+static uint64_t popcount_bytewise(const uint8_t *data, size_t len)
+{
+	uint64_t total=0;
+	size_t i;
+
+	for(i=0;i<len;i++)
+	{
+		total+=(uint64_t)counting(data[i]);
+	}
+	return total;
+}
+
+static int check(popcount_fn fn, const char *name, const uint8_t *data)
+{
+	size_t offset;
+	size_t len;
+
+	for(offset=0;offset<64;offset+=7)
+	{
+		for(len=0;len<1100;len+=(len<300 ? 1 : 37))
+		{
+			if(fn(data+offset,len)!=popcount_scalar(data+offset,len))
+			{
+				printf("@check, error occurs for kernel %s offset %zu length %zu \n",name,offset,len);
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+static void run(popcount_fn fn, const char *name, const uint8_t *data, size_t size, int repeats)
+{
+	uint64_t best=UINT64_MAX;
+	uint64_t bits=0;
+	int r;
+
+	for(r=0;r<repeats;r++)
+	{
+		uint64_t start=now_ns();
+		uint64_t elapsed;
+
+		bits=fn(data,size);
+		elapsed=now_ns()-start;
+		if(elapsed<best)
+			best=elapsed;
+	}
+	printf("%-8s %12lu bits %8.3f ms %8.2f GB/s \n",name,(unsigned long)bits,
+		(double)best/1e6,(double)size/(double)(best ? best : 1));
+}
+
+#define CHECK_CHUNK 65536   /* bits per sparse_bitmap_t container */
+
+/* sparse, runs, random, empty and full regions of CHECK_CHUNK*2 bits each, plus a ragged tail */
+static void fill_regions(bitmap_t *b)
+{
+	size_t i=0;
+
+	for(;i<2*CHECK_CHUNK;i++)
+	{
+		if(rand()%1000==0)
+			bitmap_set(b,i);
+	}
+	while(i<4*CHECK_CHUNK)
+	{
+		size_t len=1+(size_t)(rand()%200);
+
+		for(;len>0&&i<4*CHECK_CHUNK;len--,i++)
+		{
+			bitmap_set(b,i);
+		}
+		i+=1+(size_t)(rand()%300);
+	}
+	for(i=4*CHECK_CHUNK;i<6*CHECK_CHUNK;i++)
+	{
+		if(rand()&1)
+			bitmap_set(b,i);
+	}
+	for(i=8*CHECK_CHUNK;i<b->nbits;i++)
+	{
+		bitmap_set(b,i);
+	}
+}
+
+static int check_bitmap(void)
+{
+	static const char *op_names[]={"and","or","xor","andnot"};
+	static const enum bitmap_op ops[]={BITMAP_AND,BITMAP_OR,BITMAP_XOR,BITMAP_ANDNOT};
+	size_t nbits=10*CHECK_CHUNK+1000;
+	bitmap_t a,b,dst,back;
+	sparse_bitmap_t s;
+	uint64_t expect[4]={0,0,0,0};
+	uint64_t ones=0;
+	size_t types[3]={0,0,0};
+	size_t i;
+	size_t pos;
+	int err=-1;
+
+	if(bitmap_init(&a,nbits)!=0||bitmap_init(&b,nbits)!=0||bitmap_init(&dst,nbits)!=0)
+		return -1;
+	fill_regions(&a);
+	for(i=0;i<nbits;i++)
+	{
+		if(rand()&1)
+			bitmap_set(&b,i);
+	}
+	if(sparse_bitmap_compress(&s,&a)!=0)
+		return -1;
+
+	for(i=0;i<nbits;i++)
+	{
+		int x=bitmap_test(&a,i);
+		int y=bitmap_test(&b,i);
+
+		if(bitmap_rank(&a,i)!=ones)
+		{
+			printf("@check_bitmap, error occurs for rank at %zu \n",i);
+			goto out;
+		}
+		if(x&&(bitmap_select(&a,ones,&pos)!=0||pos!=i))
+		{
+			printf("@check_bitmap, error occurs for select of %lu \n",(unsigned long)ones);
+			goto out;
+		}
+		if(sparse_bitmap_test(&s,i)!=x)
+		{
+			printf("@check_bitmap, error occurs for sparse test at %zu \n",i);
+			goto out;
+		}
+		ones+=(uint64_t)x;
+		expect[0]+=(uint64_t)(x&y);
+		expect[1]+=(uint64_t)(x|y);
+		expect[2]+=(uint64_t)(x^y);
+		expect[3]+=(uint64_t)(x&!y);
+	}
+	if(bitmap_rank(&a,nbits)!=ones||bitmap_select(&a,ones,&pos)!=-1||bitmap_cardinality(&a)!=ones)
+	{
+		printf("@check_bitmap, error occurs for the total of %lu bits \n",(unsigned long)ones);
+		goto out;
+	}
+	for(i=0;i<4;i++)
+	{
+		uint64_t fused=bitmap_op(NULL,&a,&b,ops[i]);
+
+		bitmap_op(&dst,&a,&b,ops[i]);
+		if(fused!=expect[i]||bitmap_cardinality(&dst)!=expect[i])
+		{
+			printf("@check_bitmap, error occurs for %s-count %lu/%lu/%lu \n",op_names[i],(unsigned long)fused,
+				(unsigned long)bitmap_cardinality(&dst),(unsigned long)expect[i]);
+			goto out;
+		}
+	}
+
+	if(sparse_bitmap_cardinality(&s)!=ones||sparse_bitmap_and_count(&s,&b)!=expect[0])
+	{
+		printf("@check_bitmap, error occurs for sparse counts %lu/%lu \n",
+			(unsigned long)sparse_bitmap_cardinality(&s),(unsigned long)sparse_bitmap_and_count(&s,&b));
+		goto out;
+	}
+	if(sparse_bitmap_expand(&s,&back)!=0)
+		goto out;
+	if(memcmp(back.words,a.words,a.nwords*sizeof(uint64_t))!=0)
+	{
+		printf("@check_bitmap, error occurs for the sparse round trip \n");
+		bitmap_destroy(&back);
+		goto out;
+	}
+	bitmap_destroy(&back);
+	for(i=0;i<s.ncontainers;i++)
+	{
+		types[s.containers[i].type]++;
+	}
+	printf("bitmap   rank/select, set-op counts, sparse ok: %zu array %zu run %zu bitmap containers, %zu of %zu bytes \n",
+		types[SPARSE_ARRAY],types[SPARSE_RUN],types[SPARSE_BITMAP],sparse_bitmap_bytes(&s),a.nwords*sizeof(uint64_t));
+	err=0;
+out:
+	sparse_bitmap_destroy(&s);
+	bitmap_destroy(&a);
+	bitmap_destroy(&b);
+	bitmap_destroy(&dst);
+	return err;
+}
+
+static void run_bitmap(const uint8_t *data, size_t size, int repeats)
+{
+	size_t half=size/2/sizeof(uint64_t)*sizeof(uint64_t);
+	bitmap_t a,b,dst;
+	sparse_bitmap_t s;
+	uint64_t fused=UINT64_MAX;
+	uint64_t split=UINT64_MAX;
+	uint64_t sparse=UINT64_MAX;
+	uint64_t bits=0;
+	int r;
+
+	if(bitmap_init(&a,half*8)!=0||bitmap_init(&b,half*8)!=0||bitmap_init(&dst,half*8)!=0)
+		return;
+	memcpy(a.words,data,half);
+	memcpy(b.words,data+half,half);
+	for(r=0;r<repeats;r++)
+	{
+		uint64_t start=now_ns();
+		uint64_t middle;
+		uint64_t stored;
+
+		bits=bitmap_op(NULL,&a,&b,BITMAP_AND);
+		middle=now_ns();
+		bitmap_op(&dst,&a,&b,BITMAP_AND);
+		stored=bitmap_cardinality(&dst);
+		if(middle-start<fused)
+			fused=middle-start;
+		if(now_ns()-middle<split)
+			split=now_ns()-middle;
+		if(stored!=bits)
+			printf("@run_bitmap, error occurs for and-count %lu/%lu \n",(unsigned long)bits,(unsigned long)stored);
+	}
+	printf("and-count %10lu bits fused %8.3f ms, store+count %8.3f ms \n",(unsigned long)bits,
+		(double)fused/1e6,(double)split/1e6);
+	if(sparse_bitmap_compress(&s,&a)==0)
+	{
+		for(r=0;r<repeats;r++)
+		{
+			uint64_t start=now_ns();
+			uint64_t stored=sparse_bitmap_and_count(&s,&b);
+
+			if(now_ns()-start<sparse)
+				sparse=now_ns()-start;
+			if(stored!=bits)
+				printf("@run_bitmap, error occurs for sparse and-count %lu/%lu \n",(unsigned long)bits,(unsigned long)stored);
+		}
+		printf("and-count %10lu bits sparse %8.3f ms, %zu bytes compressed \n",(unsigned long)bits,
+			(double)sparse/1e6,sparse_bitmap_bytes(&s));
+		sparse_bitmap_destroy(&s);
+	}
+	bitmap_destroy(&a);
+	bitmap_destroy(&b);
+	bitmap_destroy(&dst);
+}
+
+int main(int argc, char *argv[])
+{
+	size_t size=64u<<20;
+	int repeats=5;
+	uint8_t *data;
+	size_t i;
+	int opt;
+
+	while((opt=getopt(argc,argv,"s:r:"))!=-1)
+	{
+		switch(opt)
+		{
+		case 's': size=(size_t)strtoull(optarg,NULL,0); break;
+		case 'r': repeats=atoi(optarg); break;
+		default:
+			printf("usage: %s [-s bytes] [-r repeats] \n",argv[0]);
+			return 1;
+		}
+	}
+	if(size<2048)
+		size=2048;
+	if(repeats<1)
+		repeats=1;
+	data=(uint8_t *)malloc(size);
+	if(data==NULL)
+	{
+		printf("@main, error occurs for malloc of %zu bytes \n",size);
+		return 1;
+	}
+	srand(1);
+	for(i=0;i<size;i++)
+	{
+		data[i]=(uint8_t)rand();
+	}
+
+	printf("auto picks %s \n",popcount_kernel_name());
+	for(i=0;i<NAME_COUNT;i++)
+	{
+		popcount_fn fn=popcount_kernel(kernel_names[i]);
+
+		if(fn==NULL)
+		{
+			printf("%-8s not supported \n",kernel_names[i]);
+			continue;
+		}
+		if(check(fn,kernel_names[i],data)!=0)
+		{
+			free(data);
+			return 1;
+		}
+		run(fn,kernel_names[i],data,size,repeats);
+	}
+	run(popcount_bytewise,"counting",data,size,repeats);
+	if(check_bitmap()!=0)
+	{
+		free(data);
+		return 1;
+	}
+	run_bitmap(data,size,repeats);
+	free(data);
+	return 0;
+}
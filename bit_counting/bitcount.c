@@ -0,0 +1,76 @@
+/*
+Count the 1 bits in bitmap files.
+
+build: gcc -O2 -pthread bit_counting/bitcount.c bit_counting/popcount_file.c bit_counting/popcount.c -o bitcount
+run:   ./bitcount [-t threads] [-k auto|avx512|avx2|popcnt|table|scalar] file...
+
+Each file is mapped and counted by popcount_file; one line per file with
+the bit count, the time and the rate.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "popcount.h"
+#include "popcount_file.h"
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint64_t)ts.tv_sec*1000000000u+(uint64_t)ts.tv_nsec;
+}
+
+int main(int argc, char *argv[])
+{
+	int nthreads=0;
+	int status=0;
+	int opt;
+
+	while((opt=getopt(argc,argv,"t:k:"))!=-1)
+	{
+		switch(opt)
+		{
+		case 't': nthreads=atoi(optarg); break;
+		case 'k':
+			if(popcount_select(optarg)!=0)
+				return 1;
+			break;
+		default:
+			printf("usage: %s [-t threads] [-k kernel] file... \n",argv[0]);
+			return 1;
+		}
+	}
+	if(optind>=argc)
+	{
+		printf("usage: %s [-t threads] [-k kernel] file... \n",argv[0]);
+		return 1;
+	}
+	for(;optind<argc;optind++)
+	{
+		struct stat st;
+		uint64_t bits;
+		uint64_t start=now_ns();
+		double seconds;
+
+		if(stat(argv[optind],&st)!=0)
+		{
+			printf("@main, error occurs for stat %s \n",argv[optind]);
+			status=1;
+			continue;
+		}
+		if(popcount_file(argv[optind],nthreads,&bits)!=0)
+		{
+			status=1;
+			continue;
+		}
+		seconds=(double)(now_ns()-start)/1e9;
+		printf("%s: %lu bits in %lld bytes, %.3f s, %.2f GB/s (%s) \n",argv[optind],
+			(unsigned long)bits,(long long)st.st_size,seconds,
+			seconds>0 ? (double)st.st_size/seconds/1e9 : 0.0,popcount_kernel_name());
+	}
+	return status;
+}
@@ -0,0 +1,358 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bitmap.h"
+#include "popcount.h"
+#include "count_bits.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include "popcount_simd.h"
+#define BITMAP_X86 1
+#else
+#define BITMAP_X86 0
+#endif
+
+#define OP_CHUNK_WORDS 64   /* scalar path counts through a 512-byte scratch */
+
+static size_t padded_words(size_t nbits)
+{
+	size_t words=(nbits+63)/64;
+
+	return (words+BITMAP_BLOCK_WORDS-1)/BITMAP_BLOCK_WORDS*BITMAP_BLOCK_WORDS;
+}
+
+int bitmap_init(bitmap_t *b, size_t nbits)
+{
+	size_t words=padded_words(nbits);
+	size_t bytes=words*sizeof(uint64_t);
+
+	b->nbits=nbits;
+	b->nwords=(nbits+63)/64;
+	b->rank_valid=0;
+	/* whole cache lines, zero past nbits so set operations need no tail masks */
+	b->words=(uint64_t *)aligned_alloc(64,bytes ? bytes : 64);
+	b->rank=(uint64_t *)malloc((words/BITMAP_BLOCK_WORDS+1)*sizeof(uint64_t));
+	if(b->words==NULL||b->rank==NULL)
+	{
+		printf("@bitmap_init, error occurs for %zu bits \n",nbits);
+		free(b->words);
+		free(b->rank);
+		b->words=NULL;
+		b->rank=NULL;
+		return -1;
+	}
+	memset(b->words,0,bytes ? bytes : 64);
+	return 0;
+}
+
+void bitmap_destroy(bitmap_t *b)
+{
+	free(b->words);
+	free(b->rank);
+	b->words=NULL;
+	b->rank=NULL;
+}
+
+void bitmap_set(bitmap_t *b, size_t i)
+{
+	if(i>=b->nbits)
+		return;
+	b->words[i/64]|=1ull<<(i%64);
+	b->rank_valid=0;
+}
+
+void bitmap_clear(bitmap_t *b, size_t i)
+{
+	if(i>=b->nbits)
+		return;
+	b->words[i/64]&=~(1ull<<(i%64));
+	b->rank_valid=0;
+}
+
+int bitmap_test(const bitmap_t *b, size_t i)
+{
+	if(i>=b->nbits)
+		return 0;
+	return (int)((b->words[i/64]>>(i%64))&1);
+}
+
+uint64_t bitmap_cardinality(const bitmap_t *b)
+{
+	return popcount((const uint8_t *)b->words,b->nwords*sizeof(uint64_t));
+}
+
+uint64_t bitmap_count_range(const bitmap_t *b, size_t lo, size_t hi)
+{
+	size_t first;
+	size_t last;
+	uint64_t total;
+
+	if(hi>b->nbits)
+		hi=b->nbits;
+	if(lo>=hi)
+		return 0;
+	first=lo/64;
+	last=(hi-1)/64;
+	if(first==last)
+		return (uint64_t)count_bits(b->words[first]&(~0ull<<(lo%64))&(~0ull>>(63-(hi-1)%64)));
+	total=(uint64_t)count_bits(b->words[first]&(~0ull<<(lo%64)));
+	total+=popcount((const uint8_t *)(b->words+first+1),(last-first-1)*sizeof(uint64_t));
+	total+=(uint64_t)count_bits(b->words[last]&(~0ull>>(63-(hi-1)%64)));
+	return total;
+}
+
+int bitmap_build_rank(bitmap_t *b)
+{
+	size_t blocks=padded_words(b->nbits)/BITMAP_BLOCK_WORDS;
+	uint64_t total=0;
+	size_t k;
+
+	for(k=0;k<blocks;k++)
+	{
+		b->rank[k]=total;
+		total+=popcount((const uint8_t *)(b->words+k*BITMAP_BLOCK_WORDS),BITMAP_BLOCK_WORDS*sizeof(uint64_t));
+	}
+	b->rank[blocks]=total;
+	b->rank_valid=1;
+	return 0;
+}
+
+uint64_t bitmap_rank(bitmap_t *b, size_t i)
+{
+	size_t block;
+	size_t word;
+	uint64_t r;
+
+	if(!b->rank_valid)
+		bitmap_build_rank(b);
+	if(i>b->nbits)
+		i=b->nbits;
+	block=i/(64*BITMAP_BLOCK_WORDS);
+	word=i/64;
+	r=b->rank[block];
+	r+=popcount((const uint8_t *)(b->words+block*BITMAP_BLOCK_WORDS),
+		(word-block*BITMAP_BLOCK_WORDS)*sizeof(uint64_t));
+	if(i%64)
+		r+=(uint64_t)count_bits(b->words[word]&(~0ull>>(64-i%64)));
+	return r;
+}
+
+/* position of the k-th 1 bit inside w, k < count_bits(w) */
+static int word_select(uint64_t w, uint64_t k)
+{
+	int base=0;
+	unsigned char byte;
+
+	while(1)
+	{
+		byte=(unsigned char)(w>>base);
+		if(k<(uint64_t)count_bits8(byte))
+			break;
+		k-=(uint64_t)count_bits8(byte);
+		base+=8;
+	}
+	while(1)
+	{
+		if(byte&1)
+		{
+			if(k==0)
+				return base;
+			k--;
+		}
+		byte>>=1;
+		base++;
+	}
+}
+
+int bitmap_select(bitmap_t *b, uint64_t k, size_t *pos)
+{
+	size_t lo=0;
+	size_t hi;
+	size_t word;
+	uint64_t bits;
+
+	if(!b->rank_valid)
+		bitmap_build_rank(b);
+	hi=padded_words(b->nbits)/BITMAP_BLOCK_WORDS;
+	if(k>=b->rank[hi])
+		return -1;
+	/* last block whose rank is <= k */
+	while(hi-lo>1)
+	{
+		size_t mid=lo+(hi-lo)/2;
+
+		if(b->rank[mid]<=k)
+			lo=mid;
+		else
+			hi=mid;
+	}
+	k-=b->rank[lo];
+	for(word=lo*BITMAP_BLOCK_WORDS;;word++)
+	{
+		bits=(uint64_t)count_bits(b->words[word]);
+		if(k<bits)
+			break;
+		k-=bits;
+	}
+	*pos=word*64+(size_t)word_select(b->words[word],k);
+	return 0;
+}
+
+static inline __attribute__((always_inline)) uint64_t combine(uint64_t a, uint64_t b, enum bitmap_op op)
+{
+	switch(op)
+	{
+	case BITMAP_AND: return a&b;
+	case BITMAP_OR:  return a|b;
+	case BITMAP_XOR: return a^b;
+	default:         return a&~b;
+	}
+}
+
+static inline __attribute__((always_inline)) uint64_t op_scalar_body(uint64_t *dst,
+	const uint64_t *a, const uint64_t *b, size_t n, enum bitmap_op op)
+{
+	uint64_t scratch[OP_CHUNK_WORDS];
+	uint64_t total=0;
+	size_t i=0;
+
+	/* combine a chunk, then count it while it is still in L1 */
+	while(i<n)
+	{
+		size_t chunk=n-i<OP_CHUNK_WORDS ? n-i : OP_CHUNK_WORDS;
+		uint64_t *out=dst ? dst+i : scratch;
+		size_t j;
+
+		for(j=0;j<chunk;j++)
+		{
+			out[j]=combine(a[i+j],b[i+j],op);
+		}
+		total+=popcount((const uint8_t *)out,chunk*sizeof(uint64_t));
+		i+=chunk;
+	}
+	return total;
+}
+
+/* one specialised loop per operation, so no switch runs per word */
+#define OP_DISPATCH(body) \
+	switch(op) \
+	{ \
+	case BITMAP_AND: return body(dst,a,b,n,BITMAP_AND); \
+	case BITMAP_OR:  return body(dst,a,b,n,BITMAP_OR); \
+	case BITMAP_XOR: return body(dst,a,b,n,BITMAP_XOR); \
+	default:         return body(dst,a,b,n,BITMAP_ANDNOT); \
+	}
+
+static uint64_t op_scalar(uint64_t *dst, const uint64_t *a, const uint64_t *b, size_t n, enum bitmap_op op)
+{
+	OP_DISPATCH(op_scalar_body)
+}
+
+#if BITMAP_X86
+static inline __attribute__((always_inline,target("avx2"))) __m256i combine256(__m256i a, __m256i b, enum bitmap_op op)
+{
+	switch(op)
+	{
+	case BITMAP_AND: return _mm256_and_si256(a,b);
+	case BITMAP_OR:  return _mm256_or_si256(a,b);
+	case BITMAP_XOR: return _mm256_xor_si256(a,b);
+	default:         return _mm256_andnot_si256(b,a);
+	}
+}
+
+static inline __attribute__((always_inline,target("avx2"))) uint64_t op_avx2_body(uint64_t *dst,
+	const uint64_t *a, const uint64_t *b, size_t n, enum bitmap_op op)
+{
+	__m256i acc=_mm256_setzero_si256();
+	size_t i=0;
+
+	for(;i+16<=n;i+=16)
+	{
+		__m256i r0=combine256(_mm256_loadu_si256((const __m256i *)(a+i)),_mm256_loadu_si256((const __m256i *)(b+i)),op);
+		__m256i r1=combine256(_mm256_loadu_si256((const __m256i *)(a+i+4)),_mm256_loadu_si256((const __m256i *)(b+i+4)),op);
+		__m256i r2=combine256(_mm256_loadu_si256((const __m256i *)(a+i+8)),_mm256_loadu_si256((const __m256i *)(b+i+8)),op);
+		__m256i r3=combine256(_mm256_loadu_si256((const __m256i *)(a+i+12)),_mm256_loadu_si256((const __m256i *)(b+i+12)),op);
+		__m256i sum;
+
+		if(dst)
+		{
+			_mm256_storeu_si256((__m256i *)(dst+i),r0);
+			_mm256_storeu_si256((__m256i *)(dst+i+4),r1);
+			_mm256_storeu_si256((__m256i *)(dst+i+8),r2);
+			_mm256_storeu_si256((__m256i *)(dst+i+12),r3);
+		}
+		sum=_mm256_add_epi8(avx2_byte_counts(r0),avx2_byte_counts(r1));
+		sum=_mm256_add_epi8(sum,_mm256_add_epi8(avx2_byte_counts(r2),avx2_byte_counts(r3)));
+		acc=_mm256_add_epi64(acc,_mm256_sad_epu8(sum,_mm256_setzero_si256()));
+	}
+	return avx2_reduce_epi64(acc)+op_scalar(dst ? dst+i : NULL,a+i,b+i,n-i,op);
+}
+
+__attribute__((target("avx2")))
+static uint64_t op_avx2(uint64_t *dst, const uint64_t *a, const uint64_t *b, size_t n, enum bitmap_op op)
+{
+	OP_DISPATCH(op_avx2_body)
+}
+
+static inline __attribute__((always_inline,target("avx512f"))) __m512i combine512(__m512i a, __m512i b, enum bitmap_op op)
+{
+	switch(op)
+	{
+	case BITMAP_AND: return _mm512_and_si512(a,b);
+	case BITMAP_OR:  return _mm512_or_si512(a,b);
+	case BITMAP_XOR: return _mm512_xor_si512(a,b);
+	default:         return _mm512_andnot_si512(b,a);
+	}
+}
+
+static inline __attribute__((always_inline,target("avx512f,avx512vpopcntdq"))) uint64_t op_avx512_body(uint64_t *dst,
+	const uint64_t *a, const uint64_t *b, size_t n, enum bitmap_op op)
+{
+	__m512i acc=_mm512_setzero_si512();
+	size_t i=0;
+
+	for(;i+8<=n;i+=8)
+	{
+		__m512i r=combine512(_mm512_loadu_si512((const void *)(a+i)),_mm512_loadu_si512((const void *)(b+i)),op);
+
+		if(dst)
+			_mm512_storeu_si512((void *)(dst+i),r);
+		acc=_mm512_add_epi64(acc,_mm512_popcnt_epi64(r));
+	}
+	return (uint64_t)_mm512_reduce_add_epi64(acc)+op_scalar(dst ? dst+i : NULL,a+i,b+i,n-i,op);
+}
+
+__attribute__((target("avx512f,avx512vpopcntdq")))
+static uint64_t op_avx512(uint64_t *dst, const uint64_t *a, const uint64_t *b, size_t n, enum bitmap_op op)
+{
+	OP_DISPATCH(op_avx512_body)
+}
+#endif
+
+uint64_t bitmap_words_op(uint64_t *dst, const uint64_t *a, const uint64_t *b, size_t n, enum bitmap_op op)
+{
+	/* same choice as popcount(), so popcount_select steers both */
+	const char *kernel=popcount_kernel_name();
+
+#if BITMAP_X86
+	if(strcmp(kernel,"avx512")==0)
+		return op_avx512(dst,a,b,n,op);
+	if(strcmp(kernel,"avx2")==0)
+		return op_avx2(dst,a,b,n,op);
+#else
+	(void)kernel;
+#endif
+	return op_scalar(dst,a,b,n,op);
+}
+
+uint64_t bitmap_op(bitmap_t *dst, const bitmap_t *a, const bitmap_t *b, enum bitmap_op op)
+{
+	if(a->nbits!=b->nbits||(dst!=NULL&&dst->nbits!=a->nbits))
+	{
+		printf("@bitmap_op, error occurs for sizes %zu/%zu bits \n",a->nbits,b->nbits);
+		return 0;
+	}
+	if(dst!=NULL)
+		dst->rank_valid=0;
+	return bitmap_words_op(dst ? dst->words : NULL,a->words,b->words,a->nwords,op);
+}
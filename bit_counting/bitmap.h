@@ -0,0 +1,94 @@
+#ifndef BIT_COUNTING_BITMAP_H
+#define BIT_COUNTING_BITMAP_H
+
+/*
+Dense bitmaps with rank/select and fused set operations, plus a compressed
+form for sparse data, all counting through popcount.c.
+
+bitmap_t is a plain array of 64-bit words. bitmap_build_rank stores the
+number of 1 bits before every 512-bit block (one cache line), so
+bitmap_rank is a table read plus at most eight word counts, and
+bitmap_select binary-searches the blocks before scanning one. Any write
+invalidates the table; rank/select rebuild it on demand.
+
+bitmap_op combines two bitmaps word by word and returns the cardinality
+of the result in the same pass. dst may be NULL to only count, which is
+how a filter query intersects without materialising the intersection.
+The kernel follows popcount_kernel_name() (AVX-512, AVX2 or scalar).
+
+sparse_bitmap_t splits the bit space into 65536-bit chunks and keeps each
+non-empty chunk as whichever container is smallest: a sorted array of
+16-bit offsets, a list of runs, or the 8 KiB bitmap.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define BITMAP_BLOCK_WORDS 8    /* 512 bits per rank entry */
+
+enum bitmap_op {
+	BITMAP_AND,
+	BITMAP_OR,
+	BITMAP_XOR,
+	BITMAP_ANDNOT    /* a & ~b */
+};
+
+typedef struct bitmap {
+	uint64_t *words;
+	size_t nbits;
+	size_t nwords;
+	uint64_t *rank;     /* ones before each block, plus the total at the end */
+	int rank_valid;
+} bitmap_t;
+
+int bitmap_init(bitmap_t *b, size_t nbits);
+void bitmap_destroy(bitmap_t *b);
+
+void bitmap_set(bitmap_t *b, size_t i);
+void bitmap_clear(bitmap_t *b, size_t i);
+int bitmap_test(const bitmap_t *b, size_t i);
+uint64_t bitmap_cardinality(const bitmap_t *b);
+/* number of 1 bits in [lo,hi) */
+uint64_t bitmap_count_range(const bitmap_t *b, size_t lo, size_t hi);
+
+int bitmap_build_rank(bitmap_t *b);
+/* number of 1 bits in [0,i) */
+uint64_t bitmap_rank(bitmap_t *b, size_t i);
+/* position of the k-th 1 bit (k from 0) in *pos; -1 if there are not that many */
+int bitmap_select(bitmap_t *b, uint64_t k, size_t *pos);
+
+/* dst = a op b (dst may be NULL or alias a or b), returns popcount(dst);
+all three must have the same nbits */
+uint64_t bitmap_op(bitmap_t *dst, const bitmap_t *a, const bitmap_t *b, enum bitmap_op op);
+/* the word-level kernel behind bitmap_op, dst may be NULL */
+uint64_t bitmap_words_op(uint64_t *dst, const uint64_t *a, const uint64_t *b, size_t nwords, enum bitmap_op op);
+
+#define SPARSE_ARRAY  0
+#define SPARSE_RUN    1
+#define SPARSE_BITMAP 2
+
+typedef struct sparse_container {
+	uint32_t key;        /* chunk index, bit >> 16 */
+	int type;            /* SPARSE_ARRAY, SPARSE_RUN or SPARSE_BITMAP */
+	uint32_t count;      /* array entries, runs, or 1024 words */
+	uint32_t cardinality;
+	uint16_t *data;      /* offsets, start/length-1 pairs, or the words */
+} sparse_container_t;
+
+typedef struct sparse_bitmap {
+	size_t nbits;
+	size_t ncontainers;
+	sparse_container_t *containers;   /* sorted by key */
+} sparse_bitmap_t;
+
+int sparse_bitmap_compress(sparse_bitmap_t *s, const bitmap_t *b);
+int sparse_bitmap_expand(const sparse_bitmap_t *s, bitmap_t *b);
+void sparse_bitmap_destroy(sparse_bitmap_t *s);
+int sparse_bitmap_test(const sparse_bitmap_t *s, size_t i);
+uint64_t sparse_bitmap_cardinality(const sparse_bitmap_t *s);
+/* popcount(s & b) without expanding s */
+uint64_t sparse_bitmap_and_count(const sparse_bitmap_t *s, const bitmap_t *b);
+/* bytes used by the containers, to compare with nwords*8 */
+size_t sparse_bitmap_bytes(const sparse_bitmap_t *s);
+
+#endif
@@ -0,0 +1,290 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bitmap.h"
+#include "popcount.h"
+#include "count_bits.h"
+
+#define CHUNK_BITS  65536
+#define CHUNK_WORDS (CHUNK_BITS/64)
+#define ARRAY_MAX   4096     /* beyond this an array is bigger than the bitmap */
+
+static size_t container_bytes(const sparse_container_t *c)
+{
+	switch(c->type)
+	{
+	case SPARSE_ARRAY: return c->count*sizeof(uint16_t);
+	case SPARSE_RUN:   return c->count*2*sizeof(uint16_t);
+	default:           return CHUNK_WORDS*sizeof(uint64_t);
+	}
+}
+
+/* 0->1 transitions in the chunk, i.e. the number of runs */
+static uint32_t count_runs(const uint64_t *w, size_t n)
+{
+	uint64_t carry=0;
+	uint32_t runs=0;
+	size_t i;
+
+	for(i=0;i<n;i++)
+	{
+		uint64_t starts=w[i]&~((w[i]<<1)|carry);
+
+		runs+=(uint32_t)count_bits(starts);
+		carry=w[i]>>63;
+	}
+	return runs;
+}
+
+static int fill_container(sparse_container_t *c, const uint64_t *w, size_t n)
+{
+	uint32_t runs=count_runs(w,n);
+	size_t i;
+
+	if(c->cardinality<=ARRAY_MAX&&c->cardinality<=2*runs)
+		c->type=SPARSE_ARRAY;
+	else if(runs*2*sizeof(uint16_t)<CHUNK_WORDS*sizeof(uint64_t))
+		c->type=SPARSE_RUN;
+	else
+		c->type=SPARSE_BITMAP;
+	c->count=c->type==SPARSE_ARRAY ? c->cardinality : c->type==SPARSE_RUN ? runs : CHUNK_WORDS;
+	c->data=(uint16_t *)calloc(1,container_bytes(c));
+	if(c->data==NULL)
+		return -1;
+	if(c->type==SPARSE_BITMAP)
+	{
+		memcpy(c->data,w,n*sizeof(uint64_t));
+		return 0;
+	}
+
+	{
+		uint32_t out=0;
+		int last=-2;
+
+		for(i=0;i<n;i++)
+		{
+			uint64_t bits=w[i];
+
+			while(bits)
+			{
+				int pos=(int)(i*64)+__builtin_ctzll(bits);
+
+				bits&=bits-1;
+				if(c->type==SPARSE_ARRAY)
+				{
+					c->data[out++]=(uint16_t)pos;
+				}else if(pos==last+1){
+					c->data[2*(out-1)+1]++;
+				}else{
+					c->data[2*out]=(uint16_t)pos;
+					c->data[2*out+1]=0;
+					out++;
+				}
+				last=pos;
+			}
+		}
+	}
+	return 0;
+}
+
+int sparse_bitmap_compress(sparse_bitmap_t *s, const bitmap_t *b)
+{
+	size_t chunks=(b->nwords+CHUNK_WORDS-1)/CHUNK_WORDS;
+	size_t k;
+
+	s->nbits=b->nbits;
+	s->ncontainers=0;
+	s->containers=(sparse_container_t *)calloc(chunks ? chunks : 1,sizeof(sparse_container_t));
+	if(s->containers==NULL)
+	{
+		printf("@sparse_bitmap_compress, error occurs for %zu chunks \n",chunks);
+		return -1;
+	}
+	for(k=0;k<chunks;k++)
+	{
+		const uint64_t *w=b->words+k*CHUNK_WORDS;
+		size_t n=b->nwords-k*CHUNK_WORDS<CHUNK_WORDS ? b->nwords-k*CHUNK_WORDS : CHUNK_WORDS;
+		sparse_container_t *c=&s->containers[s->ncontainers];
+
+		c->cardinality=(uint32_t)popcount((const uint8_t *)w,n*sizeof(uint64_t));
+		if(c->cardinality==0)
+			continue;
+		c->key=(uint32_t)k;
+		if(fill_container(c,w,n)!=0)
+		{
+			printf("@sparse_bitmap_compress, error occurs for chunk %zu \n",k);
+			sparse_bitmap_destroy(s);
+			return -1;
+		}
+		s->ncontainers++;
+	}
+	return 0;
+}
+
+void sparse_bitmap_destroy(sparse_bitmap_t *s)
+{
+	size_t k;
+
+	for(k=0;k<s->ncontainers;k++)
+	{
+		free(s->containers[k].data);
+	}
+	free(s->containers);
+	s->containers=NULL;
+	s->ncontainers=0;
+}
+
+int sparse_bitmap_expand(const sparse_bitmap_t *s, bitmap_t *b)
+{
+	size_t k;
+	uint32_t i;
+
+	if(bitmap_init(b,s->nbits)!=0)
+		return -1;
+	for(k=0;k<s->ncontainers;k++)
+	{
+		const sparse_container_t *c=&s->containers[k];
+		size_t base=(size_t)c->key*CHUNK_BITS;
+
+		if(c->type==SPARSE_BITMAP)
+		{
+			size_t n=b->nwords-c->key*CHUNK_WORDS<CHUNK_WORDS ? b->nwords-c->key*CHUNK_WORDS : CHUNK_WORDS;
+
+			memcpy(b->words+c->key*CHUNK_WORDS,c->data,n*sizeof(uint64_t));
+			continue;
+		}
+		for(i=0;i<c->count;i++)
+		{
+			if(c->type==SPARSE_ARRAY)
+			{
+				bitmap_set(b,base+c->data[i]);
+			}else{
+				uint32_t j;
+
+				for(j=0;j<=c->data[2*i+1];j++)
+				{
+					bitmap_set(b,base+c->data[2*i]+j);
+				}
+			}
+		}
+	}
+	return 0;
+}
+
+static const sparse_container_t *find_container(const sparse_bitmap_t *s, uint32_t key)
+{
+	size_t lo=0;
+	size_t hi=s->ncontainers;
+
+	while(lo<hi)
+	{
+		size_t mid=lo+(hi-lo)/2;
+
+		if(s->containers[mid].key<key)
+			lo=mid+1;
+		else
+			hi=mid;
+	}
+	return lo<s->ncontainers&&s->containers[lo].key==key ? &s->containers[lo] : NULL;
+}
+
+int sparse_bitmap_test(const sparse_bitmap_t *s, size_t i)
+{
+	const sparse_container_t *c;
+	uint16_t off=(uint16_t)(i%CHUNK_BITS);
+	size_t lo=0;
+	size_t hi;
+
+	if(i>=s->nbits)
+		return 0;
+	c=find_container(s,(uint32_t)(i/CHUNK_BITS));
+	if(c==NULL)
+		return 0;
+	if(c->type==SPARSE_BITMAP)
+		return (int)((((const uint64_t *)c->data)[off/64]>>(off%64))&1);
+	/* first entry (or run start) greater than off */
+	hi=c->count;
+	while(lo<hi)
+	{
+		size_t mid=lo+(hi-lo)/2;
+		uint16_t v=c->type==SPARSE_ARRAY ? c->data[mid] : c->data[2*mid];
+
+		if(v<=off)
+			lo=mid+1;
+		else
+			hi=mid;
+	}
+	if(lo==0)
+		return 0;
+	if(c->type==SPARSE_ARRAY)
+		return c->data[lo-1]==off;
+	return off-c->data[2*(lo-1)]<=c->data[2*(lo-1)+1];
+}
+
+uint64_t sparse_bitmap_cardinality(const sparse_bitmap_t *s)
+{
+	uint64_t total=0;
+	size_t k;
+
+	for(k=0;k<s->ncontainers;k++)
+	{
+		total+=s->containers[k].cardinality;
+	}
+	return total;
+}
+
+uint64_t sparse_bitmap_and_count(const sparse_bitmap_t *s, const bitmap_t *b)
+{
+	uint64_t total=0;
+	size_t k;
+	uint32_t i;
+
+	if(s->nbits!=b->nbits)
+	{
+		printf("@sparse_bitmap_and_count, error occurs for sizes %zu/%zu bits \n",s->nbits,b->nbits);
+		return 0;
+	}
+	for(k=0;k<s->ncontainers;k++)
+	{
+		const sparse_container_t *c=&s->containers[k];
+		size_t base=(size_t)c->key*CHUNK_BITS;
+
+		switch(c->type)
+		{
+		case SPARSE_ARRAY:
+			for(i=0;i<c->count;i++)
+			{
+				total+=(uint64_t)bitmap_test(b,base+c->data[i]);
+			}
+			break;
+		case SPARSE_RUN:
+			for(i=0;i<c->count;i++)
+			{
+				size_t start=base+c->data[2*i];
+
+				total+=bitmap_count_range(b,start,start+c->data[2*i+1]+1);
+			}
+			break;
+		default:
+			{
+				size_t n=b->nwords-c->key*CHUNK_WORDS<CHUNK_WORDS ? b->nwords-c->key*CHUNK_WORDS : CHUNK_WORDS;
+
+				total+=bitmap_words_op(NULL,(const uint64_t *)c->data,b->words+c->key*CHUNK_WORDS,n,BITMAP_AND);
+			}
+			break;
+		}
+	}
+	return total;
+}
+
+size_t sparse_bitmap_bytes(const sparse_bitmap_t *s)
+{
+	size_t bytes=s->ncontainers*sizeof(sparse_container_t);
+	size_t k;
+
+	for(k=0;k<s->ncontainers;k++)
+	{
+		bytes+=container_bytes(&s->containers[k]);
+	}
+	return bytes;
+}
@@ -0,0 +1,109 @@
+#ifndef BIT_COUNTING_COUNT_BITS_H
+#define BIT_COUNTING_COUNT_BITS_H
+
+/*
+Width-specialised bit counting, header only.
+
+count_bits(x) picks count_bits8/16/32/64/128 from the type of x with
+_Generic, so a call site always gets the straight-line sequence for its
+width: a lookup in count_bits_table for 8 and 16 bits, POPCNT when the
+build targets it (-mpopcnt, -march=native, or any ARMv8), otherwise
+SWAR for 32 and 64 bits and two 64-bit counts for unsigned __int128.
+None of them branch or loop.
+
+count_bits_table is generated by the preprocessor, so nothing is built at
+run time. COUNT_BITS_CONST(x) is the same count as an integer constant
+expression for constant x (array sizes, case labels, _Static_assert);
+it evaluates x many times, so keep it to constants.
+*/
+
+#include <stdint.h>
+
+#define COUNT_BITS_B2(n) n, n+1, n+1, n+2
+#define COUNT_BITS_B4(n) COUNT_BITS_B2(n), COUNT_BITS_B2(n+1), COUNT_BITS_B2(n+1), COUNT_BITS_B2(n+2)
+#define COUNT_BITS_B6(n) COUNT_BITS_B4(n), COUNT_BITS_B4(n+1), COUNT_BITS_B4(n+1), COUNT_BITS_B4(n+2)
+
+static const uint8_t count_bits_table[256]={
+	COUNT_BITS_B6(0),COUNT_BITS_B6(1),COUNT_BITS_B6(1),COUNT_BITS_B6(2)
+};
+
+#define COUNT_BITS_C2(x)  ((x)-(((x)>>1)&0x5555555555555555ull))
+#define COUNT_BITS_C4(x)  ((COUNT_BITS_C2(x)&0x3333333333333333ull)+((COUNT_BITS_C2(x)>>2)&0x3333333333333333ull))
+#define COUNT_BITS_C8(x)  ((COUNT_BITS_C4(x)+(COUNT_BITS_C4(x)>>4))&0x0f0f0f0f0f0f0f0full)
+#define COUNT_BITS_CONST(x) ((int)((COUNT_BITS_C8((unsigned long long)(x))*0x0101010101010101ull)>>56))
+
+#if defined(__POPCNT__) || defined(__aarch64__)
+#define COUNT_BITS_HW 1
+#else
+#define COUNT_BITS_HW 0
+#endif
+
+static inline int count_bits8(uint8_t x)
+{
+	return count_bits_table[x];
+}
+
+static inline int count_bits16(uint16_t x)
+{
+	return count_bits_table[x&0xff]+count_bits_table[x>>8];
+}
+
+static inline int count_bits32(uint32_t x)
+{
+#if COUNT_BITS_HW
+	return __builtin_popcount(x);
+#else
+	x=x-((x>>1)&0x55555555u);
+	x=(x&0x33333333u)+((x>>2)&0x33333333u);
+	x=(x+(x>>4))&0x0f0f0f0fu;
+	return (int)((x*0x01010101u)>>24);
+#endif
+}
+
+static inline int count_bits64(uint64_t x)
+{
+#if COUNT_BITS_HW
+	return __builtin_popcountll(x);
+#else
+	x=x-((x>>1)&0x5555555555555555ull);
+	x=(x&0x3333333333333333ull)+((x>>2)&0x3333333333333333ull);
+	x=(x+(x>>4))&0x0f0f0f0f0f0f0f0full;
+	return (int)((x*0x0101010101010101ull)>>56);
+#endif
+}
+
+#ifdef __SIZEOF_INT128__
+static inline int count_bits128(unsigned __int128 x)
+{
+	return count_bits64((uint64_t)x)+count_bits64((uint64_t)(x>>64));
+}
+
+#define COUNT_BITS_128_CASES(x) \
+	unsigned __int128: count_bits128((unsigned __int128)(x)), \
+	__int128:          count_bits128((unsigned __int128)(x)),
+#else
+#define COUNT_BITS_128_CASES(x)
+#endif
+
+/* long is 32 or 64 bits depending on the ABI, so it goes by its size */
+#define COUNT_BITS_LONG(x) (sizeof(long)==8 ? count_bits64((uint64_t)(x)) : count_bits32((uint32_t)(x)))
+
+#define count_bits(x) _Generic((x), \
+	COUNT_BITS_128_CASES(x) \
+	_Bool:              count_bits8((uint8_t)(x)), \
+	char:               count_bits8((uint8_t)(x)), \
+	signed char:        count_bits8((uint8_t)(x)), \
+	unsigned char:      count_bits8((uint8_t)(x)), \
+	short:              count_bits16((uint16_t)(x)), \
+	unsigned short:     count_bits16((uint16_t)(x)), \
+	int:                count_bits32((uint32_t)(x)), \
+	unsigned int:       count_bits32((uint32_t)(x)), \
+	long:               COUNT_BITS_LONG(x), \
+	unsigned long:      COUNT_BITS_LONG(x), \
+	long long:          count_bits64((uint64_t)(x)), \
+	unsigned long long: count_bits64((uint64_t)(x)))
+
+_Static_assert(COUNT_BITS_CONST(0xffu)==8&&COUNT_BITS_CONST(0x8000000000000001ull)==2,
+	"COUNT_BITS_CONST");
+
+#endif
@@ -0,0 +1,246 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "popcount.h"
+#include "count_bits.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include "popcount_simd.h"
+#define POPCOUNT_X86 1
+#else
+#define POPCOUNT_X86 0
+#endif
+
+int counting(unsigned char input)
+{
+	return count_bits8(input);
+}
+
+static uint64_t load64(const uint8_t *p)
+{
+	uint64_t v;
+
+	memcpy(&v,p,sizeof(v));
+	return v;
+}
+
+static uint64_t swar64(uint64_t v)
+{
+	v=v-((v>>1)&0x5555555555555555ull);
+	v=(v&0x3333333333333333ull)+((v>>2)&0x3333333333333333ull);
+	v=(v+(v>>4))&0x0f0f0f0f0f0f0f0full;
+	return (v*0x0101010101010101ull)>>56;
+}
+
+uint64_t popcount_scalar(const uint8_t *data, size_t len)
+{
+	uint64_t total=0;
+	size_t i=0;
+
+	for(;i+8<=len;i+=8)
+	{
+		total+=swar64(load64(data+i));
+	}
+	for(;i<len;i++)
+	{
+		total+=swar64(data[i]);
+	}
+	return total;
+}
+
+uint64_t popcount_table(const uint8_t *data, size_t len)
+{
+	uint64_t total=0;
+	size_t i=0;
+
+	for(;i+4<=len;i+=4)
+	{
+		total+=count_bits_table[data[i]]+count_bits_table[data[i+1]]+count_bits_table[data[i+2]]+count_bits_table[data[i+3]];
+	}
+	for(;i<len;i++)
+	{
+		total+=count_bits_table[data[i]];
+	}
+	return total;
+}
+
+#if POPCOUNT_X86
+__attribute__((target("popcnt")))
+uint64_t popcount_popcnt(const uint8_t *data, size_t len)
+{
+	uint64_t a=0,b=0,c=0,d=0;
+	size_t i=0;
+
+	/* four independent sums so POPCNT's latency overlaps */
+	for(;i+32<=len;i+=32)
+	{
+		a+=(uint64_t)__builtin_popcountll(load64(data+i));
+		b+=(uint64_t)__builtin_popcountll(load64(data+i+8));
+		c+=(uint64_t)__builtin_popcountll(load64(data+i+16));
+		d+=(uint64_t)__builtin_popcountll(load64(data+i+24));
+	}
+	for(;i+8<=len;i+=8)
+	{
+		a+=(uint64_t)__builtin_popcountll(load64(data+i));
+	}
+	for(;i<len;i++)
+	{
+		a+=count_bits_table[data[i]];
+	}
+	return a+b+c+d;
+}
+
+__attribute__((target("avx2,popcnt")))
+uint64_t popcount_avx2(const uint8_t *data, size_t len)
+{
+	__m256i acc=_mm256_setzero_si256();
+	size_t i=0;
+
+	/* per-byte counts of four vectors stay <= 32, then widen once with SAD */
+	for(;i+128<=len;i+=128)
+	{
+		__m256i sum=avx2_byte_counts(_mm256_loadu_si256((const __m256i *)(data+i)));
+
+		sum=_mm256_add_epi8(sum,avx2_byte_counts(_mm256_loadu_si256((const __m256i *)(data+i+32))));
+		sum=_mm256_add_epi8(sum,avx2_byte_counts(_mm256_loadu_si256((const __m256i *)(data+i+64))));
+		sum=_mm256_add_epi8(sum,avx2_byte_counts(_mm256_loadu_si256((const __m256i *)(data+i+96))));
+		acc=_mm256_add_epi64(acc,_mm256_sad_epu8(sum,_mm256_setzero_si256()));
+	}
+	for(;i+32<=len;i+=32)
+	{
+		__m256i sum=avx2_byte_counts(_mm256_loadu_si256((const __m256i *)(data+i)));
+
+		acc=_mm256_add_epi64(acc,_mm256_sad_epu8(sum,_mm256_setzero_si256()));
+	}
+	return avx2_reduce_epi64(acc)+popcount_popcnt(data+i,len-i);
+}
+
+__attribute__((target("avx512f,avx512vpopcntdq,popcnt")))
+uint64_t popcount_avx512(const uint8_t *data, size_t len)
+{
+	__m512i a=_mm512_setzero_si512();
+	__m512i b=_mm512_setzero_si512();
+	size_t i=0;
+
+	for(;i+128<=len;i+=128)
+	{
+		a=_mm512_add_epi64(a,_mm512_popcnt_epi64(_mm512_loadu_si512((const void *)(data+i))));
+		b=_mm512_add_epi64(b,_mm512_popcnt_epi64(_mm512_loadu_si512((const void *)(data+i+64))));
+	}
+	for(;i+64<=len;i+=64)
+	{
+		a=_mm512_add_epi64(a,_mm512_popcnt_epi64(_mm512_loadu_si512((const void *)(data+i))));
+	}
+	return (uint64_t)_mm512_reduce_add_epi64(_mm512_add_epi64(a,b))+popcount_popcnt(data+i,len-i);
+}
+
+static int has_popcnt(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("popcnt");
+}
+
+static int has_avx2(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2")&&__builtin_cpu_supports("popcnt");
+}
+
+static int has_avx512(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx512f")&&__builtin_cpu_supports("avx512vpopcntdq");
+}
+#endif
+
+static int always(void)
+{
+	return 1;
+}
+
+/* best first: the first supported entry is what "auto" picks */
+static const struct {
+	const char *name;
+	popcount_fn fn;
+	int (*supported)(void);
+} kernels[]={
+#if POPCOUNT_X86
+	{"avx512",popcount_avx512,has_avx512},
+	{"avx2",popcount_avx2,has_avx2},
+	{"popcnt",popcount_popcnt,has_popcnt},
+#endif
+	{"table",popcount_table,always},
+	{"scalar",popcount_scalar,always},
+};
+
+#define KERNEL_COUNT (sizeof(kernels)/sizeof(kernels[0]))
+
+static atomic_int current=-1;
+
+static int detect(void)
+{
+	size_t k;
+
+	for(k=0;k<KERNEL_COUNT;k++)
+	{
+		if(kernels[k].supported())
+			return (int)k;
+	}
+	return (int)KERNEL_COUNT-1;
+}
+
+static int current_kernel(void)
+{
+	int k=atomic_load_explicit(&current,memory_order_relaxed);
+
+	if(k<0)
+	{
+		k=detect();
+		atomic_store_explicit(&current,k,memory_order_relaxed);
+	}
+	return k;
+}
+
+uint64_t popcount(const uint8_t *data, size_t len)
+{
+	return kernels[current_kernel()].fn(data,len);
+}
+
+static int find_kernel(const char *name)
+{
+	size_t k;
+
+	if(strcmp(name,"auto")==0)
+		return detect();
+	for(k=0;k<KERNEL_COUNT;k++)
+	{
+		if(strcmp(kernels[k].name,name)==0)
+			return kernels[k].supported() ? (int)k : -1;
+	}
+	return -1;
+}
+
+popcount_fn popcount_kernel(const char *name)
+{
+	int k=find_kernel(name);
+
+	return k<0 ? NULL : kernels[k].fn;
+}
+
+int popcount_select(const char *name)
+{
+	int k=find_kernel(name);
+
+	if(k<0)
+	{
+		printf("@popcount_select, error occurs for kernel %s \n",name);
+		return -1;
+	}
+	atomic_store_explicit(&current,k,memory_order_relaxed);
+	return 0;
+}
+
+const char *popcount_kernel_name(void)
+{
+	return kernels[current_kernel()].name;
+}
@@ -0,0 +1,44 @@
+#ifndef BIT_COUNTING_POPCOUNT_H
+#define BIT_COUNTING_POPCOUNT_H
+
+/*
+Bulk set-bit counting, grown out of counting() in python.c.
+
+popcount(data,len) counts the 1 bits in len bytes. The first call picks
+the fastest kernel this CPU supports and every later call goes straight
+to it through a function pointer:
+  avx512  VPOPCNTDQ, 64 bytes per instruction
+  avx2    nibble lookup with VPSHUFB, summed with VPSADBW
+  popcnt  hardware POPCNT on 64-bit words
+  table   one 256-entry lookup per byte
+  scalar  SWAR on 64-bit words, no tables and no special instructions
+popcount_select forces one of them by name ("auto" redetects), which is
+what bench_popcount uses to compare them. Non-x86 builds only have table
+and scalar.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint64_t (*popcount_fn)(const uint8_t *data, size_t len);
+
+uint64_t popcount(const uint8_t *data, size_t len);
+/* number of 1 bits in one byte */
+int counting(unsigned char input);
+
+uint64_t popcount_scalar(const uint8_t *data, size_t len);
+uint64_t popcount_table(const uint8_t *data, size_t len);
+#if defined(__x86_64__) || defined(__i386__)
+uint64_t popcount_popcnt(const uint8_t *data, size_t len);
+uint64_t popcount_avx2(const uint8_t *data, size_t len);
+uint64_t popcount_avx512(const uint8_t *data, size_t len);
+#endif
+
+/* kernel by name, NULL if unknown or not supported by this CPU */
+popcount_fn popcount_kernel(const char *name);
+/* make popcount() use that kernel; 0 on success, -1 as popcount_kernel */
+int popcount_select(const char *name);
+/* name of the kernel popcount() currently uses */
+const char *popcount_kernel_name(void);
+
+#endif
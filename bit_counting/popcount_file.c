@@ -0,0 +1,163 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "popcount.h"
+#include "popcount_file.h"
+
+typedef struct count_job {
+	const uint8_t *data;
+	size_t len;
+	size_t head;          /* bytes before the first cache-line boundary */
+	size_t chunks;
+	int advise;           /* data is a file mapping, MADV_WILLNEED each chunk */
+	uintptr_t page_mask;
+	atomic_size_t next;
+} count_job_t;
+
+typedef struct count_worker {
+	_Alignas(64) uint64_t bits;
+	count_job_t *job;
+	pthread_t thread;
+} count_worker_t;
+
+static void *count_worker_run(void *arg)
+{
+	count_worker_t *w=(count_worker_t *)arg;
+	count_job_t *job=w->job;
+	size_t c;
+
+	while((c=atomic_fetch_add_explicit(&job->next,1,memory_order_relaxed))<job->chunks)
+	{
+		/* chunk 0 also takes the unaligned head, every later one starts on a line */
+		size_t start=c==0 ? 0 : job->head+c*(size_t)POPCOUNT_CHUNK;
+		size_t end=job->head+(c+1)*(size_t)POPCOUNT_CHUNK;
+
+		if(end>job->len)
+			end=job->len;
+		if(job->advise)
+		{
+			uintptr_t lo=(uintptr_t)(job->data+start)&job->page_mask;
+
+			madvise((void *)lo,(uintptr_t)(job->data+end)-lo,MADV_WILLNEED);
+		}
+		w->bits+=popcount(job->data+start,end-start);
+	}
+	return NULL;
+}
+
+static int count_threads(int nthreads)
+{
+	if(nthreads<=0)
+		nthreads=(int)sysconf(_SC_NPROCESSORS_ONLN);
+	if(nthreads<1)
+		nthreads=1;
+	if(nthreads>POPCOUNT_MAX_THREADS)
+		nthreads=POPCOUNT_MAX_THREADS;
+	return nthreads;
+}
+
+static int popcount_run(const uint8_t *data, size_t len, int nthreads, int advise, uint64_t *bits)
+{
+	count_job_t job;
+	count_worker_t *workers;
+	int started=1;
+	int i;
+
+	*bits=0;
+	if(len==0)
+		return 0;
+	job.data=data;
+	job.len=len;
+	job.head=(64-((uintptr_t)data&63))&63;
+	if(job.head>len)
+		job.head=len;
+	job.chunks=(len-job.head+POPCOUNT_CHUNK-1)/POPCOUNT_CHUNK;
+	if(job.chunks==0)
+		job.chunks=1;
+	job.advise=advise;
+	job.page_mask=~(uintptr_t)(sysconf(_SC_PAGESIZE)-1);
+	atomic_init(&job.next,0);
+
+	nthreads=count_threads(nthreads);
+	if((size_t)nthreads>job.chunks)
+		nthreads=(int)job.chunks;
+	workers=(count_worker_t *)aligned_alloc(64,sizeof(count_worker_t)*(size_t)nthreads);
+	if(workers==NULL)
+	{
+		printf("@popcount_parallel, error occurs for %d workers \n",nthreads);
+		return -1;
+	}
+	for(i=0;i<nthreads;i++)
+	{
+		workers[i].bits=0;
+		workers[i].job=&job;
+	}
+	/* worker 0 is this thread; if a create fails the rest just take more chunks */
+	for(i=1;i<nthreads;i++)
+	{
+		if(pthread_create(&workers[i].thread,NULL,count_worker_run,&workers[i])!=0)
+			break;
+		started++;
+	}
+	count_worker_run(&workers[0]);
+	for(i=1;i<started;i++)
+	{
+		pthread_join(workers[i].thread,NULL);
+	}
+	for(i=0;i<started;i++)
+	{
+		*bits+=workers[i].bits;
+	}
+	free(workers);
+	return 0;
+}
+
+int popcount_parallel(const uint8_t *data, size_t len, int nthreads, uint64_t *bits)
+{
+	return popcount_run(data,len,nthreads,0,bits);
+}
+
+int popcount_file(const char *path, int nthreads, uint64_t *bits)
+{
+	struct stat st;
+	void *map;
+	int fd;
+	int ret;
+
+	*bits=0;
+	fd=open(path,O_RDONLY);
+	if(fd<0)
+	{
+		printf("@popcount_file, error occurs for open %s errno %d \n",path,errno);
+		return -1;
+	}
+	if(fstat(fd,&st)!=0)
+	{
+		printf("@popcount_file, error occurs for fstat %s errno %d \n",path,errno);
+		close(fd);
+		return -1;
+	}
+	if(st.st_size==0)
+	{
+		close(fd);
+		return 0;
+	}
+	map=mmap(NULL,(size_t)st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+	close(fd);
+	if(map==MAP_FAILED)
+	{
+		printf("@popcount_file, error occurs for mmap %s errno %d \n",path,errno);
+		return -1;
+	}
+	madvise(map,(size_t)st.st_size,MADV_SEQUENTIAL);
+	ret=popcount_run((const uint8_t *)map,(size_t)st.st_size,nthreads,1,bits);
+	munmap(map,(size_t)st.st_size);
+	return ret;
+}
@@ -0,0 +1,29 @@
+#ifndef BIT_COUNTING_POPCOUNT_FILE_H
+#define BIT_COUNTING_POPCOUNT_FILE_H
+
+/*
+Multi-threaded popcount over large buffers and memory-mapped files.
+
+popcount_parallel cuts the buffer into POPCOUNT_CHUNK pieces whose
+boundaries fall on cache lines, and nthreads workers (the caller is one
+of them) claim pieces from a shared counter until none are left, so a
+slow page fault on one chunk does not leave the other threads idle. Each
+worker sums into its own cache line and the totals are added at the end.
+
+popcount_file maps the file read-only, marks it MADV_SEQUENTIAL for
+aggressive readahead, and every worker asks for its claimed chunk with
+MADV_WILLNEED before counting it. The kernel is whatever popcount()
+dispatches to. nthreads<=0 means one per online CPU.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define POPCOUNT_CHUNK (4u<<20)
+#define POPCOUNT_MAX_THREADS 256
+
+int popcount_parallel(const uint8_t *data, size_t len, int nthreads, uint64_t *bits);
+/* 0 and the count of 1 bits in *bits, -1 if the file cannot be mapped */
+int popcount_file(const char *path, int nthreads, uint64_t *bits);
+
+#endif
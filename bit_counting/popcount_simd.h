@@ -0,0 +1,30 @@
+#ifndef BIT_COUNTING_POPCOUNT_SIMD_H
+#define BIT_COUNTING_POPCOUNT_SIMD_H
+
+/* vector helpers shared by the popcount.c and bitmap.c kernels, x86 only */
+
+#include <stdint.h>
+#include <immintrin.h>
+
+/* per-byte bit counts of v (each 0..8), nibble lookup with VPSHUFB */
+__attribute__((target("avx2")))
+static inline __m256i avx2_byte_counts(__m256i v)
+{
+	const __m256i lookup=_mm256_setr_epi8(0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4,
+		0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4);
+	const __m256i low_mask=_mm256_set1_epi8(0x0f);
+	__m256i lo=_mm256_and_si256(v,low_mask);
+	__m256i hi=_mm256_and_si256(_mm256_srli_epi16(v,4),low_mask);
+
+	return _mm256_add_epi8(_mm256_shuffle_epi8(lookup,lo),_mm256_shuffle_epi8(lookup,hi));
+}
+
+/* sum of the four 64-bit lanes */
+__attribute__((target("avx2")))
+static inline uint64_t avx2_reduce_epi64(__m256i v)
+{
+	return (uint64_t)_mm256_extract_epi64(v,0)+(uint64_t)_mm256_extract_epi64(v,1)+
+		(uint64_t)_mm256_extract_epi64(v,2)+(uint64_t)_mm256_extract_epi64(v,3);
+}
+
+#endif
@@ -21,14 +21,17 @@ https://linuxconfig.org/how-to-extract-a-number-from-a-string-using-bash-example
 ->sec conmmand csdn
 https://blog.csdn.net/lzm1340458776/article/details/44160625
 
-void counting(unsigned char input)
+int counting(unsigned char input)
 {
 	int counter=0;
-	for(int a=0;i<8;i++)
+	for(int i=0;i<8;i++)
 	{
-		if(input&(1<<i)==i)
+		if((input&(1<<i))!=0)
 		{
 			counter++;
 		}
 	}
+	return counter;
 }
+(bulk version over whole buffers, table/POPCNT/AVX2/AVX-512 picked at runtime:
+bit_counting/popcount.c)
@@ -0,0 +1,275 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "audio_bus.h"
+
+int audio_bus_init(audio_bus_t *bus, size_t frame_bytes, unsigned long period_frames, unsigned int slots)
+{
+	size_t period_bytes=(period_frames*frame_bytes+63)&~(size_t)63;
+	unsigned int i;
+
+	memset(bus,0,sizeof(*bus));
+	if(frame_bytes==0||period_frames==0||slots<2)
+	{
+		fprintf(stderr,"@audio_bus_init, error occurs for %u slots of %lu frames of %zu bytes \n",
+			slots,period_frames,frame_bytes);
+		return -1;
+	}
+	bus->frame_bytes=frame_bytes;
+	bus->period_frames=period_frames;
+	bus->slots=slots;
+	/* every slot, one borrowed by each consumer and the one being filled */
+	bus->pool_size=slots+AUDIO_BUS_MAX_CONSUMERS+1;
+	bus->ring=calloc(slots,sizeof(*bus->ring));
+	bus->pool=(audio_bus_buffer_t *)aligned_alloc(64,bus->pool_size*sizeof(audio_bus_buffer_t));
+	bus->data=(char *)aligned_alloc(64,bus->pool_size*period_bytes);
+	if(bus->ring==NULL||bus->pool==NULL||bus->data==NULL)
+	{
+		fprintf(stderr,"@audio_bus_init, error occurs for %u buffers of %zu bytes \n",bus->pool_size,period_bytes);
+		audio_bus_destroy(bus);
+		return -1;
+	}
+	/* fault the pages in now rather than in the audio path */
+	memset(bus->data,0,bus->pool_size*period_bytes);
+	for(i=0;i<slots;i++)
+	{
+		atomic_init(&bus->ring[i],NULL);
+	}
+	for(i=0;i<bus->pool_size;i++)
+	{
+		audio_bus_buffer_t *b=&bus->pool[i];
+
+		atomic_init(&b->refs,0);
+		atomic_init(&b->seq,AUDIO_BUS_NO_SEQ);
+		b->frames=0;
+		b->data=bus->data+i*period_bytes;
+	}
+	for(i=0;i<AUDIO_BUS_MAX_CONSUMERS;i++)
+	{
+		atomic_init(&bus->consumers[i].active,0);
+		bus->consumers[i].wake_fd=-1;
+	}
+	atomic_init(&bus->head,0);
+	atomic_init(&bus->overruns,0);
+	return 0;
+}
+
+void audio_bus_destroy(audio_bus_t *bus)
+{
+	int i;
+
+	for(i=0;i<AUDIO_BUS_MAX_CONSUMERS;i++)
+	{
+		if(bus->consumers[i].wake_fd>=0)
+			close(bus->consumers[i].wake_fd);
+		bus->consumers[i].wake_fd=-1;
+	}
+	free(bus->ring);
+	free(bus->pool);
+	free(bus->data);
+	bus->ring=NULL;
+	bus->pool=NULL;
+	bus->data=NULL;
+}
+
+static void buffer_put(audio_bus_buffer_t *b)
+{
+	atomic_fetch_sub_explicit(&b->refs,1,memory_order_acq_rel);
+}
+
+void *audio_bus_acquire_write(audio_bus_t *bus)
+{
+	unsigned int i;
+
+	if(bus->filling!=NULL)
+		return bus->filling->data;
+	for(i=0;i<bus->pool_size;i++)
+	{
+		audio_bus_buffer_t *b=&bus->pool[(bus->scan+i)%bus->pool_size];
+		unsigned int zero=0;
+
+		/* free is a count of zero; taking it is the CAS that makes it one */
+		if(atomic_compare_exchange_strong_explicit(&b->refs,&zero,1,memory_order_acq_rel,memory_order_relaxed))
+		{
+			bus->scan=(bus->scan+i+1)%bus->pool_size;
+			bus->filling=b;
+			return b->data;
+		}
+	}
+	atomic_fetch_add_explicit(&bus->overruns,1,memory_order_relaxed);
+	return NULL;
+}
+
+void audio_bus_publish(audio_bus_t *bus, unsigned long frames)
+{
+	audio_bus_buffer_t *b=bus->filling;
+	audio_bus_buffer_t *old;
+	uint64_t seq=atomic_load_explicit(&bus->head,memory_order_relaxed);
+	int i;
+
+	if(b==NULL)
+		return;
+	bus->filling=NULL;
+	b->frames=frames<bus->period_frames ? frames : bus->period_frames;
+	atomic_store_explicit(&b->seq,seq,memory_order_release);
+	old=atomic_exchange_explicit(&bus->ring[seq%bus->slots],b,memory_order_acq_rel);
+	if(old!=NULL)
+	{
+		/* anyone who borrowed it before this keeps it; nobody new can */
+		atomic_store_explicit(&old->seq,AUDIO_BUS_NO_SEQ,memory_order_seq_cst);
+		buffer_put(old);
+	}
+	atomic_store_explicit(&bus->head,seq+1,memory_order_seq_cst);
+	for(i=0;i<AUDIO_BUS_MAX_CONSUMERS;i++)
+	{
+		audio_bus_consumer_t *c=&bus->consumers[i];
+		uint64_t one=1;
+
+		if(!atomic_load_explicit(&c->active,memory_order_relaxed)||
+			!atomic_exchange_explicit(&c->armed,0,memory_order_seq_cst))
+			continue;
+		if(write(c->wake_fd,&one,sizeof(one))<0&&errno!=EAGAIN)
+			fprintf(stderr,"@audio_bus_publish, error occurs for eventfd errno %d \n",errno);
+	}
+}
+
+int audio_bus_attach(audio_bus_t *bus, unsigned int lag)
+{
+	int i;
+
+	for(i=0;i<AUDIO_BUS_MAX_CONSUMERS;i++)
+	{
+		audio_bus_consumer_t *c=&bus->consumers[i];
+
+		if(atomic_load(&c->active))
+			continue;
+		if(c->wake_fd<0)
+			c->wake_fd=eventfd(0,EFD_NONBLOCK|EFD_CLOEXEC);
+		if(c->wake_fd<0)
+			break;
+		c->lag=lag==0||lag>bus->slots ? bus->slots : lag;
+		c->held=NULL;
+		atomic_init(&c->cursor,atomic_load(&bus->head));
+		atomic_init(&c->armed,0);
+		atomic_init(&c->periods,0);
+		atomic_init(&c->dropped,0);
+		atomic_init(&c->max_behind,0);
+		atomic_store(&c->active,1);
+		return i;
+	}
+	fprintf(stderr,"@audio_bus_attach, error occurs for consumer %d of %d \n",i,AUDIO_BUS_MAX_CONSUMERS);
+	return -1;
+}
+
+void audio_bus_detach(audio_bus_t *bus, int id)
+{
+	audio_bus_consumer_t *c=&bus->consumers[id];
+
+	if(c->held!=NULL)
+		buffer_put(c->held);
+	c->held=NULL;
+	atomic_store(&c->active,0);
+}
+
+int audio_bus_acquire_read(audio_bus_t *bus, int id, const void **data, unsigned long *frames, uint64_t *seq)
+{
+	audio_bus_consumer_t *c=&bus->consumers[id];
+	uint64_t cursor;
+
+	/* the previous period is done with, whether or not it was released */
+	audio_bus_release(bus,id);
+	cursor=atomic_load_explicit(&c->cursor,memory_order_relaxed);
+	while(1)
+	{
+		uint64_t head=atomic_load_explicit(&bus->head,memory_order_acquire);
+		audio_bus_buffer_t *b;
+
+		if(cursor>=head)
+			return 0;
+		if(head-cursor>c->lag)
+		{
+			/* too far behind: skip to the oldest period the limit allows */
+			atomic_fetch_add_explicit(&c->dropped,head-c->lag-cursor,memory_order_relaxed);
+			cursor=head-c->lag;
+			atomic_store_explicit(&c->cursor,cursor,memory_order_relaxed);
+		}
+		if(head-cursor>atomic_load_explicit(&c->max_behind,memory_order_relaxed))
+			atomic_store_explicit(&c->max_behind,head-cursor,memory_order_relaxed);
+		b=atomic_load_explicit(&bus->ring[cursor%bus->slots],memory_order_acquire);
+		if(b==NULL)
+			return 0;
+		/* borrow first, then make sure it is still the period wanted */
+		atomic_fetch_add_explicit(&b->refs,1,memory_order_seq_cst);
+		if(atomic_load_explicit(&b->seq,memory_order_seq_cst)==cursor)
+		{
+			c->held=b;
+			*data=b->data;
+			*frames=b->frames;
+			*seq=cursor;
+			return 1;
+		}
+		/* the slot was published over between the load and the borrow: that period is gone */
+		buffer_put(b);
+		atomic_fetch_add_explicit(&c->dropped,1,memory_order_relaxed);
+		cursor++;
+		atomic_store_explicit(&c->cursor,cursor,memory_order_relaxed);
+	}
+}
+
+void audio_bus_release(audio_bus_t *bus, int id)
+{
+	audio_bus_consumer_t *c=&bus->consumers[id];
+
+	if(c->held==NULL)
+		return;
+	buffer_put(c->held);
+	c->held=NULL;
+	atomic_fetch_add_explicit(&c->periods,1,memory_order_relaxed);
+	atomic_store_explicit(&c->cursor,atomic_load_explicit(&c->cursor,memory_order_relaxed)+1,
+		memory_order_relaxed);
+}
+
+int audio_bus_fd(audio_bus_t *bus, int id)
+{
+	return bus->consumers[id].wake_fd;
+}
+
+int audio_bus_arm(audio_bus_t *bus, int id)
+{
+	audio_bus_consumer_t *c=&bus->consumers[id];
+	uint64_t next=atomic_load_explicit(&c->cursor,memory_order_relaxed)+(c->held!=NULL);
+
+	atomic_store_explicit(&c->armed,1,memory_order_seq_cst);
+	/* a publish between the last acquire and the store above would not wake us */
+	if(atomic_load_explicit(&bus->head,memory_order_seq_cst)>next)
+	{
+		atomic_store_explicit(&c->armed,0,memory_order_relaxed);
+		return 1;
+	}
+	return 0;
+}
+
+int audio_bus_wait(audio_bus_t *bus, int id, int timeout_ms)
+{
+	struct pollfd pfd;
+	uint64_t count;
+	int rc;
+
+	if(audio_bus_arm(bus,id))
+		return 1;
+	pfd.fd=audio_bus_fd(bus,id);
+	pfd.events=POLLIN;
+	pfd.revents=0;
+	rc=poll(&pfd,1,timeout_ms);
+	if(rc<0)
+		return errno==EINTR ? 0 : -1;
+	if(rc==0)
+		return 0;
+	if(read(pfd.fd,&count,sizeof(count))<0&&errno!=EAGAIN)
+		return -1;
+	return 1;
+}
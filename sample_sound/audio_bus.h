@@ -0,0 +1,106 @@
+#ifndef SAMPLE_SOUND_AUDIO_BUS_H
+#define SAMPLE_SOUND_AUDIO_BUS_H
+
+/*
+Single-producer, many-consumer broadcast of whole periods: one capture
+stream to a recorder, an analyzer, a network sender ... without reading
+the device twice or copying a period once per consumer.
+
+The producer takes a free period buffer (audio_bus_acquire_write),
+reads the device straight into it and publishes it under the next
+sequence number. The last `slots` published periods stay in a ring of
+buffer pointers. Each consumer keeps its own cursor, the sequence
+number it wants next, and borrows that period in place
+(audio_bus_acquire_read) until audio_bus_release; there is no copy on
+either side.
+
+Buffers are refcounted: one reference for the ring slot holding it and
+one for each consumer borrowing it. When the producer publishes over a
+slot it drops the slot's reference. A buffer whose count is zero is
+free, and the producer takes it again with a CAS from 0, so a buffer is
+never written while anyone is reading it. With slots + consumers + 1
+buffers the producer always finds a free one; should it not, the period
+is counted in overruns rather than waited for.
+
+Each consumer has a lag limit, in periods, up to slots. The producer
+never waits for anyone. A consumer that finds itself further behind
+than its limit skips to the oldest period it is allowed, and the skipped
+periods count in its dropped total. A stalled recorder therefore loses
+its own periods and costs the analyzer nothing.
+
+A consumer can sleep in audio_bus_wait, or poll audio_bus_fd in its own
+loop after audio_bus_arm. The producer writes that eventfd only for a
+consumer that has armed it, so a consumer that keeps up costs the
+producer no system call.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#define AUDIO_BUS_MAX_CONSUMERS 8
+#define AUDIO_BUS_NO_SEQ UINT64_MAX
+
+typedef struct audio_bus_buffer {
+	_Alignas(64) atomic_uint refs;
+	atomic_uint_fast64_t seq;    /* published as, AUDIO_BUS_NO_SEQ once replaced */
+	unsigned long frames;
+	char *data;
+} audio_bus_buffer_t;
+
+typedef struct audio_bus_consumer {
+	atomic_int active;
+	uint64_t lag;                /* periods it may fall behind */
+	int wake_fd;
+	_Alignas(64) atomic_uint_fast64_t cursor;
+	atomic_int armed;
+	audio_bus_buffer_t *held;    /* borrowed by the last acquire_read */
+	atomic_uint_fast64_t periods;
+	atomic_uint_fast64_t dropped;
+	atomic_uint_fast64_t max_behind;
+} audio_bus_consumer_t;
+
+typedef struct audio_bus {
+	size_t frame_bytes;
+	unsigned long period_frames;
+	unsigned int slots;
+	_Atomic(audio_bus_buffer_t *) *ring;
+	audio_bus_buffer_t *pool;
+	unsigned int pool_size;
+	char *data;
+
+	/* producer */
+	audio_bus_buffer_t *filling;
+	unsigned int scan;
+	_Alignas(64) atomic_uint_fast64_t head;      /* sequence number of the next period */
+	atomic_uint_fast64_t overruns;
+
+	audio_bus_consumer_t consumers[AUDIO_BUS_MAX_CONSUMERS];
+} audio_bus_t;
+
+/* slots: periods kept for the consumers (the largest lag allowed) */
+int audio_bus_init(audio_bus_t *bus, size_t frame_bytes, unsigned long period_frames, unsigned int slots);
+void audio_bus_destroy(audio_bus_t *bus);
+
+/* producer: a period to fill in place, NULL (counted in overruns) if none is free */
+void *audio_bus_acquire_write(audio_bus_t *bus);
+/* hand the filled frames (at most a period) to every consumer */
+void audio_bus_publish(audio_bus_t *bus, unsigned long frames);
+
+/* a new consumer starting at the next period published; its id, or -1 */
+int audio_bus_attach(audio_bus_t *bus, unsigned int lag);
+void audio_bus_detach(audio_bus_t *bus, int id);
+/*
+borrow the consumer's next period: 1 with *data, *frames and *seq set, 0 if
+nothing new has been published. The frames stay valid, and must not be
+written, until audio_bus_release.
+*/
+int audio_bus_acquire_read(audio_bus_t *bus, int id, const void **data, unsigned long *frames, uint64_t *seq);
+void audio_bus_release(audio_bus_t *bus, int id);
+/* before sleeping on audio_bus_fd: 0 once armed, 1 if a period is already there */
+int audio_bus_arm(audio_bus_t *bus, int id);
+int audio_bus_fd(audio_bus_t *bus, int id);
+/* sleep until there is a period to read: 1, 0 on timeout, -1 on error */
+int audio_bus_wait(audio_bus_t *bus, int id, int timeout_ms);
+
+#endif
@@ -0,0 +1,171 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "audio_ring.h"
+
+int audio_ring_init(audio_ring_t *r, uint64_t capacity, size_t frame_bytes, audio_ring_policy_t policy)
+{
+	uint64_t frames=1;
+
+	while(frames<capacity)
+	{
+		frames<<=1;
+	}
+	r->frame_bytes=frame_bytes;
+	r->capacity=frames;
+	r->policy=policy;
+	r->read_start=0;
+	atomic_init(&r->head,0);
+	atomic_init(&r->tail,0);
+	atomic_init(&r->dropped,0);
+	atomic_init(&r->overwritten,0);
+	atomic_init(&r->high_water,0);
+	r->data=(char *)malloc(frames*frame_bytes);
+	if(r->data==NULL||frame_bytes==0)
+	{
+		fprintf(stderr,"@audio_ring_init, error occurs for %lu frames of %zu bytes \n",
+			(unsigned long)frames,frame_bytes);
+		free(r->data);
+		r->data=NULL;
+		return -1;
+	}
+	/* fault the pages in now rather than in the audio path */
+	memset(r->data,0,frames*frame_bytes);
+	return 0;
+}
+
+void audio_ring_destroy(audio_ring_t *r)
+{
+	free(r->data);
+	r->data=NULL;
+}
+
+static uint64_t min3(uint64_t a, uint64_t b, uint64_t c)
+{
+	uint64_t m=a<b ? a : b;
+
+	return m<c ? m : c;
+}
+
+uint64_t audio_ring_acquire_write(audio_ring_t *r, void **area, uint64_t frames)
+{
+	uint64_t head=atomic_load_explicit(&r->head,memory_order_relaxed);
+	uint64_t tail=atomic_load_explicit(&r->tail,memory_order_acquire);
+	uint64_t contig=r->capacity-(head&(r->capacity-1));
+
+	if(r->policy==AUDIO_RING_OVERWRITE&&r->capacity-(head-tail)<min3(frames,contig,r->capacity))
+	{
+		/* give up the oldest frames; tail only ever moves forward */
+		uint64_t target=head+min3(frames,contig,r->capacity)-r->capacity;
+
+		while(tail<target)
+		{
+			if(atomic_compare_exchange_weak_explicit(&r->tail,&tail,target,
+				memory_order_acq_rel,memory_order_acquire))
+			{
+				atomic_fetch_add_explicit(&r->overwritten,target-tail,memory_order_relaxed);
+				tail=target;
+				break;
+			}
+		}
+	}
+	*area=r->data+(size_t)(head&(r->capacity-1))*r->frame_bytes;
+	return min3(frames,r->capacity-(head-tail),contig);
+}
+
+void audio_ring_commit_write(audio_ring_t *r, uint64_t frames)
+{
+	uint64_t head=atomic_load_explicit(&r->head,memory_order_relaxed)+frames;
+	uint64_t fill=head-atomic_load_explicit(&r->tail,memory_order_relaxed);
+
+	atomic_store_explicit(&r->head,head,memory_order_release);
+	if(fill>atomic_load_explicit(&r->high_water,memory_order_relaxed))
+		atomic_store_explicit(&r->high_water,fill,memory_order_relaxed);
+}
+
+void audio_ring_drop(audio_ring_t *r, uint64_t frames)
+{
+	atomic_fetch_add_explicit(&r->dropped,frames,memory_order_relaxed);
+}
+
+uint64_t audio_ring_write(audio_ring_t *r, const void *src, uint64_t frames)
+{
+	const char *from=(const char *)src;
+	uint64_t done=0;
+
+	while(done<frames)
+	{
+		void *area;
+		uint64_t n=audio_ring_acquire_write(r,&area,frames-done);
+
+		if(n==0)
+			break;
+		memcpy(area,from+done*r->frame_bytes,(size_t)n*r->frame_bytes);
+		audio_ring_commit_write(r,n);
+		done+=n;
+	}
+	if(done<frames)
+		audio_ring_drop(r,frames-done);
+	return done;
+}
+
+uint64_t audio_ring_acquire_read(audio_ring_t *r, void **area, uint64_t frames)
+{
+	uint64_t tail=atomic_load_explicit(&r->tail,memory_order_acquire);
+	uint64_t head=atomic_load_explicit(&r->head,memory_order_acquire);
+
+	r->read_start=tail;
+	*area=r->data+(size_t)(tail&(r->capacity-1))*r->frame_bytes;
+	return min3(frames,head-tail,r->capacity-(tail&(r->capacity-1)));
+}
+
+int audio_ring_commit_read(audio_ring_t *r, uint64_t frames)
+{
+	uint64_t expected=r->read_start;
+	uint64_t target=r->read_start+frames;
+
+	if(r->policy==AUDIO_RING_DROP_NEWEST)
+	{
+		atomic_store_explicit(&r->tail,target,memory_order_release);
+		return 0;
+	}
+	if(atomic_compare_exchange_strong_explicit(&r->tail,&expected,target,
+		memory_order_acq_rel,memory_order_acquire))
+		return 0;
+	/* the producer moved tail under us: what was read may be torn */
+	while(expected<target)
+	{
+		if(atomic_compare_exchange_weak_explicit(&r->tail,&expected,target,
+			memory_order_acq_rel,memory_order_acquire))
+			break;
+	}
+	return -1;
+}
+
+uint64_t audio_ring_read(audio_ring_t *r, void *dst, uint64_t frames)
+{
+	char *to=(char *)dst;
+	uint64_t done=0;
+
+	while(done<frames)
+	{
+		void *area;
+		uint64_t n=audio_ring_acquire_read(r,&area,frames-done);
+
+		if(n==0)
+			break;
+		memcpy(to+done*r->frame_bytes,area,(size_t)n*r->frame_bytes);
+		/* overwritten while copying: that piece is stale, carry on from the new tail */
+		if(audio_ring_commit_read(r,n)!=0)
+			continue;
+		done+=n;
+	}
+	return done;
+}
+
+uint64_t audio_ring_fill(audio_ring_t *r)
+{
+	uint64_t tail=atomic_load_explicit(&r->tail,memory_order_acquire);
+
+	return atomic_load_explicit(&r->head,memory_order_acquire)-tail;
+}
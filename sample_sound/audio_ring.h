@@ -0,0 +1,74 @@
+#ifndef SAMPLE_SOUND_AUDIO_RING_H
+#define SAMPLE_SOUND_AUDIO_RING_H
+
+/*
+Single-producer/single-consumer ring of interleaved frames.
+
+Capacity is a power of two frames. head and tail are running frame
+counts (never wrapped), so head-tail is the fill and, divided by the
+rate, the latency the ring adds. The producer only stores head and the
+consumer only stores tail; no call waits or loops on the other side.
+
+Zero-copy use goes through acquire/commit: audio_ring_acquire_write
+returns the largest contiguous free region (up to the wrap point), the
+producer fills part of it in place and commits that many frames;
+audio_ring_acquire_read/commit_read do the same on the other side.
+audio_ring_write/audio_ring_read copy across the wrap for callers that
+have their own buffer.
+
+What happens when the producer finds the ring full is set at init:
+  AUDIO_RING_DROP_NEWEST  the new frames are not stored (dropped counts them)
+  AUDIO_RING_OVERWRITE    the oldest frames are given up to make room
+                          (overwritten counts them): the producer pushes
+                          tail forward with a CAS, and the consumer's
+                          commit_read notices and returns -1, since what
+                          it read may have been overwritten underneath it
+Overwrite keeps the latency bounded for a consumer that stalls, at the
+cost of that consumer having to check every commit.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+typedef enum audio_ring_policy {
+	AUDIO_RING_DROP_NEWEST,
+	AUDIO_RING_OVERWRITE
+} audio_ring_policy_t;
+
+typedef struct audio_ring {
+	char *data;
+	size_t frame_bytes;
+	uint64_t capacity;           /* frames, power of two */
+	audio_ring_policy_t policy;
+	_Alignas(64) atomic_uint_fast64_t head;
+	atomic_uint_fast64_t dropped;
+	atomic_uint_fast64_t overwritten;
+	atomic_uint_fast64_t high_water;
+	_Alignas(64) atomic_uint_fast64_t tail;
+	uint64_t read_start;          /* consumer: tail seen by the last acquire_read */
+} audio_ring_t;
+
+/* capacity is rounded up to a power of two frames */
+int audio_ring_init(audio_ring_t *r, uint64_t capacity, size_t frame_bytes, audio_ring_policy_t policy);
+void audio_ring_destroy(audio_ring_t *r);
+
+/* producer */
+uint64_t audio_ring_acquire_write(audio_ring_t *r, void **area, uint64_t frames);
+void audio_ring_commit_write(audio_ring_t *r, uint64_t frames);
+/* copy in, applying the full-ring policy; frames stored */
+uint64_t audio_ring_write(audio_ring_t *r, const void *src, uint64_t frames);
+/* frames the producer had to throw away itself (DROP_NEWEST) */
+void audio_ring_drop(audio_ring_t *r, uint64_t frames);
+
+/* consumer */
+uint64_t audio_ring_acquire_read(audio_ring_t *r, void **area, uint64_t frames);
+/* 0, or -1 if the producer overwrote part of what was acquired */
+int audio_ring_commit_read(audio_ring_t *r, uint64_t frames);
+/* copy out; frames read */
+uint64_t audio_ring_read(audio_ring_t *r, void *dst, uint64_t frames);
+
+/* frames queued, from either side */
+uint64_t audio_ring_fill(audio_ring_t *r);
+
+#endif
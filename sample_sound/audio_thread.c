@@ -0,0 +1,310 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include "audio_thread.h"
+#include "pcm_backend.h"
+
+static uint64_t audio_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint64_t)ts.tv_sec*1000000000u+(uint64_t)ts.tv_nsec;
+}
+
+static void stat_max(atomic_uint_fast64_t *a, uint64_t v)
+{
+	if(v>atomic_load_explicit(a,memory_order_relaxed))
+		atomic_store_explicit(a,v,memory_order_relaxed);
+}
+
+static void notify_app(audio_thread_t *t)
+{
+	uint64_t one=1;
+
+	if(write(t->notify_fd,&one,sizeof(one))<0&&errno!=EAGAIN)
+		fprintf(stderr,"@notify_app, error occurs for eventfd errno %d \n",errno);
+}
+
+/* move up to budget periods from the device into the ring, stopping early
+if it would block; -1 once the stream is over */
+static int capture_ready(audio_thread_t *t, uint64_t budget)
+{
+	pcm_t *pcm=t->pcm;
+	unsigned long period=pcm->config.period_frames;
+	long n;
+
+	while(budget>0)
+	{
+		void *area;
+		unsigned long want=period-t->partial;
+		uint64_t room=audio_ring_acquire_write(t->ring,&area,want);
+
+		if(room==0)
+		{
+			/* the application is behind and the ring keeps what it has */
+			n=pcm_read(pcm,t->spare,want);
+			if(n>0)
+				audio_ring_drop(t->ring,(uint64_t)n);
+		}else{
+			/* straight from the device into the ring */
+			n=pcm_read(pcm,area,(unsigned long)room);
+			if(n>0)
+				audio_ring_commit_write(t->ring,(uint64_t)n);
+		}
+		if(n<0||(n==0&&pcm->eof))
+			return -1;
+		t->partial+=(unsigned long)n;
+		if(t->partial<period)
+		{
+			/* short at the wrap point: go round for the rest */
+			if(room!=0&&(unsigned long)n==room)
+				continue;
+			return 0;
+		}
+		t->partial=0;
+		budget--;
+		atomic_fetch_add_explicit(&t->periods,1,memory_order_relaxed);
+		notify_app(t);
+	}
+	return 0;
+}
+
+/* move up to budget periods from the ring (or silence) into the device */
+static int playback_ready(audio_thread_t *t, uint64_t budget)
+{
+	pcm_t *pcm=t->pcm;
+	unsigned long period=pcm->config.period_frames;
+	long n;
+
+	while(budget>0)
+	{
+		void *area;
+		unsigned long want=period-t->partial;
+		uint64_t avail=audio_ring_acquire_read(t->ring,&area,want);
+
+		if(avail==0)
+		{
+			n=pcm_write(pcm,t->spare,want);
+			if(n>0)
+				atomic_fetch_add_explicit(&t->silence_frames,(uint64_t)n,memory_order_relaxed);
+		}else{
+			n=pcm_write(pcm,area,(unsigned long)avail);
+			if(n>0&&audio_ring_commit_read(t->ring,(uint64_t)n)!=0)
+				atomic_fetch_add_explicit(&t->torn_frames,(uint64_t)n,memory_order_relaxed);
+		}
+		if(n<0)
+			return -1;
+		if(n==0)
+			return 0;
+		t->partial+=(unsigned long)n;
+		if(t->partial<period)
+		{
+			if(avail!=0&&(unsigned long)n==avail)
+				continue;
+			return 0;
+		}
+		t->partial=0;
+		budget--;
+		atomic_fetch_add_explicit(&t->periods,1,memory_order_relaxed);
+		notify_app(t);
+	}
+	return 0;
+}
+
+static void audio_thread_realtime(audio_thread_t *t)
+{
+	struct sched_param param;
+	int rc;
+
+	if(t->rt_priority<=0)
+		return;
+	memset(&param,0,sizeof(param));
+	param.sched_priority=t->rt_priority;
+	rc=pthread_setschedparam(pthread_self(),SCHED_FIFO,&param);
+	if(rc!=0)
+		fprintf(stderr,"@audio_thread, SCHED_FIFO %d not granted (%s), staying at normal priority \n",
+			t->rt_priority,strerror(rc));
+}
+
+static void *audio_thread_run(void *arg)
+{
+	audio_thread_t *t=(audio_thread_t *)arg;
+	pcm_t *pcm=t->pcm;
+	struct pollfd pfds[AUDIO_THREAD_MAX_FDS+1];
+	int npcm;
+	int nfds;
+	int rc=0;
+	uint64_t last_wake=audio_now_ns();
+
+	audio_thread_realtime(t);
+	npcm=pcm->ops->clocked ? pcm_poll_descriptors(pcm,pfds,AUDIO_THREAD_MAX_FDS) : 0;
+	if(npcm<0)
+		goto done;
+	nfds=npcm;
+	if(npcm==0)
+	{
+		/* no device clock to wait on: tick once per period instead */
+		pfds[nfds].fd=t->timer_fd;
+		pfds[nfds].events=POLLIN;
+		nfds++;
+	}
+	pfds[nfds].fd=t->wake_fd;
+	pfds[nfds].events=POLLIN;
+	nfds++;
+
+	while(atomic_load_explicit(&t->running,memory_order_relaxed))
+	{
+		unsigned short revents=0;
+		uint64_t budget=UINT64_MAX;
+		uint64_t now;
+
+		if(poll(pfds,(nfds_t)nfds,-1)<0)
+		{
+			if(errno==EINTR)
+				continue;
+			fprintf(stderr,"@audio_thread, error occurs for poll errno %d \n",errno);
+			break;
+		}
+		now=audio_now_ns();
+		stat_max(&t->wake_max_ns,now-last_wake);
+		last_wake=now;
+		if(pfds[nfds-1].revents&POLLIN)
+			break;
+		if(npcm==0)
+		{
+			/* one period per elapsed tick, as the device would have moved */
+			if(read(t->timer_fd,&budget,sizeof(budget))<0)
+				continue;
+			revents=pcm->config.stream==PCM_CAPTURE ? POLLIN : POLLOUT;
+		}else if(pcm_poll_revents(pcm,pfds,(unsigned int)npcm,&revents)!=0){
+			break;
+		}
+		if(revents&(POLLIN|POLLOUT|POLLERR))
+		{
+			/* POLLERR is an xrun: the transfer returns -EPIPE and pcm_recover handles it */
+			rc=pcm->config.stream==PCM_CAPTURE ? capture_ready(t,budget) : playback_ready(t,budget);
+			if(rc<0)
+				break;
+		}
+		stat_max(&t->busy_max_ns,audio_now_ns()-now);
+	}
+done:
+	atomic_store(&t->finished,1);
+	notify_app(t);
+	return NULL;
+}
+
+static int timer_start(audio_thread_t *t)
+{
+	struct itimerspec its;
+	unsigned long us=pcm_period_us(t->pcm);
+
+	memset(&its,0,sizeof(its));
+	its.it_interval.tv_sec=(time_t)(us/1000000);
+	its.it_interval.tv_nsec=(long)(us%1000000)*1000;
+	its.it_value=its.it_interval;
+	if(us==0)
+		its.it_value.tv_nsec=its.it_interval.tv_nsec=1000;
+	return timerfd_settime(t->timer_fd,0,&its,NULL);
+}
+
+int audio_thread_start(audio_thread_t *t, pcm_t *pcm, audio_ring_t *ring, int rt_priority, int lock_memory)
+{
+	size_t period_bytes=pcm->config.period_frames*pcm->frame_bytes;
+
+	memset(t,0,sizeof(*t));
+	t->pcm=pcm;
+	t->ring=ring;
+	t->rt_priority=rt_priority;
+	atomic_init(&t->running,1);
+	atomic_init(&t->finished,0);
+	atomic_init(&t->periods,0);
+	atomic_init(&t->silence_frames,0);
+	atomic_init(&t->torn_frames,0);
+	atomic_init(&t->wake_max_ns,0);
+	atomic_init(&t->busy_max_ns,0);
+	t->wake_fd=eventfd(0,EFD_NONBLOCK|EFD_CLOEXEC);
+	t->notify_fd=eventfd(0,EFD_NONBLOCK|EFD_CLOEXEC);
+	t->timer_fd=timerfd_create(CLOCK_MONOTONIC,TFD_NONBLOCK|TFD_CLOEXEC);
+	t->spare=(char *)malloc(period_bytes);
+	if(t->wake_fd<0||t->notify_fd<0||t->timer_fd<0||t->spare==NULL||
+		ring->frame_bytes!=pcm->frame_bytes||timer_start(t)!=0)
+	{
+		fprintf(stderr,"@audio_thread_start, error occurs for a period of %zu bytes, ring frames of %zu \n",
+			period_bytes,ring->frame_bytes);
+		goto fail;
+	}
+	/* fault the page in before the audio thread runs */
+	memset(t->spare,0,period_bytes);
+	if(lock_memory&&mlockall(MCL_CURRENT|MCL_FUTURE)!=0)
+		fprintf(stderr,"@audio_thread_start, mlockall not granted (errno %d), memory stays pageable \n",errno);
+	if(pthread_create(&t->thread,NULL,audio_thread_run,t)!=0)
+	{
+		fprintf(stderr,"@audio_thread_start, error occurs for pthread_create \n");
+		goto fail;
+	}
+	return 0;
+
+fail:
+	if(t->wake_fd>=0)
+		close(t->wake_fd);
+	if(t->notify_fd>=0)
+		close(t->notify_fd);
+	if(t->timer_fd>=0)
+		close(t->timer_fd);
+	free(t->spare);
+	t->spare=NULL;
+	return -1;
+}
+
+void audio_thread_stop(audio_thread_t *t)
+{
+	uint64_t one=1;
+
+	atomic_store(&t->running,0);
+	if(write(t->wake_fd,&one,sizeof(one))<0)
+		fprintf(stderr,"@audio_thread_stop, error occurs for eventfd errno %d \n",errno);
+	pthread_join(t->thread,NULL);
+	close(t->wake_fd);
+	close(t->notify_fd);
+	close(t->timer_fd);
+	free(t->spare);
+	t->spare=NULL;
+}
+
+int audio_thread_fd(audio_thread_t *t)
+{
+	return t->notify_fd;
+}
+
+int audio_thread_wait(audio_thread_t *t, int timeout_ms)
+{
+	struct pollfd pfd;
+	uint64_t count;
+	int rc;
+
+	pfd.fd=t->notify_fd;
+	pfd.events=POLLIN;
+	pfd.revents=0;
+	rc=poll(&pfd,1,timeout_ms);
+	if(rc<0)
+		return errno==EINTR ? 0 : -1;
+	if(rc==0)
+		return 0;
+	if(read(t->notify_fd,&count,sizeof(count))<0&&errno!=EAGAIN)
+		return -1;
+	return 1;
+}
+
+int audio_thread_finished(audio_thread_t *t)
+{
+	return atomic_load(&t->finished);
+}
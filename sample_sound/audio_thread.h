@@ -0,0 +1,70 @@
+#ifndef SAMPLE_SOUND_AUDIO_THREAD_H
+#define SAMPLE_SOUND_AUDIO_THREAD_H
+
+/*
+Dedicated audio I/O thread for a pcm_t, so the application never makes a
+blocking readi/writei call.
+
+The thread polls the PCM's descriptors (pcm_poll_descriptors; for the
+file and null backends, which have no clock of their own, a timerfd at
+the period rate so they run in real time like a device) and moves frames
+between the device and an audio_ring, the thread being the ring's
+producer for capture and its consumer for playback:
+  capture   if the application falls behind, the ring's policy decides
+            (new frames dropped or oldest overwritten); the device
+            itself never overruns
+  playback  if the ring runs dry the thread plays silence
+            (silence_frames) instead of letting the device underrun
+Since the ring is the only thing the two sides share, a capture thread
+and a playback thread can be given the same ring for an in-process
+loopback with no copy in between.
+After every period the thread makes audio_thread_fd readable, so the
+application can sleep in its own poll/epoll loop or in audio_thread_wait.
+
+The PCM should be opened with config.nonblock. With rt_priority > 0 the
+thread switches itself to SCHED_FIFO, and lock_memory mlockall()s the
+process so no page fault lands in the audio path; both only warn if the
+process lacks the privilege.
+*/
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "pcm_engine.h"
+#include "audio_ring.h"
+
+#define AUDIO_THREAD_MAX_FDS 16
+
+typedef struct audio_thread {
+	pcm_t *pcm;
+	audio_ring_t *ring;
+	int rt_priority;
+	unsigned long partial;          /* frames of the current period already moved */
+	char *spare;                    /* discard (capture) or silence (playback) */
+	int wake_fd;
+	int notify_fd;
+	int timer_fd;
+	pthread_t thread;
+	atomic_int running;
+	atomic_int finished;
+
+	atomic_uint_fast64_t periods;
+	atomic_uint_fast64_t silence_frames;
+	atomic_uint_fast64_t torn_frames;   /* played while being overwritten (AUDIO_RING_OVERWRITE) */
+	atomic_uint_fast64_t wake_max_ns;   /* longest gap between two wakeups */
+	atomic_uint_fast64_t busy_max_ns;   /* longest time from wakeup back to poll */
+} audio_thread_t;
+
+/* ring frame size must match the pcm's */
+int audio_thread_start(audio_thread_t *t, pcm_t *pcm, audio_ring_t *ring, int rt_priority, int lock_memory);
+/* stop and join the thread; the pcm and the ring stay as they are */
+void audio_thread_stop(audio_thread_t *t);
+
+/* readable after each period the thread moves */
+int audio_thread_fd(audio_thread_t *t);
+/* sleep until the thread moved a period: 1, 0 on timeout, -1 on error */
+int audio_thread_wait(audio_thread_t *t, int timeout_ms);
+/* the thread has stopped on its own (end of capture input or PCM error) */
+int audio_thread_finished(audio_thread_t *t);
+
+#endif
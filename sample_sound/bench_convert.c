@@ -0,0 +1,256 @@
+/*
+Check and timing for the pcm_convert kernels.
+
+build: gcc -O2 sample_sound/bench_convert.c sample_sound/pcm_convert.c sample_sound/pcm_engine.c sample_sound/pcm_file.c \
+              sample_sound/pcm_alsa.c sample_sound/pcm_sim.c -DPCM_ENGINE_ALSA=0 -lpthread -lm -o bench_convert
+run:   ./bench_convert [-p period_frames] [-n channels] [-m sources] [-r repeats]
+
+Every kernel set this CPU supports is first compared bit for bit with
+the scalar one on every length up to a few hundred samples, misaligned,
+with out-of-range, NaN and full-scale input. Then each operation is
+timed on one period (default the listings' 32 frames of stereo) and
+reported as nanoseconds per period, which is what has to fit in the
+period budget (725 us at 44100 Hz).
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <unistd.h>
+#include <time.h>
+#include "pcm_convert.h"
+
+#define CHECK_SAMPLES 300
+#define CHECK_SOURCES 3
+#define MAX_SOURCES 16
+
+static const char *kernel_names[]={"avx2","sse2","scalar"};
+
+#define NAME_COUNT (sizeof(kernel_names)/sizeof(kernel_names[0]))
+
+static const pcm_format_t formats[]={PCM_FORMAT_S16_LE,PCM_FORMAT_S24_3LE,PCM_FORMAT_S32_LE};
+
+#define FORMAT_COUNT (sizeof(formats)/sizeof(formats[0]))
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint64_t)ts.tv_sec*1000000000u+(uint64_t)ts.tv_nsec;
+}
+
+/* everything the kernels produce for one offset/length, compared as bytes */
+typedef struct results {
+	uint8_t ints[FORMAT_COUNT][CHECK_SAMPLES*4];
+	float floats[FORMAT_COUNT][CHECK_SAMPLES];
+	float gain[CHECK_SAMPLES];
+	float mix[CHECK_SAMPLES];
+	int16_t mix_s16[CHECK_SAMPLES];
+	float planes[2][CHECK_SAMPLES];
+	float interleaved[CHECK_SAMPLES*2];
+} results_t;
+
+static void compute(results_t *out, const float *input, const int16_t *const *s16, size_t n)
+{
+	const float *sources[CHECK_SOURCES]={input,input+1,input+2};
+	const float gains[CHECK_SOURCES]={0.5f,-1.25f,2.0f};
+	float *planes[2]={out->planes[0],out->planes[1]};
+	size_t f;
+
+	memset(out,0,sizeof(*out));
+	for(f=0;f<FORMAT_COUNT;f++)
+	{
+		pcm_from_float(out->ints[f],formats[f],input,n);
+		pcm_to_float(out->floats[f],out->ints[f],formats[f],n);
+	}
+	pcm_gain(out->gain,input,0.7f,n);
+	pcm_mix(out->mix,sources,gains,CHECK_SOURCES,n);
+	pcm_mix_s16(out->mix_s16,s16,CHECK_SOURCES,n);
+	pcm_deinterleave(planes,input,2,n/2);
+	pcm_interleave(out->interleaved,(const float *const *)planes,2,n/2);
+}
+
+static int check(const char *name, const float *input, const int16_t *s16)
+{
+	static results_t want;
+	static results_t got;
+	size_t offset;
+	size_t n;
+
+	for(offset=0;offset<8;offset+=3)
+	{
+		const int16_t *sources[CHECK_SOURCES]={s16+offset,s16+offset+CHECK_SAMPLES,s16+offset+2*CHECK_SAMPLES};
+
+		for(n=0;n<=CHECK_SAMPLES-8;n++)
+		{
+			pcm_convert_select("scalar");
+			compute(&want,input+offset,sources,n);
+			pcm_convert_select(name);
+			compute(&got,input+offset,sources,n);
+			if(memcmp(&want,&got,sizeof(want))!=0)
+			{
+				printf("@check, error occurs for kernel %s offset %zu length %zu \n",name,offset,n);
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+/* best time over repeats of 1000 periods, in ns per period */
+#define TIME(label,call) \
+	do{ \
+		uint64_t best=UINT64_MAX; \
+		int r,i; \
+		for(r=0;r<repeats;r++) \
+		{ \
+			uint64_t start=now_ns(); \
+			for(i=0;i<1000;i++) \
+			{ \
+				call; \
+				__asm__ __volatile__("" ::: "memory"); \
+			} \
+			if(now_ns()-start<best) \
+				best=now_ns()-start; \
+		} \
+		printf("  %-22s %9.1f ns/period \n",label,(double)best/1000.0); \
+	}while(0)
+
+static void run(const char *name, size_t frames, unsigned int channels, unsigned int sources, int repeats,
+	float *const *in, void *raw, float *out, int16_t *const *s16, int16_t *s16_out)
+{
+	size_t n=frames*channels;
+	float *planes[2]={out,out+frames};
+	const float gains[MAX_SOURCES]={1.0f};
+
+	pcm_convert_select(name);
+	printf("%s \n",name);
+	TIME("s16 -> float",pcm_to_float(out,raw,PCM_FORMAT_S16_LE,n));
+	TIME("float -> s16",pcm_from_float(raw,PCM_FORMAT_S16_LE,in[0],n));
+	TIME("s24_3 -> float",pcm_to_float(out,raw,PCM_FORMAT_S24_3LE,n));
+	TIME("float -> s24_3",pcm_from_float(raw,PCM_FORMAT_S24_3LE,in[0],n));
+	TIME("s32 -> float",pcm_to_float(out,raw,PCM_FORMAT_S32_LE,n));
+	TIME("float -> s32",pcm_from_float(raw,PCM_FORMAT_S32_LE,in[0],n));
+	TIME("s16 -> s24_3",pcm_convert(out,PCM_FORMAT_S24_3LE,raw,PCM_FORMAT_S16_LE,n));
+	TIME("gain",pcm_gain(out,in[0],0.5f,n));
+	TIME("mix float",pcm_mix(out,(const float *const *)in,gains,sources,n));
+	TIME("mix s16",pcm_mix_s16(s16_out,(const int16_t *const *)s16,sources,n));
+	if(channels==2)
+	{
+		TIME("deinterleave 2",pcm_deinterleave(planes,in[0],2,frames));
+		TIME("interleave 2",pcm_interleave(in[0],(const float *const *)planes,2,frames));
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	size_t frames=32;
+	unsigned int channels=2;
+	unsigned int sources=4;
+	int repeats=20;
+	float *input;
+	int16_t *s16_check;
+	float *in[MAX_SOURCES];
+	int16_t *s16[MAX_SOURCES];
+	int16_t *s16_out;
+	void *raw;
+	float *out;
+	size_t i;
+	unsigned int k;
+	int opt;
+	int rc=0;
+
+	while((opt=getopt(argc,argv,"p:n:m:r:"))!=-1)
+	{
+		switch(opt)
+		{
+		case 'p': frames=(size_t)strtoul(optarg,NULL,0); break;
+		case 'n': channels=(unsigned int)atoi(optarg); break;
+		case 'm': sources=(unsigned int)atoi(optarg); break;
+		case 'r': repeats=atoi(optarg); break;
+		default:
+			printf("usage: %s [-p period_frames] [-n channels] [-m sources] [-r repeats] \n",argv[0]);
+			return 1;
+		}
+	}
+	if(frames<1)
+		frames=1;
+	if(channels<1)
+		channels=1;
+	if(sources<1||sources>MAX_SOURCES)
+		sources=4;
+	if(repeats<1)
+		repeats=1;
+
+	/* check input: mostly in range, some clipping, edges and a NaN */
+	input=(float *)malloc(CHECK_SAMPLES*sizeof(float));
+	s16_check=(int16_t *)malloc(3*CHECK_SAMPLES*sizeof(int16_t));
+	if(input==NULL||s16_check==NULL)
+		return 1;
+	srand(1);
+	for(i=0;i<CHECK_SAMPLES;i++)
+	{
+		input[i]=((float)rand()/(float)RAND_MAX*2.0f-1.0f)*(i%5==0 ? 1.5f : 1.0f);
+	}
+	input[3]=1.0f;
+	input[4]=-1.0f;
+	input[9]=NAN;
+	input[10]=32767.0f/32768.0f;
+	input[17]=-INFINITY;
+	for(i=0;i<3*CHECK_SAMPLES;i++)
+	{
+		s16_check[i]=(int16_t)(rand()%65536-32768);
+	}
+
+	printf("auto picks %s \n",pcm_convert_kernel_name());
+	for(i=0;i<NAME_COUNT;i++)
+	{
+		if(pcm_convert_select(kernel_names[i])!=0)
+		{
+			printf("%-8s not supported \n",kernel_names[i]);
+			continue;
+		}
+		if(check(kernel_names[i],input,s16_check)!=0)
+			rc=1;
+	}
+	if(rc==0)
+		printf("all kernels match scalar \n");
+
+	printf("%zu frames x %u channels per period, %u sources mixed \n",frames,channels,sources);
+	raw=malloc(frames*channels*4);
+	out=(float *)malloc(frames*channels*sizeof(float));
+	s16_out=(int16_t *)malloc(frames*channels*sizeof(int16_t));
+	for(k=0;k<sources;k++)
+	{
+		in[k]=(float *)malloc(frames*channels*sizeof(float));
+		s16[k]=(int16_t *)malloc(frames*channels*sizeof(int16_t));
+		if(in[k]==NULL||s16[k]==NULL)
+			return 1;
+		for(i=0;i<frames*channels;i++)
+		{
+			in[k][i]=(float)rand()/(float)RAND_MAX-0.5f;
+			s16[k][i]=(int16_t)(rand()%65536-32768);
+		}
+	}
+	if(raw==NULL||out==NULL||s16_out==NULL)
+		return 1;
+	memset(raw,0,frames*channels*4);
+	for(i=0;i<NAME_COUNT;i++)
+	{
+		if(pcm_convert_select(kernel_names[i])==0)
+			run(kernel_names[i],frames,channels,sources,repeats,in,raw,out,s16,s16_out);
+	}
+	for(k=0;k<sources;k++)
+	{
+		free(in[k]);
+		free(s16[k]);
+	}
+	free(raw);
+	free(out);
+	free(s16_out);
+	free(input);
+	free(s16_check);
+	return rc;
+}
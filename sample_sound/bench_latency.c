@@ -0,0 +1,471 @@
+/*
+Latency and xrun sweep over period/buffer sizes, on the sim backend so it
+runs without a sound card.
+
+build: gcc -O2 sample_sound/bench_latency.c sample_sound/pcm_engine.c sample_sound/pcm_file.c sample_sound/pcm_alsa.c \
+              sample_sound/pcm_sim.c -DPCM_ENGINE_ALSA=0 -lpthread -o bench_latency
+run:   ./bench_latency [-p period_frames,...] [-P periods,...] [-r rate] [-n channels] [-d seconds]
+                       [-c callback_load_percent] [-l load_threads] [-u load_duty_percent] [-t rt_priority]
+
+For every period size (default 32,64,128,256,512 frames) and periods per
+buffer (default 2,3,4) a playback and a capture stream are opened on one
+sim wire, so what is played comes back on the capture side, and run as
+the classic blocking full-duplex loop: read a period, process it, write
+a period. The playback ring is primed full of silence first, so a
+frame written waits out the rest of that ring and then the capture
+period it lands in: the round trip comes to about one buffer time.
+  -c  busy-waits for that share of every period inside the loop, the
+      processing the callback would do
+  -l  starts that many threads spinning for -u percent of every
+      millisecond, the rest of the machine competing for the CPU
+  -t  runs the loop under SCHED_FIFO, to see how much of the load it
+      shrugs off
+Every so often the loop writes a one-frame impulse and times how long it
+takes to read it back: the round-trip latency. The gap between two reads
+returning, less the period time, is the callback jitter. Each row gives
+the sizes as Listing 2 prints them (period, periods, buffer frames and
+buffer time), the xruns on both streams, impulses lost to them, and the
+jitter and round-trip percentiles. The last line names the lowest
+latency setting that ran without an xrun, the one to try on a device.
+
+Before each setting is timed, an impulse has to make it back with the
+capture stream started at a handful of points inside the first playback
+period (0, 1, a third, a half and all but one frame in). A setting where
+it is lost without an xrun is reported and skipped; a run that xruns is
+tried again, since a busy machine can make any setting xrun.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include "pcm_engine.h"
+
+#define BENCH_MAX_SIZES 16
+#define BENCH_IMPULSE 16384
+/* an impulse still missing after this many buffers is given up on */
+#define BENCH_IMPULSE_TIMEOUT_BUFFERS 4
+/* start-phase runs that xrun are retried this many times */
+#define BENCH_PHASE_TRIES 3
+
+typedef struct bench_result {
+	uint64_t xruns;
+	uint64_t lost;
+	uint64_t impulses;
+	uint64_t jitter[3];          /* p50 p99 max, ns */
+	uint64_t rtl[4];             /* p50 p95 p99 max, ns */
+} bench_result_t;
+
+static atomic_int load_running;
+static unsigned int load_duty=100;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint64_t)ts.tv_sec*1000000000u+(uint64_t)ts.tv_nsec;
+}
+
+static void spin_until(uint64_t t)
+{
+	while(now_ns()<t)
+	{
+	}
+}
+
+static void *load_thread(void *arg)
+{
+	(void)arg;
+	while(atomic_load_explicit(&load_running,memory_order_relaxed))
+	{
+		uint64_t t=now_ns();
+
+		spin_until(t+load_duty*10000u);
+		if(load_duty<100)
+			usleep((100-load_duty)*10);
+	}
+	return NULL;
+}
+
+static int parse_list(const char *arg, unsigned long *values, int space)
+{
+	int count=0;
+
+	while(*arg!='\0'&&count<space)
+	{
+		char *end;
+
+		values[count]=strtoul(arg,&end,10);
+		if(end==arg||values[count]==0)
+			return -1;
+		count++;
+		arg=*end==',' ? end+1 : end;
+	}
+	return count;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x=*(const uint64_t *)a;
+	uint64_t y=*(const uint64_t *)b;
+
+	return x<y ? -1 : x>y;
+}
+
+static uint64_t percentile(const uint64_t *sorted, size_t count, unsigned int pct)
+{
+	return count ? sorted[(count-1)*pct/100] : 0;
+}
+
+static int bench_open(pcm_t *pcm, pcm_stream_t stream, unsigned int rate, unsigned int channels,
+	unsigned long period, unsigned int periods)
+{
+	pcm_config_t cfg;
+
+	pcm_config_init(&cfg,stream);
+	pcm_config_set_device(&cfg,PCM_BACKEND_SIM,"bench_latency");
+	pcm_config_set_format(&cfg,PCM_FORMAT_S16_LE,channels,rate);
+	pcm_config_set_period(&cfg,period,periods);
+	return pcm_open(pcm,&cfg);
+}
+
+/* capture started phase frames into the playback stream's first period:
+1 if an impulse written then comes back, 0 if it does not, 2 if it does
+not but an xrun may have eaten it, -1 on error */
+static int phase_run(unsigned int rate, unsigned int channels, unsigned long period, unsigned int periods,
+	unsigned long phase)
+{
+	pcm_t capture;
+	pcm_t playback;
+	size_t frame_bytes=channels*sizeof(int16_t);
+	int16_t *in=(int16_t *)calloc(period,frame_bytes);
+	int16_t *out=(int16_t *)calloc(period,frame_bytes);
+	uint64_t start;
+	unsigned long f;
+	unsigned int i;
+	int rc=-1;
+
+	if(in==NULL||out==NULL)
+		goto done;
+	if(bench_open(&playback,PCM_PLAYBACK,rate,channels,period,periods)!=0)
+		goto done;
+	if(bench_open(&capture,PCM_CAPTURE,rate,channels,period,periods)!=0)
+	{
+		pcm_close(&playback);
+		goto done;
+	}
+	for(i=0;i<periods;i++)
+	{
+		if(pcm_write(&playback,out,period)!=(long)period)
+			goto close;
+	}
+	/* the last priming write started playback; capture starts on its first read */
+	start=now_ns();
+	spin_until(start+(uint64_t)phase*1000000000u/rate);
+	if(pcm_read(&capture,in,period)!=(long)period)
+		goto close;
+	rc=0;
+	for(i=0;i<periods+4&&rc==0;i++)
+	{
+		out[0]=i==0 ? BENCH_IMPULSE : 0;
+		if(pcm_write(&playback,out,period)!=(long)period||pcm_read(&capture,in,period)!=(long)period)
+		{
+			rc=-1;
+			break;
+		}
+		for(f=0;f<period;f++)
+		{
+			if(in[f*channels]>BENCH_IMPULSE/2)
+				rc=1;
+		}
+	}
+	if(rc==0&&capture.xruns+playback.xruns!=0)
+		rc=2;
+
+close:
+	pcm_close(&capture);
+	pcm_close(&playback);
+done:
+	free(in);
+	free(out);
+	return rc;
+}
+
+/* the impulse has to survive capture starting at any point of a playback period; 0 if it does.
+A run with an xrun says nothing either way and is tried again; if they
+all xrun the phase is reported as unchecked, not as a failure */
+static int phase_check(unsigned int rate, unsigned int channels, unsigned long period, unsigned int periods)
+{
+	unsigned long phases[]={0,1,period/3,period/2,period-1};
+	unsigned int i;
+
+	for(i=0;i<sizeof(phases)/sizeof(phases[0]);i++)
+	{
+		int rc=2;
+		int tries;
+
+		for(tries=0;tries<BENCH_PHASE_TRIES&&rc==2;tries++)
+		{
+			rc=phase_run(rate,channels,period,periods,phases[i]);
+		}
+		if(rc==2)
+		{
+			fprintf(stderr,"@phase_check, %lu x %u frames with capture %lu frames behind xruns on every try, unchecked \n",
+				period,periods,phases[i]);
+		}else if(rc!=1){
+			fprintf(stderr,"@phase_check, error occurs for %lu x %u frames: impulse %s with capture %lu frames behind \n",
+				period,periods,rc==0 ? "lost" : "not run",phases[i]);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* one period/periods setting for seconds; 0, or -1 if the streams could not run */
+static int bench_run(bench_result_t *res, unsigned int rate, unsigned int channels, unsigned long period,
+	unsigned int periods, double seconds, unsigned int callback_load)
+{
+	pcm_t capture;
+	pcm_t playback;
+	size_t frame_bytes=channels*sizeof(int16_t);
+	uint64_t period_ns=(uint64_t)period*1000000000u/rate;
+	uint64_t end;
+	uint64_t last=0;
+	uint64_t emitted=0;
+	uint64_t emitted_xruns=0;
+	uint64_t timeout_ns=BENCH_IMPULSE_TIMEOUT_BUFFERS*(uint64_t)(periods+1)*period_ns;
+	/* far enough apart that only one impulse is ever in flight */
+	uint64_t gap=(uint64_t)periods+2;
+	uint64_t k=0;
+	size_t max_samples=(size_t)(seconds*rate/period)+2;
+	uint64_t *jitter=(uint64_t *)malloc(max_samples*sizeof(uint64_t));
+	uint64_t *rtl=(uint64_t *)malloc(max_samples*sizeof(uint64_t));
+	int16_t *in=(int16_t *)calloc(period,frame_bytes);
+	int16_t *out=(int16_t *)calloc(period,frame_bytes);
+	size_t njitter=0;
+	size_t nrtl=0;
+	unsigned int i;
+	int rc=-1;
+
+	memset(res,0,sizeof(*res));
+	if(jitter==NULL||rtl==NULL||in==NULL||out==NULL)
+	{
+		fprintf(stderr,"@bench_run, error occurs for %zu samples of %lu frames \n",max_samples,period);
+		goto done;
+	}
+	if(bench_open(&playback,PCM_PLAYBACK,rate,channels,period,periods)!=0)
+		goto done;
+	if(bench_open(&capture,PCM_CAPTURE,rate,channels,period,periods)!=0)
+	{
+		pcm_close(&playback);
+		goto done;
+	}
+	/* prime: a full playback ring starts the device */
+	for(i=0;i<periods;i++)
+	{
+		if(pcm_write(&playback,out,period)!=(long)period)
+			goto close;
+	}
+	end=now_ns()+(uint64_t)(seconds*1e9);
+	for(k=0;;k++)
+	{
+		uint64_t t;
+		unsigned long f;
+
+		if(pcm_read(&capture,in,period)!=(long)period)
+			goto close;
+		t=now_ns();
+		if(last!=0&&njitter<max_samples)
+			jitter[njitter++]=t-last>period_ns ? t-last-period_ns : period_ns-(t-last);
+		last=t;
+		if(emitted!=0)
+		{
+			for(f=0;f<period;f++)
+			{
+				if(in[f*channels]>BENCH_IMPULSE/2)
+					break;
+			}
+			if(capture.xruns+playback.xruns!=emitted_xruns||t-emitted>timeout_ns)
+			{
+				/* an xrun in between may have eaten it or moved it */
+				res->lost++;
+				emitted=0;
+			}else if(f<period&&nrtl<max_samples){
+				rtl[nrtl++]=t-emitted;
+				emitted=0;
+			}
+		}
+		if(t>=end)
+			break;
+		if(callback_load)
+			spin_until(t+period_ns*callback_load/100);
+		out[0]=0;
+		if(emitted==0&&k%gap==0)
+		{
+			out[0]=BENCH_IMPULSE;
+			emitted=now_ns();
+			emitted_xruns=capture.xruns+playback.xruns;
+			res->impulses++;
+		}
+		if(pcm_write(&playback,out,period)!=(long)period)
+			goto close;
+	}
+	rc=0;
+
+close:
+	if(rc!=0)
+		fprintf(stderr,"@bench_run, error occurs for %lu x %u frames after %llu periods \n",
+			period,periods,(unsigned long long)k);
+	res->xruns=capture.xruns+playback.xruns;
+	pcm_close(&capture);
+	pcm_close(&playback);
+	qsort(jitter,njitter,sizeof(uint64_t),cmp_u64);
+	qsort(rtl,nrtl,sizeof(uint64_t),cmp_u64);
+	res->jitter[0]=percentile(jitter,njitter,50);
+	res->jitter[1]=percentile(jitter,njitter,99);
+	res->jitter[2]=percentile(jitter,njitter,100);
+	res->rtl[0]=percentile(rtl,nrtl,50);
+	res->rtl[1]=percentile(rtl,nrtl,95);
+	res->rtl[2]=percentile(rtl,nrtl,99);
+	res->rtl[3]=percentile(rtl,nrtl,100);
+done:
+	free(jitter);
+	free(rtl);
+	free(in);
+	free(out);
+	return rc;
+}
+
+static void set_realtime(int rt_priority)
+{
+	struct sched_param param;
+	int rc;
+
+	if(rt_priority<=0)
+		return;
+	memset(&param,0,sizeof(param));
+	param.sched_priority=rt_priority;
+	rc=pthread_setschedparam(pthread_self(),SCHED_FIFO,&param);
+	if(rc!=0)
+		fprintf(stderr,"@bench_latency, SCHED_FIFO %d not granted (%s), staying at normal priority \n",
+			rt_priority,strerror(rc));
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long sizes[BENCH_MAX_SIZES]={32,64,128,256,512};
+	unsigned long counts[BENCH_MAX_SIZES]={2,3,4};
+	int nsizes=5;
+	int ncounts=3;
+	unsigned int rate=44100;
+	unsigned int channels=2;
+	double seconds=2.0;
+	unsigned int callback_load=0;
+	unsigned int load_threads=0;
+	int rt_priority=0;
+	pthread_t loaders[64];
+	unsigned long best_period=0;
+	unsigned int best_periods=0;
+	uint64_t best_rtl=UINT64_MAX;
+	unsigned int i;
+	int failed=0;
+	int s;
+	int c;
+	int opt;
+
+	while((opt=getopt(argc,argv,"p:P:r:n:d:c:l:u:t:"))!=-1)
+	{
+		switch(opt)
+		{
+		case 'p': nsizes=parse_list(optarg,sizes,BENCH_MAX_SIZES); break;
+		case 'P': ncounts=parse_list(optarg,counts,BENCH_MAX_SIZES); break;
+		case 'r': rate=(unsigned int)atoi(optarg); break;
+		case 'n': channels=(unsigned int)atoi(optarg); break;
+		case 'd': seconds=atof(optarg); break;
+		case 'c': callback_load=(unsigned int)atoi(optarg); break;
+		case 'l': load_threads=(unsigned int)atoi(optarg); break;
+		case 'u': load_duty=(unsigned int)atoi(optarg); break;
+		case 't': rt_priority=atoi(optarg); break;
+		default:
+			fprintf(stderr,"usage: %s [-p period_frames,...] [-P periods,...] [-r rate] [-n channels] [-d seconds] "
+				"[-c callback_load_percent] [-l load_threads] [-u load_duty_percent] [-t rt_priority]\n",argv[0]);
+			return 1;
+		}
+	}
+	if(nsizes<=0||ncounts<=0||rate==0||channels==0||seconds<=0||callback_load>=100||
+		load_duty==0||load_duty>100||load_threads>64)
+	{
+		fprintf(stderr,"@bench_latency, error occurs for sizes, rate %u, channels %u, %.2f s, load %u%% x %u at %u%% \n",
+			rate,channels,seconds,callback_load,load_threads,load_duty);
+		return 1;
+	}
+	for(c=0;c<ncounts;c++)
+	{
+		if(counts[c]<2)
+		{
+			fprintf(stderr,"@bench_latency, error occurs for %lu periods per buffer \n",counts[c]);
+			return 1;
+		}
+	}
+
+	atomic_store(&load_running,1);
+	for(i=0;i<load_threads;i++)
+	{
+		if(pthread_create(&loaders[i],NULL,load_thread,NULL)!=0)
+		{
+			fprintf(stderr,"@bench_latency, error occurs for load thread %u \n",i);
+			load_threads=i;
+			break;
+		}
+	}
+	set_realtime(rt_priority);
+
+	printf("rate %u Hz, %u ch, %.1f s per setting, callback load %u%%, %u load threads at %u%%\n",
+		rate,channels,seconds,callback_load,load_threads,load_duty);
+	printf("%8s %7s %8s %9s %6s %5s %24s %31s\n","period","periods","buffer","buffer_us","xruns","lost",
+		"jitter_us p50/p99/max","round_trip_ms p50/p95/p99/max");
+	for(s=0;s<nsizes;s++)
+	{
+		for(c=0;c<ncounts;c++)
+		{
+			bench_result_t res;
+			unsigned long buffer=sizes[s]*counts[c];
+
+			if(phase_check(rate,channels,sizes[s],(unsigned int)counts[c])!=0||
+				bench_run(&res,rate,channels,sizes[s],(unsigned int)counts[c],seconds,callback_load)!=0)
+			{
+				failed=1;
+				continue;
+			}
+			printf("%8lu %7lu %8lu %9lu %6llu %5llu %8.1f/%6.1f/%8.1f %7.2f/%7.2f/%7.2f/%7.2f\n",
+				sizes[s],counts[c],buffer,(unsigned long)((uint64_t)buffer*1000000u/rate),
+				(unsigned long long)res.xruns,(unsigned long long)res.lost,
+				res.jitter[0]/1e3,res.jitter[1]/1e3,res.jitter[2]/1e3,
+				res.rtl[0]/1e6,res.rtl[1]/1e6,res.rtl[2]/1e6,res.rtl[3]/1e6);
+			fflush(stdout);
+			if(res.xruns==0&&res.lost==0&&res.impulses>0&&res.rtl[2]<best_rtl)
+			{
+				best_rtl=res.rtl[2];
+				best_period=sizes[s];
+				best_periods=(unsigned int)counts[c];
+			}
+		}
+	}
+	if(best_period!=0)
+		printf("lowest latency without xruns: %lu x %u frames, round trip %.2f ms p99\n",
+			best_period,best_periods,best_rtl/1e6);
+	else
+		printf("no setting ran without xruns\n");
+
+	atomic_store(&load_running,0);
+	for(i=0;i<load_threads;i++)
+	{
+		pthread_join(loaders[i],NULL);
+	}
+	return failed;
+}
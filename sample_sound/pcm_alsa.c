@@ -0,0 +1,226 @@
+#include "pcm_backend.h"
+
+#if PCM_ENGINE_ALSA
+
+/* Use the newer ALSA API */
+#define ALSA_PCM_NEW_HW_PARAMS_API
+
+#include <stdio.h>
+#include <alsa/asoundlib.h>
+
+static snd_pcm_format_t alsa_format(pcm_format_t format)
+{
+	switch(format)
+	{
+	case PCM_FORMAT_S24_3LE:  return SND_PCM_FORMAT_S24_3LE;
+	case PCM_FORMAT_S32_LE:   return SND_PCM_FORMAT_S32_LE;
+	case PCM_FORMAT_FLOAT_LE: return SND_PCM_FORMAT_FLOAT_LE;
+	default:                  return SND_PCM_FORMAT_S16_LE;
+	}
+}
+
+#define ALSA_CHECK(call,what) \
+	do{ \
+		rc=(call); \
+		if(rc<0) \
+		{ \
+			fprintf(stderr,"@alsa_open, error occurs for %s on %s: %s \n",what,pcm->config.device,snd_strerror(rc)); \
+			goto fail; \
+		} \
+	}while(0)
+
+static int alsa_open(pcm_t *pcm)
+{
+	pcm_config_t *cfg=&pcm->config;
+	snd_pcm_t *handle;
+	snd_pcm_hw_params_t *hw;
+	snd_pcm_sw_params_t *sw;
+	snd_pcm_uframes_t period=cfg->period_frames;
+	snd_pcm_uframes_t buffer=cfg->period_frames*cfg->periods;
+	unsigned int rate=cfg->rate;
+	int dir=0;
+	int rc;
+
+	rc=snd_pcm_open(&handle,cfg->device ? cfg->device : "default",
+		cfg->stream==PCM_CAPTURE ? SND_PCM_STREAM_CAPTURE : SND_PCM_STREAM_PLAYBACK,
+		cfg->nonblock ? SND_PCM_NONBLOCK : 0);
+	if(rc<0)
+		return rc;
+	pcm->handle=handle;
+
+	snd_pcm_hw_params_alloca(&hw);
+	ALSA_CHECK(snd_pcm_hw_params_any(handle,hw),"hw_params_any");
+	if(cfg->mmap&&snd_pcm_hw_params_set_access(handle,hw,SND_PCM_ACCESS_MMAP_INTERLEAVED)<0)
+	{
+		fprintf(stderr,"@alsa_open, %s has no mmap access, using read/write \n",cfg->device);
+		cfg->mmap=0;
+	}
+	if(!cfg->mmap)
+		ALSA_CHECK(snd_pcm_hw_params_set_access(handle,hw,SND_PCM_ACCESS_RW_INTERLEAVED),"access");
+	ALSA_CHECK(snd_pcm_hw_params_set_format(handle,hw,alsa_format(cfg->format)),"format");
+	ALSA_CHECK(snd_pcm_hw_params_set_channels(handle,hw,cfg->channels),"channels");
+	ALSA_CHECK(snd_pcm_hw_params_set_rate_near(handle,hw,&rate,&dir),"rate");
+	ALSA_CHECK(snd_pcm_hw_params_set_period_size_near(handle,hw,&period,&dir),"period size");
+	ALSA_CHECK(snd_pcm_hw_params_set_buffer_size_near(handle,hw,&buffer),"buffer size");
+	ALSA_CHECK(snd_pcm_hw_params(handle,hw),"hw_params");
+
+	/* keep what the driver granted, not what was asked for */
+	snd_pcm_hw_params_get_period_size(hw,&period,&dir);
+	snd_pcm_hw_params_get_buffer_size(hw,&buffer);
+	snd_pcm_hw_params_get_rate(hw,&rate,&dir);
+	cfg->period_frames=period;
+	cfg->periods=(unsigned int)(buffer/period);
+	cfg->rate=rate;
+
+	snd_pcm_sw_params_alloca(&sw);
+	ALSA_CHECK(snd_pcm_sw_params_current(handle,sw),"sw_params_current");
+	if(cfg->start_threshold!=0)
+		ALSA_CHECK(snd_pcm_sw_params_set_start_threshold(handle,sw,cfg->start_threshold),"start threshold");
+	if(cfg->avail_min!=0)
+		ALSA_CHECK(snd_pcm_sw_params_set_avail_min(handle,sw,cfg->avail_min),"avail_min");
+	ALSA_CHECK(snd_pcm_sw_params(handle,sw),"sw_params");
+	return 0;
+
+fail:
+	snd_pcm_close(handle);
+	pcm->handle=NULL;
+	return rc;
+}
+
+static long alsa_read(pcm_t *pcm, void *buffer, unsigned long frames)
+{
+	return (long)snd_pcm_readi((snd_pcm_t *)pcm->handle,buffer,frames);
+}
+
+static long alsa_write(pcm_t *pcm, const void *buffer, unsigned long frames)
+{
+	return (long)snd_pcm_writei((snd_pcm_t *)pcm->handle,buffer,frames);
+}
+
+static int alsa_prepare(pcm_t *pcm)
+{
+	return snd_pcm_prepare((snd_pcm_t *)pcm->handle);
+}
+
+static int alsa_resume(pcm_t *pcm)
+{
+	return snd_pcm_resume((snd_pcm_t *)pcm->handle);
+}
+
+static int alsa_drain(pcm_t *pcm)
+{
+	if(pcm->config.stream==PCM_CAPTURE)
+		return snd_pcm_drop((snd_pcm_t *)pcm->handle);
+	return snd_pcm_drain((snd_pcm_t *)pcm->handle);
+}
+
+/*
+wait for at least a period (or what was asked for, if less) to be free
+(playback) or filled (capture), then map that part of the ring. A stream
+that is prepared but not running is started here, since nothing else
+would start it: capture has no readi to trigger it and a full playback
+ring has no room for the commit that would.
+*/
+static int alsa_mmap_begin(pcm_t *pcm, void **area, unsigned long *offset, unsigned long *frames)
+{
+	snd_pcm_t *handle=(snd_pcm_t *)pcm->handle;
+	const snd_pcm_channel_area_t *areas;
+	snd_pcm_uframes_t off;
+	snd_pcm_uframes_t n=*frames;
+	snd_pcm_sframes_t avail;
+	unsigned long need=*frames<pcm->config.period_frames ? *frames : pcm->config.period_frames;
+	int rc;
+
+	while(1)
+	{
+		avail=snd_pcm_avail_update(handle);
+		if(avail<0)
+			return (int)avail;
+		if((unsigned long)avail>=need)
+			break;
+		if(snd_pcm_state(handle)==SND_PCM_STATE_PREPARED)
+		{
+			rc=snd_pcm_start(handle);
+			if(rc<0)
+				return rc;
+			continue;
+		}
+		if(pcm->config.nonblock)
+			return -EAGAIN;
+		rc=snd_pcm_wait(handle,1000);
+		if(rc<0)
+			return rc;
+	}
+	rc=snd_pcm_mmap_begin(handle,&areas,&off,&n);
+	if(rc<0)
+		return rc;
+	/* interleaved: one area, first/step in bits */
+	*area=(char *)areas[0].addr+areas[0].first/8+off*(areas[0].step/8);
+	*offset=off;
+	*frames=n;
+	return 0;
+}
+
+static long alsa_mmap_commit(pcm_t *pcm, unsigned long offset, unsigned long frames)
+{
+	snd_pcm_t *handle=(snd_pcm_t *)pcm->handle;
+	snd_pcm_sframes_t rc=snd_pcm_mmap_commit(handle,offset,frames);
+
+	if(rc>=0&&(unsigned long)rc!=frames)
+		return -EPIPE;
+	/* mmap playback does not auto-start: go once start_threshold (default a full ring) is queued */
+	if(rc>0&&pcm->config.stream==PCM_PLAYBACK&&snd_pcm_state(handle)==SND_PCM_STATE_PREPARED)
+	{
+		unsigned long ring=pcm->config.period_frames*pcm->config.periods;
+		unsigned long threshold=pcm->config.start_threshold ? pcm->config.start_threshold : ring;
+		snd_pcm_sframes_t avail=snd_pcm_avail_update(handle);
+
+		if(avail>=0&&ring-(unsigned long)avail>=threshold)
+		{
+			int err=snd_pcm_start(handle);
+
+			if(err<0)
+				return err;
+		}
+	}
+	return (long)rc;
+}
+
+static int alsa_poll_descriptors(pcm_t *pcm, struct pollfd *pfds, unsigned int space)
+{
+	snd_pcm_t *handle=(snd_pcm_t *)pcm->handle;
+
+	if((unsigned int)snd_pcm_poll_descriptors_count(handle)>space)
+		return -ENOSPC;
+	return snd_pcm_poll_descriptors(handle,pfds,space);
+}
+
+static int alsa_poll_revents(pcm_t *pcm, struct pollfd *pfds, unsigned int nfds, unsigned short *revents)
+{
+	return snd_pcm_poll_descriptors_revents((snd_pcm_t *)pcm->handle,pfds,nfds,revents);
+}
+
+static void alsa_close(pcm_t *pcm)
+{
+	if(pcm->handle!=NULL)
+		snd_pcm_close((snd_pcm_t *)pcm->handle);
+	pcm->handle=NULL;
+}
+
+const pcm_ops_t pcm_alsa_ops={
+	"alsa",
+	1,
+	alsa_open,
+	alsa_read,
+	alsa_write,
+	alsa_prepare,
+	alsa_resume,
+	alsa_drain,
+	alsa_close,
+	alsa_mmap_begin,
+	alsa_mmap_commit,
+	alsa_poll_descriptors,
+	alsa_poll_revents,
+};
+
+#endif
@@ -0,0 +1,435 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "pcm_analyze.h"
+#include "pcm_convert.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PCM_ANALYZE_X86 1
+#else
+#define PCM_ANALYZE_X86 0
+#endif
+
+/* frames converted to float at a time, on the stack */
+#define PCM_ANALYZE_CHUNK 256
+
+void pcm_analyze_config_init(pcm_analyze_config_t *cfg)
+{
+	memset(cfg,0,sizeof(*cfg));
+	cfg->fft_size=1024;
+	cfg->hop=512;
+	cfg->bands=10;
+	cfg->min_hz=50;
+	cfg->max_ffts=4;
+}
+
+/* one radix-2 stage: butterflies of span 2*half across all n points */
+static void stage_scalar(float *re, float *im, const float *tw_re, const float *tw_im, unsigned int n, unsigned int half)
+{
+	unsigned int k;
+	unsigned int j;
+
+	for(k=0;k<n;k+=2*half)
+	{
+		for(j=0;j<half;j++)
+		{
+			float wr=tw_re[half+j];
+			float wi=tw_im[half+j];
+			float br=re[k+j+half];
+			float bi=im[k+j+half];
+			float xr=br*wr-bi*wi;
+			float xi=br*wi+bi*wr;
+			float ar=re[k+j];
+			float ai=im[k+j];
+
+			re[k+j]=ar+xr;
+			im[k+j]=ai+xi;
+			re[k+j+half]=ar-xr;
+			im[k+j+half]=ai-xi;
+		}
+	}
+}
+
+#if PCM_ANALYZE_X86
+__attribute__((target("sse2")))
+static void stage_sse2(float *re, float *im, const float *tw_re, const float *tw_im, unsigned int n, unsigned int half)
+{
+	unsigned int k;
+	unsigned int j;
+
+	if(half<4)
+	{
+		stage_scalar(re,im,tw_re,tw_im,n,half);
+		return;
+	}
+	for(k=0;k<n;k+=2*half)
+	{
+		for(j=0;j<half;j+=4)
+		{
+			__m128 wr=_mm_load_ps(tw_re+half+j);
+			__m128 wi=_mm_load_ps(tw_im+half+j);
+			__m128 br=_mm_load_ps(re+k+j+half);
+			__m128 bi=_mm_load_ps(im+k+j+half);
+			__m128 xr=_mm_sub_ps(_mm_mul_ps(br,wr),_mm_mul_ps(bi,wi));
+			__m128 xi=_mm_add_ps(_mm_mul_ps(br,wi),_mm_mul_ps(bi,wr));
+			__m128 ar=_mm_load_ps(re+k+j);
+			__m128 ai=_mm_load_ps(im+k+j);
+
+			_mm_store_ps(re+k+j,_mm_add_ps(ar,xr));
+			_mm_store_ps(im+k+j,_mm_add_ps(ai,xi));
+			_mm_store_ps(re+k+j+half,_mm_sub_ps(ar,xr));
+			_mm_store_ps(im+k+j+half,_mm_sub_ps(ai,xi));
+		}
+	}
+}
+
+__attribute__((target("avx2")))
+static void stage_avx2(float *re, float *im, const float *tw_re, const float *tw_im, unsigned int n, unsigned int half)
+{
+	unsigned int k;
+	unsigned int j;
+
+	if(half<8)
+	{
+		stage_sse2(re,im,tw_re,tw_im,n,half);
+		return;
+	}
+	for(k=0;k<n;k+=2*half)
+	{
+		for(j=0;j<half;j+=8)
+		{
+			__m256 wr=_mm256_load_ps(tw_re+half+j);
+			__m256 wi=_mm256_load_ps(tw_im+half+j);
+			__m256 br=_mm256_load_ps(re+k+j+half);
+			__m256 bi=_mm256_load_ps(im+k+j+half);
+			__m256 xr=_mm256_sub_ps(_mm256_mul_ps(br,wr),_mm256_mul_ps(bi,wi));
+			__m256 xi=_mm256_add_ps(_mm256_mul_ps(br,wi),_mm256_mul_ps(bi,wr));
+			__m256 ar=_mm256_load_ps(re+k+j);
+			__m256 ai=_mm256_load_ps(im+k+j);
+
+			_mm256_store_ps(re+k+j,_mm256_add_ps(ar,xr));
+			_mm256_store_ps(im+k+j,_mm256_add_ps(ai,xi));
+			_mm256_store_ps(re+k+j+half,_mm256_sub_ps(ar,xr));
+			_mm256_store_ps(im+k+j+half,_mm256_sub_ps(ai,xi));
+		}
+	}
+	_mm256_zeroupper();
+}
+#endif
+
+static pcm_analyze_stage_fn pick_stage(void)
+{
+#if PCM_ANALYZE_X86
+	const char *kernel=pcm_convert_kernel_name();
+
+	if(strcmp(kernel,"avx2")==0)
+		return stage_avx2;
+	if(strcmp(kernel,"sse2")==0)
+		return stage_sse2;
+#endif
+	return stage_scalar;
+}
+
+static int plan(pcm_analyze_t *a)
+{
+	unsigned int n=a->config.fft_size;
+	unsigned int m=a->half;
+	double res=(double)a->rate/n;
+	double nyquist=a->rate/2.0;
+	double sum_w2=0;
+	unsigned int b;
+	unsigned int i;
+	unsigned int h;
+
+	for(i=0;i<n;i++)
+	{
+		a->window[i]=(float)(0.5-0.5*cos(2*M_PI*i/n));
+		sum_w2+=(double)a->window[i]*a->window[i];
+	}
+	for(i=0;i<m;i++)
+	{
+		uint32_t r=0;
+		unsigned int bit;
+
+		for(bit=0;bit<a->log2_half;bit++)
+		{
+			if(i&(1u<<bit))
+				r|=1u<<(a->log2_half-1-bit);
+		}
+		a->bitrev[i]=r;
+	}
+	/* stage h uses exp(-i*pi*j/h), j<h; kept at [h,2h) so every stage is one aligned run */
+	a->tw_re[0]=a->tw_im[0]=0;
+	for(h=1;h<m;h*=2)
+	{
+		for(i=0;i<h;i++)
+		{
+			a->tw_re[h+i]=(float)cos(-M_PI*i/h);
+			a->tw_im[h+i]=(float)sin(-M_PI*i/h);
+		}
+	}
+	for(i=0;i<=m;i++)
+	{
+		a->split_re[i]=(float)cos(-2*M_PI*i/n);
+		a->split_im[i]=(float)sin(-2*M_PI*i/n);
+	}
+	/* one-sided |X|^2 to the mean square of the unwindowed signal */
+	a->scale=2.0/(n*sum_w2);
+
+	if(a->config.min_hz<res)
+		a->config.min_hz=res;
+	if(a->config.min_hz>=nyquist)
+		return -1;
+	for(b=0;b<=a->config.bands;b++)
+	{
+		double hz=a->config.min_hz*pow(nyquist/a->config.min_hz,(double)b/a->config.bands);
+		unsigned int bin=(unsigned int)floor(hz/res+0.5);
+
+		if(b==a->config.bands)
+			bin=m+1;
+		if(b>0&&bin<=a->band_edge[b-1])
+			bin=a->band_edge[b-1]+1;
+		/* too many bands for this resolution */
+		if(bin>m+1)
+			return -1;
+		a->band_edge[b]=bin;
+		a->band_hz[b]=(b==a->config.bands ? nyquist : bin*res);
+	}
+	return 0;
+}
+
+int pcm_analyze_init(pcm_analyze_t *a, const pcm_analyze_config_t *cfg, pcm_format_t format,
+	unsigned int channels, unsigned int rate)
+{
+	unsigned int n=cfg->fft_size;
+
+	memset(a,0,sizeof(*a));
+	if(n<PCM_ANALYZE_MIN_FFT||n>PCM_ANALYZE_MAX_FFT||(n&(n-1))!=0||cfg->hop==0||cfg->hop>n||
+		cfg->bands==0||cfg->bands>PCM_ANALYZE_MAX_BANDS||cfg->min_hz<0||
+		channels==0||channels>PCM_ANALYZE_MAX_CHANNELS||rate==0||pcm_format_bytes(format)==0)
+	{
+		fprintf(stderr,"@pcm_analyze_init, error occurs for a %u-point FFT every %u frames, %u bands, "
+			"%u ch at %u Hz \n",n,cfg->hop,cfg->bands,channels,rate);
+		return -1;
+	}
+	a->config=*cfg;
+	a->format=format;
+	a->channels=channels;
+	a->rate=rate;
+	a->half=n/2;
+	while((1u<<a->log2_half)<a->half)
+		a->log2_half++;
+	a->window=(float *)aligned_alloc(64,n*sizeof(float));
+	a->history=(float *)aligned_alloc(64,n*sizeof(float));
+	a->bitrev=(uint32_t *)aligned_alloc(64,a->half*sizeof(uint32_t));
+	a->tw_re=(float *)aligned_alloc(64,a->half*sizeof(float));
+	a->tw_im=(float *)aligned_alloc(64,a->half*sizeof(float));
+	a->re=(float *)aligned_alloc(64,a->half*sizeof(float));
+	a->im=(float *)aligned_alloc(64,a->half*sizeof(float));
+	/* half+1 rounded up to a whole cache line */
+	a->split_re=(float *)aligned_alloc(64,(a->half+16)*sizeof(float));
+	a->split_im=(float *)aligned_alloc(64,(a->half+16)*sizeof(float));
+	if(a->window==NULL||a->history==NULL||a->bitrev==NULL||a->tw_re==NULL||a->tw_im==NULL||
+		a->re==NULL||a->im==NULL||a->split_re==NULL||a->split_im==NULL)
+	{
+		fprintf(stderr,"@pcm_analyze_init, error occurs for the plan of a %u-point FFT \n",n);
+		pcm_analyze_destroy(a);
+		return -1;
+	}
+	if(plan(a)!=0)
+	{
+		fprintf(stderr,"@pcm_analyze_init, error occurs for %u bands from %.0f Hz with %.1f Hz bins \n",
+			cfg->bands,cfg->min_hz,(double)rate/n);
+		pcm_analyze_destroy(a);
+		return -1;
+	}
+	memset(a->history,0,n*sizeof(float));
+	a->stage=pick_stage();
+	a->work.channels=channels;
+	a->work.bands=cfg->bands;
+	atomic_init(&a->seq,0);
+	return 0;
+}
+
+void pcm_analyze_destroy(pcm_analyze_t *a)
+{
+	free(a->window);
+	free(a->history);
+	free(a->bitrev);
+	free(a->tw_re);
+	free(a->tw_im);
+	free(a->re);
+	free(a->im);
+	free(a->split_re);
+	free(a->split_im);
+	a->window=a->history=a->tw_re=a->tw_im=a->re=a->im=a->split_re=a->split_im=NULL;
+	a->bitrev=NULL;
+}
+
+double pcm_analyze_band_hz(const pcm_analyze_t *a, unsigned int edge)
+{
+	return edge<=a->config.bands ? a->band_hz[edge] : 0;
+}
+
+/* the latest fft_size frames: window, transform, reduce to bands */
+static void transform(pcm_analyze_t *a)
+{
+	unsigned int n=a->config.fft_size;
+	unsigned int m=a->half;
+	unsigned int mask=n-1;
+	unsigned int pos=a->write_pos;
+	float *re=a->re;
+	float *im=a->im;
+	double energy[PCM_ANALYZE_MAX_BANDS]={0};
+	double best=-1;
+	unsigned int best_bin=0;
+	unsigned int b=0;
+	unsigned int k;
+	unsigned int h;
+
+	/* even samples to the real part, odd to the imaginary, landing in bit-reversed order */
+	for(k=0;k<m;k++)
+	{
+		re[a->bitrev[k]]=a->history[(pos+2*k)&mask]*a->window[2*k];
+		im[a->bitrev[k]]=a->history[(pos+2*k+1)&mask]*a->window[2*k+1];
+	}
+	for(h=1;h<m;h*=2)
+	{
+		a->stage(re,im,a->tw_re,a->tw_im,m,h);
+	}
+	/* split Z into the spectrum of the real input; bands start at bin 1, so DC is never needed */
+	for(k=1;k<=m;k++)
+	{
+		unsigned int c=(m-k)&(m-1);
+		float zr=re[k&(m-1)];
+		float zi=im[k&(m-1)];
+		float er=0.5f*(zr+re[c]);
+		float ei=0.5f*(zi-im[c]);
+		/* odd half, times -i */
+		float or_=0.5f*(zi+im[c]);
+		float oi=-0.5f*(zr-re[c]);
+		float xr=er+a->split_re[k]*or_-a->split_im[k]*oi;
+		float xi=ei+a->split_re[k]*oi+a->split_im[k]*or_;
+		double power=(double)xr*xr+(double)xi*xi;
+
+		if(k==m)
+			power*=0.5;          /* Nyquist has no mirror image */
+		if(power>best)
+		{
+			best=power;
+			best_bin=k;
+		}
+		if(k<a->band_edge[0])
+			continue;
+		/* band_edge[bands] is past the last bin, so b stays in range */
+		while(k>=a->band_edge[b+1])
+			b++;
+		energy[b]+=power;
+	}
+	for(b=0;b<a->config.bands;b++)
+	{
+		a->work.band_energy[b]=(float)(energy[b]*a->scale);
+	}
+	a->work.dominant_hz=(float)((double)best_bin*a->rate/n);
+	a->work.ffts++;
+}
+
+static void publish(pcm_analyze_t *a)
+{
+	uint_fast64_t s=atomic_load_explicit(&a->seq,memory_order_relaxed);
+
+	atomic_store_explicit(&a->seq,s+1,memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	a->published=a->work;
+	atomic_store_explicit(&a->seq,s+2,memory_order_release);
+}
+
+int pcm_analyze_process(pcm_analyze_t *a, const void *frames, size_t count)
+{
+	float chunk[PCM_ANALYZE_CHUNK*PCM_ANALYZE_MAX_CHANNELS];
+	const char *src=(const char *)frames;
+	size_t frame_bytes=pcm_format_bytes(a->format)*a->channels;
+	unsigned int ch=a->channels;
+	unsigned int mask=a->config.fft_size-1;
+	float inv_ch=1.0f/ch;
+	uint64_t due=(a->pending+count)/a->config.hop;
+	uint64_t skip=a->config.max_ffts>0&&due>a->config.max_ffts ? due-a->config.max_ffts : 0;
+	unsigned int c;
+
+	while(count>0)
+	{
+		size_t n=count<PCM_ANALYZE_CHUNK ? count : PCM_ANALYZE_CHUNK;
+		size_t i;
+
+		if(pcm_to_float(chunk,src,a->format,n*ch)!=0)
+		{
+			fprintf(stderr,"@pcm_analyze_process, error occurs for format %d \n",(int)a->format);
+			return -1;
+		}
+		for(i=0;i<n;i++)
+		{
+			const float *f=chunk+i*ch;
+			float mono=0;
+
+			for(c=0;c<ch;c++)
+			{
+				double v=fabs(f[c]);
+
+				if(v>a->peak[c])
+					a->peak[c]=v;
+				a->sum_squares[c]+=v*v;
+				mono+=f[c];
+			}
+			a->history[a->write_pos]=mono*inv_ch;
+			a->write_pos=(a->write_pos+1)&mask;
+			if(++a->pending<a->config.hop)
+				continue;
+			a->pending=0;
+			/* over budget: drop the oldest hops, keep the freshest */
+			if(skip>0)
+			{
+				skip--;
+				a->work.skipped++;
+			}else{
+				transform(a);
+			}
+		}
+		a->meter_frames+=n;
+		a->work.frames+=n;
+		src+=n*frame_bytes;
+		count-=n;
+	}
+	if(a->meter_frames>0)
+	{
+		for(c=0;c<ch;c++)
+		{
+			a->work.peak[c]=(float)a->peak[c];
+			a->work.rms[c]=(float)sqrt(a->sum_squares[c]/a->meter_frames);
+			a->peak[c]=0;
+			a->sum_squares[c]=0;
+		}
+		a->meter_frames=0;
+	}
+	publish(a);
+	return 0;
+}
+
+int pcm_analyze_read(const pcm_analyze_t *a, pcm_analyze_result_t *out)
+{
+	while(1)
+	{
+		uint_fast64_t s=atomic_load_explicit(&a->seq,memory_order_acquire);
+
+		if(s==0)
+			return 0;
+		/* a publish is one struct copy: spin it out */
+		if(s&1)
+			continue;
+		*out=a->published;
+		atomic_thread_fence(memory_order_acquire);
+		if(atomic_load_explicit(&a->seq,memory_order_relaxed)==s)
+			return 1;
+	}
+}
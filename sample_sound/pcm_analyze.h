@@ -0,0 +1,131 @@
+#ifndef SAMPLE_SOUND_PCM_ANALYZE_H
+#define SAMPLE_SOUND_PCM_ANALYZE_H
+
+/*
+Level and spectrum analysis on the capture path, run on each period as
+it is captured, in the process, instead of piping the raw stream into
+another process to be metered.
+
+pcm_analyze_process takes the period in the stream's own format and
+converts it to float in chunks on the stack. It does two things with the
+samples:
+  meters  peak and RMS of each channel over the frames since the last
+          publish
+  FFT     channels summed to mono into a history of fft_size frames. At
+          every hop frames (fft_size/2 by default, 50% overlap) the
+          latest fft_size frames are Hann windowed and go through a
+          real FFT
+The real FFT is a complex radix-2 FFT of fft_size/2 points on the even
+and odd samples, followed by one split pass. pcm_analyze_init
+precomputes everything the transform needs:
+  - the window;
+  - the bit-reversed order, which is applied while the window is;
+  - the twiddles of every stage, each stage in its own contiguous run;
+  - the split twiddles.
+The butterflies run on the kernel set pcm_convert is using (avx2, sse2,
+scalar; pcm_convert_select steers it too). No set uses FMA, so every
+set gives the same result.
+
+Each FFT is reduced to band energies. The bands are log spaced from
+min_hz to the Nyquist frequency, and the frequency of the strongest bin
+is kept too. A band energy is the mean square its bins contribute, on
+the same scale as rms squared: a full-scale sine puts -3 dBFS in its
+band.
+
+At most max_ffts transforms run per call. If a long period makes more
+hops due, the oldest are skipped and counted, so a call never costs more
+than max_ffts FFTs plus a pass over its frames. Nothing is allocated
+after init.
+
+At the end of each call the results are published under a sequence
+lock. There is one writer, the thread calling pcm_analyze_process.
+pcm_analyze_read can be called from any number of threads at any time.
+It copies the latest result and retries if a publish overlapped the copy.
+The writer never waits for a reader.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include "pcm_engine.h"
+
+#define PCM_ANALYZE_MAX_CHANNELS 8
+#define PCM_ANALYZE_MAX_BANDS 32
+#define PCM_ANALYZE_MIN_FFT 64
+#define PCM_ANALYZE_MAX_FFT 16384
+
+typedef struct pcm_analyze_config {
+	unsigned int fft_size;       /* power of two */
+	unsigned int hop;            /* frames between FFTs, at most fft_size */
+	unsigned int bands;
+	double min_hz;               /* lower edge of the first band */
+	unsigned int max_ffts;       /* per pcm_analyze_process call */
+} pcm_analyze_config_t;
+
+typedef struct pcm_analyze_result {
+	uint64_t frames;             /* analysed so far */
+	uint64_t ffts;
+	uint64_t skipped;            /* hops over the max_ffts budget */
+	unsigned int channels;
+	unsigned int bands;
+	float peak[PCM_ANALYZE_MAX_CHANNELS];        /* linear, 1.0 full scale, since the previous publish */
+	float rms[PCM_ANALYZE_MAX_CHANNELS];
+	float band_energy[PCM_ANALYZE_MAX_BANDS];    /* mean square, of the latest FFT */
+	float dominant_hz;
+} pcm_analyze_result_t;
+
+typedef void (*pcm_analyze_stage_fn)(float *re, float *im, const float *tw_re, const float *tw_im,
+	unsigned int n, unsigned int half);
+
+typedef struct pcm_analyze {
+	pcm_analyze_config_t config;
+	pcm_format_t format;
+	unsigned int channels;
+	unsigned int rate;
+	unsigned int half;           /* complex FFT size, fft_size/2 */
+	unsigned int log2_half;
+
+	/* the plan */
+	float *window;               /* fft_size, periodic Hann */
+	uint32_t *bitrev;            /* half */
+	float *tw_re;                /* half: stage h at [h,2h) */
+	float *tw_im;
+	float *split_re;             /* half+1 */
+	float *split_im;
+	unsigned int band_edge[PCM_ANALYZE_MAX_BANDS+1];   /* first bin of each band */
+	double band_hz[PCM_ANALYZE_MAX_BANDS+1];
+	double scale;                /* |X|^2 to mean square */
+	pcm_analyze_stage_fn stage;
+
+	/* writer state */
+	float *history;              /* fft_size mono frames, a ring */
+	float *re;                   /* half */
+	float *im;
+	unsigned int write_pos;
+	unsigned int pending;        /* frames since the last hop */
+	double peak[PCM_ANALYZE_MAX_CHANNELS];
+	double sum_squares[PCM_ANALYZE_MAX_CHANNELS];
+	uint64_t meter_frames;
+	pcm_analyze_result_t work;
+
+	/* what readers see */
+	_Alignas(64) atomic_uint_fast64_t seq;       /* odd while a publish is in progress */
+	pcm_analyze_result_t published;
+} pcm_analyze_t;
+
+/* 1024-point FFT, 50% overlap, 10 bands from 50 Hz, 4 FFTs per call */
+void pcm_analyze_config_init(pcm_analyze_config_t *cfg);
+
+int pcm_analyze_init(pcm_analyze_t *a, const pcm_analyze_config_t *cfg, pcm_format_t format,
+	unsigned int channels, unsigned int rate);
+void pcm_analyze_destroy(pcm_analyze_t *a);
+
+/* analyse interleaved frames in the stream's format and publish; 0, or -1 for an unknown format */
+int pcm_analyze_process(pcm_analyze_t *a, const void *frames, size_t count);
+/* the latest published result, from any thread: 1, or 0 if nothing has been published yet */
+int pcm_analyze_read(const pcm_analyze_t *a, pcm_analyze_result_t *out);
+
+/* band b covers [band_hz(b), band_hz(b+1)) */
+double pcm_analyze_band_hz(const pcm_analyze_t *a, unsigned int edge);
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef SAMPLE_SOUND_PCM_BACKEND_H
+#define SAMPLE_SOUND_PCM_BACKEND_H
+
+/*
+Backend interface behind pcm_engine.c. Every call returns frames or 0 on
+success and a negative errno on failure, the way libasound does, so
+pcm_recover sees the same codes from every backend. The mmap calls are
+only used while pcm->config.mmap is set.
+*/
+
+#include <poll.h>
+#include "pcm_engine.h"
+
+typedef struct pcm_ops {
+	const char *name;
+	/* the device itself consumes/produces frames at config.rate; the
+	file and null backends are not, so the audio thread paces them */
+	int clocked;
+	/* open and negotiate; update pcm->config with what was granted */
+	int (*open)(pcm_t *pcm);
+	long (*read)(pcm_t *pcm, void *buffer, unsigned long frames);
+	long (*write)(pcm_t *pcm, const void *buffer, unsigned long frames);
+	int (*prepare)(pcm_t *pcm);
+	int (*resume)(pcm_t *pcm);
+	int (*drain)(pcm_t *pcm);
+	void (*close)(pcm_t *pcm);
+	/* direct ring access, NULL when the backend has none; begin waits for
+	frames unless nonblocking (-EAGAIN), *offset is passed back to commit */
+	int (*mmap_begin)(pcm_t *pcm, void **area, unsigned long *offset, unsigned long *frames);
+	long (*mmap_commit)(pcm_t *pcm, unsigned long offset, unsigned long frames);
+	/* descriptors to poll and their translation into POLLIN/POLLOUT/POLLERR;
+	NULL when there is nothing to poll (null backend) */
+	int (*poll_descriptors)(pcm_t *pcm, struct pollfd *pfds, unsigned int space);
+	int (*poll_revents)(pcm_t *pcm, struct pollfd *pfds, unsigned int nfds, unsigned short *revents);
+} pcm_ops_t;
+
+extern const pcm_ops_t pcm_file_ops;
+extern const pcm_ops_t pcm_null_ops;
+extern const pcm_ops_t pcm_sim_ops;
+#if PCM_ENGINE_ALSA
+extern const pcm_ops_t pcm_alsa_ops;
+#endif
+
+#endif
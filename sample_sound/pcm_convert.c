@@ -0,0 +1,846 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <stdatomic.h>
+#include "pcm_convert.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PCM_CONVERT_X86 1
+#else
+#define PCM_CONVERT_X86 0
+#endif
+
+/* floats converted per step when neither side of pcm_convert is float */
+#define PCM_CONVERT_CHUNK 256
+
+#define S16_SCALE 32768.0f
+#define S24_SCALE 8388608.0f
+#define S32_SCALE 2147483648.0f
+
+/*
+Clamping is written as a>b ? a : b so a NaN sample ends up at the lower
+bound, which is what MAXPS does with the bound as second operand; that
+keeps the scalar results identical to the vector ones.
+*/
+static float clamp_sample(float v, float lo, float hi)
+{
+	v=v>lo ? v : lo;
+	return v<hi ? v : hi;
+}
+
+static void scalar_s16_to_float(float *dst, const int16_t *src, size_t n)
+{
+	size_t i;
+
+	for(i=0;i<n;i++)
+	{
+		dst[i]=(float)src[i]*(1.0f/S16_SCALE);
+	}
+}
+
+static void scalar_float_to_s16(int16_t *dst, const float *src, size_t n)
+{
+	size_t i;
+
+	for(i=0;i<n;i++)
+	{
+		dst[i]=(int16_t)lrintf(clamp_sample(src[i]*S16_SCALE,-32768.0f,32767.0f));
+	}
+}
+
+static void scalar_s24_to_float(float *dst, const uint8_t *src, size_t n)
+{
+	size_t i;
+
+	for(i=0;i<n;i++)
+	{
+		const uint8_t *p=src+i*3;
+		/* the three bytes in the top of an int32, then an arithmetic shift down */
+		int32_t v=(int32_t)((uint32_t)p[0]<<8|(uint32_t)p[1]<<16|(uint32_t)p[2]<<24)>>8;
+
+		dst[i]=(float)v*(1.0f/S24_SCALE);
+	}
+}
+
+static void scalar_float_to_s24(uint8_t *dst, const float *src, size_t n)
+{
+	size_t i;
+
+	for(i=0;i<n;i++)
+	{
+		int32_t v=(int32_t)lrintf(clamp_sample(src[i]*S24_SCALE,-8388608.0f,8388607.0f));
+		uint8_t *p=dst+i*3;
+
+		p[0]=(uint8_t)v;
+		p[1]=(uint8_t)(v>>8);
+		p[2]=(uint8_t)(v>>16);
+	}
+}
+
+static void scalar_s32_to_float(float *dst, const int32_t *src, size_t n)
+{
+	size_t i;
+
+	for(i=0;i<n;i++)
+	{
+		dst[i]=(float)src[i]*(1.0f/S32_SCALE);
+	}
+}
+
+static void scalar_float_to_s32(int32_t *dst, const float *src, size_t n)
+{
+	size_t i;
+
+	for(i=0;i<n;i++)
+	{
+		/* 2^31 itself is the first float past INT32_MAX */
+		float v=clamp_sample(src[i]*S32_SCALE,-S32_SCALE,S32_SCALE);
+
+		dst[i]=v>=S32_SCALE ? INT32_MAX : (int32_t)lrintf(v);
+	}
+}
+
+static void scalar_gain(float *dst, const float *src, float gain, size_t n)
+{
+	size_t i;
+
+	for(i=0;i<n;i++)
+	{
+		dst[i]=src[i]*gain;
+	}
+}
+
+static void scalar_mix(float *dst, const float *const *src, const float *gains, unsigned int count, size_t n)
+{
+	size_t i;
+	unsigned int k;
+
+	for(i=0;i<n;i++)
+	{
+		float acc=src[0][i]*gains[0];
+
+		for(k=1;k<count;k++)
+		{
+			acc+=src[k][i]*gains[k];
+		}
+		dst[i]=acc;
+	}
+}
+
+static void scalar_mix_s16(int16_t *dst, const int16_t *const *src, unsigned int count, size_t n)
+{
+	size_t i;
+	unsigned int k;
+
+	for(i=0;i<n;i++)
+	{
+		int32_t acc=0;
+
+		for(k=0;k<count;k++)
+		{
+			acc+=src[k][i];
+		}
+		dst[i]=(int16_t)(acc>32767 ? 32767 : acc<-32768 ? -32768 : acc);
+	}
+}
+
+static void scalar_deinterleave2(float *left, float *right, const float *src, size_t frames)
+{
+	size_t i;
+
+	for(i=0;i<frames;i++)
+	{
+		left[i]=src[2*i];
+		right[i]=src[2*i+1];
+	}
+}
+
+static void scalar_interleave2(float *dst, const float *left, const float *right, size_t frames)
+{
+	size_t i;
+
+	for(i=0;i<frames;i++)
+	{
+		dst[2*i]=left[i];
+		dst[2*i+1]=right[i];
+	}
+}
+
+#if PCM_CONVERT_X86
+__attribute__((target("sse2")))
+static void sse2_s16_to_float(float *dst, const int16_t *src, size_t n)
+{
+	const __m128 scale=_mm_set1_ps(1.0f/S16_SCALE);
+	size_t i=0;
+
+	for(;i+8<=n;i+=8)
+	{
+		__m128i x=_mm_loadu_si128((const __m128i *)(src+i));
+		/* sign-extend by putting each sample in the top half and shifting down */
+		__m128i lo=_mm_srai_epi32(_mm_unpacklo_epi16(x,x),16);
+		__m128i hi=_mm_srai_epi32(_mm_unpackhi_epi16(x,x),16);
+
+		_mm_storeu_ps(dst+i,_mm_mul_ps(_mm_cvtepi32_ps(lo),scale));
+		_mm_storeu_ps(dst+i+4,_mm_mul_ps(_mm_cvtepi32_ps(hi),scale));
+	}
+	scalar_s16_to_float(dst+i,src+i,n-i);
+}
+
+__attribute__((target("sse2")))
+static void sse2_float_to_s16(int16_t *dst, const float *src, size_t n)
+{
+	const __m128 scale=_mm_set1_ps(S16_SCALE);
+	const __m128 lo=_mm_set1_ps(-32768.0f);
+	const __m128 hi=_mm_set1_ps(32767.0f);
+	size_t i=0;
+
+	for(;i+8<=n;i+=8)
+	{
+		__m128 a=_mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(src+i),scale),lo),hi);
+		__m128 b=_mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(src+i+4),scale),lo),hi);
+
+		_mm_storeu_si128((__m128i *)(dst+i),_mm_packs_epi32(_mm_cvtps_epi32(a),_mm_cvtps_epi32(b)));
+	}
+	scalar_float_to_s16(dst+i,src+i,n-i);
+}
+
+__attribute__((target("sse2")))
+static void sse2_s32_to_float(float *dst, const int32_t *src, size_t n)
+{
+	const __m128 scale=_mm_set1_ps(1.0f/S32_SCALE);
+	size_t i=0;
+
+	for(;i+4<=n;i+=4)
+	{
+		_mm_storeu_ps(dst+i,_mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)(src+i))),scale));
+	}
+	scalar_s32_to_float(dst+i,src+i,n-i);
+}
+
+__attribute__((target("sse2")))
+static void sse2_float_to_s32(int32_t *dst, const float *src, size_t n)
+{
+	const __m128 scale=_mm_set1_ps(S32_SCALE);
+	const __m128 lo=_mm_set1_ps(-S32_SCALE);
+	size_t i=0;
+
+	for(;i+4<=n;i+=4)
+	{
+		__m128 v=_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(src+i),scale),lo);
+		/* CVTPS2DQ gives 0x80000000 past INT32_MAX; flipping every bit makes it 0x7fffffff */
+		__m128i over=_mm_castps_si128(_mm_cmpge_ps(v,scale));
+
+		_mm_storeu_si128((__m128i *)(dst+i),_mm_xor_si128(_mm_cvtps_epi32(v),over));
+	}
+	scalar_float_to_s32(dst+i,src+i,n-i);
+}
+
+__attribute__((target("sse2")))
+static void sse2_gain(float *dst, const float *src, float gain, size_t n)
+{
+	const __m128 g=_mm_set1_ps(gain);
+	size_t i=0;
+
+	for(;i+4<=n;i+=4)
+	{
+		_mm_storeu_ps(dst+i,_mm_mul_ps(_mm_loadu_ps(src+i),g));
+	}
+	scalar_gain(dst+i,src+i,gain,n-i);
+}
+
+__attribute__((target("sse2")))
+static void sse2_mix(float *dst, const float *const *src, const float *gains, unsigned int count, size_t n)
+{
+	size_t i=0;
+	unsigned int k;
+
+	for(;i+4<=n;i+=4)
+	{
+		__m128 acc=_mm_mul_ps(_mm_loadu_ps(src[0]+i),_mm_set1_ps(gains[0]));
+
+		for(k=1;k<count;k++)
+		{
+			acc=_mm_add_ps(acc,_mm_mul_ps(_mm_loadu_ps(src[k]+i),_mm_set1_ps(gains[k])));
+		}
+		_mm_storeu_ps(dst+i,acc);
+	}
+	for(;i<n;i++)
+	{
+		float acc=src[0][i]*gains[0];
+
+		for(k=1;k<count;k++)
+		{
+			acc+=src[k][i]*gains[k];
+		}
+		dst[i]=acc;
+	}
+}
+
+__attribute__((target("sse2")))
+static void sse2_mix_s16(int16_t *dst, const int16_t *const *src, unsigned int count, size_t n)
+{
+	size_t i=0;
+	unsigned int k;
+
+	for(;i+8<=n;i+=8)
+	{
+		__m128i lo=_mm_setzero_si128();
+		__m128i hi=_mm_setzero_si128();
+
+		for(k=0;k<count;k++)
+		{
+			__m128i x=_mm_loadu_si128((const __m128i *)(src[k]+i));
+
+			lo=_mm_add_epi32(lo,_mm_srai_epi32(_mm_unpacklo_epi16(x,x),16));
+			hi=_mm_add_epi32(hi,_mm_srai_epi32(_mm_unpackhi_epi16(x,x),16));
+		}
+		_mm_storeu_si128((__m128i *)(dst+i),_mm_packs_epi32(lo,hi));
+	}
+	for(;i<n;i++)
+	{
+		int32_t acc=0;
+
+		for(k=0;k<count;k++)
+		{
+			acc+=src[k][i];
+		}
+		dst[i]=(int16_t)(acc>32767 ? 32767 : acc<-32768 ? -32768 : acc);
+	}
+}
+
+__attribute__((target("sse2")))
+static void sse2_deinterleave2(float *left, float *right, const float *src, size_t frames)
+{
+	size_t i=0;
+
+	for(;i+4<=frames;i+=4)
+	{
+		__m128 a=_mm_loadu_ps(src+2*i);
+		__m128 b=_mm_loadu_ps(src+2*i+4);
+
+		_mm_storeu_ps(left+i,_mm_shuffle_ps(a,b,_MM_SHUFFLE(2,0,2,0)));
+		_mm_storeu_ps(right+i,_mm_shuffle_ps(a,b,_MM_SHUFFLE(3,1,3,1)));
+	}
+	scalar_deinterleave2(left+i,right+i,src+2*i,frames-i);
+}
+
+__attribute__((target("sse2")))
+static void sse2_interleave2(float *dst, const float *left, const float *right, size_t frames)
+{
+	size_t i=0;
+
+	for(;i+4<=frames;i+=4)
+	{
+		__m128 l=_mm_loadu_ps(left+i);
+		__m128 r=_mm_loadu_ps(right+i);
+
+		_mm_storeu_ps(dst+2*i,_mm_unpacklo_ps(l,r));
+		_mm_storeu_ps(dst+2*i+4,_mm_unpackhi_ps(l,r));
+	}
+	scalar_interleave2(dst+2*i,left+i,right+i,frames-i);
+}
+
+/*
+The AVX2 kernels hand their tails to the SSE2/scalar ones, which are not
+VEX encoded; GCC does not always put a VZEROUPPER on that call, and
+running legacy SSE with the upper halves dirty costs more than the
+whole 32-frame period, so each one clears them itself.
+*/
+__attribute__((target("avx2")))
+static void avx2_s16_to_float(float *dst, const int16_t *src, size_t n)
+{
+	const __m256 scale=_mm256_set1_ps(1.0f/S16_SCALE);
+	size_t i=0;
+
+	for(;i+8<=n;i+=8)
+	{
+		__m256i x=_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(src+i)));
+
+		_mm256_storeu_ps(dst+i,_mm256_mul_ps(_mm256_cvtepi32_ps(x),scale));
+	}
+	_mm256_zeroupper();
+	scalar_s16_to_float(dst+i,src+i,n-i);
+}
+
+__attribute__((target("avx2")))
+static void avx2_float_to_s16(int16_t *dst, const float *src, size_t n)
+{
+	const __m256 scale=_mm256_set1_ps(S16_SCALE);
+	const __m256 lo=_mm256_set1_ps(-32768.0f);
+	const __m256 hi=_mm256_set1_ps(32767.0f);
+	size_t i=0;
+
+	for(;i+16<=n;i+=16)
+	{
+		__m256 a=_mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(src+i),scale),lo),hi);
+		__m256 b=_mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(src+i+8),scale),lo),hi);
+		/* PACKSSDW works per 128-bit lane: a0-3 b0-3 | a4-7 b4-7, put the quarters back in order */
+		__m256i x=_mm256_packs_epi32(_mm256_cvtps_epi32(a),_mm256_cvtps_epi32(b));
+
+		_mm256_storeu_si256((__m256i *)(dst+i),_mm256_permute4x64_epi64(x,_MM_SHUFFLE(3,1,2,0)));
+	}
+	_mm256_zeroupper();
+	sse2_float_to_s16(dst+i,src+i,n-i);
+}
+
+__attribute__((target("avx2")))
+static void avx2_s24_to_float(float *dst, const uint8_t *src, size_t n)
+{
+	/* per lane: 12 packed bytes to four int32 with the sample in the top 24 bits */
+	const __m256i spread=_mm256_setr_epi8(
+		-1,0,1,2,-1,3,4,5,-1,6,7,8,-1,9,10,11,
+		-1,0,1,2,-1,3,4,5,-1,6,7,8,-1,9,10,11);
+	const __m256 scale=_mm256_set1_ps(1.0f/S24_SCALE);
+	size_t i=0;
+
+	/* the second 16-byte load reaches 4 bytes past the 8 samples */
+	for(;i+10<=n;i+=8)
+	{
+		const uint8_t *p=src+i*3;
+		__m256i x=_mm256_setr_m128i(_mm_loadu_si128((const __m128i *)p),_mm_loadu_si128((const __m128i *)(p+12)));
+
+		x=_mm256_srai_epi32(_mm256_shuffle_epi8(x,spread),8);
+		_mm256_storeu_ps(dst+i,_mm256_mul_ps(_mm256_cvtepi32_ps(x),scale));
+	}
+	_mm256_zeroupper();
+	scalar_s24_to_float(dst+i,src+i*3,n-i);
+}
+
+__attribute__((target("avx2")))
+static void avx2_float_to_s24(uint8_t *dst, const float *src, size_t n)
+{
+	/* per lane: the low three bytes of four int32 packed into the first 12 */
+	const __m256i pack=_mm256_setr_epi8(
+		0,1,2,4,5,6,8,9,10,12,13,14,-1,-1,-1,-1,
+		0,1,2,4,5,6,8,9,10,12,13,14,-1,-1,-1,-1);
+	const __m256 scale=_mm256_set1_ps(S24_SCALE);
+	const __m256 lo=_mm256_set1_ps(-8388608.0f);
+	const __m256 hi=_mm256_set1_ps(8388607.0f);
+	size_t i=0;
+
+	for(;i+8<=n;i+=8)
+	{
+		__m256 v=_mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(src+i),scale),lo),hi);
+		__m256i x=_mm256_shuffle_epi8(_mm256_cvtps_epi32(v),pack);
+		__m128i a=_mm256_castsi256_si128(x);
+		__m128i b=_mm256_extracti128_si256(x,1);
+		uint8_t *p=dst+i*3;
+		int32_t tail;
+
+		/* 12 bytes per lane, written as 8+4 so nothing past the 24 is touched */
+		_mm_storel_epi64((__m128i *)p,a);
+		tail=_mm_cvtsi128_si32(_mm_srli_si128(a,8));
+		memcpy(p+8,&tail,4);
+		_mm_storel_epi64((__m128i *)(p+12),b);
+		tail=_mm_cvtsi128_si32(_mm_srli_si128(b,8));
+		memcpy(p+20,&tail,4);
+	}
+	_mm256_zeroupper();
+	scalar_float_to_s24(dst+i*3,src+i,n-i);
+}
+
+__attribute__((target("avx2")))
+static void avx2_s32_to_float(float *dst, const int32_t *src, size_t n)
+{
+	const __m256 scale=_mm256_set1_ps(1.0f/S32_SCALE);
+	size_t i=0;
+
+	for(;i+8<=n;i+=8)
+	{
+		__m256i x=_mm256_loadu_si256((const __m256i *)(src+i));
+
+		_mm256_storeu_ps(dst+i,_mm256_mul_ps(_mm256_cvtepi32_ps(x),scale));
+	}
+	_mm256_zeroupper();
+	scalar_s32_to_float(dst+i,src+i,n-i);
+}
+
+__attribute__((target("avx2")))
+static void avx2_float_to_s32(int32_t *dst, const float *src, size_t n)
+{
+	const __m256 scale=_mm256_set1_ps(S32_SCALE);
+	const __m256 lo=_mm256_set1_ps(-S32_SCALE);
+	size_t i=0;
+
+	for(;i+8<=n;i+=8)
+	{
+		__m256 v=_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(src+i),scale),lo);
+		__m256i over=_mm256_castps_si256(_mm256_cmp_ps(v,scale,_CMP_GE_OQ));
+
+		_mm256_storeu_si256((__m256i *)(dst+i),_mm256_xor_si256(_mm256_cvtps_epi32(v),over));
+	}
+	_mm256_zeroupper();
+	scalar_float_to_s32(dst+i,src+i,n-i);
+}
+
+__attribute__((target("avx2")))
+static void avx2_gain(float *dst, const float *src, float gain, size_t n)
+{
+	const __m256 g=_mm256_set1_ps(gain);
+	size_t i=0;
+
+	for(;i+8<=n;i+=8)
+	{
+		_mm256_storeu_ps(dst+i,_mm256_mul_ps(_mm256_loadu_ps(src+i),g));
+	}
+	_mm256_zeroupper();
+	scalar_gain(dst+i,src+i,gain,n-i);
+}
+
+__attribute__((target("avx2")))
+static void avx2_mix(float *dst, const float *const *src, const float *gains, unsigned int count, size_t n)
+{
+	size_t i=0;
+	unsigned int k;
+
+	/* no FMA: a fused multiply-add would round differently from the other kernels */
+	for(;i+8<=n;i+=8)
+	{
+		__m256 acc=_mm256_mul_ps(_mm256_loadu_ps(src[0]+i),_mm256_set1_ps(gains[0]));
+
+		for(k=1;k<count;k++)
+		{
+			acc=_mm256_add_ps(acc,_mm256_mul_ps(_mm256_loadu_ps(src[k]+i),_mm256_set1_ps(gains[k])));
+		}
+		_mm256_storeu_ps(dst+i,acc);
+	}
+	_mm256_zeroupper();
+	if(i<n)
+	{
+		const float *rest[count];
+
+		for(k=0;k<count;k++)
+		{
+			rest[k]=src[k]+i;
+		}
+		sse2_mix(dst+i,rest,gains,count,n-i);
+	}
+}
+
+__attribute__((target("avx2")))
+static void avx2_mix_s16(int16_t *dst, const int16_t *const *src, unsigned int count, size_t n)
+{
+	size_t i=0;
+	unsigned int k;
+
+	for(;i+16<=n;i+=16)
+	{
+		__m256i lo=_mm256_setzero_si256();
+		__m256i hi=_mm256_setzero_si256();
+
+		for(k=0;k<count;k++)
+		{
+			lo=_mm256_add_epi32(lo,_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(src[k]+i))));
+			hi=_mm256_add_epi32(hi,_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(src[k]+i+8))));
+		}
+		_mm256_storeu_si256((__m256i *)(dst+i),_mm256_permute4x64_epi64(_mm256_packs_epi32(lo,hi),_MM_SHUFFLE(3,1,2,0)));
+	}
+	_mm256_zeroupper();
+	if(i<n)
+	{
+		const int16_t *rest[count];
+
+		for(k=0;k<count;k++)
+		{
+			rest[k]=src[k]+i;
+		}
+		sse2_mix_s16(dst+i,rest,count,n-i);
+	}
+}
+
+__attribute__((target("avx2")))
+static void avx2_deinterleave2(float *left, float *right, const float *src, size_t frames)
+{
+	size_t i=0;
+
+	for(;i+8<=frames;i+=8)
+	{
+		__m256 a=_mm256_loadu_ps(src+2*i);
+		__m256 b=_mm256_loadu_ps(src+2*i+8);
+		/* in-lane shuffles give l0 l1 l4 l5 | l2 l3 l6 l7; swap the middle pairs */
+		__m256 l=_mm256_shuffle_ps(a,b,_MM_SHUFFLE(2,0,2,0));
+		__m256 r=_mm256_shuffle_ps(a,b,_MM_SHUFFLE(3,1,3,1));
+
+		_mm256_storeu_ps(left+i,_mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(l),_MM_SHUFFLE(3,1,2,0))));
+		_mm256_storeu_ps(right+i,_mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(r),_MM_SHUFFLE(3,1,2,0))));
+	}
+	_mm256_zeroupper();
+	sse2_deinterleave2(left+i,right+i,src+2*i,frames-i);
+}
+
+__attribute__((target("avx2")))
+static void avx2_interleave2(float *dst, const float *left, const float *right, size_t frames)
+{
+	size_t i=0;
+
+	for(;i+8<=frames;i+=8)
+	{
+		__m256 l=_mm256_loadu_ps(left+i);
+		__m256 r=_mm256_loadu_ps(right+i);
+		__m256 lo=_mm256_unpacklo_ps(l,r);
+		__m256 hi=_mm256_unpackhi_ps(l,r);
+
+		_mm256_storeu_ps(dst+2*i,_mm256_permute2f128_ps(lo,hi,0x20));
+		_mm256_storeu_ps(dst+2*i+8,_mm256_permute2f128_ps(lo,hi,0x31));
+	}
+	_mm256_zeroupper();
+	sse2_interleave2(dst+2*i,left+i,right+i,frames-i);
+}
+
+static int has_sse2(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("sse2");
+}
+
+static int has_avx2(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+}
+#endif
+
+static int always(void)
+{
+	return 1;
+}
+
+/* best first: the first supported entry is what "auto" picks */
+static const struct {
+	const char *name;
+	int (*supported)(void);
+	void (*s16_to_float)(float *dst, const int16_t *src, size_t n);
+	void (*float_to_s16)(int16_t *dst, const float *src, size_t n);
+	void (*s24_to_float)(float *dst, const uint8_t *src, size_t n);
+	void (*float_to_s24)(uint8_t *dst, const float *src, size_t n);
+	void (*s32_to_float)(float *dst, const int32_t *src, size_t n);
+	void (*float_to_s32)(int32_t *dst, const float *src, size_t n);
+	void (*gain)(float *dst, const float *src, float gain, size_t n);
+	void (*mix)(float *dst, const float *const *src, const float *gains, unsigned int count, size_t n);
+	void (*mix_s16)(int16_t *dst, const int16_t *const *src, unsigned int count, size_t n);
+	void (*deinterleave2)(float *left, float *right, const float *src, size_t frames);
+	void (*interleave2)(float *dst, const float *left, const float *right, size_t frames);
+} kernels[]={
+#if PCM_CONVERT_X86
+	{"avx2",has_avx2,avx2_s16_to_float,avx2_float_to_s16,avx2_s24_to_float,avx2_float_to_s24,
+		avx2_s32_to_float,avx2_float_to_s32,avx2_gain,avx2_mix,avx2_mix_s16,avx2_deinterleave2,avx2_interleave2},
+	/* SSE2 has no byte shuffle, so packed 24-bit stays scalar */
+	{"sse2",has_sse2,sse2_s16_to_float,sse2_float_to_s16,scalar_s24_to_float,scalar_float_to_s24,
+		sse2_s32_to_float,sse2_float_to_s32,sse2_gain,sse2_mix,sse2_mix_s16,sse2_deinterleave2,sse2_interleave2},
+#endif
+	{"scalar",always,scalar_s16_to_float,scalar_float_to_s16,scalar_s24_to_float,scalar_float_to_s24,
+		scalar_s32_to_float,scalar_float_to_s32,scalar_gain,scalar_mix,scalar_mix_s16,scalar_deinterleave2,scalar_interleave2},
+};
+
+#define KERNEL_COUNT (sizeof(kernels)/sizeof(kernels[0]))
+
+static atomic_int current=-1;
+
+static int detect(void)
+{
+	size_t k;
+
+	for(k=0;k<KERNEL_COUNT;k++)
+	{
+		if(kernels[k].supported())
+			return (int)k;
+	}
+	return (int)KERNEL_COUNT-1;
+}
+
+static int current_kernel(void)
+{
+	int k=atomic_load_explicit(&current,memory_order_relaxed);
+
+	if(k<0)
+	{
+		k=detect();
+		atomic_store_explicit(&current,k,memory_order_relaxed);
+	}
+	return k;
+}
+
+int pcm_to_float(float *dst, const void *src, pcm_format_t src_format, size_t samples)
+{
+	int k=current_kernel();
+
+	switch(src_format)
+	{
+	case PCM_FORMAT_S16_LE:   kernels[k].s16_to_float(dst,(const int16_t *)src,samples); return 0;
+	case PCM_FORMAT_S24_3LE:  kernels[k].s24_to_float(dst,(const uint8_t *)src,samples); return 0;
+	case PCM_FORMAT_S32_LE:   kernels[k].s32_to_float(dst,(const int32_t *)src,samples); return 0;
+	case PCM_FORMAT_FLOAT_LE:
+		if(dst!=src)
+			memmove(dst,src,samples*sizeof(float));
+		return 0;
+	}
+	fprintf(stderr,"@pcm_to_float, error occurs for format %d \n",(int)src_format);
+	return -1;
+}
+
+int pcm_from_float(void *dst, pcm_format_t dst_format, const float *src, size_t samples)
+{
+	int k=current_kernel();
+
+	switch(dst_format)
+	{
+	case PCM_FORMAT_S16_LE:   kernels[k].float_to_s16((int16_t *)dst,src,samples); return 0;
+	case PCM_FORMAT_S24_3LE:  kernels[k].float_to_s24((uint8_t *)dst,src,samples); return 0;
+	case PCM_FORMAT_S32_LE:   kernels[k].float_to_s32((int32_t *)dst,src,samples); return 0;
+	case PCM_FORMAT_FLOAT_LE:
+		if(dst!=src)
+			memmove(dst,src,samples*sizeof(float));
+		return 0;
+	}
+	fprintf(stderr,"@pcm_from_float, error occurs for format %d \n",(int)dst_format);
+	return -1;
+}
+
+int pcm_convert(void *dst, pcm_format_t dst_format, const void *src, pcm_format_t src_format, size_t samples)
+{
+	float chunk[PCM_CONVERT_CHUNK];
+	size_t src_bytes=pcm_format_bytes(src_format);
+	size_t dst_bytes=pcm_format_bytes(dst_format);
+	size_t done;
+
+	if(src_bytes==0||dst_bytes==0)
+	{
+		fprintf(stderr,"@pcm_convert, error occurs for formats %d -> %d \n",(int)src_format,(int)dst_format);
+		return -1;
+	}
+	if(src_format==dst_format)
+	{
+		if(dst!=src)
+			memmove(dst,src,samples*src_bytes);
+		return 0;
+	}
+	if(src_format==PCM_FORMAT_FLOAT_LE)
+		return pcm_from_float(dst,dst_format,(const float *)src,samples);
+	if(dst_format==PCM_FORMAT_FLOAT_LE)
+		return pcm_to_float((float *)dst,src,src_format,samples);
+	for(done=0;done<samples;done+=PCM_CONVERT_CHUNK)
+	{
+		size_t n=samples-done<PCM_CONVERT_CHUNK ? samples-done : PCM_CONVERT_CHUNK;
+
+		pcm_to_float(chunk,(const char *)src+done*src_bytes,src_format,n);
+		pcm_from_float((char *)dst+done*dst_bytes,dst_format,chunk,n);
+	}
+	return 0;
+}
+
+void pcm_deinterleave(float *const *planes, const float *src, unsigned int channels, size_t frames)
+{
+	size_t i;
+	unsigned int c;
+
+	if(channels==1)
+	{
+		memcpy(planes[0],src,frames*sizeof(float));
+		return;
+	}
+	if(channels==2)
+	{
+		kernels[current_kernel()].deinterleave2(planes[0],planes[1],src,frames);
+		return;
+	}
+	for(i=0;i<frames;i++)
+	{
+		for(c=0;c<channels;c++)
+		{
+			planes[c][i]=src[i*channels+c];
+		}
+	}
+}
+
+void pcm_interleave(float *dst, const float *const *planes, unsigned int channels, size_t frames)
+{
+	size_t i;
+	unsigned int c;
+
+	if(channels==1)
+	{
+		memcpy(dst,planes[0],frames*sizeof(float));
+		return;
+	}
+	if(channels==2)
+	{
+		kernels[current_kernel()].interleave2(dst,planes[0],planes[1],frames);
+		return;
+	}
+	for(i=0;i<frames;i++)
+	{
+		for(c=0;c<channels;c++)
+		{
+			dst[i*channels+c]=planes[c][i];
+		}
+	}
+}
+
+void pcm_gain(float *dst, const float *src, float gain, size_t samples)
+{
+	kernels[current_kernel()].gain(dst,src,gain,samples);
+}
+
+void pcm_mix(float *dst, const float *const *src, const float *gains, unsigned int count, size_t samples)
+{
+	float unity[count ? count : 1];
+	unsigned int k;
+
+	if(count==0)
+	{
+		memset(dst,0,samples*sizeof(float));
+		return;
+	}
+	if(gains==NULL)
+	{
+		for(k=0;k<count;k++)
+		{
+			unity[k]=1.0f;
+		}
+		gains=unity;
+	}
+	kernels[current_kernel()].mix(dst,src,gains,count,samples);
+}
+
+void pcm_mix_s16(int16_t *dst, const int16_t *const *src, unsigned int count, size_t samples)
+{
+	if(count==0)
+	{
+		memset(dst,0,samples*sizeof(int16_t));
+		return;
+	}
+	kernels[current_kernel()].mix_s16(dst,src,count,samples);
+}
+
+static int find_kernel(const char *name)
+{
+	size_t k;
+
+	if(strcmp(name,"auto")==0)
+		return detect();
+	for(k=0;k<KERNEL_COUNT;k++)
+	{
+		if(strcmp(kernels[k].name,name)==0)
+			return kernels[k].supported() ? (int)k : -1;
+	}
+	return -1;
+}
+
+int pcm_convert_select(const char *name)
+{
+	int k=find_kernel(name);
+
+	if(k<0)
+	{
+		fprintf(stderr,"@pcm_convert_select, error occurs for kernel %s \n",name);
+		return -1;
+	}
+	atomic_store_explicit(&current,k,memory_order_relaxed);
+	return 0;
+}
+
+const char *pcm_convert_kernel_name(void)
+{
+	return kernels[current_kernel()].name;
+}
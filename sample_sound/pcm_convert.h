@@ -0,0 +1,50 @@
+#ifndef SAMPLE_SOUND_PCM_CONVERT_H
+#define SAMPLE_SOUND_PCM_CONVERT_H
+
+/*
+Sample-format conversion and mixing for the PCM path, so DSP can run on
+float samples and only the device boundary sees S16/S24/S32.
+
+Integer samples map to [-1,1) by their full scale (32768, 8388608,
+2^31). Going back, floats are scaled, rounded to nearest and saturated,
+so out-of-range DSP output clips instead of wrapping. Counts are in
+samples (frames*channels) unless a call takes channels.
+
+  pcm_convert       any format to any other (through float in chunks
+                    that stay on the stack)
+  pcm_deinterleave  interleaved frames to one plane per channel, and
+  pcm_interleave    back; stereo has its own kernel
+  pcm_gain          dst = src*gain, in place if dst==src
+  pcm_mix           dst = sum of count sources, each with its own gain
+  pcm_mix_s16       saturating sum of count S16 streams, summed at 32
+                    bits so only the final result clips
+
+As with popcount, the first call picks the widest kernel set the CPU
+has (avx2, sse2, scalar) and pcm_convert_select forces one by name
+("auto" redetects); every set gives bit-identical results. Non-x86
+builds only have scalar.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include "pcm_engine.h"
+
+/* 0, or -1 for a format it does not know */
+int pcm_convert(void *dst, pcm_format_t dst_format, const void *src, pcm_format_t src_format, size_t samples);
+int pcm_to_float(float *dst, const void *src, pcm_format_t src_format, size_t samples);
+int pcm_from_float(void *dst, pcm_format_t dst_format, const float *src, size_t samples);
+
+void pcm_deinterleave(float *const *planes, const float *src, unsigned int channels, size_t frames);
+void pcm_interleave(float *dst, const float *const *planes, unsigned int channels, size_t frames);
+
+void pcm_gain(float *dst, const float *src, float gain, size_t samples);
+/* gains may be NULL for unity; count==0 writes silence */
+void pcm_mix(float *dst, const float *const *src, const float *gains, unsigned int count, size_t samples);
+void pcm_mix_s16(int16_t *dst, const int16_t *const *src, unsigned int count, size_t samples);
+
+/* use that kernel set; 0 on success, -1 if unknown or not supported by this CPU */
+int pcm_convert_select(const char *name);
+/* name of the kernel set in use */
+const char *pcm_convert_kernel_name(void);
+
+#endif
@@ -0,0 +1,393 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "pcm_engine.h"
+#include "pcm_backend.h"
+
+#define PCM_XRUN_RETRIES 8
+
+void pcm_config_init(pcm_config_t *cfg, pcm_stream_t stream)
+{
+	memset(cfg,0,sizeof(*cfg));
+	cfg->backend=PCM_ENGINE_ALSA ? PCM_BACKEND_ALSA : PCM_BACKEND_NULL;
+	cfg->device="default";
+	cfg->stream=stream;
+	cfg->format=PCM_FORMAT_S16_LE;
+	cfg->channels=2;
+	cfg->rate=44100;
+	cfg->period_frames=32;
+	cfg->periods=4;
+	cfg->xrun_retries=PCM_XRUN_RETRIES;
+}
+
+void pcm_config_set_device(pcm_config_t *cfg, pcm_backend_t backend, const char *device)
+{
+	cfg->backend=backend;
+	cfg->device=device;
+}
+
+void pcm_config_set_format(pcm_config_t *cfg, pcm_format_t format, unsigned int channels, unsigned int rate)
+{
+	cfg->format=format;
+	cfg->channels=channels;
+	cfg->rate=rate;
+}
+
+void pcm_config_set_period(pcm_config_t *cfg, unsigned long period_frames, unsigned int periods)
+{
+	cfg->period_frames=period_frames;
+	cfg->periods=periods;
+}
+
+void pcm_config_set_sw(pcm_config_t *cfg, unsigned long start_threshold, unsigned long avail_min)
+{
+	cfg->start_threshold=start_threshold;
+	cfg->avail_min=avail_min;
+}
+
+void pcm_config_set_nonblock(pcm_config_t *cfg, int nonblock)
+{
+	cfg->nonblock=nonblock;
+}
+
+void pcm_config_set_mmap(pcm_config_t *cfg, int mmap)
+{
+	cfg->mmap=mmap;
+}
+
+size_t pcm_format_bytes(pcm_format_t format)
+{
+	switch(format)
+	{
+	case PCM_FORMAT_S16_LE:   return 2;
+	case PCM_FORMAT_S24_3LE:  return 3;
+	case PCM_FORMAT_S32_LE:   return 4;
+	case PCM_FORMAT_FLOAT_LE: return 4;
+	}
+	return 0;
+}
+
+const char *pcm_format_name(pcm_format_t format)
+{
+	switch(format)
+	{
+	case PCM_FORMAT_S16_LE:   return "S16_LE";
+	case PCM_FORMAT_S24_3LE:  return "S24_3LE";
+	case PCM_FORMAT_S32_LE:   return "S32_LE";
+	case PCM_FORMAT_FLOAT_LE: return "FLOAT_LE";
+	}
+	return "unknown";
+}
+
+unsigned long pcm_period_us(const pcm_t *pcm)
+{
+	if(pcm->config.rate==0)
+		return 0;
+	return (unsigned long)((uint64_t)pcm->config.period_frames*1000000u/pcm->config.rate);
+}
+
+static const pcm_ops_t *pcm_backend_ops(pcm_backend_t backend)
+{
+	switch(backend)
+	{
+#if PCM_ENGINE_ALSA
+	case PCM_BACKEND_ALSA: return &pcm_alsa_ops;
+#endif
+	case PCM_BACKEND_FILE: return &pcm_file_ops;
+	case PCM_BACKEND_NULL: return &pcm_null_ops;
+	case PCM_BACKEND_SIM:  return &pcm_sim_ops;
+	default:               return NULL;
+	}
+}
+
+int pcm_open(pcm_t *pcm, const pcm_config_t *cfg)
+{
+	int rc;
+
+	memset(pcm,0,sizeof(*pcm));
+	pcm->config=*cfg;
+	pcm->fd=-1;
+	pcm->ops=pcm_backend_ops(cfg->backend);
+	pcm->frame_bytes=pcm_format_bytes(cfg->format)*cfg->channels;
+	if(pcm->ops==NULL||pcm->frame_bytes==0||cfg->rate==0||cfg->period_frames==0||cfg->periods<2)
+	{
+		fprintf(stderr,"@pcm_open, error occurs for backend %d format %s channels %u rate %u period %lux%u \n",
+			(int)cfg->backend,pcm_format_name(cfg->format),cfg->channels,cfg->rate,
+			cfg->period_frames,cfg->periods);
+		return -1;
+	}
+	rc=pcm->ops->open(pcm);
+	if(rc<0)
+	{
+		fprintf(stderr,"@pcm_open, error occurs for %s device %s: %s \n",pcm->ops->name,
+			cfg->device ? cfg->device : "(none)",strerror(-rc));
+		pcm->ops=NULL;
+		return -1;
+	}
+	if(pcm->ops->mmap_begin==NULL)
+		pcm->config.mmap=0;
+	return 0;
+}
+
+void pcm_close(pcm_t *pcm)
+{
+	if(pcm->ops!=NULL)
+		pcm->ops->close(pcm);
+	pcm->ops=NULL;
+	free(pcm->bounce);
+	pcm->bounce=NULL;
+}
+
+int pcm_reconfigure(pcm_t *pcm, unsigned long period_frames, unsigned int periods)
+{
+	pcm_config_t old=pcm->config;
+	int rc;
+
+	if(pcm->ops==NULL||period_frames==0||periods<2)
+		return -1;
+	/* play out what is queued; capture just stops */
+	pcm->ops->drain(pcm);
+	free(pcm->bounce);
+	pcm->bounce=NULL;
+	pcm->bounce_frames=0;
+	pcm->mmap_frames=0;
+	pcm->config.period_frames=period_frames;
+	pcm->config.periods=periods;
+	/* an unclocked backend has no buffer to renegotiate, the sizes only
+	pace the audio thread; reopening would truncate a playback file and
+	rewind a capture one */
+	if(!pcm->ops->clocked)
+		return 0;
+	pcm->ops->close(pcm);
+	rc=pcm->ops->open(pcm);
+	if(rc==0)
+		return 0;
+	fprintf(stderr,"@pcm_reconfigure, error occurs for %s period %lux%u: %s \n",pcm->ops->name,
+		period_frames,periods,strerror(-rc));
+	/* back to what worked */
+	pcm->config=old;
+	rc=pcm->ops->open(pcm);
+	if(rc<0)
+	{
+		fprintf(stderr,"@pcm_reconfigure, error occurs for %s reopening period %lux%u: %s \n",pcm->ops->name,
+			old.period_frames,old.periods,strerror(-rc));
+		pcm->ops=NULL;
+	}
+	return -1;
+}
+
+int pcm_recover(pcm_t *pcm, int err)
+{
+	int rc;
+
+	switch(err)
+	{
+	case -EINTR:
+		return 0;
+	case -EPIPE:
+		/* overrun on capture, underrun on playback */
+		pcm->xruns++;
+		rc=pcm->ops->prepare(pcm);
+		break;
+	case -ESTRPIPE:
+		pcm->xruns++;
+		while((rc=pcm->ops->resume(pcm))==-EAGAIN)
+		{
+			usleep(10000);
+		}
+		if(rc<0)
+			rc=pcm->ops->prepare(pcm);
+		break;
+	default:
+		rc=err;
+		break;
+	}
+	if(rc<0)
+	{
+		fprintf(stderr,"@pcm_recover, error occurs for %s after %s: %s \n",pcm->ops->name,
+			strerror(-err),strerror(-rc));
+		return -1;
+	}
+	return 0;
+}
+
+static long pcm_transfer(pcm_t *pcm, void *buffer, unsigned long frames, int writing)
+{
+	unsigned long done=0;
+	int retries=0;
+
+	if(pcm->ops==NULL)
+		return -1;
+	while(done<frames&&!pcm->eof)
+	{
+		char *at=(char *)buffer+done*pcm->frame_bytes;
+		long rc=writing ? pcm->ops->write(pcm,at,frames-done) : pcm->ops->read(pcm,at,frames-done);
+
+		if(rc>0)
+		{
+			done+=(unsigned long)rc;
+			continue;
+		}
+		if(rc==0)
+		{
+			pcm->eof=1;
+			break;
+		}
+		if(rc==-EAGAIN)
+			break;
+		if(++retries>pcm->config.xrun_retries||pcm_recover(pcm,(int)rc)!=0)
+		{
+			pcm->frames+=done;
+			return done ? (long)done : -1;
+		}
+	}
+	pcm->frames+=done;
+	return (long)done;
+}
+
+long pcm_read(pcm_t *pcm, void *buffer, unsigned long frames)
+{
+	return pcm_transfer(pcm,buffer,frames,0);
+}
+
+long pcm_write(pcm_t *pcm, const void *buffer, unsigned long frames)
+{
+	return pcm_transfer(pcm,(void *)buffer,frames,1);
+}
+
+/* the RW fallback for pcm_mmap_*: one period at a time through a bounce buffer */
+static int bounce_begin(pcm_t *pcm, void **area, unsigned long *frames)
+{
+	long got;
+
+	if(pcm->bounce==NULL)
+	{
+		pcm->bounce=malloc(pcm->config.period_frames*pcm->frame_bytes);
+		if(pcm->bounce==NULL)
+		{
+			fprintf(stderr,"@pcm_mmap_begin, error occurs for bounce buffer of %lu frames \n",
+				pcm->config.period_frames);
+			return -1;
+		}
+		pcm->bounce_frames=pcm->config.period_frames;
+	}
+	if(*frames>pcm->bounce_frames)
+		*frames=pcm->bounce_frames;
+	if(pcm->config.stream==PCM_CAPTURE)
+	{
+		got=pcm_read(pcm,pcm->bounce,*frames);
+		if(got<0)
+			return -1;
+		*frames=(unsigned long)got;
+	}
+	*area=pcm->bounce;
+	pcm->mmap_frames=*frames;
+	return 0;
+}
+
+int pcm_mmap_begin(pcm_t *pcm, void **area, unsigned long *frames)
+{
+	int retries=0;
+	int rc;
+
+	if(pcm->ops==NULL)
+		return -1;
+	if(!pcm->config.mmap)
+		return bounce_begin(pcm,area,frames);
+	while(1)
+	{
+		unsigned long granted=*frames;
+
+		rc=pcm->ops->mmap_begin(pcm,area,&pcm->mmap_offset,&granted);
+		if(rc==0)
+		{
+			*frames=granted;
+			pcm->mmap_frames=granted;
+			return 0;
+		}
+		if(rc==-EAGAIN)
+		{
+			*frames=0;
+			pcm->mmap_frames=0;
+			return 0;
+		}
+		if(++retries>pcm->config.xrun_retries||pcm_recover(pcm,rc)!=0)
+			return -1;
+	}
+}
+
+long pcm_mmap_commit(pcm_t *pcm, unsigned long frames)
+{
+	long rc;
+
+	if(pcm->ops==NULL||frames>pcm->mmap_frames)
+		return -1;
+	pcm->mmap_frames=0;
+	if(!pcm->config.mmap)
+	{
+		/* capture already counted the frames in pcm_read */
+		if(pcm->config.stream==PCM_CAPTURE||frames==0)
+			return (long)frames;
+		return pcm_write(pcm,pcm->bounce,frames);
+	}
+	rc=pcm->ops->mmap_commit(pcm,pcm->mmap_offset,frames);
+	if(rc<0)
+		return pcm_recover(pcm,(int)rc)==0 ? 0 : -1;
+	pcm->frames+=(unsigned long)rc;
+	return rc;
+}
+
+int pcm_poll_descriptors(pcm_t *pcm, struct pollfd *pfds, unsigned int space)
+{
+	int rc;
+
+	if(pcm->ops==NULL)
+		return -1;
+	if(pcm->ops->poll_descriptors==NULL)
+		return 0;
+	rc=pcm->ops->poll_descriptors(pcm,pfds,space);
+	if(rc<0)
+	{
+		fprintf(stderr,"@pcm_poll_descriptors, error occurs for %s: %s \n",pcm->ops->name,strerror(-rc));
+		return -1;
+	}
+	return rc;
+}
+
+int pcm_poll_revents(pcm_t *pcm, struct pollfd *pfds, unsigned int nfds, unsigned short *revents)
+{
+	int rc;
+
+	*revents=0;
+	if(pcm->ops==NULL)
+		return -1;
+	if(pcm->ops->poll_revents==NULL)
+	{
+		*revents=pcm->config.stream==PCM_CAPTURE ? POLLIN : POLLOUT;
+		return 0;
+	}
+	rc=pcm->ops->poll_revents(pcm,pfds,nfds,revents);
+	if(rc<0)
+	{
+		fprintf(stderr,"@pcm_poll_revents, error occurs for %s: %s \n",pcm->ops->name,strerror(-rc));
+		return -1;
+	}
+	return 0;
+}
+
+int pcm_drain(pcm_t *pcm)
+{
+	int rc;
+
+	if(pcm->ops==NULL)
+		return -1;
+	rc=pcm->ops->drain(pcm);
+	if(rc<0)
+	{
+		fprintf(stderr,"@pcm_drain, error occurs for %s: %s \n",pcm->ops->name,strerror(-rc));
+		return -1;
+	}
+	return 0;
+}
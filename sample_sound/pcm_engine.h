@@ -0,0 +1,143 @@
+#ifndef SAMPLE_SOUND_PCM_ENGINE_H
+#define SAMPLE_SOUND_PCM_ENGINE_H
+
+/*
+PCM stream engine, pulled out of Listings 2-4 in sample_sound.c.
+
+A pcm_config_t is built up with pcm_config_init (the listings' S16_LE,
+2 channels, 44100 Hz, 32-frame periods) and the pcm_config_set_* calls,
+then pcm_open negotiates it with the backend and writes the values the
+backend actually chose back into pcm->config:
+  PCM_BACKEND_ALSA  snd_pcm_open on config.device ("default", "hw:0,0" ...)
+  PCM_BACKEND_FILE  raw interleaved frames to/from config.device ("-" is stdout/stdin)
+  PCM_BACKEND_NULL  playback discards, capture returns silence
+  PCM_BACKEND_SIM   a software card on CLOCK_MONOTONIC; config.device names
+                    a wire that loops its playback stream into its capture
+                    streams (pcm_sim.c)
+so the same program runs with or without a sound card. Build with
+-DPCM_ENGINE_ALSA=0 to leave libasound out altogether.
+
+With config.mmap set the ALSA backend asks for
+SND_PCM_ACCESS_MMAP_INTERLEAVED and pcm_mmap_begin/pcm_mmap_commit hand
+out the driver's ring itself, so samples are produced or consumed in
+place. If the device refuses mmap access, or the backend is file/null,
+the same two calls work on a period-sized bounce buffer through
+pcm_read/pcm_write; pcm->config.mmap says which one was granted.
+
+For an event loop, open with config.nonblock and poll the descriptors
+from pcm_poll_descriptors; pcm_read/pcm_write then return 0 instead of
+blocking when the device is not ready.
+
+pcm_read/pcm_write move whole frames and go through the one xrun policy
+in pcm_recover: an overrun/underrun (-EPIPE) re-prepares the stream, a
+suspend (-ESTRPIPE) waits for resume, -EINTR retries, each counted in
+pcm->xruns, up to config.xrun_retries times per call before giving up.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <poll.h>
+
+#ifndef PCM_ENGINE_ALSA
+#define PCM_ENGINE_ALSA 1
+#endif
+
+typedef enum pcm_backend {
+	PCM_BACKEND_ALSA,
+	PCM_BACKEND_FILE,
+	PCM_BACKEND_NULL,
+	PCM_BACKEND_SIM
+} pcm_backend_t;
+
+typedef enum pcm_stream {
+	PCM_PLAYBACK,
+	PCM_CAPTURE
+} pcm_stream_t;
+
+typedef enum pcm_format {
+	PCM_FORMAT_S16_LE,
+	PCM_FORMAT_S24_3LE,                /* packed, 3 bytes per sample */
+	PCM_FORMAT_S32_LE,
+	PCM_FORMAT_FLOAT_LE
+} pcm_format_t;
+
+typedef struct pcm_config {
+	pcm_backend_t backend;
+	const char *device;
+	pcm_stream_t stream;
+	pcm_format_t format;
+	unsigned int channels;
+	unsigned int rate;
+	unsigned long period_frames;
+	unsigned int periods;              /* buffer = period_frames*periods */
+	unsigned long start_threshold;     /* sw params, 0 leaves the backend default */
+	unsigned long avail_min;
+	int nonblock;
+	int mmap;                          /* ask for mmap access, cleared if refused */
+	int xrun_retries;
+} pcm_config_t;
+
+struct pcm_ops;
+
+typedef struct pcm {
+	pcm_config_t config;
+	const struct pcm_ops *ops;
+	void *handle;           /* snd_pcm_t * for ALSA, the stream state for SIM */
+	int fd;                 /* FILE backend */
+	size_t frame_bytes;
+	int eof;
+	void *bounce;           /* one period, for pcm_mmap_* without mmap access */
+	unsigned long bounce_frames;
+	unsigned long mmap_offset;
+	unsigned long mmap_frames;
+	uint64_t frames;
+	uint64_t xruns;
+} pcm_t;
+
+void pcm_config_init(pcm_config_t *cfg, pcm_stream_t stream);
+void pcm_config_set_device(pcm_config_t *cfg, pcm_backend_t backend, const char *device);
+void pcm_config_set_format(pcm_config_t *cfg, pcm_format_t format, unsigned int channels, unsigned int rate);
+void pcm_config_set_period(pcm_config_t *cfg, unsigned long period_frames, unsigned int periods);
+void pcm_config_set_sw(pcm_config_t *cfg, unsigned long start_threshold, unsigned long avail_min);
+void pcm_config_set_nonblock(pcm_config_t *cfg, int nonblock);
+void pcm_config_set_mmap(pcm_config_t *cfg, int mmap);
+
+int pcm_open(pcm_t *pcm, const pcm_config_t *cfg);
+void pcm_close(pcm_t *pcm);
+/* renegotiate period and buffer on an open stream (playback is drained
+first); frames and xruns carry on. -1 if refused, the old sizes then
+still in place, or, if even they cannot be had back, the stream closed.
+Unclocked backends (file, null) keep their descriptor and position and
+just take the new sizes */
+int pcm_reconfigure(pcm_t *pcm, unsigned long period_frames, unsigned int periods);
+
+/* frames moved; 0 at end of input or, when nonblocking, if the device is
+not ready; -1 once recovery has failed */
+long pcm_read(pcm_t *pcm, void *buffer, unsigned long frames);
+long pcm_write(pcm_t *pcm, const void *buffer, unsigned long frames);
+/* apply the xrun policy to a negative errno from the backend; 0 if the
+stream can continue */
+int pcm_recover(pcm_t *pcm, int err);
+/*
+borrow up to *frames contiguous frames: *area points at the first one and
+*frames is lowered to what is available. Playback fills them, capture
+reads them, then pcm_mmap_commit gives back how many were used. Returns
+0, or -1 as pcm_read; *frames==0 at end of input or when a nonblocking
+stream is not ready.
+*/
+int pcm_mmap_begin(pcm_t *pcm, void **area, unsigned long *frames);
+long pcm_mmap_commit(pcm_t *pcm, unsigned long frames);
+/* fill pfds with what to poll for this stream, at most space entries;
+0 if the backend has nothing to poll (null), -1 on error */
+int pcm_poll_descriptors(pcm_t *pcm, struct pollfd *pfds, unsigned int space);
+/* after poll: POLLIN (capture) / POLLOUT (playback) / POLLERR in *revents */
+int pcm_poll_revents(pcm_t *pcm, struct pollfd *pfds, unsigned int nfds, unsigned short *revents);
+/* playback: wait until everything written has been played */
+int pcm_drain(pcm_t *pcm);
+
+size_t pcm_format_bytes(pcm_format_t format);
+const char *pcm_format_name(pcm_format_t format);
+/* period length in microseconds */
+unsigned long pcm_period_us(const pcm_t *pcm);
+
+#endif
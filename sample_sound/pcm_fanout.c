@@ -0,0 +1,500 @@
+/*
+One capture stream, several consumers: Listing 4's loop publishing into
+an audio_bus instead of writing stdout.
+
+build: gcc -O2 sample_sound/pcm_fanout.c sample_sound/audio_bus.c sample_sound/pcm_engine.c sample_sound/pcm_file.c \
+              sample_sound/pcm_alsa.c sample_sound/pcm_sim.c sample_sound/wav_writer.c sample_sound/pcm_analyze.c \
+              sample_sound/pcm_convert.c -lasound -lpthread -lm -o pcm_fanout
+       (or -DPCM_ENGINE_ALSA=0 without -lasound for the file/null/sim backends only)
+run:   ./pcm_fanout [-b alsa|file|null|sim] [-D device] [-r rate] [-n channels] [-p period_frames] [-P periods]
+                    [-s seconds] [-k slots] [-w out.wav] [-l recorder,analyzer,sender lag] [-S analyzer_stall_ms]
+                    [-A fft_size] [-M meter_ms]
+
+The capture loop reads each period from the device straight into a bus
+buffer and publishes it once. Three threads consume it in place, each at
+its own pace and under its own lag limit (-l, in periods, 0 for slots;
+default 0,4,16):
+  recorder  -w: pushes the periods into a wav_writer
+  analyzer  runs a pcm_analyze stage on each period in place: meters,
+            and an -A point FFT (default 1024) every half window reduced
+            to band energies. -M prints the latest result every that
+            many ms from the main thread, read without a lock. -S makes
+            the analyzer sleep that long per period, a consumer that
+            cannot keep up
+  sender    encodes each period as an RTP L16 packet (RFC 3551:
+            big-endian samples behind a 12-byte header) and sends it
+            over UDP on the loopback to a receiver thread, which counts
+            the packets and the gaps in their sequence numbers
+At the end each consumer's periods, dropped periods and furthest lag
+are reported. A stalled analyzer drops its own periods while the
+recorder and the sender see every one.
+
+Without a sound card, "-b file -D /dev/urandom" gives it something to
+capture; the file and null backends are paced at the period rate so the
+consumers see a real-time stream.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <math.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include "pcm_engine.h"
+#include "audio_bus.h"
+#include "wav_writer.h"
+#include "pcm_analyze.h"
+
+#define FANOUT_SLOTS 64
+#define RTP_HEADER_BYTES 12
+#define RTP_PAYLOAD_L16 96        /* dynamic payload type */
+
+typedef struct fanout {
+	audio_bus_t bus;
+	unsigned int channels;
+	atomic_int done;                /* the capture loop has published its last period */
+	unsigned int stall_ms;
+	unsigned int meter_ms;
+	wav_writer_t *wav;
+	int send_fd;
+	int recv_fd;
+	/* analyzer */
+	pcm_analyze_t analyze;
+	double peak[PCM_ANALYZE_MAX_CHANNELS];
+	double sum_squares[PCM_ANALYZE_MAX_CHANNELS];
+	/* receiver */
+	uint64_t packets;
+	uint64_t gaps;
+} fanout_t;
+
+typedef struct consumer {
+	fanout_t *f;
+	const char *name;
+	int id;
+	void (*period)(fanout_t *f, const void *data, unsigned long frames, uint64_t seq);
+	pthread_t thread;
+} consumer_t;
+
+static int parse_backend(const char *name, pcm_backend_t *backend)
+{
+	if(strcmp(name,"alsa")==0)
+		*backend=PCM_BACKEND_ALSA;
+	else if(strcmp(name,"file")==0)
+		*backend=PCM_BACKEND_FILE;
+	else if(strcmp(name,"null")==0)
+		*backend=PCM_BACKEND_NULL;
+	else if(strcmp(name,"sim")==0)
+		*backend=PCM_BACKEND_SIM;
+	else
+		return -1;
+	return 0;
+}
+
+static void record_period(fanout_t *f, const void *data, unsigned long frames, uint64_t seq)
+{
+	(void)seq;
+	wav_writer_push(f->wav,data,frames);
+}
+
+static void analyze_period(fanout_t *f, const void *data, unsigned long frames, uint64_t seq)
+{
+	pcm_analyze_result_t r;
+	unsigned int c;
+
+	(void)seq;
+	pcm_analyze_process(&f->analyze,data,frames);
+	/* the writer's own read never retries; it keeps the whole-capture levels */
+	pcm_analyze_read(&f->analyze,&r);
+	for(c=0;c<r.channels;c++)
+	{
+		if(r.peak[c]>f->peak[c])
+			f->peak[c]=r.peak[c];
+		f->sum_squares[c]+=(double)r.rms[c]*r.rms[c]*frames;
+	}
+	if(f->stall_ms)
+		usleep(f->stall_ms*1000);
+}
+
+static double dbfs(double mean_square)
+{
+	return 10*log10(mean_square+1e-20);
+}
+
+static void print_meters(const fanout_t *f, const pcm_analyze_result_t *r, const char *prefix)
+{
+	unsigned int c;
+	unsigned int b;
+
+	fprintf(stderr,"%speak",prefix);
+	for(c=0;c<r->channels;c++)
+	{
+		fprintf(stderr," %.1f",dbfs((double)r->peak[c]*r->peak[c]));
+	}
+	fprintf(stderr,", rms");
+	for(c=0;c<r->channels;c++)
+	{
+		fprintf(stderr," %.1f",dbfs((double)r->rms[c]*r->rms[c]));
+	}
+	fprintf(stderr," dBFS, strongest %.0f Hz; bands from %.0f Hz:",r->dominant_hz,pcm_analyze_band_hz(&f->analyze,0));
+	for(b=0;b<r->bands;b++)
+	{
+		fprintf(stderr," %.0f",dbfs(r->band_energy[b]));
+	}
+	fprintf(stderr,"\n");
+}
+
+static void *meter_run(void *arg)
+{
+	fanout_t *f=(fanout_t *)arg;
+
+	while(!atomic_load(&f->done))
+	{
+		pcm_analyze_result_t r;
+
+		usleep(f->meter_ms*1000);
+		if(pcm_analyze_read(&f->analyze,&r))
+			print_meters(f,&r,"meter: ");
+	}
+	return NULL;
+}
+
+static void send_period(fanout_t *f, const void *data, unsigned long frames, uint64_t seq)
+{
+	unsigned char packet[65536];
+	const int16_t *s=(const int16_t *)data;
+	size_t n=(size_t)frames*f->channels;
+	uint32_t timestamp=(uint32_t)(seq*f->bus.period_frames);
+	uint16_t be16;
+	uint32_t be32;
+	size_t i;
+
+	packet[0]=0x80;                 /* version 2, no padding, extension or CSRCs */
+	packet[1]=RTP_PAYLOAD_L16;
+	be16=htons((uint16_t)seq);
+	memcpy(packet+2,&be16,2);
+	be32=htonl(timestamp);
+	memcpy(packet+4,&be32,4);
+	be32=htonl(0x53534e44u);        /* SSRC */
+	memcpy(packet+8,&be32,4);
+	for(i=0;i<n;i++)
+	{
+		be16=htons((uint16_t)s[i]);
+		memcpy(packet+RTP_HEADER_BYTES+i*2,&be16,2);
+	}
+	if(send(f->send_fd,packet,RTP_HEADER_BYTES+n*2,0)<0&&errno!=ECONNREFUSED)
+		fprintf(stderr,"@send_period, error occurs for send errno %d \n",errno);
+}
+
+static void *consumer_run(void *arg)
+{
+	consumer_t *c=(consumer_t *)arg;
+	fanout_t *f=c->f;
+	int finishing=0;
+
+	while(1)
+	{
+		const void *data;
+		unsigned long frames;
+		uint64_t seq;
+
+		if(audio_bus_acquire_read(&f->bus,c->id,&data,&frames,&seq))
+		{
+			c->period(f,data,frames,seq);
+			audio_bus_release(&f->bus,c->id);
+			continue;
+		}
+		/* nothing new: finished if the producer is, else sleep until it publishes.
+		Its last publish can land between the read above and done being set,
+		so once done is seen read until the bus is empty before leaving */
+		if(finishing)
+			break;
+		if(atomic_load(&f->done))
+		{
+			finishing=1;
+			continue;
+		}
+		if(audio_bus_wait(&f->bus,c->id,100)<0)
+			break;
+	}
+	return NULL;
+}
+
+static void *receiver_run(void *arg)
+{
+	fanout_t *f=(fanout_t *)arg;
+	unsigned char packet[65536];
+	uint16_t expect=0;
+
+	while(1)
+	{
+		struct pollfd pfd;
+		ssize_t n;
+		uint16_t seq;
+
+		pfd.fd=f->recv_fd;
+		pfd.events=POLLIN;
+		pfd.revents=0;
+		if(poll(&pfd,1,200)<=0)
+		{
+			/* quiet for a while after the capture ended: all in */
+			if(atomic_load(&f->done))
+				break;
+			continue;
+		}
+		n=recv(f->recv_fd,packet,sizeof(packet),0);
+		if(n<RTP_HEADER_BYTES)
+			continue;
+		memcpy(&seq,packet+2,2);
+		seq=ntohs(seq);
+		if(f->packets>0&&seq!=expect)
+			f->gaps++;
+		expect=(uint16_t)(seq+1);
+		f->packets++;
+	}
+	return NULL;
+}
+
+/* a UDP socket pair on 127.0.0.1, the sender connected to the receiver */
+static int loopback_open(fanout_t *f)
+{
+	struct sockaddr_in addr;
+	socklen_t len=sizeof(addr);
+	int size=1<<20;
+
+	f->recv_fd=socket(AF_INET,SOCK_DGRAM|SOCK_CLOEXEC,0);
+	f->send_fd=socket(AF_INET,SOCK_DGRAM|SOCK_CLOEXEC,0);
+	if(f->recv_fd<0||f->send_fd<0)
+		goto fail;
+	memset(&addr,0,sizeof(addr));
+	addr.sin_family=AF_INET;
+	addr.sin_addr.s_addr=htonl(INADDR_LOOPBACK);
+	addr.sin_port=0;
+	setsockopt(f->recv_fd,SOL_SOCKET,SO_RCVBUF,&size,sizeof(size));
+	if(bind(f->recv_fd,(struct sockaddr *)&addr,sizeof(addr))!=0||
+		getsockname(f->recv_fd,(struct sockaddr *)&addr,&len)!=0||
+		connect(f->send_fd,(struct sockaddr *)&addr,sizeof(addr))!=0)
+		goto fail;
+	return 0;
+
+fail:
+	fprintf(stderr,"@loopback_open, error occurs for UDP on 127.0.0.1 errno %d \n",errno);
+	if(f->recv_fd>=0)
+		close(f->recv_fd);
+	if(f->send_fd>=0)
+		close(f->send_fd);
+	f->recv_fd=f->send_fd=-1;
+	return -1;
+}
+
+int main(int argc, char *argv[])
+{
+	static fanout_t f;
+	pcm_config_t cfg;
+	pcm_t pcm;
+	pcm_backend_t backend=PCM_ENGINE_ALSA ? PCM_BACKEND_ALSA : PCM_BACKEND_NULL;
+	const char *device=NULL;
+	const char *wav_path=NULL;
+	wav_writer_t recording;
+	unsigned int rate=44100;
+	unsigned int channels=2;
+	unsigned long period=32;
+	unsigned int periods=4;
+	unsigned int slots=FANOUT_SLOTS;
+	unsigned int lags[3]={0,4,16};
+	double seconds=5;
+	consumer_t consumers[3];
+	pthread_t receiver;
+	pthread_t meter;
+	pcm_analyze_config_t acfg;
+	pcm_analyze_result_t result;
+	int nconsumers=0;
+	char *spare;
+	unsigned long loops;
+	struct timespec tick;
+	int rc=0;
+	int i;
+	int opt;
+
+	pcm_analyze_config_init(&acfg);
+	while((opt=getopt(argc,argv,"b:D:r:n:p:P:s:k:w:l:S:A:M:"))!=-1)
+	{
+		switch(opt)
+		{
+		case 'b':
+			if(parse_backend(optarg,&backend)!=0)
+			{
+				fprintf(stderr,"unknown backend %s\n",optarg);
+				return 1;
+			}
+			break;
+		case 'D': device=optarg; break;
+		case 'r': rate=(unsigned int)atoi(optarg); break;
+		case 'n': channels=(unsigned int)atoi(optarg); break;
+		case 'p': period=strtoul(optarg,NULL,0); break;
+		case 'P': periods=(unsigned int)atoi(optarg); break;
+		case 's': seconds=atof(optarg); break;
+		case 'k': slots=(unsigned int)atoi(optarg); break;
+		case 'w': wav_path=optarg; break;
+		case 'l':
+			if(sscanf(optarg,"%u,%u,%u",&lags[0],&lags[1],&lags[2])!=3)
+			{
+				fprintf(stderr,"-l wants recorder,analyzer,sender\n");
+				return 1;
+			}
+			break;
+		case 'S': f.stall_ms=(unsigned int)atoi(optarg); break;
+		case 'A': acfg.fft_size=(unsigned int)atoi(optarg); acfg.hop=acfg.fft_size/2; break;
+		case 'M': f.meter_ms=(unsigned int)atoi(optarg); break;
+		default:
+			fprintf(stderr,"usage: %s [-b alsa|file|null|sim] [-D device] [-r rate] [-n channels] [-p period_frames] "
+				"[-P periods] [-s seconds] [-k slots] [-w out.wav] [-l recorder,analyzer,sender lag] "
+				"[-S analyzer_stall_ms] [-A fft_size] [-M meter_ms]\n",argv[0]);
+			return 1;
+		}
+	}
+
+	pcm_config_init(&cfg,PCM_CAPTURE);
+	pcm_config_set_device(&cfg,backend,device ? device : backend==PCM_BACKEND_FILE ? "-" : "default");
+	pcm_config_set_format(&cfg,PCM_FORMAT_S16_LE,channels,rate);
+	pcm_config_set_period(&cfg,period,periods);
+	if(pcm_open(&pcm,&cfg)!=0)
+		return 1;
+	f.channels=pcm.config.channels;
+	f.recv_fd=f.send_fd=-1;
+	if(RTP_HEADER_BYTES+pcm.config.period_frames*pcm.frame_bytes>65507)
+	{
+		fprintf(stderr,"@pcm_fanout, error occurs for a period of %lu frames, too big for one UDP packet \n",
+			pcm.config.period_frames);
+		pcm_close(&pcm);
+		return 1;
+	}
+	spare=(char *)malloc(pcm.config.period_frames*pcm.frame_bytes);
+	if(spare==NULL||audio_bus_init(&f.bus,pcm.frame_bytes,pcm.config.period_frames,slots)!=0||loopback_open(&f)!=0||
+		pcm_analyze_init(&f.analyze,&acfg,pcm.config.format,pcm.config.channels,pcm.config.rate)!=0)
+	{
+		pcm_close(&pcm);
+		free(spare);
+		return 1;
+	}
+	if(wav_path!=NULL)
+	{
+		wav_writer_config_t wcfg;
+
+		wav_writer_config_init(&wcfg,PCM_FORMAT_S16_LE,pcm.config.channels,pcm.config.rate);
+		if(wav_writer_open(&recording,wav_path,&wcfg)==0)
+		{
+			f.wav=&recording;
+			consumers[nconsumers].name="recorder";
+			consumers[nconsumers].period=record_period;
+			consumers[nconsumers].id=audio_bus_attach(&f.bus,lags[0]);
+			nconsumers++;
+		}
+	}
+	consumers[nconsumers].name="analyzer";
+	consumers[nconsumers].period=analyze_period;
+	consumers[nconsumers].id=audio_bus_attach(&f.bus,lags[1]);
+	nconsumers++;
+	consumers[nconsumers].name="sender";
+	consumers[nconsumers].period=send_period;
+	consumers[nconsumers].id=audio_bus_attach(&f.bus,lags[2]);
+	nconsumers++;
+	pthread_create(&receiver,NULL,receiver_run,&f);
+	if(f.meter_ms)
+		pthread_create(&meter,NULL,meter_run,&f);
+	for(i=0;i<nconsumers;i++)
+	{
+		consumers[i].f=&f;
+		pthread_create(&consumers[i].thread,NULL,consumer_run,&consumers[i]);
+	}
+
+	loops=(unsigned long)(seconds*1e6/(double)pcm_period_us(&pcm));
+	clock_gettime(CLOCK_MONOTONIC,&tick);
+	while(loops>0)
+	{
+		void *area=audio_bus_acquire_write(&f.bus);
+		long frames;
+
+		loops--;
+		if(backend==PCM_BACKEND_FILE||backend==PCM_BACKEND_NULL)
+		{
+			/* no device clock: one period per period time */
+			tick.tv_nsec+=(long)pcm_period_us(&pcm)*1000;
+			while(tick.tv_nsec>=1000000000)
+			{
+				tick.tv_nsec-=1000000000;
+				tick.tv_sec++;
+			}
+			clock_nanosleep(CLOCK_MONOTONIC,TIMER_ABSTIME,&tick,NULL);
+		}
+		/* straight from the device into the buffer every consumer will read */
+		frames=pcm_read(&pcm,area!=NULL ? area : spare,pcm.config.period_frames);
+		if(frames<=0)
+		{
+			rc=frames<0;
+			break;
+		}
+		if(area!=NULL)
+			audio_bus_publish(&f.bus,(unsigned long)frames);
+	}
+	atomic_store(&f.done,1);
+	for(i=0;i<nconsumers;i++)
+	{
+		pthread_join(consumers[i].thread,NULL);
+	}
+	pthread_join(receiver,NULL);
+	if(f.meter_ms)
+		pthread_join(meter,NULL);
+
+	fprintf(stderr,"capture %s: %lu frames, %u Hz, %u ch, period %lu x %u, %lu xruns; bus: %lu periods, %u slots, %lu overruns\n",
+		pcm.config.device,(unsigned long)pcm.frames,pcm.config.rate,pcm.config.channels,
+		pcm.config.period_frames,pcm.config.periods,(unsigned long)pcm.xruns,
+		(unsigned long)atomic_load(&f.bus.head),slots,(unsigned long)atomic_load(&f.bus.overruns));
+	for(i=0;i<nconsumers;i++)
+	{
+		audio_bus_consumer_t *c=&f.bus.consumers[consumers[i].id];
+
+		fprintf(stderr,"  %-8s lag limit %3lu: %lu periods, %lu dropped, at most %lu behind\n",consumers[i].name,
+			(unsigned long)c->lag,(unsigned long)atomic_load(&c->periods),(unsigned long)atomic_load(&c->dropped),
+			(unsigned long)atomic_load(&c->max_behind));
+		audio_bus_detach(&f.bus,consumers[i].id);
+	}
+	if(pcm_analyze_read(&f.analyze,&result))
+	{
+		fprintf(stderr,"  analyzer: %lu frames, %lu FFTs of %u, %lu over budget; whole capture peak",
+			(unsigned long)result.frames,(unsigned long)result.ffts,acfg.fft_size,(unsigned long)result.skipped);
+		for(i=0;i<(int)result.channels;i++)
+		{
+			fprintf(stderr," %.1f",dbfs(f.peak[i]*f.peak[i]));
+		}
+		fprintf(stderr,", rms");
+		for(i=0;i<(int)result.channels;i++)
+		{
+			fprintf(stderr," %.1f",dbfs(result.frames ? f.sum_squares[i]/result.frames : 0));
+		}
+		fprintf(stderr," dBFS\n");
+		print_meters(&f,&result,"  last period: ");
+	}
+	fprintf(stderr,"  receiver: %lu RTP packets, %lu sequence gaps\n",(unsigned long)f.packets,(unsigned long)f.gaps);
+	if(f.wav!=NULL)
+	{
+		uint64_t bytes=wav_writer_bytes(f.wav);
+
+		if(wav_writer_close(f.wav)!=0)
+			rc=1;
+		fprintf(stderr,"recorded %s: %llu bytes\n",wav_path,(unsigned long long)bytes);
+	}
+	close(f.send_fd);
+	close(f.recv_fd);
+	audio_bus_destroy(&f.bus);
+	pcm_analyze_destroy(&f.analyze);
+	pcm_close(&pcm);
+	free(spare);
+	return rc;
+}
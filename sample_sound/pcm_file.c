@@ -0,0 +1,164 @@
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "pcm_backend.h"
+
+/* raw interleaved frames in a file, a pipe or stdin/stdout */
+
+static int file_open(pcm_t *pcm)
+{
+	const char *path=pcm->config.device;
+	int flags;
+
+	if(path==NULL||strcmp(path,"-")==0)
+	{
+		pcm->fd=pcm->config.stream==PCM_CAPTURE ? dup(0) : dup(1);
+		if(pcm->fd<0)
+			return -errno;
+		if(pcm->config.nonblock)
+			fcntl(pcm->fd,F_SETFL,fcntl(pcm->fd,F_GETFL)|O_NONBLOCK);
+		return 0;
+	}
+	flags=pcm->config.stream==PCM_CAPTURE ? O_RDONLY : O_WRONLY|O_CREAT|O_TRUNC;
+	if(pcm->config.nonblock)
+		flags|=O_NONBLOCK;
+	pcm->fd=open(path,flags,0644);
+	return pcm->fd<0 ? -errno : 0;
+}
+
+/* keep going until a frame boundary so a short read never splits a frame */
+static long file_read(pcm_t *pcm, void *buffer, unsigned long frames)
+{
+	size_t want=frames*pcm->frame_bytes;
+	size_t got=0;
+	ssize_t n;
+
+	while(got<want)
+	{
+		n=read(pcm->fd,(char *)buffer+got,want-got);
+		if(n>0)
+		{
+			got+=(size_t)n;
+			if(got%pcm->frame_bytes==0)
+				break;
+			continue;
+		}
+		if(n==0)
+			break;
+		if(errno==EINTR)
+			continue;
+		if(errno==EAGAIN&&got%pcm->frame_bytes!=0)
+			continue;
+		if(got>=pcm->frame_bytes)
+			break;
+		return -errno;
+	}
+	return (long)(got/pcm->frame_bytes);
+}
+
+static long file_write(pcm_t *pcm, const void *buffer, unsigned long frames)
+{
+	size_t want=frames*pcm->frame_bytes;
+	size_t put=0;
+	ssize_t n;
+
+	while(put<want)
+	{
+		n=write(pcm->fd,(const char *)buffer+put,want-put);
+		if(n>=0)
+		{
+			put+=(size_t)n;
+			continue;
+		}
+		if(errno==EINTR||(errno==EAGAIN&&put%pcm->frame_bytes!=0))
+			continue;
+		if(put>=pcm->frame_bytes)
+			break;
+		return -errno;
+	}
+	return (long)(put/pcm->frame_bytes);
+}
+
+static int file_nothing(pcm_t *pcm)
+{
+	(void)pcm;
+	return 0;
+}
+
+static void file_close(pcm_t *pcm)
+{
+	if(pcm->fd>=0)
+		close(pcm->fd);
+	pcm->fd=-1;
+}
+
+static int file_poll_descriptors(pcm_t *pcm, struct pollfd *pfds, unsigned int space)
+{
+	if(space<1)
+		return -ENOSPC;
+	pfds[0].fd=pcm->fd;
+	pfds[0].events=pcm->config.stream==PCM_CAPTURE ? POLLIN : POLLOUT;
+	pfds[0].revents=0;
+	return 1;
+}
+
+static int file_poll_revents(pcm_t *pcm, struct pollfd *pfds, unsigned int nfds, unsigned short *revents)
+{
+	(void)pcm;
+	*revents=nfds ? pfds[0].revents : 0;
+	/* end of a pipe shows as POLLHUP; let the read see the EOF */
+	if(*revents&POLLHUP)
+		*revents=(unsigned short)((*revents&~POLLHUP)|POLLIN);
+	return 0;
+}
+
+const pcm_ops_t pcm_file_ops={
+	"file",
+	0,
+	file_open,
+	file_read,
+	file_write,
+	file_nothing,
+	file_nothing,
+	file_nothing,
+	file_close,
+	NULL,
+	NULL,
+	file_poll_descriptors,
+	file_poll_revents,
+};
+
+static long null_read(pcm_t *pcm, void *buffer, unsigned long frames)
+{
+	memset(buffer,0,frames*pcm->frame_bytes);
+	return (long)frames;
+}
+
+static long null_write(pcm_t *pcm, const void *buffer, unsigned long frames)
+{
+	(void)pcm;
+	(void)buffer;
+	return (long)frames;
+}
+
+static void null_close(pcm_t *pcm)
+{
+	(void)pcm;
+}
+
+const pcm_ops_t pcm_null_ops={
+	"null",
+	0,
+	file_nothing,
+	null_read,
+	null_write,
+	file_nothing,
+	file_nothing,
+	file_nothing,
+	null_close,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+};
@@ -0,0 +1,192 @@
+/*
+Capture -> playback loopback in one process, Listings 4 and 3 joined by
+an audio_ring instead of a pipe.
+
+build: gcc -O2 sample_sound/pcm_loopback.c sample_sound/pcm_engine.c sample_sound/pcm_file.c sample_sound/pcm_alsa.c \
+              sample_sound/pcm_sim.c sample_sound/audio_thread.c sample_sound/audio_ring.c -lasound -lpthread -o pcm_loopback
+       (or -DPCM_ENGINE_ALSA=0 without -lasound for the file/null/sim backends only)
+run:   ./pcm_loopback [-b alsa|file|null|sim] [-i capture_device] [-B alsa|file|null|sim] [-o playback_device]
+                      [-r rate] [-n channels] [-p period_frames] [-P periods] [-l ring_periods] [-w]
+                      [-t rt_priority] [-s seconds]
+
+Two audio_threads, one capturing and one playing back, share a single
+ring: the capture thread reads from the device straight into the ring
+and the playback thread writes from the ring straight to the other
+device, with no copy and no kernel buffer in between. The ring is the
+whole of the added latency, so it is bounded by -l periods; -w makes a
+full ring give up its oldest frames (the latency stays at the bound)
+instead of dropping new ones. Once a period the main thread samples the
+fill and, at the end, reports the mean/max latency through the ring
+together with the dropped, overwritten and silence frame counts.
+
+Without a sound card, "-b file -i /dev/urandom -B null" exercises the
+same path at real-time pace, and "-b sim -B sim -o other" runs it
+against a pair of simulated devices.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "pcm_engine.h"
+#include "audio_ring.h"
+#include "audio_thread.h"
+
+static int parse_backend(const char *name, pcm_backend_t *backend)
+{
+	if(strcmp(name,"alsa")==0)
+		*backend=PCM_BACKEND_ALSA;
+	else if(strcmp(name,"file")==0)
+		*backend=PCM_BACKEND_FILE;
+	else if(strcmp(name,"null")==0)
+		*backend=PCM_BACKEND_NULL;
+	else if(strcmp(name,"sim")==0)
+		*backend=PCM_BACKEND_SIM;
+	else
+		return -1;
+	return 0;
+}
+
+static double loop_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (double)ts.tv_sec+(double)ts.tv_nsec/1e9;
+}
+
+static int loop_open(pcm_t *pcm, pcm_stream_t stream, pcm_backend_t backend, const char *device,
+	unsigned int channels, unsigned int rate, unsigned long period, unsigned int periods)
+{
+	pcm_config_t cfg;
+
+	pcm_config_init(&cfg,stream);
+	pcm_config_set_device(&cfg,backend,device ? device : backend==PCM_BACKEND_FILE ? "-" : "default");
+	pcm_config_set_format(&cfg,PCM_FORMAT_S16_LE,channels,rate);
+	pcm_config_set_period(&cfg,period,periods);
+	pcm_config_set_nonblock(&cfg,1);
+	return pcm_open(pcm,&cfg);
+}
+
+int main(int argc, char *argv[])
+{
+	pcm_t capture;
+	pcm_t playback;
+	audio_ring_t ring;
+	audio_thread_t in;
+	audio_thread_t out;
+	pcm_backend_t in_backend=PCM_ENGINE_ALSA ? PCM_BACKEND_ALSA : PCM_BACKEND_NULL;
+	pcm_backend_t out_backend=in_backend;
+	const char *in_device=NULL;
+	const char *out_device=NULL;
+	unsigned int rate=44100;
+	unsigned int channels=2;
+	unsigned long period=32;
+	unsigned int periods=4;
+	unsigned int ring_periods=8;
+	audio_ring_policy_t policy=AUDIO_RING_DROP_NEWEST;
+	int rt_priority=0;
+	double seconds=5;
+	double end;
+	uint64_t samples=0;
+	uint64_t fill_sum=0;
+	uint64_t fill_max=0;
+	int rc=1;
+	int opt;
+
+	while((opt=getopt(argc,argv,"b:i:B:o:r:n:p:P:l:wt:s:"))!=-1)
+	{
+		switch(opt)
+		{
+		case 'b':
+		case 'B':
+			if(parse_backend(optarg,opt=='b' ? &in_backend : &out_backend)!=0)
+			{
+				fprintf(stderr,"unknown backend %s\n",optarg);
+				return 1;
+			}
+			break;
+		case 'i': in_device=optarg; break;
+		case 'o': out_device=optarg; break;
+		case 'r': rate=(unsigned int)atoi(optarg); break;
+		case 'n': channels=(unsigned int)atoi(optarg); break;
+		case 'p': period=strtoul(optarg,NULL,0); break;
+		case 'P': periods=(unsigned int)atoi(optarg); break;
+		case 'l': ring_periods=(unsigned int)atoi(optarg); break;
+		case 'w': policy=AUDIO_RING_OVERWRITE; break;
+		case 't': rt_priority=atoi(optarg); break;
+		case 's': seconds=atof(optarg); break;
+		default:
+			fprintf(stderr,"usage: %s [-b alsa|file|null|sim] [-i capture_device] [-B alsa|file|null|sim] [-o playback_device] "
+				"[-r rate] [-n channels] [-p period_frames] [-P periods] [-l ring_periods] [-w] "
+				"[-t rt_priority] [-s seconds]\n",argv[0]);
+			return 1;
+		}
+	}
+
+	if(loop_open(&capture,PCM_CAPTURE,in_backend,in_device,channels,rate,period,periods)!=0)
+		return 1;
+	/* the playback side takes whatever the capture side was granted */
+	if(loop_open(&playback,PCM_PLAYBACK,out_backend,out_device,capture.config.channels,capture.config.rate,
+		capture.config.period_frames,capture.config.periods)!=0)
+	{
+		pcm_close(&capture);
+		return 1;
+	}
+	if(capture.config.rate!=playback.config.rate||capture.frame_bytes!=playback.frame_bytes)
+	{
+		fprintf(stderr,"capture %u Hz/%zu-byte frames and playback %u Hz/%zu-byte frames do not match\n",
+			capture.config.rate,capture.frame_bytes,playback.config.rate,playback.frame_bytes);
+		goto close;
+	}
+	if(audio_ring_init(&ring,(uint64_t)ring_periods*capture.config.period_frames,capture.frame_bytes,policy)!=0)
+		goto close;
+	if(audio_thread_start(&out,&playback,&ring,rt_priority,1)!=0)
+		goto ring;
+	if(audio_thread_start(&in,&capture,&ring,rt_priority,0)!=0)
+	{
+		audio_thread_stop(&out);
+		goto ring;
+	}
+
+	/* sample the ring after each captured period: that fill is what a frame
+	captured now waits before it is played */
+	end=loop_now()+seconds;
+	while(loop_now()<end&&!audio_thread_finished(&in)&&!audio_thread_finished(&out))
+	{
+		uint64_t fill;
+
+		if(audio_thread_wait(&in,100)<=0)
+			continue;
+		fill=audio_ring_fill(&ring);
+		fill_sum+=fill;
+		if(fill>fill_max)
+			fill_max=fill;
+		samples++;
+	}
+	audio_thread_stop(&in);
+	audio_thread_stop(&out);
+
+	fprintf(stderr,"loopback %s -> %s: %u Hz, %u ch, period %lu x %u, ring %lu frames (%s)\n",
+		capture.config.device,playback.config.device,capture.config.rate,capture.config.channels,
+		capture.config.period_frames,capture.config.periods,(unsigned long)ring.capacity,
+		policy==AUDIO_RING_OVERWRITE ? "overwrite" : "drop newest");
+	fprintf(stderr,"ring latency: mean %.3f ms, max %.3f ms, high water %lu frames over %lu periods\n",
+		samples ? (double)fill_sum/(double)samples*1e3/capture.config.rate : 0.0,
+		(double)fill_max*1e3/capture.config.rate,(unsigned long)atomic_load(&ring.high_water),
+		(unsigned long)samples);
+	fprintf(stderr,"frames: %lu captured, %lu played, %lu dropped, %lu overwritten, %lu torn, %lu silence; "
+		"xruns %lu capture, %lu playback\n",
+		(unsigned long)capture.frames,(unsigned long)playback.frames,
+		(unsigned long)atomic_load(&ring.dropped),(unsigned long)atomic_load(&ring.overwritten),
+		(unsigned long)atomic_load(&out.torn_frames),(unsigned long)atomic_load(&out.silence_frames),
+		(unsigned long)capture.xruns,(unsigned long)playback.xruns);
+	rc=0;
+
+ring:
+	audio_ring_destroy(&ring);
+close:
+	pcm_close(&playback);
+	pcm_close(&capture);
+	return rc;
+}
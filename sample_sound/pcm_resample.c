@@ -0,0 +1,311 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "pcm_resample.h"
+#include "pcm_convert.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PCM_RESAMPLE_X86 1
+#else
+#define PCM_RESAMPLE_X86 0
+#endif
+
+#define PCM_RESAMPLE_MAX_TAPS 256
+
+static const struct {
+	const char *name;
+	unsigned int taps;
+	double passband;
+	double beta;                 /* Kaiser window */
+} qualities[]={
+	{"low",8,0.80,5.0},
+	{"medium",16,0.88,6.5},
+	{"high",32,0.93,8.0},
+	{"best",64,0.96,10.0},
+};
+
+#define QUALITY_COUNT (sizeof(qualities)/sizeof(qualities[0]))
+
+static float dot_scalar(const float *coefs, const float *x, unsigned int taps)
+{
+	float acc[4]={0,0,0,0};
+	unsigned int i;
+
+	/* four partial sums so the compiler can keep them in flight */
+	for(i=0;i<taps;i+=4)
+	{
+		acc[0]+=coefs[i]*x[i];
+		acc[1]+=coefs[i+1]*x[i+1];
+		acc[2]+=coefs[i+2]*x[i+2];
+		acc[3]+=coefs[i+3]*x[i+3];
+	}
+	return (acc[0]+acc[1])+(acc[2]+acc[3]);
+}
+
+#if PCM_RESAMPLE_X86
+__attribute__((target("sse2")))
+static float dot_sse2(const float *coefs, const float *x, unsigned int taps)
+{
+	__m128 a=_mm_setzero_ps();
+	__m128 b=_mm_setzero_ps();
+	unsigned int i;
+
+	for(i=0;i<taps;i+=8)
+	{
+		a=_mm_add_ps(a,_mm_mul_ps(_mm_load_ps(coefs+i),_mm_loadu_ps(x+i)));
+		b=_mm_add_ps(b,_mm_mul_ps(_mm_load_ps(coefs+i+4),_mm_loadu_ps(x+i+4)));
+	}
+	a=_mm_add_ps(a,b);
+	a=_mm_add_ps(a,_mm_movehl_ps(a,a));
+	a=_mm_add_ss(a,_mm_shuffle_ps(a,a,1));
+	return _mm_cvtss_f32(a);
+}
+
+__attribute__((target("avx2")))
+static float dot_avx2(const float *coefs, const float *x, unsigned int taps)
+{
+	__m256 a=_mm256_setzero_ps();
+	__m128 s;
+	unsigned int i;
+
+	for(i=0;i<taps;i+=8)
+	{
+		a=_mm256_add_ps(a,_mm256_mul_ps(_mm256_load_ps(coefs+i),_mm256_loadu_ps(x+i)));
+	}
+	s=_mm_add_ps(_mm256_castps256_ps128(a),_mm256_extractf128_ps(a,1));
+	s=_mm_add_ps(s,_mm_movehl_ps(s,s));
+	s=_mm_add_ss(s,_mm_shuffle_ps(s,s,1));
+	/* the caller's loop is plain C: leave the upper halves clean for it */
+	_mm256_zeroupper();
+	return _mm_cvtss_f32(s);
+}
+#endif
+
+static pcm_resample_dot_fn pick_dot(void)
+{
+#if PCM_RESAMPLE_X86
+	const char *kernel=pcm_convert_kernel_name();
+
+	if(strcmp(kernel,"avx2")==0)
+		return dot_avx2;
+	if(strcmp(kernel,"sse2")==0)
+		return dot_sse2;
+#endif
+	return dot_scalar;
+}
+
+static uint64_t gcd(uint64_t a, uint64_t b)
+{
+	while(b!=0)
+	{
+		uint64_t t=a%b;
+
+		a=b;
+		b=t;
+	}
+	return a;
+}
+
+/* zeroth-order modified Bessel function, for the Kaiser window */
+static double bessel_i0(double x)
+{
+	double sum=1.0;
+	double term=1.0;
+	int k;
+
+	for(k=1;k<50;k++)
+	{
+		term*=(x/(2.0*k))*(x/(2.0*k));
+		sum+=term;
+		if(term<sum*1e-12)
+			break;
+	}
+	return sum;
+}
+
+/* coefs[phase][j] weighs input frame pos-(taps-1)+j for an output phase/phases after pos */
+static void design(pcm_resample_t *r, double cutoff, double beta)
+{
+	double half=r->taps/2.0;
+	double norm=bessel_i0(beta);
+	unsigned int p;
+	unsigned int j;
+
+	/* phases+1 rows when interpolating, the last being phase 0 one frame later */
+	for(p=0;p<r->phases+(r->phases!=r->up);p++)
+	{
+		float *c=r->coefs+(size_t)p*r->taps;
+		double sum=0.0;
+
+		for(j=0;j<r->taps;j++)
+		{
+			/* distance from the filter centre, in input frames */
+			double t=(double)(r->taps-1-j)+(double)p/r->phases-half;
+			double x=t/half;
+			double w=x*x<1.0 ? bessel_i0(beta*sqrt(1.0-x*x))/norm : 0.0;
+			double s=t==0.0 ? 1.0 : sin(M_PI*cutoff*t)/(M_PI*cutoff*t);
+
+			c[j]=(float)(s*w);
+			sum+=s*w;
+		}
+		/* unity gain at DC for every phase */
+		for(j=0;j<r->taps;j++)
+		{
+			c[j]=(float)(c[j]/sum);
+		}
+	}
+}
+
+int pcm_resample_init(pcm_resample_t *r, unsigned int channels, unsigned int rate_in, unsigned int rate_out,
+	pcm_resample_quality_t quality)
+{
+	uint64_t g;
+	unsigned int taps;
+	double cutoff;
+
+	memset(r,0,sizeof(*r));
+	if(channels==0||rate_in==0||rate_out==0||(unsigned int)quality>=QUALITY_COUNT)
+	{
+		fprintf(stderr,"@pcm_resample_init, error occurs for %u ch %u -> %u Hz quality %d \n",
+			channels,rate_in,rate_out,(int)quality);
+		return -1;
+	}
+	g=gcd(rate_in,rate_out);
+	r->channels=channels;
+	r->rate_in=rate_in;
+	r->rate_out=rate_out;
+	r->up=rate_out/g;
+	r->down=rate_in/g;
+	r->phases=r->up<PCM_RESAMPLE_MAX_PHASES ? (unsigned int)r->up : PCM_RESAMPLE_MAX_PHASES;
+	taps=qualities[quality].taps;
+	cutoff=qualities[quality].passband;
+	if(r->down>r->up)
+	{
+		/* band-limit to the output rate, with proportionally more taps */
+		cutoff*=(double)r->up/(double)r->down;
+		taps=(unsigned int)ceil(taps*(double)r->down/(double)r->up);
+		if(taps>PCM_RESAMPLE_MAX_TAPS)
+			taps=PCM_RESAMPLE_MAX_TAPS;
+	}
+	r->taps=(taps+7)&~7u;
+	r->stride=((size_t)r->taps-1+PCM_RESAMPLE_BLOCK+7)&~(size_t)7;
+	/* aligned_alloc wants the size in whole 64-byte blocks */
+	r->coefs=(float *)aligned_alloc(64,((size_t)(r->phases+1)*r->taps*sizeof(float)+63)&~(size_t)63);
+	r->history=(float *)aligned_alloc(64,(r->stride*channels*sizeof(float)+63)&~(size_t)63);
+	if(r->coefs==NULL||r->history==NULL)
+	{
+		fprintf(stderr,"@pcm_resample_init, error occurs for %u phases of %u taps \n",r->phases,r->taps);
+		pcm_resample_destroy(r);
+		return -1;
+	}
+	design(r,cutoff,qualities[quality].beta);
+	r->dot=pick_dot();
+	pcm_resample_reset(r);
+	return 0;
+}
+
+void pcm_resample_destroy(pcm_resample_t *r)
+{
+	free(r->coefs);
+	free(r->history);
+	r->coefs=NULL;
+	r->history=NULL;
+}
+
+void pcm_resample_reset(pcm_resample_t *r)
+{
+	memset(r->history,0,r->stride*r->channels*sizeof(float));
+	r->fill=r->taps-1;
+	r->pos=r->taps-1;
+	r->frac=0;
+}
+
+size_t pcm_resample_out_frames(const pcm_resample_t *r, size_t in_frames)
+{
+	return (size_t)(((uint64_t)in_frames*r->up+r->down-1)/r->down)+1;
+}
+
+unsigned int pcm_resample_delay(const pcm_resample_t *r)
+{
+	return r->taps/2;
+}
+
+const char *pcm_resample_quality_name(pcm_resample_quality_t quality)
+{
+	return (unsigned int)quality<QUALITY_COUNT ? qualities[quality].name : "unknown";
+}
+
+size_t pcm_resample_process(pcm_resample_t *r, const float *in, size_t in_frames, float *out)
+{
+	unsigned int channels=r->channels;
+	size_t produced=0;
+
+	while(in_frames>0)
+	{
+		size_t n=in_frames<PCM_RESAMPLE_BLOCK ? in_frames : PCM_RESAMPLE_BLOCK;
+		size_t shift;
+		size_t i;
+		unsigned int c;
+
+		/* append the block to each channel's history */
+		for(i=0;i<n;i++)
+		{
+			for(c=0;c<channels;c++)
+			{
+				r->history[c*r->stride+r->fill+i]=in[i*channels+c];
+			}
+		}
+		r->fill+=n;
+		in+=n*channels;
+		in_frames-=n;
+
+		while(r->pos<r->fill)
+		{
+			const float *x=r->history+r->pos-(r->taps-1);
+
+			if(r->phases==r->up)
+			{
+				const float *coefs=r->coefs+(size_t)r->frac*r->taps;
+
+				for(c=0;c<channels;c++)
+				{
+					out[c]=r->dot(coefs,x+c*r->stride,r->taps);
+				}
+			}else{
+				/* between two tabulated phases: interpolate their outputs */
+				uint64_t at=r->frac*r->phases;
+				const float *coefs=r->coefs+(size_t)(at/r->up)*r->taps;
+				float mu=(float)(at%r->up)/(float)r->up;
+
+				for(c=0;c<channels;c++)
+				{
+					float y0=r->dot(coefs,x+c*r->stride,r->taps);
+					float y1=r->dot(coefs+r->taps,x+c*r->stride,r->taps);
+
+					out[c]=y0+mu*(y1-y0);
+				}
+			}
+			out+=channels;
+			produced++;
+			r->frac+=r->down;
+			r->pos+=(size_t)(r->frac/r->up);
+			r->frac%=r->up;
+		}
+
+		/* keep the taps-1 frames the next output still needs */
+		shift=r->pos-(r->taps-1);
+		if(shift>r->fill)
+			shift=r->fill;
+		for(c=0;c<channels;c++)
+		{
+			float *h=r->history+c*r->stride;
+
+			memmove(h,h+shift,(r->fill-shift)*sizeof(float));
+		}
+		r->fill-=shift;
+		r->pos-=shift;
+	}
+	return produced;
+}
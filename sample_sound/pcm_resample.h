@@ -0,0 +1,80 @@
+#ifndef SAMPLE_SOUND_PCM_RESAMPLE_H
+#define SAMPLE_SOUND_PCM_RESAMPLE_H
+
+/*
+Streaming polyphase resampler for interleaved float frames, to sit
+between pcm_engine and the application when the rate the device granted
+(pcm->config.rate after set_rate_near) is not the rate the application
+works at.
+
+rate_in/rate_out is reduced to up/down. Each output frame is a dot
+product of taps input frames with one phase of a Kaiser-windowed sinc,
+picked by where the output falls between two input frames. With up up
+to PCM_RESAMPLE_MAX_PHASES every phase is exact; beyond that (44100 to
+44101, say) the outputs of the two nearest tabulated phases are
+interpolated, at twice the work per frame. Quality sets taps per phase,
+window and passband:
+  LOW     8 taps, 80% of the band
+  MEDIUM  16 taps, 88%
+  HIGH    32 taps, 93%
+  BEST    64 taps, 96%
+Downsampling widens the filter by down/up so the stopband still starts
+at the output Nyquist. The dot product uses the kernel set pcm_convert
+is using (pcm_convert_select steers both).
+
+The work per output frame is fixed at taps*channels multiply-adds and
+nothing is allocated after init, so a period always costs the same; the
+output count per call varies by at most one frame around
+in_frames*rate_out/rate_in. The filter delays the signal by
+pcm_resample_delay input frames.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PCM_RESAMPLE_MAX_PHASES 256
+/* input frames moved into the history per step */
+#define PCM_RESAMPLE_BLOCK 256
+
+typedef enum pcm_resample_quality {
+	PCM_RESAMPLE_LOW,
+	PCM_RESAMPLE_MEDIUM,
+	PCM_RESAMPLE_HIGH,
+	PCM_RESAMPLE_BEST
+} pcm_resample_quality_t;
+
+typedef float (*pcm_resample_dot_fn)(const float *coefs, const float *x, unsigned int taps);
+
+typedef struct pcm_resample {
+	unsigned int channels;
+	unsigned int rate_in;
+	unsigned int rate_out;
+	uint64_t up;                 /* rate_out/gcd */
+	uint64_t down;               /* rate_in/gcd */
+	unsigned int phases;
+	unsigned int taps;           /* multiple of 8 */
+	float *coefs;                /* phases(+1) x taps, each phase reversed for ascending input */
+	float *history;              /* per channel: taps-1 old frames then up to one block */
+	size_t stride;               /* floats per channel in history */
+	size_t fill;                 /* frames in history */
+	size_t pos;                  /* newest input frame of the next output */
+	uint64_t frac;               /* and where it falls after it, in 1/up */
+	pcm_resample_dot_fn dot;
+} pcm_resample_t;
+
+int pcm_resample_init(pcm_resample_t *r, unsigned int channels, unsigned int rate_in, unsigned int rate_out,
+	pcm_resample_quality_t quality);
+void pcm_resample_destroy(pcm_resample_t *r);
+/* forget the history, as after a seek or an xrun */
+void pcm_resample_reset(pcm_resample_t *r);
+
+/* the most frames pcm_resample_process can produce from in_frames */
+size_t pcm_resample_out_frames(const pcm_resample_t *r, size_t in_frames);
+/* consume all in_frames; out must hold pcm_resample_out_frames of them. Frames produced */
+size_t pcm_resample_process(pcm_resample_t *r, const float *in, size_t in_frames, float *out);
+/* group delay in input frames */
+unsigned int pcm_resample_delay(const pcm_resample_t *r);
+
+const char *pcm_resample_quality_name(pcm_resample_quality_t quality);
+
+#endif
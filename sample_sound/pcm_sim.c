@@ -0,0 +1,595 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/timerfd.h>
+#include "pcm_backend.h"
+
+/*
+A device that exists only as a clock. config.device names a "wire"
+(NULL is "default"): every sim stream opened on the same name shares its
+CLOCK_MONOTONIC time base, and what the one playback stream on a wire
+plays comes back out of every capture stream on it at the same instant,
+so a playback/capture pair is a sound card with its output patched into
+its input.
+
+Each stream has a ring of period_frames*periods frames and a hardware
+pointer that moves a whole period at a time, at the moment the period
+would end on a real card running at config.rate. Nothing runs in the
+background: the pointer is worked out from the clock whenever the
+stream is touched. Capture takes each wire frame as of its own instant,
+so a frame is heard once its time has come even when the playback
+pointer is still waiting for the end of its period: the two streams can
+start at any phase to each other. Overruns and underruns happen exactly
+as ALSA would report them (capture a whole ring behind, playback
+once it has played the last frame written) and return -EPIPE until
+prepare. The poll descriptor is a timerfd armed for the moment
+avail_min frames will be ready.
+*/
+
+#define SIM_WIRE_SECONDS 1
+
+enum {
+	SIM_PREPARED,
+	SIM_RUNNING,
+	SIM_XRUN
+};
+
+struct sim_pcm;
+
+typedef struct sim_wire {
+	struct sim_wire *next;
+	char name[64];
+	unsigned int refs;
+	unsigned int rate;
+	size_t frame_bytes;
+	uint64_t epoch_ns;           /* wire frame 0 */
+	char *data;                  /* the last frames wire frames played */
+	uint64_t frames;
+	uint64_t valid_from;         /* wire frames [valid_from, played) hold sound */
+	uint64_t played;
+	struct sim_pcm *playback;
+} sim_wire_t;
+
+typedef struct sim_pcm {
+	pcm_t *pcm;
+	sim_wire_t *wire;
+	int state;
+	uint64_t start;              /* wire frame the stream started on */
+	uint64_t hw;                 /* stream frames the device has moved */
+	uint64_t appl;               /* and the application */
+	uint64_t buffer;
+	unsigned long period;
+	unsigned long start_threshold;
+	unsigned long avail_min;
+	char *ring;
+	int timer_fd;
+} sim_pcm_t;
+
+/* one lock for every wire: a capture update reaches into the playback stream */
+static pthread_mutex_t sim_lock=PTHREAD_MUTEX_INITIALIZER;
+static sim_wire_t *sim_wires;
+
+static uint64_t sim_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint64_t)ts.tv_sec*1000000000u+(uint64_t)ts.tv_nsec;
+}
+
+/* wire frame being played at now_ns */
+static uint64_t wire_frame(const sim_wire_t *w, uint64_t now_ns)
+{
+	uint64_t d=now_ns-w->epoch_ns;
+
+	return d/1000000000u*w->rate+d%1000000000u*w->rate/1000000000u;
+}
+
+/* first instant at which wire frame f has begun */
+static uint64_t wire_ns(const sim_wire_t *w, uint64_t f)
+{
+	return w->epoch_ns+f/w->rate*1000000000u+(f%w->rate*1000000000u+w->rate-1)/w->rate;
+}
+
+static uint64_t sim_avail(const sim_pcm_t *s)
+{
+	if(s->pcm->config.stream==PCM_CAPTURE)
+		return s->hw<s->appl ? 0 : s->hw-s->appl;
+	return s->buffer-(s->appl-s->hw);
+}
+
+/* playback: stream frames [from, to) reach the wire */
+static void sim_play(sim_pcm_t *s, uint64_t from, uint64_t to)
+{
+	sim_wire_t *w=s->wire;
+	size_t fb=w->frame_bytes;
+	uint64_t i;
+
+	if(to-from>w->frames)
+		from=to-w->frames;
+	if(s->start+from!=w->played)
+		w->valid_from=s->start+from;
+	for(i=from;i<to;i++)
+	{
+		memcpy(w->data+(s->start+i)%w->frames*fb,s->ring+i%s->buffer*fb,fb);
+	}
+	w->played=s->start+to;
+}
+
+/* capture: stream frames [from, to) come off the wire, silence where nothing played;
+frames whose time has come in a playback period that has not ended yet
+are still in the playback ring and come from there */
+static void sim_record(sim_pcm_t *s, uint64_t from, uint64_t to)
+{
+	sim_wire_t *w=s->wire;
+	const sim_pcm_t *p=w->playback;
+	size_t fb=w->frame_bytes;
+	uint64_t i;
+
+	for(i=from;i<to;i++)
+	{
+		uint64_t f=s->start+i;
+		char *at=s->ring+i%s->buffer*fb;
+
+		if(f>=w->valid_from&&f<w->played&&w->played-f<=w->frames)
+			memcpy(at,w->data+f%w->frames*fb,fb);
+		else if(p!=NULL&&p->state==SIM_RUNNING&&f>=p->start+p->hw&&f<p->start+p->appl)
+			memcpy(at,p->ring+(f-p->start)%p->buffer*fb,fb);
+		else
+			memset(at,0,fb);
+	}
+}
+
+static void sim_update(sim_pcm_t *s, uint64_t now_ns)
+{
+	uint64_t hw;
+
+	if(s->state!=SIM_RUNNING)
+		return;
+	hw=wire_frame(s->wire,now_ns)-s->start;
+	hw-=hw%s->period;
+	if(hw<=s->hw)
+		return;
+	if(s->pcm->config.stream==PCM_PLAYBACK)
+	{
+		if(hw>=s->appl)
+		{
+			/* played everything it was given: the ring ran dry, as ALSA's
+			avail >= stop_threshold, even if the next period is about to come */
+			sim_play(s,s->hw,s->appl);
+			s->hw=s->appl;
+			s->state=SIM_XRUN;
+			return;
+		}
+		sim_play(s,s->hw,hw);
+		s->hw=hw;
+		return;
+	}
+	/* what the playback side has played up to now must be on the wire first */
+	if(s->wire->playback!=NULL)
+		sim_update(s->wire->playback,now_ns);
+	sim_record(s,hw-s->hw>s->buffer ? hw-s->buffer : s->hw,hw);
+	s->hw=hw;
+	if(s->hw-s->appl>=s->buffer)
+		s->state=SIM_XRUN;
+}
+
+static void sim_start(sim_pcm_t *s, uint64_t now_ns)
+{
+	s->start=wire_frame(s->wire,now_ns);
+	s->hw=0;
+	s->state=SIM_RUNNING;
+}
+
+/* when avail_min frames will be there; 0 if they are already (or never will be) */
+static uint64_t sim_ready_ns(const sim_pcm_t *s)
+{
+	uint64_t need;
+
+	if(s->state!=SIM_RUNNING||sim_avail(s)>=s->avail_min)
+		return 0;
+	if(s->pcm->config.stream==PCM_CAPTURE)
+		need=s->appl+s->avail_min;
+	else
+		need=s->appl+s->avail_min-s->buffer;
+	/* rounded up to the period the pointer will next stop at */
+	need=(need+s->period-1)/s->period*s->period;
+	return wire_ns(s->wire,s->start+need);
+}
+
+static void sim_arm(sim_pcm_t *s)
+{
+	struct itimerspec its;
+	uint64_t at=sim_ready_ns(s);
+
+	/* a time in the past fires at once; zero would disarm */
+	if(at==0)
+		at=1;
+	memset(&its,0,sizeof(its));
+	its.it_value.tv_sec=(time_t)(at/1000000000u);
+	its.it_value.tv_nsec=(long)(at%1000000000u);
+	timerfd_settime(s->timer_fd,TFD_TIMER_ABSTIME,&its,NULL);
+}
+
+/* with sim_lock held: until at least want frames can move, or -EAGAIN/-EPIPE */
+static int sim_wait(sim_pcm_t *s, unsigned long want)
+{
+	while(1)
+	{
+		struct timespec ts;
+		uint64_t need;
+		uint64_t at;
+
+		sim_update(s,sim_now_ns());
+		if(s->state==SIM_XRUN)
+			return -EPIPE;
+		if(sim_avail(s)>=want)
+			return 0;
+		if(s->pcm->config.nonblock)
+			return -EAGAIN;
+		if(s->state!=SIM_RUNNING)
+			return -EPIPE;
+		need=s->pcm->config.stream==PCM_CAPTURE ? s->appl+want : s->appl+want-s->buffer;
+		need=(need+s->period-1)/s->period*s->period;
+		at=wire_ns(s->wire,s->start+need);
+		ts.tv_sec=(time_t)(at/1000000000u);
+		ts.tv_nsec=(long)(at%1000000000u);
+		pthread_mutex_unlock(&sim_lock);
+		while(clock_nanosleep(CLOCK_MONOTONIC,TIMER_ABSTIME,&ts,NULL)==EINTR)
+		{
+		}
+		pthread_mutex_lock(&sim_lock);
+	}
+}
+
+/* playback goes once start_threshold frames are queued, capture on first use */
+static void sim_kick(sim_pcm_t *s)
+{
+	if(s->state!=SIM_PREPARED)
+		return;
+	if(s->pcm->config.stream==PCM_CAPTURE||s->appl>=s->start_threshold)
+		sim_start(s,sim_now_ns());
+}
+
+static sim_wire_t *wire_get(const char *name, unsigned int rate, size_t frame_bytes, uint64_t min_frames)
+{
+	sim_wire_t *w;
+	uint64_t frames;
+
+	for(w=sim_wires;w!=NULL;w=w->next)
+	{
+		if(strcmp(w->name,name)==0)
+		{
+			if(w->rate!=rate||w->frame_bytes!=frame_bytes||w->frames<min_frames)
+				return NULL;
+			w->refs++;
+			return w;
+		}
+	}
+	frames=(uint64_t)rate*SIM_WIRE_SECONDS;
+	if(frames<min_frames*2)
+		frames=min_frames*2;
+	w=(sim_wire_t *)calloc(1,sizeof(*w));
+	if(w==NULL)
+		return NULL;
+	w->data=(char *)calloc((size_t)frames,frame_bytes);
+	if(w->data==NULL)
+	{
+		free(w);
+		return NULL;
+	}
+	snprintf(w->name,sizeof(w->name),"%s",name);
+	w->refs=1;
+	w->rate=rate;
+	w->frame_bytes=frame_bytes;
+	w->frames=frames;
+	w->epoch_ns=sim_now_ns();
+	w->next=sim_wires;
+	sim_wires=w;
+	return w;
+}
+
+static void wire_put(sim_wire_t *w)
+{
+	sim_wire_t **at;
+
+	if(--w->refs>0)
+		return;
+	for(at=&sim_wires;*at!=NULL;at=&(*at)->next)
+	{
+		if(*at==w)
+		{
+			*at=w->next;
+			break;
+		}
+	}
+	free(w->data);
+	free(w);
+}
+
+static int sim_open(pcm_t *pcm)
+{
+	pcm_config_t *cfg=&pcm->config;
+	const char *name=cfg->device ? cfg->device : "default";
+	sim_pcm_t *s;
+	int rc=0;
+
+	s=(sim_pcm_t *)calloc(1,sizeof(*s));
+	if(s==NULL)
+		return -ENOMEM;
+	s->pcm=pcm;
+	s->period=cfg->period_frames;
+	s->buffer=(uint64_t)cfg->period_frames*cfg->periods;
+	s->start_threshold=cfg->start_threshold ? cfg->start_threshold :
+		cfg->stream==PCM_CAPTURE ? 1 : (unsigned long)s->buffer;
+	if(s->start_threshold>s->buffer)
+		s->start_threshold=(unsigned long)s->buffer;
+	s->avail_min=cfg->avail_min ? cfg->avail_min : cfg->period_frames;
+	if(s->avail_min>s->buffer)
+		s->avail_min=(unsigned long)s->buffer;
+	s->ring=(char *)calloc((size_t)s->buffer,pcm->frame_bytes);
+	s->timer_fd=timerfd_create(CLOCK_MONOTONIC,TFD_NONBLOCK|TFD_CLOEXEC);
+	if(s->ring==NULL||s->timer_fd<0)
+	{
+		rc=s->timer_fd<0 ? -errno : -ENOMEM;
+		goto fail;
+	}
+	pthread_mutex_lock(&sim_lock);
+	s->wire=wire_get(name,cfg->rate,pcm->frame_bytes,s->buffer);
+	if(s->wire==NULL)
+		rc=-EINVAL;
+	else if(cfg->stream==PCM_PLAYBACK&&s->wire->playback!=NULL)
+		rc=-EBUSY;
+	else if(cfg->stream==PCM_PLAYBACK)
+		s->wire->playback=s;
+	if(rc!=0&&s->wire!=NULL)
+		wire_put(s->wire);
+	pthread_mutex_unlock(&sim_lock);
+	if(rc!=0)
+		goto fail;
+	pcm->handle=s;
+	return 0;
+
+fail:
+	if(s->timer_fd>=0)
+		close(s->timer_fd);
+	free(s->ring);
+	free(s);
+	return rc;
+}
+
+static long sim_transfer(pcm_t *pcm, void *buffer, unsigned long frames, int writing)
+{
+	sim_pcm_t *s=(sim_pcm_t *)pcm->handle;
+	size_t fb=pcm->frame_bytes;
+	unsigned long want=frames<s->avail_min ? frames : s->avail_min;
+	uint64_t n;
+	uint64_t done;
+	int rc;
+
+	pthread_mutex_lock(&sim_lock);
+	if(!writing)
+		sim_kick(s);
+	rc=sim_wait(s,want);
+	if(rc<0)
+	{
+		pthread_mutex_unlock(&sim_lock);
+		return rc;
+	}
+	n=sim_avail(s);
+	if(n>frames)
+		n=frames;
+	for(done=0;done<n;)
+	{
+		uint64_t at=(s->appl+done)%s->buffer;
+		uint64_t run=s->buffer-at<n-done ? s->buffer-at : n-done;
+		char *ring=s->ring+at*fb;
+		char *user=(char *)buffer+done*fb;
+
+		if(writing)
+			memcpy(ring,user,(size_t)(run*fb));
+		else
+			memcpy(user,ring,(size_t)(run*fb));
+		done+=run;
+	}
+	s->appl+=n;
+	if(writing)
+		sim_kick(s);
+	sim_arm(s);
+	pthread_mutex_unlock(&sim_lock);
+	return (long)n;
+}
+
+static long sim_read(pcm_t *pcm, void *buffer, unsigned long frames)
+{
+	return sim_transfer(pcm,buffer,frames,0);
+}
+
+static long sim_write(pcm_t *pcm, const void *buffer, unsigned long frames)
+{
+	return sim_transfer(pcm,(void *)buffer,frames,1);
+}
+
+static int sim_prepare(pcm_t *pcm)
+{
+	sim_pcm_t *s=(sim_pcm_t *)pcm->handle;
+
+	pthread_mutex_lock(&sim_lock);
+	s->state=SIM_PREPARED;
+	s->hw=0;
+	s->appl=0;
+	sim_arm(s);
+	pthread_mutex_unlock(&sim_lock);
+	return 0;
+}
+
+static int sim_resume(pcm_t *pcm)
+{
+	/* never suspends */
+	(void)pcm;
+	return 0;
+}
+
+static int sim_drain(pcm_t *pcm)
+{
+	sim_pcm_t *s=(sim_pcm_t *)pcm->handle;
+
+	if(pcm->config.stream==PCM_CAPTURE)
+		return 0;
+	pthread_mutex_lock(&sim_lock);
+	if(s->state==SIM_PREPARED&&s->appl>0)
+		sim_start(s,sim_now_ns());
+	while(s->state==SIM_RUNNING&&s->hw<s->appl)
+	{
+		struct timespec ts;
+		uint64_t at=wire_ns(s->wire,s->start+s->appl);
+
+		ts.tv_sec=(time_t)(at/1000000000u);
+		ts.tv_nsec=(long)(at%1000000000u);
+		pthread_mutex_unlock(&sim_lock);
+		while(clock_nanosleep(CLOCK_MONOTONIC,TIMER_ABSTIME,&ts,NULL)==EINTR)
+		{
+		}
+		pthread_mutex_lock(&sim_lock);
+		/* the last partial period is played out too, not counted as an underrun */
+		if(wire_frame(s->wire,sim_now_ns())-s->start>=s->appl)
+		{
+			sim_play(s,s->hw,s->appl);
+			s->hw=s->appl;
+		}else{
+			sim_update(s,sim_now_ns());
+		}
+	}
+	s->state=SIM_PREPARED;
+	s->hw=0;
+	s->appl=0;
+	pthread_mutex_unlock(&sim_lock);
+	return 0;
+}
+
+static void sim_close(pcm_t *pcm)
+{
+	sim_pcm_t *s=(sim_pcm_t *)pcm->handle;
+
+	if(s==NULL)
+		return;
+	pthread_mutex_lock(&sim_lock);
+	if(s->wire->playback==s)
+		s->wire->playback=NULL;
+	wire_put(s->wire);
+	pthread_mutex_unlock(&sim_lock);
+	close(s->timer_fd);
+	free(s->ring);
+	free(s);
+	pcm->handle=NULL;
+}
+
+static int sim_mmap_begin(pcm_t *pcm, void **area, unsigned long *offset, unsigned long *frames)
+{
+	sim_pcm_t *s=(sim_pcm_t *)pcm->handle;
+	unsigned long want=*frames<s->avail_min ? *frames : s->avail_min;
+	uint64_t at;
+	uint64_t n;
+	int rc;
+
+	pthread_mutex_lock(&sim_lock);
+	if(pcm->config.stream==PCM_CAPTURE)
+		sim_kick(s);
+	rc=sim_wait(s,want ? want : 1);
+	if(rc<0)
+	{
+		pthread_mutex_unlock(&sim_lock);
+		return rc;
+	}
+	at=s->appl%s->buffer;
+	n=sim_avail(s);
+	if(n>s->buffer-at)
+		n=s->buffer-at;
+	if(n>*frames)
+		n=*frames;
+	*area=s->ring+at*pcm->frame_bytes;
+	*offset=(unsigned long)at;
+	*frames=(unsigned long)n;
+	pthread_mutex_unlock(&sim_lock);
+	return 0;
+}
+
+static long sim_mmap_commit(pcm_t *pcm, unsigned long offset, unsigned long frames)
+{
+	sim_pcm_t *s=(sim_pcm_t *)pcm->handle;
+
+	pthread_mutex_lock(&sim_lock);
+	sim_update(s,sim_now_ns());
+	if(s->state==SIM_XRUN||offset!=s->appl%s->buffer)
+	{
+		pthread_mutex_unlock(&sim_lock);
+		return -EPIPE;
+	}
+	s->appl+=frames;
+	sim_kick(s);
+	sim_arm(s);
+	pthread_mutex_unlock(&sim_lock);
+	return (long)frames;
+}
+
+static int sim_poll_descriptors(pcm_t *pcm, struct pollfd *pfds, unsigned int space)
+{
+	sim_pcm_t *s=(sim_pcm_t *)pcm->handle;
+
+	if(space<1)
+		return -ENOSPC;
+	pthread_mutex_lock(&sim_lock);
+	/* a poll loop never reads first: capture starts here */
+	if(pcm->config.stream==PCM_CAPTURE)
+		sim_kick(s);
+	sim_arm(s);
+	pthread_mutex_unlock(&sim_lock);
+	pfds[0].fd=s->timer_fd;
+	pfds[0].events=POLLIN;
+	pfds[0].revents=0;
+	return 1;
+}
+
+static int sim_poll_revents(pcm_t *pcm, struct pollfd *pfds, unsigned int nfds, unsigned short *revents)
+{
+	sim_pcm_t *s=(sim_pcm_t *)pcm->handle;
+	uint64_t ticks;
+
+	*revents=0;
+	if(nfds<1||!(pfds[0].revents&POLLIN))
+		return 0;
+	if(read(s->timer_fd,&ticks,sizeof(ticks))<0&&errno!=EAGAIN)
+		return -errno;
+	pthread_mutex_lock(&sim_lock);
+	if(pcm->config.stream==PCM_CAPTURE)
+		sim_kick(s);
+	sim_update(s,sim_now_ns());
+	if(s->state==SIM_XRUN)
+		*revents=POLLERR;
+	else if(sim_avail(s)>=s->avail_min)
+		*revents=pcm->config.stream==PCM_CAPTURE ? POLLIN : POLLOUT;
+	/* level-triggered like a real device: stays readable until the frames move */
+	sim_arm(s);
+	pthread_mutex_unlock(&sim_lock);
+	return 0;
+}
+
+const pcm_ops_t pcm_sim_ops={
+	"sim",
+	1,
+	sim_open,
+	sim_read,
+	sim_write,
+	sim_prepare,
+	sim_resume,
+	sim_drain,
+	sim_close,
+	sim_mmap_begin,
+	sim_mmap_commit,
+	sim_poll_descriptors,
+	sim_poll_revents,
+};
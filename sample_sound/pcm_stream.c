@@ -0,0 +1,464 @@
+/*
+Listings 3 and 4 of sample_sound.c on top of pcm_engine.
+
+build: gcc -O2 sample_sound/pcm_stream.c sample_sound/pcm_engine.c sample_sound/pcm_file.c sample_sound/pcm_alsa.c \
+              sample_sound/pcm_sim.c sample_sound/audio_thread.c sample_sound/audio_ring.c sample_sound/pcm_convert.c \
+              sample_sound/pcm_resample.c sample_sound/wav_writer.c sample_sound/pcm_tune.c -lasound -lpthread -lm -o pcm_stream
+       (or -DPCM_ENGINE_ALSA=0 without -lasound for the file/null/sim backends only)
+run:   ./pcm_stream [-c] [-w out.wav] [-m] [-t rt_priority] [-a] [-b alsa|file|null|sim] [-D device] [-r rate] [-R device_rate]
+                    [-q low|medium|high|best] [-n channels] [-p period_frames] [-P periods] [-s seconds] < in.raw
+       ./pcm_stream -c ... > out.raw
+       ./pcm_stream -c -w out.wav ...
+
+Playback (the default) copies stdin to the PCM for the given number of
+seconds (5, as in the listings) or until end of input; -c captures from
+the PCM to stdout instead. -m uses mmap access: stdin is read straight
+into the driver's ring (or the ring written straight to stdout), falling
+back to read/write if the device has no mmap. -t moves the PCM I/O to an
+audio_thread (SCHED_FIFO at the given priority, 0 for normal, memory
+locked) and the main thread only exchanges periods with it. A summary
+goes to stderr.
+
+stdin/stdout are at -r. The device is asked for -R (default the same)
+and, if the rate it grants differs, read/write periods go through a
+pcm_resample stage of -q quality (default high) instead of being played
+or recorded at the wrong speed; -m and -t move device-rate frames as
+they are.
+
+-w records to a WAV file through a wav_writer instead of stdout: the
+capture loop only copies each period into the writer's chunks and a
+background thread does the disk I/O.
+
+-a lets a pcm_tune controller pick the period and buffer instead of -p
+and -P, which only give the starting point: the stream is renegotiated
+a step up whenever it xruns or wakes up dangerously late, and a step
+down after a stretch of quiet. Each change is reported on stderr. Not
+with -t, whose thread holds the PCM.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "pcm_engine.h"
+#include "audio_thread.h"
+#include "pcm_convert.h"
+#include "pcm_resample.h"
+#include "wav_writer.h"
+#include "pcm_tune.h"
+
+#define STREAM_RING_PERIODS 16
+
+static int parse_backend(const char *name, pcm_backend_t *backend)
+{
+	if(strcmp(name,"alsa")==0)
+		*backend=PCM_BACKEND_ALSA;
+	else if(strcmp(name,"file")==0)
+		*backend=PCM_BACKEND_FILE;
+	else if(strcmp(name,"null")==0)
+		*backend=PCM_BACKEND_NULL;
+	else if(strcmp(name,"sim")==0)
+		*backend=PCM_BACKEND_SIM;
+	else
+		return -1;
+	return 0;
+}
+
+static int parse_quality(const char *name, pcm_resample_quality_t *quality)
+{
+	pcm_resample_quality_t q;
+
+	for(q=PCM_RESAMPLE_LOW;q<=PCM_RESAMPLE_BEST;q++)
+	{
+		if(strcmp(name,pcm_resample_quality_name(q))==0)
+		{
+			*quality=q;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/* read/write a whole period from a plain fd, short only at end of input */
+static long fd_frames(int fd, char *buffer, size_t frame_bytes, unsigned long frames, int writing)
+{
+	size_t want=frames*frame_bytes;
+	size_t done=0;
+	ssize_t n;
+
+	while(done<want)
+	{
+		n=writing ? write(fd,buffer+done,want-done) : read(fd,buffer+done,want-done);
+		if(n<=0)
+			break;
+		done+=(size_t)n;
+	}
+	return (long)(done/frame_bytes);
+}
+
+/* capture output: the -w recording if there is one, else stdout */
+static long sink_frames(wav_writer_t *wav, char *buffer, size_t frame_bytes, unsigned long frames)
+{
+	if(wav!=NULL)
+	{
+		wav_writer_push(wav,buffer,frames);
+		return (long)frames;
+	}
+	return fd_frames(1,buffer,frame_bytes,frames,1);
+}
+
+/* S16 frames at one rate in, S16 frames at the other out, through float */
+typedef struct stream_rate {
+	pcm_resample_t resample;
+	unsigned int channels;
+	float *in;
+	float *out;
+	int16_t *converted;
+} stream_rate_t;
+
+static int rate_init(stream_rate_t *sr, unsigned int channels, unsigned int rate_in, unsigned int rate_out,
+	pcm_resample_quality_t quality, unsigned long max_frames)
+{
+	size_t out_frames;
+
+	if(pcm_resample_init(&sr->resample,channels,rate_in,rate_out,quality)!=0)
+		return -1;
+	out_frames=pcm_resample_out_frames(&sr->resample,max_frames);
+	sr->channels=channels;
+	sr->in=(float *)malloc(max_frames*channels*sizeof(float));
+	sr->out=(float *)malloc(out_frames*channels*sizeof(float));
+	sr->converted=(int16_t *)malloc(out_frames*channels*sizeof(int16_t));
+	if(sr->in==NULL||sr->out==NULL||sr->converted==NULL)
+	{
+		fprintf(stderr,"@rate_init, error occurs for %lu frames of %u ch \n",max_frames,channels);
+		free(sr->in);
+		free(sr->out);
+		free(sr->converted);
+		pcm_resample_destroy(&sr->resample);
+		return -1;
+	}
+	return 0;
+}
+
+/* frames left in sr->converted */
+static long rate_run(stream_rate_t *sr, const char *buffer, long frames)
+{
+	size_t produced;
+
+	pcm_to_float(sr->in,buffer,PCM_FORMAT_S16_LE,(size_t)frames*sr->channels);
+	produced=pcm_resample_process(&sr->resample,sr->in,(size_t)frames,sr->out);
+	pcm_from_float(sr->converted,PCM_FORMAT_S16_LE,sr->out,produced*sr->channels);
+	return (long)produced;
+}
+
+static void rate_free(stream_rate_t *sr)
+{
+	free(sr->in);
+	free(sr->out);
+	free(sr->converted);
+	pcm_resample_destroy(&sr->resample);
+}
+
+/* the main-thread side of -t: stdin/stdout <-> the audio_thread's ring */
+static void run_threaded(pcm_t *pcm, unsigned long loops, int rt_priority, wav_writer_t *wav)
+{
+	audio_thread_t at;
+	audio_ring_t ring;
+	int capture=pcm->config.stream==PCM_CAPTURE;
+	uint64_t total=(uint64_t)loops*pcm->config.period_frames;
+
+	if(audio_ring_init(&ring,(uint64_t)STREAM_RING_PERIODS*pcm->config.period_frames,pcm->frame_bytes,
+		AUDIO_RING_DROP_NEWEST)!=0)
+		return;
+	if(audio_thread_start(&at,pcm,&ring,rt_priority,1)!=0)
+	{
+		audio_ring_destroy(&ring);
+		return;
+	}
+	while(total>0&&!audio_thread_finished(&at))
+	{
+		void *area;
+		uint64_t avail;
+		long frames;
+
+		if(capture)
+		{
+			avail=audio_ring_acquire_read(&ring,&area,total);
+			if(avail==0)
+			{
+				audio_thread_wait(&at,100);
+				continue;
+			}
+			frames=sink_frames(wav,(char *)area,pcm->frame_bytes,(unsigned long)avail);
+			audio_ring_commit_read(&ring,avail);
+			total-=avail;
+			if(frames!=(long)avail)
+				break;
+			continue;
+		}
+		avail=audio_ring_acquire_write(&ring,&area,total);
+		if(avail==0)
+		{
+			audio_thread_wait(&at,100);
+			continue;
+		}
+		frames=fd_frames(0,(char *)area,pcm->frame_bytes,(unsigned long)avail,0);
+		audio_ring_commit_write(&ring,(uint64_t)frames);
+		total-=(uint64_t)frames;
+		if(frames!=(long)avail)
+		{
+			fprintf(stderr,"end of file on input\n");
+			break;
+		}
+	}
+	/* let the thread play out what is queued */
+	while(!capture&&!audio_thread_finished(&at)&&audio_ring_fill(&ring)>0)
+	{
+		audio_thread_wait(&at,100);
+	}
+	audio_thread_stop(&at);
+	fprintf(stderr,"audio thread: %lu periods, %s %lu frames, ring high water %lu, max wake gap %.3f ms, max busy %.3f ms\n",
+		(unsigned long)atomic_load(&at.periods),capture ? "dropped" : "silence",
+		(unsigned long)(capture ? atomic_load(&ring.dropped) : atomic_load(&at.silence_frames)),
+		(unsigned long)atomic_load(&ring.high_water),
+		(double)atomic_load(&at.wake_max_ns)/1e6,(double)atomic_load(&at.busy_max_ns)/1e6);
+	audio_ring_destroy(&ring);
+}
+
+int main(int argc, char *argv[])
+{
+	pcm_config_t cfg;
+	pcm_t pcm;
+	pcm_stream_t stream=PCM_PLAYBACK;
+	pcm_backend_t backend=PCM_ENGINE_ALSA ? PCM_BACKEND_ALSA : PCM_BACKEND_NULL;
+	const char *device=NULL;
+	unsigned int rate=44100;
+	unsigned int device_rate=0;
+	pcm_resample_quality_t quality=PCM_RESAMPLE_HIGH;
+	stream_rate_t sr;
+	int resampling=0;
+	const char *wav_path=NULL;
+	wav_writer_t recording;
+	wav_writer_t *wav=NULL;
+	unsigned int channels=2;
+	unsigned long period=32;
+	unsigned int periods=4;
+	double seconds=5;
+	int mmap=0;
+	int threaded=0;
+	int rt_priority=0;
+	int autotune=0;
+	pcm_tune_t tune;
+	unsigned long max_period;
+	unsigned long loops;
+	char *buffer;
+	int opt;
+
+	while((opt=getopt(argc,argv,"cmt:aw:b:D:r:R:q:n:p:P:s:"))!=-1)
+	{
+		switch(opt)
+		{
+		case 'c': stream=PCM_CAPTURE; break;
+		case 'm': mmap=1; break;
+		case 'w': wav_path=optarg; break;
+		case 't': threaded=1; rt_priority=atoi(optarg); break;
+		case 'a': autotune=1; break;
+		case 'b':
+			if(parse_backend(optarg,&backend)!=0)
+			{
+				fprintf(stderr,"unknown backend %s\n",optarg);
+				return 1;
+			}
+			break;
+		case 'D': device=optarg; break;
+		case 'r': rate=(unsigned int)atoi(optarg); break;
+		case 'R': device_rate=(unsigned int)atoi(optarg); break;
+		case 'q':
+			if(parse_quality(optarg,&quality)!=0)
+			{
+				fprintf(stderr,"unknown quality %s\n",optarg);
+				return 1;
+			}
+			break;
+		case 'n': channels=(unsigned int)atoi(optarg); break;
+		case 'p': period=strtoul(optarg,NULL,0); break;
+		case 'P': periods=(unsigned int)atoi(optarg); break;
+		case 's': seconds=atof(optarg); break;
+		default:
+			fprintf(stderr,"usage: %s [-c] [-w out.wav] [-m] [-t rt_priority] [-a] [-b alsa|file|null|sim] [-D device] [-r rate] "
+				"[-R device_rate] [-q low|medium|high|best] [-n channels] [-p period_frames] [-P periods] [-s seconds]\n",argv[0]);
+			return 1;
+		}
+	}
+
+	if(autotune&&threaded)
+	{
+		fprintf(stderr,"-a and -t cannot be combined\n");
+		return 1;
+	}
+
+	pcm_config_init(&cfg,stream);
+	pcm_config_set_device(&cfg,backend,device ? device : backend==PCM_BACKEND_FILE ? "-" : "default");
+	pcm_config_set_format(&cfg,PCM_FORMAT_S16_LE,channels,device_rate ? device_rate : rate);
+	pcm_config_set_period(&cfg,period,periods);
+	pcm_config_set_mmap(&cfg,mmap);
+	pcm_config_set_nonblock(&cfg,threaded);
+	if(pcm_open(&pcm,&cfg)!=0)
+		return 1;
+
+	max_period=pcm.config.period_frames;
+	if(autotune)
+	{
+		pcm_tune_config_t tcfg;
+
+		pcm_tune_config_init(&tcfg);
+		if(pcm_tune_init(&tune,&tcfg,pcm.config.rate,pcm.config.period_frames,pcm.config.periods,pcm.xruns)!=0)
+		{
+			pcm_close(&pcm);
+			return 1;
+		}
+		/* room for any period the tuner may move to */
+		if(pcm_tune_max_period(&tune)>max_period)
+			max_period=pcm_tune_max_period(&tune);
+	}
+	buffer=(char *)malloc(max_period*pcm.frame_bytes);
+	if(buffer==NULL)
+	{
+		pcm_close(&pcm);
+		return 1;
+	}
+	if(pcm.config.rate!=rate&&!mmap&&!threaded)
+	{
+		/* playback turns stdin's periods into device frames, capture the other way round */
+		if(rate_init(&sr,pcm.config.channels,stream==PCM_PLAYBACK ? rate : pcm.config.rate,
+			stream==PCM_PLAYBACK ? pcm.config.rate : rate,quality,max_period)!=0)
+		{
+			pcm_close(&pcm);
+			free(buffer);
+			return 1;
+		}
+		resampling=1;
+		fprintf(stderr,"resampling %u Hz <-> device %u Hz (%s, %u taps, delay %u frames)\n",rate,pcm.config.rate,
+			pcm_resample_quality_name(quality),sr.resample.taps,pcm_resample_delay(&sr.resample));
+	}
+	if(wav_path!=NULL&&stream==PCM_CAPTURE)
+	{
+		wav_writer_config_t wcfg;
+
+		wav_writer_config_init(&wcfg,PCM_FORMAT_S16_LE,pcm.config.channels,resampling ? rate : pcm.config.rate);
+		if(wav_writer_open(&recording,wav_path,&wcfg)!=0)
+		{
+			pcm_close(&pcm);
+			if(resampling)
+				rate_free(&sr);
+			free(buffer);
+			return 1;
+		}
+		wav=&recording;
+	}
+	/* seconds of audio divided by the period time the backend granted;
+	resampled playback reads its periods from stdin, at -r */
+	if(resampling&&stream==PCM_PLAYBACK)
+		loops=(unsigned long)(seconds*rate/(double)pcm.config.period_frames);
+	else
+		loops=(unsigned long)(seconds*1e6/(double)pcm_period_us(&pcm));
+	if(threaded)
+	{
+		run_threaded(&pcm,loops,rt_priority,wav);
+		loops=0;
+	}
+	while(loops>0)
+	{
+		long frames;
+
+		loops--;
+		if(mmap)
+		{
+			void *area;
+			unsigned long avail=pcm.config.period_frames;
+
+			if(pcm_mmap_begin(&pcm,&area,&avail)!=0||avail==0)
+				break;
+			if(stream==PCM_CAPTURE)
+				frames=sink_frames(wav,(char *)area,pcm.frame_bytes,avail);
+			else
+				frames=fd_frames(0,(char *)area,pcm.frame_bytes,avail,0);
+			if(stream==PCM_PLAYBACK&&frames==0)
+				fprintf(stderr,"end of file on input\n");
+			if(pcm_mmap_commit(&pcm,(unsigned long)frames)<0||(unsigned long)frames!=avail)
+				break;
+		}else if(stream==PCM_PLAYBACK)
+		{
+			frames=fd_frames(0,buffer,pcm.frame_bytes,pcm.config.period_frames,0);
+			if(frames==0)
+			{
+				fprintf(stderr,"end of file on input\n");
+				break;
+			}
+			if(resampling)
+			{
+				long n=rate_run(&sr,buffer,frames);
+
+				if(n>0&&pcm_write(&pcm,sr.converted,(unsigned long)n)<0)
+					break;
+			}else if(pcm_write(&pcm,buffer,(unsigned long)frames)<0){
+				break;
+			}
+		}else{
+			const char *out=buffer;
+
+			frames=pcm_read(&pcm,buffer,pcm.config.period_frames);
+			if(frames<=0)
+				break;
+			if(resampling)
+			{
+				frames=rate_run(&sr,buffer,frames);
+				out=(const char *)sr.converted;
+			}
+			if(sink_frames(wav,(char *)out,pcm.frame_bytes,(unsigned long)frames)!=frames)
+				break;
+		}
+		if(autotune&&pcm_tune_period(&tune,pcm.xruns))
+		{
+			const pcm_tune_step_t *step=&tune.steps[tune.level];
+			unsigned long old_period=pcm.config.period_frames;
+			unsigned int old_periods=pcm.config.periods;
+
+			if(pcm_reconfigure(&pcm,step->period,step->periods)!=0)
+				break;
+			fprintf(stderr,"autotune: period %lu x %u -> %lu x %u (%lu xruns, wakeup %.3f ms late)\n",
+				old_period,old_periods,pcm.config.period_frames,pcm.config.periods,
+				(unsigned long)tune.last_xruns,(double)tune.last_late_ns/1e6);
+			/* the same time left, in periods of the new size */
+			loops=(unsigned long)((uint64_t)loops*old_period/pcm.config.period_frames);
+			pcm_tune_restart(&tune,pcm.xruns);
+		}
+	}
+	if(stream==PCM_PLAYBACK)
+		pcm_drain(&pcm);
+	fprintf(stderr,"%s %s%s: %lu frames, %u Hz, %u ch, period %lu x %u, %lu xruns\n",
+		stream==PCM_CAPTURE ? "capture" : "playback",pcm.config.device,pcm.config.mmap ? " (mmap)" : "",
+		(unsigned long)pcm.frames,pcm.config.rate,pcm.config.channels,
+		pcm.config.period_frames,pcm.config.periods,(unsigned long)pcm.xruns);
+	if(autotune)
+		fprintf(stderr,"autotune: %lu changes, ended at %lu x %u (%.3f ms buffer)\n",(unsigned long)tune.changes,
+			pcm.config.period_frames,pcm.config.periods,
+			(double)pcm.config.period_frames*pcm.config.periods*1e3/pcm.config.rate);
+	if(wav!=NULL)
+	{
+		uint64_t bytes=wav_writer_bytes(wav);
+		uint64_t dropped=atomic_load(&wav->dropped_frames);
+		uint64_t fixups=atomic_load(&wav->fixups);
+		uint64_t write_max=atomic_load(&wav->write_max_ns);
+		int direct=wav->direct;
+		int rc=wav_writer_close(wav);
+
+		fprintf(stderr,"recorded %s: %llu bytes%s, %llu frames dropped, %llu header fixups, longest write %.3f ms%s\n",
+			wav_path,(unsigned long long)bytes,direct ? " (O_DIRECT)" : "",(unsigned long long)dropped,
+			(unsigned long long)fixups,(double)write_max/1e6,rc!=0 ? ", WRITE FAILED" : "");
+	}
+	pcm_close(&pcm);
+	if(resampling)
+		rate_free(&sr);
+	free(buffer);
+	return 0;
+}
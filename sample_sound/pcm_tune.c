@@ -0,0 +1,178 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "pcm_tune.h"
+
+static uint64_t tune_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint64_t)ts.tv_sec*1000000000u+(uint64_t)ts.tv_nsec;
+}
+
+void pcm_tune_config_init(pcm_tune_config_t *cfg)
+{
+	memset(cfg,0,sizeof(*cfg));
+	cfg->min_period=32;
+	cfg->max_period=2048;
+	cfg->min_periods=2;
+	cfg->max_periods=4;
+	cfg->window_ms=1000;
+	cfg->grow_pct=75;
+	cfg->shrink_pct=40;
+	cfg->quiet_windows=4;
+	cfg->max_backoff=64;
+}
+
+static int step_cmp(const void *a, const void *b)
+{
+	const pcm_tune_step_t *x=(const pcm_tune_step_t *)a;
+	const pcm_tune_step_t *y=(const pcm_tune_step_t *)b;
+	unsigned long bx=x->period*x->periods;
+	unsigned long by=y->period*y->periods;
+
+	if(bx!=by)
+		return bx<by ? -1 : 1;
+	return x->period<y->period ? -1 : x->period>y->period;
+}
+
+/* how late a wakeup at step i can be before the stream xruns */
+static uint64_t step_slack_ns(const pcm_tune_t *t, unsigned int i)
+{
+	const pcm_tune_step_t *s=&t->steps[i];
+
+	return (uint64_t)s->period*(s->periods-1)*1000000000u/t->rate;
+}
+
+int pcm_tune_init(pcm_tune_t *t, const pcm_tune_config_t *cfg, unsigned int rate, unsigned long period,
+	unsigned int periods, uint64_t xruns)
+{
+	pcm_tune_step_t all[PCM_TUNE_MAX_STEPS];
+	unsigned int count=0;
+	unsigned long p;
+	unsigned int n;
+	unsigned int i;
+
+	memset(t,0,sizeof(*t));
+	if(rate==0||cfg->min_period==0||cfg->min_period>cfg->max_period||cfg->min_periods<2||
+		cfg->min_periods>cfg->max_periods||cfg->window_ms==0||cfg->shrink_pct>=cfg->grow_pct||
+		cfg->quiet_windows==0||cfg->max_backoff==0)
+	{
+		fprintf(stderr,"@pcm_tune_init, error occurs for %lu..%lu x %u..%u frames at %u Hz \n",
+			cfg->min_period,cfg->max_period,cfg->min_periods,cfg->max_periods,rate);
+		return -1;
+	}
+	for(p=cfg->min_period;p<=cfg->max_period;p*=2)
+	{
+		for(n=cfg->min_periods;n<=cfg->max_periods;n++)
+		{
+			if(count==PCM_TUNE_MAX_STEPS)
+			{
+				fprintf(stderr,"@pcm_tune_init, error occurs for more than %d steps \n",PCM_TUNE_MAX_STEPS);
+				return -1;
+			}
+			all[count].period=p;
+			all[count].periods=n;
+			count++;
+		}
+	}
+	qsort(all,count,sizeof(all[0]),step_cmp);
+	/* one step per buffer length: the smaller period, sorted first */
+	for(i=0;i<count;i++)
+	{
+		if(t->nsteps>0&&all[i].period*all[i].periods==
+			t->steps[t->nsteps-1].period*t->steps[t->nsteps-1].periods)
+			continue;
+		t->steps[t->nsteps]=all[i];
+		t->backoff[t->nsteps]=1;
+		t->nsteps++;
+	}
+	t->config=*cfg;
+	t->rate=rate;
+	t->level=t->nsteps-1;
+	for(i=0;i<t->nsteps;i++)
+	{
+		if(t->steps[i].period*t->steps[i].periods>=period*periods)
+		{
+			t->level=i;
+			break;
+		}
+	}
+	pcm_tune_restart(t,xruns);
+	return 0;
+}
+
+void pcm_tune_restart(pcm_tune_t *t, uint64_t xruns)
+{
+	t->window_start=tune_now_ns();
+	t->last_wake=0;
+	t->late_max=0;
+	t->xruns_start=xruns;
+}
+
+unsigned long pcm_tune_max_period(const pcm_tune_t *t)
+{
+	unsigned long max=0;
+	unsigned int i;
+
+	for(i=0;i<t->nsteps;i++)
+	{
+		if(t->steps[i].period>max)
+			max=t->steps[i].period;
+	}
+	return max;
+}
+
+int pcm_tune_period(pcm_tune_t *t, uint64_t xruns)
+{
+	const pcm_tune_step_t *s=&t->steps[t->level];
+	uint64_t period_ns=(uint64_t)s->period*1000000000u/t->rate;
+	uint64_t now=tune_now_ns();
+	uint64_t window_xruns;
+	uint64_t late;
+
+	if(t->last_wake!=0&&now-t->last_wake>period_ns)
+	{
+		late=now-t->last_wake-period_ns;
+		if(late>t->late_max)
+			t->late_max=late;
+	}
+	t->last_wake=now;
+	if(now-t->window_start<(uint64_t)t->config.window_ms*1000000u)
+		return 0;
+
+	window_xruns=xruns-t->xruns_start;
+	late=t->late_max;
+	t->window_start=now;
+	t->late_max=0;
+	t->xruns_start=xruns;
+	if(window_xruns>0||late>step_slack_ns(t,t->level)*t->config.grow_pct/100)
+	{
+		t->quiet=0;
+		if(t->level+1>=t->nsteps)
+			return 0;
+		/* coming back here has to be earned, and more so each time it fails */
+		if(window_xruns>0)
+		{
+			t->backoff[t->level]*=2;
+			if(t->backoff[t->level]>t->config.max_backoff)
+				t->backoff[t->level]=t->config.max_backoff;
+		}
+		t->level++;
+	}else{
+		t->quiet++;
+		if(t->quiet%t->config.quiet_windows==0&&t->backoff[t->level]>1)
+			t->backoff[t->level]/=2;
+		if(t->level==0||t->quiet<t->config.quiet_windows*t->backoff[t->level-1]||
+			late>=step_slack_ns(t,t->level-1)*t->config.shrink_pct/100)
+			return 0;
+		t->quiet=0;
+		t->level--;
+	}
+	t->last_xruns=window_xruns;
+	t->last_late_ns=late;
+	t->changes++;
+	return 1;
+}
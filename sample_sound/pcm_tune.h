@@ -0,0 +1,84 @@
+#ifndef SAMPLE_SOUND_PCM_TUNE_H
+#define SAMPLE_SOUND_PCM_TUNE_H
+
+/*
+Period/buffer autotuner: Listings 3 and 4 fix the period at 32 frames
+and only print "underrun occurred"; this watches the stream and picks
+the size for it.
+
+The sizes it moves between are a ladder of period x periods settings,
+periods from config.min_periods to max_periods and the period doubling
+from min_period to max_period, in order of buffer length (where two give
+the same buffer, the smaller period, which leaves more of the buffer as
+slack). Call pcm_tune_period once per period transferred. Every
+window_ms it looks back over the window:
+  grow    any xrun, or a wakeup later than grow_pct of the slack
+          (buffer less one period, the lateness the stream can absorb):
+          one step up the ladder
+  shrink  quiet_windows clean windows in a row, with the latest wakeup
+          inside shrink_pct of the next smaller setting's slack: one
+          step down
+Two things keep it from oscillating. The two thresholds leave a dead band
+between them. And a step that had to be left because of an xrun costs
+twice as many quiet windows to come back to each time it fails (up to
+max_backoff), halving again for every quiet_windows it then holds.
+
+When pcm_tune_period returns 1, renegotiate the stream at
+steps[level] (pcm_reconfigure) and call pcm_tune_restart, so the reopen
+is not counted as a late wakeup.
+*/
+
+#include <stdint.h>
+
+#define PCM_TUNE_MAX_STEPS 64
+
+typedef struct pcm_tune_config {
+	unsigned long min_period;
+	unsigned long max_period;
+	unsigned int min_periods;
+	unsigned int max_periods;
+	unsigned int window_ms;
+	unsigned int grow_pct;
+	unsigned int shrink_pct;
+	unsigned int quiet_windows;
+	unsigned int max_backoff;
+} pcm_tune_config_t;
+
+typedef struct pcm_tune_step {
+	unsigned long period;
+	unsigned int periods;
+} pcm_tune_step_t;
+
+typedef struct pcm_tune {
+	pcm_tune_config_t config;
+	unsigned int rate;
+	pcm_tune_step_t steps[PCM_TUNE_MAX_STEPS];
+	unsigned int backoff[PCM_TUNE_MAX_STEPS];  /* quiet_windows multiple to step down to each */
+	unsigned int nsteps;
+	unsigned int level;                        /* current step */
+	uint64_t window_start;
+	uint64_t last_wake;
+	uint64_t late_max;                         /* ns, this window */
+	uint64_t xruns_start;                      /* pcm->xruns when the window opened */
+	unsigned int quiet;                        /* clean windows in a row */
+	uint64_t changes;
+	/* the window behind the last change, to report it */
+	uint64_t last_xruns;
+	uint64_t last_late_ns;
+} pcm_tune_t;
+
+/* 32..2048 frames x 2..4, 1 s windows, grow at 75% of slack, shrink under 40% after 4 quiet windows */
+void pcm_tune_config_init(pcm_tune_config_t *cfg);
+
+/* start at the smallest step holding period*periods frames */
+int pcm_tune_init(pcm_tune_t *t, const pcm_tune_config_t *cfg, unsigned int rate, unsigned long period,
+	unsigned int periods, uint64_t xruns);
+/* after each period with the stream's xrun count so far; 1 when steps[level] has changed */
+int pcm_tune_period(pcm_tune_t *t, uint64_t xruns);
+/* the stream has been renegotiated: start a fresh window */
+void pcm_tune_restart(pcm_tune_t *t, uint64_t xruns);
+
+/* the largest period any step uses, to size buffers once */
+unsigned long pcm_tune_max_period(const pcm_tune_t *t);
+
+#endif
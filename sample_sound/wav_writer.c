@@ -0,0 +1,368 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "wav_writer.h"
+
+#define WAV_CHUNK_BYTES (1u<<20)
+#define WAV_CHUNKS 16
+#define WAV_PREALLOC_BYTES (64u<<20)
+#define WAV_FIXUP_MS 1000
+
+/* WAVE_FORMAT_* tags */
+#define WAV_TAG_PCM 0x0001
+#define WAV_TAG_FLOAT 0x0003
+#define WAV_TAG_EXTENSIBLE 0xfffe
+
+static uint64_t wav_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint64_t)ts.tv_sec*1000000000u+(uint64_t)ts.tv_nsec;
+}
+
+static void put16(char *p, unsigned int v)
+{
+	p[0]=(char)(v&0xff);
+	p[1]=(char)((v>>8)&0xff);
+}
+
+static void put32(char *p, uint32_t v)
+{
+	put16(p,v&0xffff);
+	put16(p+2,v>>16);
+}
+
+static void put64(char *p, uint64_t v)
+{
+	put32(p,(uint32_t)v);
+	put32(p+4,(uint32_t)(v>>32));
+}
+
+/* chunk id and size, returning where its body starts */
+static char *put_chunk(char *p, const char *id, uint32_t size)
+{
+	memcpy(p,id,4);
+	put32(p+4,size);
+	return p+8;
+}
+
+/* the whole first block for data_bytes of samples */
+static void build_header(wav_writer_t *w, uint64_t data_bytes)
+{
+	const wav_writer_config_t *cfg=&w->config;
+	unsigned int bits=(unsigned int)pcm_format_bytes(cfg->format)*8;
+	int is_float=cfg->format==PCM_FORMAT_FLOAT_LE;
+	int extensible=cfg->channels>2||bits>16;
+	unsigned int tag=is_float ? WAV_TAG_FLOAT : WAV_TAG_PCM;
+	/* RIFF sizes count the pad byte after an odd-sized chunk */
+	uint64_t riff_bytes=WAV_HEADER_BYTES-8+data_bytes+(data_bytes&1);
+	int rf64=riff_bytes>0xffffffffu;
+	uint32_t fmt_bytes=extensible ? 40 : is_float ? 18 : 16;
+	char *h=w->header;
+	char *p;
+	char *data;
+
+	memset(h,0,WAV_HEADER_BYTES);
+	p=put_chunk(h,rf64 ? "RF64" : "RIFF",rf64 ? 0xffffffffu : (uint32_t)riff_bytes);
+	memcpy(p,"WAVE",4);
+	p+=4;
+	/* ds64 when it is needed, the same 28 bytes of JUNK until then */
+	p=put_chunk(p,rf64 ? "ds64" : "JUNK",28);
+	if(rf64)
+	{
+		put64(p,riff_bytes);
+		put64(p+8,data_bytes);
+		put64(p+16,data_bytes/w->frame_bytes);
+		put32(p+24,0);
+	}
+	p+=28;
+	p=put_chunk(p,"fmt ",fmt_bytes);
+	put16(p,extensible ? WAV_TAG_EXTENSIBLE : tag);
+	put16(p+2,cfg->channels);
+	put32(p+4,cfg->rate);
+	put32(p+8,(uint32_t)(cfg->rate*w->frame_bytes));
+	put16(p+12,(unsigned int)w->frame_bytes);
+	put16(p+14,bits);
+	if(fmt_bytes>16)
+		put16(p+16,extensible ? 22 : 0);
+	if(extensible)
+	{
+		static const char guid_tail[12]={0x00,0x00,0x10,0x00,(char)0x80,0x00,0x00,(char)0xaa,0x00,0x38,(char)0x9b,0x71};
+
+		put16(p+18,bits);
+		/* the first channels speaker positions: FL, FR, FC, LFE, ... */
+		put32(p+20,cfg->channels>=32 ? 0xffffffffu : (1u<<cfg->channels)-1);
+		put32(p+24,tag);
+		memcpy(p+28,guid_tail,sizeof(guid_tail));
+	}
+	p+=fmt_bytes;
+	/* pad so the samples start on the block boundary */
+	data=h+WAV_HEADER_BYTES-8;
+	put_chunk(p,"JUNK",(uint32_t)(data-p-8));
+	put_chunk(data,"data",rf64 ? 0xffffffffu : (uint32_t)data_bytes);
+}
+
+static int write_at(wav_writer_t *w, const char *buffer, size_t bytes, uint64_t offset)
+{
+	size_t done=0;
+	uint64_t start=wav_now_ns();
+	uint64_t elapsed;
+
+	while(done<bytes)
+	{
+		ssize_t n=pwrite(w->fd,buffer+done,bytes-done,(off_t)(offset+done));
+
+		if(n<0&&errno==EINTR)
+			continue;
+		if(n<=0)
+		{
+			fprintf(stderr,"@wav_writer, error occurs for pwrite of %zu bytes at %llu errno %d \n",
+				bytes-done,(unsigned long long)(offset+done),n<0 ? errno : 0);
+			return -1;
+		}
+		done+=(size_t)n;
+	}
+	elapsed=wav_now_ns()-start;
+	if(elapsed>atomic_load_explicit(&w->write_max_ns,memory_order_relaxed))
+		atomic_store_explicit(&w->write_max_ns,elapsed,memory_order_relaxed);
+	return 0;
+}
+
+static void fixup(wav_writer_t *w, uint64_t data_bytes)
+{
+	build_header(w,data_bytes);
+	if(write_at(w,w->header,WAV_HEADER_BYTES,0)!=0)
+	{
+		w->failed=1;
+		return;
+	}
+	fdatasync(w->fd);
+	atomic_fetch_add_explicit(&w->fixups,1,memory_order_relaxed);
+}
+
+/* chunk seq, bytes long, goes to its place after the header */
+static void write_chunk(wav_writer_t *w, uint64_t seq, size_t bytes)
+{
+	uint64_t offset=WAV_HEADER_BYTES+seq*w->config.chunk_bytes;
+	char *chunk=w->chunks+(size_t)(seq%w->config.chunks)*w->config.chunk_bytes;
+
+	if(w->failed)
+		return;
+	if(w->config.prealloc_bytes>0&&offset+bytes>w->preallocated)
+	{
+		/* KEEP_SIZE: reserve the blocks without making the file look longer */
+		if(fallocate(w->fd,FALLOC_FL_KEEP_SIZE,(off_t)w->preallocated,(off_t)w->config.prealloc_bytes)==0)
+			w->preallocated+=w->config.prealloc_bytes;
+		else
+			w->config.prealloc_bytes=0;
+	}
+	if(write_at(w,chunk,bytes,offset)!=0)
+		w->failed=1;
+}
+
+static void *wav_writer_run(void *arg)
+{
+	wav_writer_t *w=(wav_writer_t *)arg;
+	uint64_t last_fixup=wav_now_ns();
+	uint64_t fixed_bytes=0;
+	struct pollfd pfd;
+
+	pfd.fd=w->wake_fd;
+	pfd.events=POLLIN;
+	for(;;)
+	{
+		uint64_t count;
+		uint64_t filled;
+		uint64_t seq;
+		int closed;
+
+		pfd.revents=0;
+		if(poll(&pfd,1,(int)w->config.fixup_ms)>0&&read(w->wake_fd,&count,sizeof(count))<0&&errno!=EAGAIN)
+			fprintf(stderr,"@wav_writer, error occurs for eventfd errno %d \n",errno);
+		/* closed before filled: once closed is seen, filled is final */
+		closed=atomic_load_explicit(&w->closed,memory_order_acquire);
+		filled=atomic_load_explicit(&w->filled,memory_order_acquire);
+		for(seq=atomic_load_explicit(&w->written,memory_order_relaxed);seq<filled;seq++)
+		{
+			write_chunk(w,seq,w->config.chunk_bytes);
+			atomic_store_explicit(&w->written,seq+1,memory_order_release);
+		}
+		if(closed)
+			break;
+		if(filled*w->config.chunk_bytes!=fixed_bytes&&wav_now_ns()-last_fixup>=(uint64_t)w->config.fixup_ms*1000000u)
+		{
+			fixed_bytes=filled*w->config.chunk_bytes;
+			fixup(w,fixed_bytes);
+			last_fixup=wav_now_ns();
+		}
+	}
+	return NULL;
+}
+
+void wav_writer_config_init(wav_writer_config_t *cfg, pcm_format_t format, unsigned int channels, unsigned int rate)
+{
+	memset(cfg,0,sizeof(*cfg));
+	cfg->format=format;
+	cfg->channels=channels;
+	cfg->rate=rate;
+	cfg->chunk_bytes=WAV_CHUNK_BYTES;
+	cfg->chunks=WAV_CHUNKS;
+	cfg->prealloc_bytes=WAV_PREALLOC_BYTES;
+	cfg->fixup_ms=WAV_FIXUP_MS;
+	cfg->direct=1;
+}
+
+int wav_writer_open(wav_writer_t *w, const char *path, const wav_writer_config_t *cfg)
+{
+	memset(w,0,sizeof(*w));
+	w->config=*cfg;
+	w->fd=-1;
+	w->wake_fd=-1;
+	w->frame_bytes=pcm_format_bytes(cfg->format)*cfg->channels;
+	atomic_init(&w->filled,0);
+	atomic_init(&w->closed,0);
+	atomic_init(&w->written,0);
+	atomic_init(&w->dropped_frames,0);
+	atomic_init(&w->fixups,0);
+	atomic_init(&w->write_max_ns,0);
+	if(w->frame_bytes==0||cfg->chunks==0||cfg->chunk_bytes==0||cfg->chunk_bytes%WAV_HEADER_BYTES!=0)
+	{
+		fprintf(stderr,"@wav_writer_open, error occurs for %zu-byte frames, %u chunks of %zu bytes \n",
+			w->frame_bytes,cfg->chunks,cfg->chunk_bytes);
+		return -1;
+	}
+	if(cfg->direct)
+	{
+		w->fd=open(path,O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC|O_DIRECT,0644);
+		w->direct=w->fd>=0;
+	}
+	if(w->fd<0)
+		w->fd=open(path,O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC,0644);
+	w->chunks=(char *)aligned_alloc(WAV_HEADER_BYTES,cfg->chunk_bytes*cfg->chunks);
+	w->header=(char *)aligned_alloc(WAV_HEADER_BYTES,WAV_HEADER_BYTES);
+	w->wake_fd=eventfd(0,EFD_NONBLOCK|EFD_CLOEXEC);
+	if(w->fd<0||w->chunks==NULL||w->header==NULL||w->wake_fd<0)
+	{
+		fprintf(stderr,"@wav_writer_open, error occurs for %s errno %d \n",path,errno);
+		goto fail;
+	}
+	/* fault the buffers in now rather than on the capture thread */
+	memset(w->chunks,0,cfg->chunk_bytes*cfg->chunks);
+	build_header(w,0);
+	if(write_at(w,w->header,WAV_HEADER_BYTES,0)!=0)
+		goto fail;
+	w->preallocated=WAV_HEADER_BYTES;
+	if(pthread_create(&w->thread,NULL,wav_writer_run,w)!=0)
+	{
+		fprintf(stderr,"@wav_writer_open, error occurs for pthread_create \n");
+		goto fail;
+	}
+	return 0;
+
+fail:
+	if(w->fd>=0)
+		close(w->fd);
+	if(w->wake_fd>=0)
+		close(w->wake_fd);
+	free(w->chunks);
+	free(w->header);
+	w->chunks=NULL;
+	w->header=NULL;
+	return -1;
+}
+
+static void wake_writer(wav_writer_t *w)
+{
+	uint64_t one=1;
+
+	if(write(w->wake_fd,&one,sizeof(one))<0&&errno!=EAGAIN)
+		fprintf(stderr,"@wav_writer, error occurs for eventfd errno %d \n",errno);
+}
+
+void wav_writer_push(wav_writer_t *w, const void *frames, unsigned long count)
+{
+	const char *from=(const char *)frames;
+	size_t bytes=count*w->frame_bytes;
+	size_t chunk_bytes=w->config.chunk_bytes;
+	uint64_t last;
+
+	if(bytes==0)
+		return;
+	/* every chunk this push reaches into must be free, or none of it is kept */
+	last=w->current+(w->used+bytes-1)/chunk_bytes;
+	if(last-atomic_load_explicit(&w->written,memory_order_acquire)>=w->config.chunks)
+	{
+		atomic_fetch_add_explicit(&w->dropped_frames,count,memory_order_relaxed);
+		return;
+	}
+	while(bytes>0)
+	{
+		size_t n=chunk_bytes-w->used;
+
+		if(n>bytes)
+			n=bytes;
+		memcpy(w->chunks+(size_t)(w->current%w->config.chunks)*chunk_bytes+w->used,from,n);
+		from+=n;
+		bytes-=n;
+		w->used+=n;
+		if(w->used==chunk_bytes)
+		{
+			w->current++;
+			w->used=0;
+			atomic_store_explicit(&w->filled,w->current,memory_order_release);
+			wake_writer(w);
+		}
+	}
+}
+
+uint64_t wav_writer_bytes(const wav_writer_t *w)
+{
+	return w->current*w->config.chunk_bytes+w->used;
+}
+
+int wav_writer_close(wav_writer_t *w)
+{
+	uint64_t data_bytes=wav_writer_bytes(w);
+	size_t tail=w->used;
+	int rc;
+
+	atomic_store_explicit(&w->closed,1,memory_order_release);
+	wake_writer(w);
+	pthread_join(w->thread,NULL);
+
+	if(tail>0||(data_bytes&1))
+	{
+		/* the partial chunk, zero-padded to a whole block for O_DIRECT (and
+		the RIFF pad byte), then the file cut back to its real length */
+		char *chunk=w->chunks+(size_t)(w->current%w->config.chunks)*w->config.chunk_bytes;
+		size_t bytes=tail+(data_bytes&1);
+
+		if(w->direct)
+			bytes=(bytes+WAV_HEADER_BYTES-1)&~(size_t)(WAV_HEADER_BYTES-1);
+		memset(chunk+tail,0,bytes-tail);
+		write_chunk(w,w->current,bytes);
+	}
+	if(!w->failed&&ftruncate(w->fd,(off_t)(WAV_HEADER_BYTES+data_bytes+(data_bytes&1)))!=0)
+	{
+		fprintf(stderr,"@wav_writer_close, error occurs for ftruncate errno %d \n",errno);
+		w->failed=1;
+	}
+	if(!w->failed)
+		fixup(w,data_bytes);
+	rc=w->failed ? -1 : 0;
+	close(w->fd);
+	close(w->wake_fd);
+	free(w->chunks);
+	free(w->header);
+	w->chunks=NULL;
+	w->header=NULL;
+	return rc;
+}
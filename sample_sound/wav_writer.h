@@ -0,0 +1,87 @@
+#ifndef SAMPLE_SOUND_WAV_WRITER_H
+#define SAMPLE_SOUND_WAV_WRITER_H
+
+/*
+Recording sink: Listing 4's write(1,buffer,size) taken off the capture
+thread.
+
+wav_writer_push copies the captured frames into the current chunk of a
+ring of large chunks and returns; it never makes a system call other
+than the eventfd write that wakes the writer when a chunk fills. A
+background thread writes whole chunks with pwrite, in order, at
+chunk-aligned file offsets. If the disk falls so far behind that every
+chunk is still waiting, whole pushes are dropped (dropped_frames)
+instead of the capture thread waiting.
+
+The file is a WAV whose header fills exactly the first 4096 bytes (the
+pad goes in a JUNK chunk), so every data write is aligned and the file
+is opened with O_DIRECT, bypassing the page cache, unless the
+filesystem refuses it (tmpfs) or config.direct is cleared. Space is
+fallocate()d prealloc_bytes ahead of the data to keep the file
+contiguous. Every fixup_ms the header is rewritten with the current
+sizes and the data synced, so a recording cut short by a crash or power
+loss is still a valid WAV up to the last fixup. Past 4 GiB the header
+switches to RF64 (EBU Tech 3306), with the 64-bit sizes in a ds64 chunk
+that takes the place of the leading JUNK chunk.
+
+Integer formats are written as WAVE_FORMAT_PCM and float as
+WAVE_FORMAT_IEEE_FLOAT, with WAVE_FORMAT_EXTENSIBLE for more than two
+channels or more than 16 bits.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "pcm_engine.h"
+
+#define WAV_HEADER_BYTES 4096
+
+typedef struct wav_writer_config {
+	pcm_format_t format;
+	unsigned int channels;
+	unsigned int rate;
+	size_t chunk_bytes;          /* multiple of WAV_HEADER_BYTES */
+	unsigned int chunks;
+	uint64_t prealloc_bytes;     /* fallocate this far ahead, 0 for none */
+	unsigned int fixup_ms;
+	int direct;                  /* try O_DIRECT */
+} wav_writer_config_t;
+
+typedef struct wav_writer {
+	wav_writer_config_t config;
+	int fd;
+	int direct;                  /* O_DIRECT was granted */
+	size_t frame_bytes;
+	char *chunks;                /* config.chunks x chunk_bytes, aligned */
+	char *header;                /* one aligned block */
+	int wake_fd;
+	pthread_t thread;
+
+	/* capture side */
+	uint64_t current;            /* chunk being filled */
+	size_t used;                 /* bytes in it */
+
+	_Alignas(64) atomic_uint_fast64_t filled;   /* chunks handed to the writer */
+	atomic_int closed;
+	_Alignas(64) atomic_uint_fast64_t written;  /* chunks on disk */
+	uint64_t preallocated;                      /* file offset fallocate()d up to */
+	int failed;                                 /* a write failed, the file stops growing */
+
+	atomic_uint_fast64_t dropped_frames;
+	atomic_uint_fast64_t fixups;
+	atomic_uint_fast64_t write_max_ns;          /* longest single pwrite */
+} wav_writer_t;
+
+void wav_writer_config_init(wav_writer_config_t *cfg, pcm_format_t format, unsigned int channels, unsigned int rate);
+
+int wav_writer_open(wav_writer_t *w, const char *path, const wav_writer_config_t *cfg);
+/* from the capture thread: frames copied or, if the writer is that far behind, dropped */
+void wav_writer_push(wav_writer_t *w, const void *frames, unsigned long count);
+/* write what is left, fix the header for good and close; 0, or -1 if any write failed */
+int wav_writer_close(wav_writer_t *w);
+
+/* data bytes accepted so far (written or queued) */
+uint64_t wav_writer_bytes(const wav_writer_t *w);
+
+#endif